@@ -63,6 +63,10 @@ htmltcl.o: $(TOP)/src/htmltcl.c $(HDR) htmldefaultstyle.c
 	@echo '$$(COMPILE) -c $< htmldefaultstyle.c -o $@'
 	@$(COMPILE) -c $(TOP)/src/htmltcl.c -o $@
 
+htmltext.o: $(TOP)/src/htmltext.c $(HDR) htmlentities.c
+	@echo '$$(COMPILE) -c $< htmlentities.c -o $@'
+	@$(COMPILE) -c $(TOP)/src/htmltext.c -o $@
+
 %.o: %.c $(HDR)
 	@echo '$$(COMPILE) -c $< -o $@'
 	@$(COMPILE) -c $< -o $@
@@ -75,6 +79,10 @@ htmldefaultstyle.c: $(TOP)/src/tkhtml.tcl  $(TOP)/src/html.css $(TOP)/src/mkdefa
 	@echo '$$(TCLSH) $(TOP)/src/mkdefaultstyle.tcl > htmldefaultstyle.c'
 	@$(TCLSH) $(TOP)/src/mkdefaultstyle.tcl > htmldefaultstyle.c
 
+htmlentities.c: $(TOP)/src/entities.txt $(TOP)/src/mkentities.tcl
+	@echo '$$(TCLSH) $(TOP)/src/mkentities.tcl > htmlentities.c'
+	@$(TCLSH) $(TOP)/src/mkentities.tcl > htmlentities.c
+
 htmltokens.h:	$(TOP)/src/tokenlist.txt
 	@echo '$$(TCLSH) $<'
 	@$(TCLSH) $<
@@ -2126,6 +2126,7 @@ newCssPriority(pStyle, origin, pIdTail, important)
 
     pNew->pNext = pStyle->pPriority;
     pStyle->pPriority = pNew;
+    pStyle->isOrderValid = 0;
 
     return pNew;
 }
@@ -2201,6 +2202,10 @@ pTree, n, z, isStyle, origin, pStyleId, pImportCmd, pUrlCmd, pErrorVar, ppStyle)
             Tcl_InitHashTable(&sParse.pStyle->aByTag, TCL_STRING_KEYS);
             Tcl_InitHashTable(&sParse.pStyle->aByClass, TCL_STRING_KEYS);
             Tcl_InitHashTable(&sParse.pStyle->aById, TCL_STRING_KEYS);
+            Tcl_InitHashTable(&sParse.pStyle->aByAttr, TCL_STRING_KEYS);
+            Tcl_InitHashTable(&sParse.pStyle->aDependAttr, TCL_STRING_KEYS);
+            Tcl_InitHashTable(&sParse.pStyle->aDependClass, TCL_STRING_KEYS);
+            Tcl_InitHashTable(&sParse.pStyle->aDependId, TCL_STRING_KEYS);
         }
     } else {
         sParse.pStyle = *ppStyle;
@@ -2457,6 +2462,10 @@ HtmlCssStyleSheetFree(pStyle)
         freeRulesHash(&pStyle->aByTag); 
         freeRulesHash(&pStyle->aByClass); 
         freeRulesHash(&pStyle->aById); 
+        freeRulesHash(&pStyle->aByAttr); 
+        Tcl_DeleteHashTable(&pStyle->aDependAttr);
+        Tcl_DeleteHashTable(&pStyle->aDependClass);
+        Tcl_DeleteHashTable(&pStyle->aDependId);
 
         /* Free the priorities list */
         pPriority = pStyle->pPriority;
@@ -2631,6 +2640,22 @@ void HtmlCssSelector(pParse, stype, pAttr, pValue)
     pSelector->eSelector = stype;
     pSelector->zValue = tokenToString(pValue);
     pSelector->zAttr = tokenToString(pAttr);
+    pSelector->zAttrAtom = pSelector->zAttr;
+    if (pSelector->zAttr) {
+        /* Use the atom for the attribute name, if it is an exact match,
+         * so that HtmlMarkupArg() usually finds the attribute by
+         * comparing pointers (see HtmlAttributesIntern()).
+         */
+        Tcl_HashTable *pAtom = &pParse->pTree->aAtom;
+        Tcl_HashEntry *pEntry;
+        const char *zAtom;
+        int isNew;
+        pEntry = Tcl_CreateHashEntry(pAtom, pSelector->zAttr, &isNew);
+        zAtom = Tcl_GetHashKey(pAtom, pEntry);
+        if (0 == strcmp(zAtom, pSelector->zAttr)) {
+            pSelector->zAttrAtom = zAtom;
+        }
+    }
     pSelector->pNext = pParse->pSelector;
     pSelector->isDynamic = (
         (pSelector->pNext && pSelector->pNext->isDynamic) ||
@@ -2739,6 +2764,331 @@ insertRule(ppList, pRule)
     }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssBloomHash --
+ *
+ *     Return a hash value for the type, class or id name in buffer z
+ *     (size n bytes, or nul-terminated if n is less than zero). The first
+ *     argument should be CSS_SELECTOR_TYPE, CSS_SELECTOR_CLASS or
+ *     CSS_SELECTOR_ID. The name is folded to lower-case before hashing,
+ *     as class and id values are compared case-insensitively by
+ *     HtmlCssSelectorTest().
+ *
+ * Results:
+ *     Hash value.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+unsigned int
+HtmlCssBloomHash(eType, z, n)
+    int eType;
+    const char *z;
+    int n;
+{
+    unsigned int h = 2166136261U ^ (unsigned int)eType;
+    int ii;
+    if (n < 0) n = strlen(z);
+    for (ii = 0; ii < n; ii++) {
+        h = (h ^ (unsigned char)tolower((unsigned char)z[ii])) * 16777619U;
+    }
+    return h;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * ruleAncestorHash --
+ *
+ *     Populate the CssRule.aAncestorHash[] array for rule pRule. See
+ *     comments above the CssRule structure in cssInt.h for details.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets pRule->nAncestorHash and pRule->aAncestorHash[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+ruleAncestorHash(pRule)
+    CssRule *pRule;
+{
+    CssSelector *pS;
+    int isAncestor = 0;
+
+    pRule->nAncestorHash = 0;
+    for (pS = pRule->pSelector; pS; pS = pS->pNext) {
+        switch (pS->eSelector) {
+            /* The compound selector following a descendant or child
+             * combinator must match an ancestor of the node. The compound
+             * following an adjacent combinator matches a sibling of 
+             * the node (or of an ancestor), which is not an ancestor.
+             */
+            case CSS_SELECTORCHAIN_DESCENDANT:
+            case CSS_SELECTORCHAIN_CHILD:
+                isAncestor = 1;
+                break;
+            case CSS_SELECTORCHAIN_ADJACENT:
+                isAncestor = 0;
+                break;
+
+            case CSS_SELECTOR_TYPE:
+            case CSS_SELECTOR_CLASS:
+            case CSS_SELECTOR_ID:
+                if (isAncestor && pRule->nAncestorHash<CSS_MAX_ANCESTOR_HASH) {
+                    pRule->aAncestorHash[pRule->nAncestorHash++] = 
+                        HtmlCssBloomHash(pS->eSelector, pS->zValue, -1);
+                }
+                break;
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * ruleShareFlags --
+ *
+ *     Set the CssRule.isPositional and CssRule.isTcl flags for rule 
+ *     pRule, which must have both the pSelector and pPropertySet 
+ *     variables set. See comments above the CssRule structure in 
+ *     cssInt.h for details.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets pRule->isPositional and pRule->isTcl.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+ruleShareFlags(pRule)
+    CssRule *pRule;
+{
+    CssSelector *pS;
+    int ii;
+
+    /* Only the selectors that apply to the subject node or to one of it's
+     * preceding siblings (those before the first descendant or child
+     * combinator) can depend on the position of the node within it's
+     * parent. Conditions on ancestors are the same for all siblings.
+     */
+    pRule->isPositional = 0;
+    pRule->zPositionalTag = 0;
+    for (pS = pRule->pSelector; pS; pS = pS->pNext) {
+        int eSelector = pS->eSelector;
+        if (eSelector == CSS_SELECTORCHAIN_DESCENDANT ||
+            eSelector == CSS_SELECTORCHAIN_CHILD
+        ) {
+            break;
+        }
+        if (eSelector == CSS_SELECTORCHAIN_ADJACENT ||
+            eSelector == CSS_PSEUDOCLASS_FIRSTCHILD ||
+            eSelector == CSS_PSEUDOCLASS_LASTCHILD
+        ) {
+            pRule->isPositional = 1;
+        }
+    }
+
+    /* Record the type selector of the subject, if any. Nodes that share
+     * computed values have the same tag, so a positional rule that can
+     * only match some other tag does not prevent sharing.
+     */
+    for (pS = pRule->pSelector; pRule->isPositional && pS; pS = pS->pNext) {
+        if (pS->eSelector == CSS_SELECTOR_TYPE) {
+            pRule->zPositionalTag = pS->zValue;
+        }
+        if (pS->eSelector >= CSS_SELECTORCHAIN_DESCENDANT &&
+            pS->eSelector <= CSS_SELECTORCHAIN_ADJACENT
+        ) {
+            break;
+        }
+    }
+
+    pRule->isTcl = 0;
+    for (ii = 0; ii < pRule->pPropertySet->n; ii++) {
+        CssProperty *pProp = pRule->pPropertySet->a[ii].pProp;
+        if (pProp && pProp->eType == CSS_TYPE_TCL) {
+            pRule->isTcl = 1;
+        }
+    }
+}
+
+/*
+ * Class names and ids are compared case-insensitively by 
+ * HtmlCssSelectorTest(). So the keys of the CssStyleSheet.aDependClass,
+ * aDependId and aDependAttr tables are folded to lower case, both when
+ * an entry is added by addDependency() and when one is looked up by
+ * findDependency().
+ */
+static void
+addDependency(pHash, zKey, eDepend)
+    Tcl_HashTable *pHash;
+    const char *zKey;
+    int eDepend;
+{
+    int isNew;
+    int eOld;
+    Tcl_HashEntry *pEntry;
+    Tcl_DString str;
+
+    Tcl_DStringInit(&str);
+    Tcl_DStringAppend(&str, zKey, -1);
+    Tcl_UtfToLower(Tcl_DStringValue(&str));
+    pEntry = Tcl_CreateHashEntry(pHash, Tcl_DStringValue(&str), &isNew);
+    eOld = (isNew ? 0 : (int)((size_t)Tcl_GetHashValue(pEntry)));
+    Tcl_SetHashValue(pEntry, (ClientData)((size_t)(eOld | eDepend)));
+    Tcl_DStringFree(&str);
+}
+static int
+findDependency(pHash, zKey, nKey)
+    Tcl_HashTable *pHash;
+    const char *zKey;
+    int nKey;
+{
+    int eDepend = 0;
+    Tcl_HashEntry *pEntry;
+    Tcl_DString str;
+
+    if (pHash->numEntries == 0) return 0;
+    Tcl_DStringInit(&str);
+    Tcl_DStringAppend(&str, zKey, nKey);
+    Tcl_UtfToLower(Tcl_DStringValue(&str));
+    pEntry = Tcl_FindHashEntry(pHash, Tcl_DStringValue(&str));
+    if (pEntry) {
+        eDepend = (int)((size_t)Tcl_GetHashValue(pEntry));
+    }
+    Tcl_DStringFree(&str);
+    return eDepend;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * ruleDependencies --
+ *
+ *     Add the attribute and dynamic pseudo-class dependencies of rule 
+ *     pRule to the CssStyleSheet.aDependAttr, aDependClass, aDependId, 
+ *     iDependAny, iDependHover, iDependFocus and iDependActive variables
+ *     of stylesheet pStyle.
+ *
+ *     The position of each simple selector in the selector chain 
+ *     determines the nodes affected when the attribute of a node it tests
+ *     is modified. Selectors in the subject compound affect the node
+ *     itself (CSS_DEPEND_SUBJECT). Selectors following a descendant or
+ *     child combinator affect descendants (CSS_DEPEND_ANCESTOR). Those 
+ *     following an adjacent sibling combinator affect right-siblings and
+ *     their descendants (CSS_DEPEND_SIBLING).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     See above.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+ruleDependencies(pStyle, pRule)
+    CssStyleSheet *pStyle;
+    CssRule *pRule;
+{
+    CssSelector *pS;
+    int eDepend = CSS_DEPEND_SUBJECT;
+    int ii;
+
+    for (pS = pRule->pSelector; pS; pS = pS->pNext) {
+        switch (pS->eSelector) {
+            case CSS_SELECTORCHAIN_DESCENDANT:
+            case CSS_SELECTORCHAIN_CHILD:
+                eDepend = CSS_DEPEND_ANCESTOR;
+                break;
+            case CSS_SELECTORCHAIN_ADJACENT:
+                eDepend = CSS_DEPEND_SIBLING;
+                break;
+
+            case CSS_SELECTOR_CLASS:
+                addDependency(&pStyle->aDependClass, pS->zValue, eDepend);
+                break;
+            case CSS_SELECTOR_ID:
+                addDependency(&pStyle->aDependId, pS->zValue, eDepend);
+                break;
+
+            case CSS_SELECTOR_ATTR:
+            case CSS_SELECTOR_ATTRVALUE:
+            case CSS_SELECTOR_ATTRLISTVALUE:
+            case CSS_SELECTOR_ATTRHYPHEN:
+            case CSS_SELECTOR_ATTRSTAR:
+            case CSS_SELECTOR_ATTRHAT:
+                addDependency(&pStyle->aDependAttr, pS->zAttr, eDepend);
+                break;
+
+            case CSS_PSEUDOCLASS_HOVER:
+                pStyle->iDependHover |= eDepend;
+                break;
+            case CSS_PSEUDOCLASS_FOCUS:
+                pStyle->iDependFocus |= eDepend;
+                break;
+            case CSS_PSEUDOCLASS_ACTIVE:
+                pStyle->iDependActive |= eDepend;
+                break;
+        }
+    }
+
+    /* An attr() value depends on an attribute of the node, or of the
+     * nearest ancestor of a specified type if a third argument is 
+     * present (see propertyValuesAttr() in htmlprop.c). Scripts invoked 
+     * for tcl() values and the 'content' property are assumed to depend 
+     * on any attribute of the node.
+     */
+    for (ii = 0; ii < pRule->pPropertySet->n; ii++) {
+        CssProperty *pProp = pRule->pPropertySet->a[ii].pProp;
+        if (!pProp) continue;
+        if (pProp->eType == CSS_TYPE_TCL || 
+            pRule->pPropertySet->a[ii].eProp == CSS_PROPERTY_CONTENT
+        ) {
+            pStyle->iDependAny |= CSS_DEPEND_SUBJECT;
+        } else if (pProp->eType == CSS_TYPE_ATTR) {
+            const char *zArg = pProp->v.zVal;
+            const char *zEnd = &zArg[strlen(zArg)];
+            const char *zAttr;
+            int nAttr;
+            int n;
+            int iArg;
+
+            zAttr = HtmlCssGetNextListItem(zArg, zEnd - zArg, &nAttr);
+            if (!zAttr) continue;
+            eDepend = CSS_DEPEND_SUBJECT;
+            zArg = &zAttr[nAttr];
+            for (iArg = 0; iArg < 2; iArg++) {
+                zArg = HtmlCssGetNextListItem(zArg, zEnd - zArg, &n);
+                if (!zArg) break;
+                zArg += n;
+            }
+            if (iArg == 2) {
+                eDepend |= CSS_DEPEND_ANCESTOR;
+            }
+
+            {
+                Tcl_DString str;
+                Tcl_DStringInit(&str);
+                Tcl_DStringAppend(&str, zAttr, nAttr);
+                addDependency(
+                    &pStyle->aDependAttr, Tcl_DStringValue(&str), eDepend
+                );
+                Tcl_DStringFree(&str);
+            }
+        }
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2845,6 +3195,12 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
         pRule->pPriority = pParse->pPriority2;
     }
     pRule->iRule = pParse->iNextRule++;
+    pRule->pSelector = pSelector;
+    ruleAncestorHash(pRule);
+    if (pRule->nAncestorHash > 0) {
+        pStyle->nAncestorRule++;
+    }
+    pStyle->isOrderValid = 0;
 
     /* Insert the rule into it's list. */
     if (pParse->pStyleId) {
@@ -2903,6 +3259,30 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
                 Tcl_SetHashValue(p, pList);
                 break;
             }
+
+            /* If the rightmost compound selector contains no type, class 
+             * or id selector, but does contain an attribute selector, the
+             * rule can only match elements that have the named attribute.
+             * Store it in the aByAttr table.
+             */
+            case CSS_SELECTOR_ATTR:
+            case CSS_SELECTOR_ATTRVALUE:
+            case CSS_SELECTOR_ATTRLISTVALUE:
+            case CSS_SELECTOR_ATTRHYPHEN:
+            case CSS_SELECTOR_ATTRSTAR:
+            case CSS_SELECTOR_ATTRHAT: {
+                int newentry;
+                Tcl_HashEntry *p;
+                CssRule *pList = 0;
+
+                p = Tcl_CreateHashEntry(&pStyle->aByAttr, pS->zAttr, &newentry);
+                if (!newentry) { 
+                    pList = (CssRule *)Tcl_GetHashValue(p); 
+                }
+                insertRule(&pList, pRule);
+                Tcl_SetHashValue(p, pList);
+                break;
+            }
     
             default:
                 insertRule(&pStyle->pUniversalRules, pRule);
@@ -2912,8 +3292,11 @@ cssSelectorPropertySetPair(pParse, pSelector, pPropertySet, freeWhat)
         insertRule(&pStyle->pUniversalRules, pRule);
     }
 
-    pRule->pSelector = pSelector;
     pRule->pPropertySet = pPropertySet;
+    ruleShareFlags(pRule);
+    if (pParse->pStyleId) {
+        ruleDependencies(pStyle, pRule);
+    }
 }
 
 /*--------------------------------------------------------------------------
@@ -3135,18 +3518,19 @@ HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
                 break;
 
             case CSS_SELECTOR_CLASS: {
-                const char *zClass = p->zValue;
-                const char *zAttr = N_ATTR(x, "class");
-                if( !attrTest(CSS_SELECTOR_ATTRLISTVALUE, zClass, zAttr) ){
-                    return 0;
+                HtmlAttributes *pAttr = pElem ? pElem->pAttributes : 0;
+                int ii;
+                if (!pAttr) return 0;
+                for (ii = 0; ii < pAttr->nClass; ii++) {
+                    if (0 == stricmp(pAttr->azClass[ii], p->zValue)) break;
                 }
+                if (ii == pAttr->nClass) return 0;
                 break;
             }
 
             case CSS_SELECTOR_ID: {
-                const char *zId = p->zValue;
-                const char *zAttr = N_ATTR(x, "id");
-                if( !attrTest(CSS_SELECTOR_ATTRVALUE, zId, zAttr) ){
+                HtmlAttributes *pAttr = pElem ? pElem->pAttributes : 0;
+                if (!pAttr || !pAttr->zId || stricmp(pAttr->zId, p->zValue)) {
                     return 0;
                 }
                 break;
@@ -3158,7 +3542,7 @@ HtmlCssSelectorTest(pSelector, pNode, dynamic_true)
             case CSS_SELECTOR_ATTRHYPHEN:
             case CSS_SELECTOR_ATTRSTAR:
             case CSS_SELECTOR_ATTRHAT:
-                if( !attrTest(p->eSelector, p->zValue, N_ATTR(x,p->zAttr)) ){
+                if( !attrTest(p->eSelector,p->zValue,N_ATTR(x,p->zAttrAtom)) ){
                     return 0;
                 }
                 break;
@@ -3400,6 +3784,46 @@ overrideToPropertyValues(pTree, p, aPropDone, pOverride)
     }
 }
 
+/*--------------------------------------------------------------------------
+ *
+ * logRuleMatch --
+ *
+ *     Log the result of testing the selector of pRule against node pNode
+ *     (if logging is enabled).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void
+logRuleMatch(pTree, pNode, pRule, isMatch)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    CssRule *pRule;
+    int isMatch;
+{
+    LOG {
+        CssPriority *pPriority = pRule->pPriority;
+        Tcl_Obj *pS = Tcl_NewObj();
+        Tcl_IncrRefCount(pS);
+        HtmlCssSelectorToString(pRule->pSelector, pS);
+        HtmlLog(pTree, "STYLEENGINE", "%s %s (%s)"
+            " from \"%s%s\"",
+            Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
+            (isMatch ? "matches" : "nomatch"),
+            Tcl_GetString(pS),
+            pPriority->origin == CSS_ORIGIN_AUTHOR ? "author" :
+            pPriority->origin == CSS_ORIGIN_AGENT ? "agent" : "user",
+            Tcl_GetString(pPriority->pIdTail)
+        );
+        Tcl_DecrRefCount(pS);
+    }
+}
+
 /*--------------------------------------------------------------------------
  *
  * applyRule --
@@ -3431,23 +3855,8 @@ applyRule(pTree, pNode, pRule, aPropDone, pzIfMatch, pCreator)
     CssSelector *pSelector = pRule->pSelector;
     int isMatch = HtmlCssSelectorTest(pSelector, pNode, 0);
 
-    /* There is a match. Log some output for debugging. */
-    LOG {
-        CssPriority *pPriority = pRule->pPriority;
-        Tcl_Obj *pS = Tcl_NewObj();
-        Tcl_IncrRefCount(pS);
-        HtmlCssSelectorToString(pSelector, pS);
-        HtmlLog(pTree, "STYLEENGINE", "%s %s (%s)"
-            " from \"%s%s\"",
-            Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
-            (isMatch ? "matches" : "nomatch"),
-            Tcl_GetString(pS),
-            pPriority->origin == CSS_ORIGIN_AUTHOR ? "author" :
-            pPriority->origin == CSS_ORIGIN_AGENT ? "agent" : "user",
-            Tcl_GetString(pPriority->pIdTail)
-        );
-        Tcl_DecrRefCount(pS);
-    }
+    /* Log some output for debugging. */
+    logRuleMatch(pTree, pNode, pRule, isMatch);
     if (isMatch) {
 
         if (pzIfMatch) {
@@ -3463,37 +3872,908 @@ applyRule(pTree, pNode, pRule, aPropDone, pzIfMatch, pCreator)
     return isMatch;
 }
 
-/*--------------------------------------------------------------------------
- *
- * nextRule --
+/*
+ *---------------------------------------------------------------------------
  *
- * Results:
+ * ruleOrderCompare --
  *
- * Side effects:
+ *     qsort() comparison function used by cssRuleOrderUpdate().
  *
- *--------------------------------------------------------------------------
+ *---------------------------------------------------------------------------
  */
-static CssRule *
-nextRule(apRule, n)
-    CssRule **apRule;
-    int n;
+static int
+ruleOrderCompare(const void *pLeft, const void *pRight)
 {
-    CssRule **ppRule = 0;
-    CssRule *pRet = 0;
-    int i;
+    CssRule *pL = *(CssRule **)pLeft;
+    CssRule *pR = *(CssRule **)pRight;
+    return ruleCompare(pL, pR);
+}
 
-    for (i = 0; i < n; i++) {
-        if (apRule[i] && (ppRule == 0 || ruleCompare(apRule[i], *ppRule) > 0)) {
-            ppRule = &apRule[i];
+static int
+ruleListCollect(pRule, apRule, iRule)
+    CssRule *pRule;
+    CssRule **apRule;
+    int iRule;
+{
+    for ( ; pRule; pRule = pRule->pNext) {
+        if (apRule) apRule[iRule] = pRule;
+        iRule++;
+    }
+    return iRule;
+}
+
+static int
+ruleHashCollect(pHash, apRule, iRule)
+    Tcl_HashTable *pHash;
+    CssRule **apRule;
+    int iRule;
+{
+    Tcl_HashEntry *pEntry;
+    Tcl_HashSearch search;
+    for (
+        pEntry = Tcl_FirstHashEntry(pHash, &search);
+        pEntry;
+        pEntry = Tcl_NextHashEntry(&search)
+    ) {
+        CssRule *pRule = (CssRule *)Tcl_GetHashValue(pEntry);
+        iRule = ruleListCollect(pRule, apRule, iRule);
+    }
+    return iRule;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * cssRuleOrderUpdate --
+ *
+ *     Set the CssRule.iOrder variable of each rule in the universal and
+ *     hashed rule lists of stylesheet pStyle. Rules are sorted using
+ *     ruleCompare() and then numbered from lowest to highest priority.
+ *
+ *     Each rule list is already in priority order, so once the iOrder
+ *     values are set HtmlCssStyleSheetApply() can merge the lists that
+ *     apply to a node using integer comparisons only.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets CssRule.iOrder for all rules, and CssStyleSheet.isOrderValid.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+cssRuleOrderUpdate(pStyle)
+    CssStyleSheet *pStyle;
+{
+    int nRule;
+    int ii;
+    CssRule **apRule = 0;
+
+    for (ii = 0; ii < 2; ii++) {
+        nRule = ruleListCollect(pStyle->pUniversalRules, apRule, 0);
+        nRule = ruleHashCollect(&pStyle->aByTag, apRule, nRule);
+        nRule = ruleHashCollect(&pStyle->aByClass, apRule, nRule);
+        nRule = ruleHashCollect(&pStyle->aById, apRule, nRule);
+        nRule = ruleHashCollect(&pStyle->aByAttr, apRule, nRule);
+        if (ii == 0) {
+            apRule = (CssRule **)HtmlAlloc(
+                "temp", sizeof(CssRule *) * (nRule + 1)
+            );
+        }
+    }
+
+    qsort(apRule, nRule, sizeof(CssRule *), ruleOrderCompare);
+    for (ii = 0; ii < nRule; ii++) {
+        apRule[ii]->iOrder = ii;
+    }
+
+    HtmlFree(apRule);
+    pStyle->isOrderValid = 1;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * nextRule --
+ *
+ *     The rule lists that apply to a single node are merged using a
+ *     binary heap (array apRule[]) ordered by the CssRule.iOrder value of
+ *     the head of each list. ruleHeapSift() restores the heap property
+ *     for the sub-heap rooted at index i. Function nextRule() removes the
+ *     highest priority rule from the heap and returns it, or returns NULL
+ *     if the heap is empty.
+ *
+ *     The heap is initialized by calling ruleHeapSift() for each non-leaf
+ *     entry, in reverse order.
+ *
+ * Results:
+ *     See above.
+ *
+ * Side effects:
+ *     Modifies the contents of apRule[] and *pN.
+ *
+ *--------------------------------------------------------------------------
+ */
+static void
+ruleHeapSift(apRule, n, i)
+    CssRule **apRule;
+    int n;
+    int i;
+{
+    while (1) {
+        int iLeft = i * 2 + 1;
+        int iBest = i;
+        CssRule *pTmp;
+        if (iLeft < n && apRule[iLeft]->iOrder > apRule[iBest]->iOrder) {
+            iBest = iLeft;
+        }
+        if ((iLeft + 1) < n && 
+            apRule[iLeft + 1]->iOrder > apRule[iBest]->iOrder
+        ) {
+            iBest = iLeft + 1;
+        }
+        if (iBest == i) break;
+        pTmp = apRule[i];
+        apRule[i] = apRule[iBest];
+        apRule[iBest] = pTmp;
+        i = iBest;
+    }
+}
+
+static CssRule *
+nextRule(apRule, pN)
+    CssRule **apRule;
+    int *pN;
+{
+    CssRule *pRet = 0;
+
+    if (*pN > 0) {
+        pRet = apRule[0];
+        if (pRet->pNext) {
+            apRule[0] = pRet->pNext;
+        } else {
+            (*pN)--;
+            apRule[0] = apRule[*pN];
+        }
+        ruleHeapSift(apRule, *pN, 0);
+    }
+
+    return pRet;
+}
+
+/*
+ * An instance of the following structure is a counting bloom filter 
+ * populated with the tag, class and id names of the ancestors of the node
+ * currently being styled. HtmlStyleApply() pushes each element onto the
+ * filter (HtmlCssAncestorFilterPush()) before styling its children and pops
+ * it afterwards (HtmlCssAncestorFilterPop()). HtmlCssStyleSheetApply() uses
+ * the filter to reject rules that cannot match a node without calling 
+ * HtmlCssSelectorTest() to walk up the tree.
+ *
+ * Each hash value increments two 8-bit counters in aCount[]. A counter that
+ * reaches 255 is never decremented (so the filter may report false 
+ * positives, but never false negatives). The hash values added for each
+ * element are stored in aHash[], so that they can be removed by the 
+ * matching pop even if the element's attributes are modified in between.
+ * aFrame[] contains the size of aHash[] before each push.
+ */
+#define CSS_FILTER_BITS 12
+#define CSS_FILTER_SIZE (1 << CSS_FILTER_BITS)
+#define CSS_FILTER_MASK (CSS_FILTER_SIZE - 1)
+#define FILTER_IDX1(h) ((h) & CSS_FILTER_MASK)
+#define FILTER_IDX2(h) (((h) >> CSS_FILTER_BITS) & CSS_FILTER_MASK)
+
+struct CssAncestorFilter {
+    u8 aCount[CSS_FILTER_SIZE];
+
+    unsigned int *aHash;
+    int nHash;
+    int nHashAlloc;
+
+    int *aFrame;
+    int nFrame;
+    int nFrameAlloc;
+};
+
+CssAncestorFilter *
+HtmlCssAncestorFilterNew()
+{
+    return HtmlNew(CssAncestorFilter);
+}
+
+void
+HtmlCssAncestorFilterFree(pFilter)
+    CssAncestorFilter *pFilter;
+{
+    if (pFilter) {
+        HtmlFree(pFilter->aHash);
+        HtmlFree(pFilter->aFrame);
+        HtmlFree(pFilter);
+    }
+}
+
+static void
+filterAdd(pFilter, h)
+    CssAncestorFilter *pFilter;
+    unsigned int h;
+{
+    u8 *p1 = &pFilter->aCount[FILTER_IDX1(h)];
+    u8 *p2 = &pFilter->aCount[FILTER_IDX2(h)];
+    if (*p1 < 255) (*p1)++;
+    if (*p2 < 255) (*p2)++;
+
+    if (pFilter->nHash == pFilter->nHashAlloc) {
+        int nByte;
+        pFilter->nHashAlloc += 64;
+        nByte = pFilter->nHashAlloc * sizeof(unsigned int);
+        pFilter->aHash = (unsigned int *)HtmlRealloc(
+            "CssAncestorFilter.aHash", pFilter->aHash, nByte
+        );
+    }
+    pFilter->aHash[pFilter->nHash++] = h;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssAncestorFilterPush --
+ *
+ *     Add the type, id and class names of element pNode to the filter.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlCssAncestorFilterPush(pFilter, pNode)
+    CssAncestorFilter *pFilter;
+    HtmlNode *pNode;
+{
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    HtmlAttributes *pAttr = pElem ? pElem->pAttributes : 0;
+    int ii;
+
+    if (pFilter->nFrame == pFilter->nFrameAlloc) {
+        int nByte;
+        pFilter->nFrameAlloc += 32;
+        nByte = pFilter->nFrameAlloc * sizeof(int);
+        pFilter->aFrame = (int *)HtmlRealloc(
+            "CssAncestorFilter.aFrame", pFilter->aFrame, nByte
+        );
+    }
+    pFilter->aFrame[pFilter->nFrame++] = pFilter->nHash;
+
+    if (pNode->zTag) {
+        filterAdd(pFilter, HtmlCssBloomHash(CSS_SELECTOR_TYPE,pNode->zTag,-1));
+    }
+    if (pAttr && pAttr->zId) {
+        filterAdd(pFilter, HtmlCssBloomHash(CSS_SELECTOR_ID, pAttr->zId, -1));
+    }
+    for (ii = 0; pAttr && ii < pAttr->nClass; ii++) {
+        const char *zClass = pAttr->azClass[ii];
+        filterAdd(pFilter, HtmlCssBloomHash(CSS_SELECTOR_CLASS, zClass, -1));
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssAncestorFilterPop --
+ *
+ *     Remove the names added by the most recent call to 
+ *     HtmlCssAncestorFilterPush() from the filter.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlCssAncestorFilterPop(pFilter)
+    CssAncestorFilter *pFilter;
+{
+    int iFrame;
+    assert(pFilter->nFrame > 0);
+
+    iFrame = pFilter->aFrame[--pFilter->nFrame];
+    while (pFilter->nHash > iFrame) {
+        unsigned int h = pFilter->aHash[--pFilter->nHash];
+        u8 *p1 = &pFilter->aCount[FILTER_IDX1(h)];
+        u8 *p2 = &pFilter->aCount[FILTER_IDX2(h)];
+        assert(*p1 > 0 && *p2 > 0);
+        if (*p1 < 255) (*p1)--;
+        if (*p2 < 255) (*p2)--;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * filterReject --
+ *
+ *     Return true if the ancestor filter indicates that rule pRule 
+ *     cannot possibly match the node.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+filterReject(pFilter, pRule)
+    CssAncestorFilter *pFilter;
+    CssRule *pRule;
+{
+    int ii;
+    for (ii = 0; ii < pRule->nAncestorHash; ii++) {
+        unsigned int h = pRule->aAncestorHash[ii];
+        if (!pFilter->aCount[FILTER_IDX1(h)] || 
+            !pFilter->aCount[FILTER_IDX2(h)]
+        ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The hard coded constant mentioned in the header comment of
+ * HtmlCssStyleSheetApply() below.
+ */
+#define MAX_CLASSES    126
+
+/* Size of the array passed to ruleListsFind(). This is enough for the
+ * universal, tag and id lists, MAX_CLASSES class lists and MAX_ATTRS
+ * attribute lists. If a node has more than MAX_ATTRS attributes, 
+ * ruleListsFind() allocates a larger array.
+ */
+#define MAX_ATTRS      32
+#define MAX_RULE_LISTS (MAX_CLASSES + 3 + MAX_ATTRS)
+
+/*--------------------------------------------------------------------------
+ *
+ * ruleListsFind --
+ *
+ *     Populate an array with the lists of rules that may apply to
+ *     node pNode (the universal rules and the lists for the tag, each
+ *     attribute, id and class of the node) and arrange them into a 
+ *     heap for nextRule(). 
+ *
+ *     Array apStatic must have room for MAX_RULE_LISTS entries. It is
+ *     used unless pNode has too many attributes, in which case a larger
+ *     array is obtained from HtmlAlloc(). Either way, *papRule is set to
+ *     point to the array used. If it is not apStatic, the caller must
+ *     free it with HtmlFree().
+ *
+ *     This function does not modify pStyle or pNode. It may be called
+ *     by HtmlCssPrematch() worker threads.
+ *
+ * Results:
+ *     Number of entries written to *papRule.
+ *
+ * Side effects:
+ *     May allocate memory (see above).
+ *
+ *--------------------------------------------------------------------------
+ */
+static int
+ruleListsFind(pStyle, pNode, apStatic, papRule)
+    CssStyleSheet *pStyle;
+    HtmlNode *pNode;
+    CssRule **apStatic;
+    CssRule ***papRule;
+{
+    Tcl_HashEntry *pEntry;
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    HtmlAttributes *pAttr = pElem->pAttributes;
+    CssRule **apRule = apStatic;
+    int nRuleAlloc = MAX_RULE_LISTS;
+    int npRule = 0;
+    int ii;
+
+    assert(pStyle->isOrderValid);
+
+    if (pAttr && pAttr->nAttr > MAX_ATTRS && pStyle->aByAttr.numEntries > 0) {
+        nRuleAlloc = MAX_CLASSES + 3 + pAttr->nAttr;
+        apRule = (CssRule **)HtmlAlloc(
+            "ruleListsFind()", nRuleAlloc * sizeof(CssRule *)
+        );
+    }
+    *papRule = apRule;
+
+    /* The universal rules list applies to all nodes */
+    if (pStyle->pUniversalRules && npRule < nRuleAlloc) {
+        apRule[npRule++] = pStyle->pUniversalRules;
+    }
+
+    /* Find the applicable "by-tag" rules list, if any. */
+    pEntry = Tcl_FindHashEntry(&pStyle->aByTag, pNode->zTag);
+    if (pEntry && npRule < nRuleAlloc) {
+        apRule[npRule++] = Tcl_GetHashValue(pEntry);
+    }
+
+    /* Find a rules list for each attribute of the element, if any */
+    if (pStyle->aByAttr.numEntries > 0 && pAttr) {
+        for (ii = 0; ii < pAttr->nAttr; ii++) {
+            pEntry = Tcl_FindHashEntry(&pStyle->aByAttr, pAttr->a[ii].zName);
+            if (pEntry && npRule < nRuleAlloc) {
+                apRule[npRule++] = Tcl_GetHashValue(pEntry);
+            }
+        }
+    }
+
+    /* Find a rules list for the element id, if any */
+    if (pAttr && pAttr->zId) {
+        pEntry = Tcl_FindHashEntry(&pStyle->aById, pAttr->zId);
+        if (pEntry && npRule < nRuleAlloc) {
+            apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
+        }
+    }
+
+    /* Find a rules list for each class the element belongs to */
+    for (ii = 0; pAttr && ii < pAttr->nClass && ii < MAX_CLASSES; ii++) {
+        pEntry = Tcl_FindHashEntry(&pStyle->aByClass, pAttr->azClass[ii]);
+        if (pEntry && npRule < nRuleAlloc) {
+            apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
+        }
+    }
+
+    /* Arrange the rule lists into a heap (see nextRule()). */
+    for (ii = (npRule / 2) - 1; ii >= 0; ii--) {
+        ruleHeapSift(apRule, npRule, ii);
+    }
+
+    return npRule;
+}
+
+/*
+ * The following structures are used by HtmlCssPrematch() to test the
+ * selectors in the stylesheet configuration against every element of the
+ * document using multiple threads, before the style engine restyles the
+ * whole tree (see the -stylethreads option). The results are consumed by
+ * HtmlCssStyleSheetApply().
+ *
+ * Only selector matching is done by the worker threads. Running the
+ * cascade interns computed values, fonts and colors and may invoke Tcl
+ * scripts (-stylecmd, -imagecmd and tcl() property values), so it is
+ * still done on the main thread by the normal style pass.
+ *
+ * For each element node a CssPrematchNode structure holds one byte for
+ * each rule visited by the nextRule() loop in HtmlCssStyleSheetApply(),
+ * in the same order. The PREMATCH_MATCH bit is set if the selector
+ * matches the node. The PREMATCH_DYNAMIC bit is set if the selector is
+ * dynamic and would match with all dynamic conditions set to true.
+ *
+ * The result of a selector test may depend on the attributes and dynamic
+ * flags of any node in the document, not just those of the node tested.
+ * So if any node is added, moved or deleted, or any attribute or dynamic
+ * flag is modified after the results are computed (this can only happen
+ * if a Tcl script, for example a tcl() property value or the -imagecmd
+ * callback, is invoked during the style pass), HtmlTree.iDocumentGeneration
+ * changes and none of the stored results are used.
+ */
+#define PREMATCH_MATCH   0x01
+#define PREMATCH_DYNAMIC 0x02
+
+/* Number of consecutive nodes claimed by a worker thread at a time */
+#define PREMATCH_CHUNK 256
+
+typedef struct CssPrematchNode CssPrematchNode;
+typedef struct CssPrematchChunk CssPrematchChunk;
+
+struct CssPrematchNode {
+    HtmlNode *pNode;
+    int iMatch;                   /* Offset of results in chunk buffer */
+    int nMatch;                   /* Number of entries in aMatch[] */
+    unsigned char *aMatch;        /* Results (set once all threads finish) */
+};
+
+struct CssPrematchChunk {
+    unsigned char *aMatch;        /* Results for all nodes of this chunk */
+    int nMatch;
+    int nMatchAlloc;
+};
+
+struct CssPrematch {
+    CssStyleSheet *pStyle;        /* Stylesheet configuration used */
+    int iDocumentGeneration;      /* HtmlTree.iDocumentGeneration when built */
+
+    int nNode;                    /* Number of element nodes in aNode[] */
+    int nNodeAlloc;
+    CssPrematchNode *aNode;       /* Element nodes in document order */
+
+    int nChunk;                   /* Number of chunks in aChunk[] */
+    CssPrematchChunk *aChunk;     /* One for each PREMATCH_CHUNK nodes */
+
+    Tcl_HashTable aHash;          /* Map from HtmlNode* to CssPrematchNode* */
+
+    Tcl_Mutex mutex;              /* Mutex protecting iNextChunk */
+    int iNextChunk;               /* Next chunk to be claimed by a thread */
+};
+
+#if defined(TCL_THREADS) && !defined(HTML_DEBUG)
+  #define CSS_PREMATCH_THREADS 1
+#endif
+
+#ifdef CSS_PREMATCH_THREADS
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * prematchNode --
+ *
+ *     Test the selector of each rule that HtmlCssStyleSheetApply() will
+ *     visit for node pNode and append the results to pChunk. Ancestor
+ *     filter pFilter contains the ancestors of pNode.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+prematchNode(pStyle, pFilter, pEntry, pChunk)
+    CssStyleSheet *pStyle;
+    CssAncestorFilter *pFilter;
+    CssPrematchNode *pEntry;
+    CssPrematchChunk *pChunk;
+{
+    CssRule *apStatic[MAX_RULE_LISTS];
+    CssRule **apRule;
+    CssRule *pRule;
+    HtmlNode *pNode = pEntry->pNode;
+    int npRule = ruleListsFind(pStyle, pNode, apStatic, &apRule);
+
+    pEntry->iMatch = pChunk->nMatch;
+    for (
+        pRule = nextRule(apRule, &npRule); 
+        pRule; 
+        pRule = nextRule(apRule, &npRule)
+    ) {
+        CssSelector *pSelector = pRule->pSelector;
+        unsigned char eMatch = 0;
+
+        if (pChunk->nMatch == pChunk->nMatchAlloc) {
+            pChunk->nMatchAlloc = pChunk->nMatchAlloc * 2 + 1024;
+            pChunk->aMatch = (unsigned char *)HtmlRealloc(
+                "CssPrematchChunk.aMatch", pChunk->aMatch, pChunk->nMatchAlloc
+            );
+        }
+
+        if (pRule->nAncestorHash == 0 || !filterReject(pFilter, pRule)) {
+            if (HtmlCssSelectorTest(pSelector, pNode, 0)) {
+                eMatch |= PREMATCH_MATCH;
+            }
+            if (pSelector->isDynamic && HtmlCssSelectorTest(pSelector,pNode,1)){
+                eMatch |= PREMATCH_DYNAMIC;
+            }
+        }
+        pChunk->aMatch[pChunk->nMatch++] = eMatch;
+    }
+    pEntry->nMatch = pChunk->nMatch - pEntry->iMatch;
+
+    if (apRule != apStatic) {
+        HtmlFree(apRule);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * prematchChunk --
+ *
+ *     Compute the selector match results for the nodes that make up
+ *     chunk iChunk of p->aNode[]. The nodes are visited in document 
+ *     order, maintaining an ancestor filter as HtmlStyleApply() does.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+prematchChunk(p, iChunk)
+    CssPrematch *p;
+    int iChunk;
+{
+    CssPrematchChunk *pChunk = &p->aChunk[iChunk];
+    CssAncestorFilter *pFilter = HtmlCssAncestorFilterNew();
+    HtmlNode **apStack = 0;       /* Nodes pushed onto pFilter */
+    int nStack = 0;
+    int nStackAlloc = 0;
+
+    int iFirst = iChunk * PREMATCH_CHUNK;
+    int iLast = MIN(iFirst + PREMATCH_CHUNK, p->nNode);
+    int ii;
+
+    for (ii = iFirst; ii < iLast; ii++) {
+        CssPrematchNode *pEntry = &p->aNode[ii];
+        HtmlNode *pParent = HtmlNodeParent(pEntry->pNode);
+
+        /* Pop nodes from the filter until the parent of pNode is on top.
+         * For the first node in the chunk, push the entire ancestor chain.
+         */
+        while (nStack > 0 && apStack[nStack - 1] != pParent) {
+            HtmlCssAncestorFilterPop(pFilter);
+            nStack--;
+        }
+        if (nStack == 0 && pParent) {
+            HtmlNode *pAncestor;
+            int jj;
+            pAncestor = pParent;
+            for ( ; pAncestor; pAncestor = HtmlNodeParent(pAncestor)) {
+                nStack++;
+            }
+            if (nStack >= nStackAlloc) {
+                nStackAlloc = nStack + 32;
+                apStack = (HtmlNode **)HtmlRealloc(
+                    "CssPrematch.apStack", apStack, sizeof(HtmlNode*)*nStackAlloc
+                );
+            }
+            jj = nStack;
+            pAncestor = pParent;
+            for ( ; pAncestor; pAncestor = HtmlNodeParent(pAncestor)) {
+                apStack[--jj] = pAncestor;
+            }
+            for (jj = 0; jj < nStack; jj++) {
+                HtmlCssAncestorFilterPush(pFilter, apStack[jj]);
+            }
+        }
+
+        prematchNode(p->pStyle, pFilter, pEntry, pChunk);
+
+        if (nStack >= nStackAlloc) {
+            nStackAlloc = nStack + 32;
+            apStack = (HtmlNode **)HtmlRealloc(
+                "CssPrematch.apStack", apStack, sizeof(HtmlNode*)*nStackAlloc
+            );
         }
+        apStack[nStack++] = pEntry->pNode;
+        HtmlCssAncestorFilterPush(pFilter, pEntry->pNode);
     }
 
-    if (ppRule) {
-        pRet = *ppRule;
-        *ppRule = (*ppRule)->pNext;
+    HtmlFree(apStack);
+    HtmlCssAncestorFilterFree(pFilter);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * prematchWork --
+ *
+ *     Claim and process chunks of p until there are none left. This is
+ *     run by each worker thread, and by the main thread.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+prematchWork(p)
+    CssPrematch *p;
+{
+    while (1) {
+        int iChunk;
+        Tcl_MutexLock(&p->mutex);
+        iChunk = p->iNextChunk++;
+        Tcl_MutexUnlock(&p->mutex);
+        if (iChunk >= p->nChunk) break;
+        prematchChunk(p, iChunk);
     }
+}
 
-    return pRet;
+static Tcl_ThreadCreateType
+prematchThread(clientData)
+    ClientData clientData;
+{
+    prematchWork((CssPrematch *)clientData);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * prematchCollect --
+ *
+ *     HtmlWalkTree() callback used by HtmlCssPrematch() to build the
+ *     CssPrematch.aNode[] array.
+ *
+ * Results:
+ *     HTML_WALK_DESCEND.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+prematchCollect(pTree, pNode, clientData)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    ClientData clientData;
+{
+    CssPrematch *p = (CssPrematch *)clientData;
+    if (!HtmlNodeIsText(pNode)) {
+        CssPrematchNode *pEntry;
+        if (p->nNode == p->nNodeAlloc) {
+            p->nNodeAlloc = p->nNodeAlloc * 2 + 256;
+            p->aNode = (CssPrematchNode *)HtmlRealloc("CssPrematch.aNode", 
+                p->aNode, sizeof(CssPrematchNode) * p->nNodeAlloc
+            );
+        }
+        pEntry = &p->aNode[p->nNode++];
+        memset(pEntry, 0, sizeof(CssPrematchNode));
+        pEntry->pNode = pNode;
+    }
+    return HTML_WALK_DESCEND;
+}
+
+#endif /* CSS_PREMATCH_THREADS */
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssPrematch --
+ *
+ *     Test the selectors of the current stylesheet configuration against
+ *     all element nodes in the document using nThread threads (including
+ *     the calling thread). The returned object may be passed to 
+ *     HtmlCssStyleSheetApply() during the following style pass, and must
+ *     eventually be freed with HtmlCssPrematchFree().
+ *
+ *     The document tree and stylesheet configuration must not be modified
+ *     while this function is running. It is not safe to run any Tcl 
+ *     script from the worker threads, so none are.
+ *
+ * Results:
+ *     Pointer to a new CssPrematch object, or NULL if nThread is less
+ *     than 2 or Tkhtml was not built with thread support.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+CssPrematch *
+HtmlCssPrematch(pTree, nThread)
+    HtmlTree *pTree;
+    int nThread;
+{
+    CssPrematch *p = 0;
+#ifdef CSS_PREMATCH_THREADS
+    CssStyleSheet *pStyle = pTree->pStyle;
+    Tcl_ThreadId *aId;
+    int nStarted = 0;
+    int ii;
+
+    if (nThread < 2 || !pStyle || !pTree->pRoot) {
+        return 0;
+    }
+    if (!pStyle->isOrderValid) {
+        cssRuleOrderUpdate(pStyle);
+    }
+
+    p = HtmlNew(CssPrematch);
+    p->pStyle = pStyle;
+    p->iDocumentGeneration = pTree->iDocumentGeneration;
+    Tcl_InitHashTable(&p->aHash, TCL_ONE_WORD_KEYS);
+    HtmlWalkTree(pTree, 0, prematchCollect, (ClientData)p);
+
+    p->nChunk = (p->nNode + PREMATCH_CHUNK - 1) / PREMATCH_CHUNK;
+    p->aChunk = (CssPrematchChunk *)HtmlClearAlloc(
+        "CssPrematch.aChunk", sizeof(CssPrematchChunk) * p->nChunk
+    );
+    nThread = MIN(nThread, p->nChunk);
+
+    /* Start nThread-1 worker threads, then do a share of the work on
+     * this thread before waiting for the workers to finish. If a thread
+     * cannot be created, the remaining work is done by those that were.
+     */
+    aId = (Tcl_ThreadId *)HtmlAlloc("CssPrematch.aId", 
+        sizeof(Tcl_ThreadId) * MAX(nThread, 1)
+    );
+    for (ii = 1; ii < nThread; ii++) {
+        if (TCL_OK != Tcl_CreateThread(&aId[nStarted], prematchThread, 
+                (ClientData)p, TCL_THREAD_STACK_DEFAULT, TCL_THREAD_JOINABLE
+        )) {
+            break;
+        }
+        nStarted++;
+    }
+    prematchWork(p);
+    for (ii = 0; ii < nStarted; ii++) {
+        int rc;
+        Tcl_JoinThread(aId[ii], &rc);
+    }
+    HtmlFree(aId);
+    Tcl_MutexFinalize(&p->mutex);
+
+    for (ii = 0; ii < p->nNode; ii++) {
+        CssPrematchNode *pEntry = &p->aNode[ii];
+        CssPrematchChunk *pChunk = &p->aChunk[ii / PREMATCH_CHUNK];
+        Tcl_HashEntry *pHash;
+        int isNew;
+        pEntry->aMatch = &pChunk->aMatch[pEntry->iMatch];
+        pHash = Tcl_CreateHashEntry(&p->aHash, (char *)pEntry->pNode, &isNew);
+        Tcl_SetHashValue(pHash, (ClientData)pEntry);
+    }
+#endif
+    return p;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssPrematchFree --
+ *
+ *     Free an object returned by HtmlCssPrematch(). It is a no-op to
+ *     pass NULL to this function.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlCssPrematchFree(p)
+    CssPrematch *p;
+{
+    if (p) {
+        int ii;
+        for (ii = 0; ii < p->nChunk; ii++) {
+            HtmlFree(p->aChunk[ii].aMatch);
+        }
+        HtmlFree(p->aChunk);
+        HtmlFree(p->aNode);
+        Tcl_DeleteHashTable(&p->aHash);
+        HtmlFree(p);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * prematchLookup --
+ *
+ *     Return the precomputed selector match results for node pNode, or
+ *     NULL if there are none or they may be out of date (because the
+ *     stylesheet configuration or the document has been modified since
+ *     HtmlCssPrematch() was called).
+ *
+ *---------------------------------------------------------------------------
+ */
+static CssPrematchNode *
+prematchLookup(p, pTree, pNode)
+    CssPrematch *p;
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    Tcl_HashEntry *pHash;
+
+    if (
+        p->pStyle != pTree->pStyle ||
+        p->iDocumentGeneration != pTree->iDocumentGeneration
+    ) {
+        return 0;
+    }
+    pHash = Tcl_FindHashEntry(&p->aHash, (char *)pNode);
+    return (pHash ? (CssPrematchNode *)Tcl_GetHashValue(pHash) : 0);
 }
 
 /*--------------------------------------------------------------------------
@@ -3505,28 +4785,33 @@ nextRule(apRule, n)
  *     returns, the HtmlNode.pPropertyValues variable points to the
  *     structure containing the computed values applied to the node.
  *
- *     NOTE: There are two hard-coded limits in this function:
- *         1) No element may be a member of more than 126 classes.  
- *         2) No class name may be longer than 128 bytes (includes null term).
+ *     If argument pPrematch is not NULL and contains the selector match
+ *     results for pNode computed by HtmlCssPrematch(), they are used
+ *     instead of testing each selector against the node.
+ *
+ *     NOTE: There is a hard-coded limit in this function: rules for
+ *     no more than the first 126 classes of an element are considered.
  *
  * Results:
  *
- *     None.
+ *     Non-zero if the computed values may be shared with a sibling that
+ *     has the same tag, attributes and dynamic flags as pNode (see the
+ *     style sharing cache in htmlstyle.c). Zero if pNode has override
+ *     properties, or if a rule that depends on the position of the node
+ *     among it's siblings was considered, or if a rule with a tcl() 
+ *     property value was matched.
  *
  * Side effects:
  *
  *--------------------------------------------------------------------------
  */
-void 
-HtmlCssStyleSheetApply(pTree, pNode)
+int 
+HtmlCssStyleSheetApply(pTree, pNode, pFilter, pPrematch)
     HtmlTree *pTree; 
     HtmlNode *pNode; 
+    CssAncestorFilter *pFilter;     /* Ancestors of pNode, or NULL */
+    CssPrematch *pPrematch;         /* Precomputed matches, or NULL */
 {
-
-    /* The two hard coded constants mentioned above */
-    #define MAX_CLASSES    126
-    #define MAX_CLASS_NAME 128
-
     CssStyleSheet *pStyle = pTree->pStyle;    /* Stylesheet config */
     CssRule *pRule;                           /* Iterator variable */
 
@@ -3542,60 +4827,31 @@ HtmlCssStyleSheetApply(pTree, pNode)
      */
     int aPropDone[CSS_PROPERTY_MAX_PROPERTY + 1];
 
-    Tcl_HashEntry *pEntry;
-    char const *zClassAttr;            /* Value of node "class" attribute */
-    char const *zIdAttr;               /* Value of node "id" attribute */
+    /* Array of applicable rules lists (see ruleListsFind()). */
+    CssRule *apStatic[MAX_RULE_LISTS];
+    CssRule **apRule;
+    int npRule = 0;
 
-    CssRule *apRule[MAX_CLASSES + 2];  /* Array of applicable rules lists. */
-    int npRule;
+    /* Precomputed selector matches for pNode, if any. */
+    CssPrematchNode *pMatch = 0;
+    int iRule = 0;
 
     int nSelectorMatch = 0;
     int nSelectorTest = 0;
+    int nFilterReject = 0;
+    int isShareable;
 
     HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
     assert(pElem);
+    isShareable = (pElem->pOverride ? 0 : 1);
 
-    /* The universal rules list applies to all nodes */
-    apRule[0] = pStyle->pUniversalRules;
-    npRule = 1;
-
-    /* Find the applicable "by-tag" rules list, if any. */
-    pEntry = Tcl_FindHashEntry(&pStyle->aByTag, pNode->zTag);
-    if (pEntry) {
-        apRule[npRule++] = Tcl_GetHashValue(pEntry);
-    }
-
-    /* Find a rules list for the element id, if any */
-    zIdAttr = HtmlNodeAttr(pNode, "id");
-    if (zIdAttr) {
-        pEntry = Tcl_FindHashEntry(&pStyle->aById, zIdAttr);
-        if (pEntry) {
-            apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
-        }
+    if (!pStyle->isOrderValid) {
+        cssRuleOrderUpdate(pStyle);
     }
-
-    /* Find a rules list for each class the element belongs to */
-    zClassAttr = HtmlNodeAttr(pNode, "class");
-    if (zClassAttr) {
-        int nClass;
-        char const *zClass = zClassAttr;
-        char zTerm[MAX_CLASS_NAME];
-
-        while (
-            npRule < (MAX_CLASSES + 2) &&
-            (zClass = HtmlCssGetNextListItem(zClass, strlen(zClass), &nClass))
-        ) {
-            strncpy(zTerm, zClass, MIN(MAX_CLASS_NAME, nClass));
-            zTerm[MIN(MAX_CLASS_NAME - 1, nClass)] = '\0';
-            zClass += nClass;
-
-            pEntry = Tcl_FindHashEntry(&pStyle->aByClass, zTerm);
-            if (pEntry) {
-                apRule[npRule++] = (CssRule *)Tcl_GetHashValue(pEntry);
-            }
-        }
+    npRule = ruleListsFind(pStyle, pNode, apStatic, &apRule);
+    if (pPrematch) {
+        pMatch = prematchLookup(pPrematch, pTree, pNode);
     }
-    
 
     /* Initialise aPropDone and sCreator */
     HtmlComputedValuesInit(pTree, pNode, 0, &sCreator);
@@ -3613,14 +4869,25 @@ HtmlCssStyleSheetApply(pTree, pNode)
      * earlier in the list have a higher priority than those that occur later.
      */
     for (
-        pRule = nextRule(apRule, npRule); 
+        pRule = nextRule(apRule, &npRule); 
         pRule; 
-        pRule = nextRule(apRule, npRule)
+        pRule = nextRule(apRule, &npRule)
     ) {
         CssPriority *pPriority = pRule->pPriority;
         CssSelector *pSelector = pRule->pSelector;
+        int eMatch = -1;
+
+        if (pMatch && iRule < pMatch->nMatch) {
+            eMatch = pMatch->aMatch[iRule];
+        }
+        iRule++;
 
         nSelectorTest++;
+        if (pRule->isPositional && (!pRule->zPositionalTag || 
+            0 == strcmp(pRule->zPositionalTag, pNode->zTag)
+        )) {
+            isShareable = 0;
+        }
 
         /* The contents of the "style" attribute, if one exists, are handled
          * after the important rules but before anything else. This is because:
@@ -3638,14 +4905,40 @@ HtmlCssStyleSheetApply(pTree, pNode)
             }
         }
 
-        /* If the selector is a match for our node, apply the rule properties */
-        nSelectorMatch += 
-                applyRule(pTree, pNode, pRule, aPropDone, 0, &sCreator);
+        /* If the ancestors of the node cannot match the selector, skip
+         * the rule without testing it. If the selector cannot match with
+         * the dynamic conditions set to true, it cannot match at all, so
+         * there is no need to consider adding a CssDynamic either.
+         */
+        if (pFilter && pRule->nAncestorHash>0 && filterReject(pFilter,pRule)) {
+            nFilterReject++;
+            continue;
+        }
 
-        if (
-            pSelector->isDynamic &&
+        /* If the selector is a match for our node, apply the rule 
+         * properties. If the result of the selector test was computed by
+         * HtmlCssPrematch(), use it instead of running the test again.
+         */
+        if (eMatch >= 0) {
+            logRuleMatch(pTree, pNode, pRule, (eMatch & PREMATCH_MATCH));
+            if (eMatch & PREMATCH_MATCH) {
+                ruleToPropertyValues(&sCreator, aPropDone, pRule);
+                nSelectorMatch++;
+                if (pRule->isTcl) {
+                    isShareable = 0;
+                }
+            }
+        } else if (applyRule(pTree, pNode, pRule, aPropDone, 0, &sCreator)) {
+            nSelectorMatch++;
+            if (pRule->isTcl) {
+                isShareable = 0;
+            }
+        }
+
+        if (pSelector->isDynamic && (eMatch >= 0 ? 
+            (eMatch & PREMATCH_DYNAMIC) : 
             HtmlCssSelectorTest(pSelector, pNode, 1)
-        ) {
+        )) {
             HtmlCssAddDynamic(pElem, pSelector, 0);
         }
     }
@@ -3653,11 +4946,15 @@ HtmlCssStyleSheetApply(pTree, pNode)
     if (!isStyleDone && pElem->pStyle) {
         propertySetToPropertyValues(&sCreator, aPropDone, pElem->pStyle);
     }
+    if (apRule != apStatic) {
+        HtmlFree(apRule);
+    }
 
     LOG {
-       HtmlLog(pTree, "STYLEENGINE", "%s matched %d/%d selectors",
+       HtmlLog(pTree, "STYLEENGINE", 
+           "%s matched %d/%d selectors (bloom rejected %d)",
            Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
-           nSelectorMatch, nSelectorTest
+           nSelectorMatch, nSelectorTest, nFilterReject
        );
     }
 
@@ -3665,6 +4962,118 @@ HtmlCssStyleSheetApply(pTree, pNode)
      * HtmlComputedValues structure.
      */
     pElem->pPropertyValues = HtmlComputedValuesFinish(&sCreator);
+    return isShareable;
+}
+
+static int
+listDepends(pHash, zList)
+    Tcl_HashTable *pHash;
+    const char *zList;
+{
+    int eDepend = 0;
+    const char *zItem = zList;
+    int nItem;
+
+    if (!zList || pHash->numEntries == 0) return 0;
+    while ((zItem = HtmlCssGetNextListItem(zItem, strlen(zItem), &nItem))) {
+        eDepend |= findDependency(pHash, zItem, nItem);
+        zItem += nItem;
+    }
+    return eDepend;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssAttributeDepends --
+ *
+ *     This function is called when the value of attribute zAttr of a 
+ *     node is modified from zOld to zNew (either of which may be NULL).
+ *     The dependencies recorded for the current stylesheet configuration
+ *     are used to determine the nodes that may need to be restyled.
+ *
+ *     Both the old and new values of the "class" and "id" attributes 
+ *     are looked up in the class and id dependency tables (the class
+ *     attribute is first split into words), as a selector may cease to 
+ *     match or begin to match the node.
+ *
+ * Results:
+ *     A mask of CSS_DEPEND_XXX values (see css.h).
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+int 
+HtmlCssAttributeDepends(pTree, zAttr, zOld, zNew)
+    HtmlTree *pTree;
+    CONST char *zAttr;
+    CONST char *zOld;
+    CONST char *zNew;
+{
+    CssStyleSheet *pStyle = pTree->pStyle;
+    int eDepend;
+
+    if (zOld == zNew || (zOld && zNew && 0 == strcmp(zOld, zNew))) {
+        return 0;
+    }
+    if (0 == strcmp(zAttr, HTML_INLINE_STYLE_ATTR)) {
+        return CSS_DEPEND_SUBJECT;
+    }
+    if (!pStyle) {
+        return 0;
+    }
+
+    eDepend = pStyle->iDependAny;
+    eDepend |= findDependency(&pStyle->aDependAttr, zAttr, -1);
+
+    if (0 == strcmp(zAttr, "class")) {
+        eDepend |= listDepends(&pStyle->aDependClass, zOld);
+        eDepend |= listDepends(&pStyle->aDependClass, zNew);
+    }
+    else if (0 == strcmp(zAttr, "id")) {
+        const char *azId[2];
+        int ii;
+        azId[0] = zOld;
+        azId[1] = zNew;
+        for (ii = 0; ii < 2; ii++) {
+            if (!azId[ii]) continue;
+            eDepend |= findDependency(&pStyle->aDependId, azId[ii], -1);
+        }
+    }
+
+    return eDepend;
+}
+
+/*--------------------------------------------------------------------------
+ *
+ * HtmlCssDynamicDepends --
+ *
+ *     This function is called when the HTML_DYNAMIC_XXX flags in mask 
+ *     eFlags are set or cleared on a node. 
+ *
+ * Results:
+ *     A mask of CSS_DEPEND_XXX values (see css.h) indicating the nodes
+ *     whose dynamic conditions must be rechecked.
+ *
+ * Side effects:
+ *     None.
+ *
+ *--------------------------------------------------------------------------
+ */
+int 
+HtmlCssDynamicDepends(pTree, eFlags)
+    HtmlTree *pTree;
+    int eFlags;
+{
+    CssStyleSheet *pStyle = pTree->pStyle;
+    int eDepend = 0;
+    if (pStyle) {
+        if (eFlags & HTML_DYNAMIC_HOVER)  eDepend |= pStyle->iDependHover;
+        if (eFlags & HTML_DYNAMIC_FOCUS)  eDepend |= pStyle->iDependFocus;
+        if (eFlags & HTML_DYNAMIC_ACTIVE) eDepend |= pStyle->iDependActive;
+    }
+    return eDepend;
 }
 
 /*--------------------------------------------------------------------------
@@ -3689,7 +5098,9 @@ generateContentText(pTree, zContent)
     HtmlTree *pTree;
     const char *zContent;
 {
-    HtmlTextNode *pTextNode = HtmlTextNew(strlen(zContent), zContent, 0, 0);
+    HtmlTextNode *pTextNode = HtmlTextNew(
+        pTree, 0, strlen(zContent), zContent, 0, 0
+    );
     return pTextNode;
 }
 
@@ -3736,7 +5147,7 @@ generatedContent(pTree, pNode, pCssRule, ppNode)
         return;
     }
 
-    *ppNode = (HtmlNode *)HtmlNew(HtmlElementNode);
+    *ppNode = (HtmlNode *)HtmlArenaNew(pTree, HtmlElementNode);
     ((HtmlElementNode *)(*ppNode))->pPropertyValues = pValues;
 
     if (zContent) {
@@ -4066,6 +5477,7 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     int nByTag = 0;
     int nByClass = 0;
     int nById = 0;
+    int nByAttr = 0;
     int nAfter = 0;
     int nBefore = 0;
 
@@ -4080,6 +5492,7 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     Tcl_Obj *pByTag;
     Tcl_Obj *pByClass;
     Tcl_Obj *pById;
+    Tcl_Obj *pByAttr;
 
     Tcl_Obj *pReport;
 
@@ -4158,6 +5571,22 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     }
     Tcl_AppendStringsToObj(pById, "</table>", NULL);
 
+    pByAttr = Tcl_NewObj();
+    Tcl_IncrRefCount(pByAttr);
+    Tcl_AppendStringsToObj(pByAttr, 
+        "<h1>By Attribute Rules</h1>",
+        "<table border=1>", NULL
+    );
+    for (
+        pEntry = Tcl_FirstHashEntry(&pStyle->aByAttr, &search);
+        pEntry;
+        pEntry = Tcl_NextHashEntry(&search)
+    ) {
+        pRule = (CssRule *)Tcl_GetHashValue(pEntry);
+        rulelistReport(pRule, pByAttr, &nByAttr);
+    }
+    Tcl_AppendStringsToObj(pByAttr, "</table>", NULL);
+
     pReport = Tcl_NewObj();
     Tcl_IncrRefCount(pReport);
 
@@ -4176,6 +5605,9 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     Tcl_AppendStringsToObj(pReport, "<li>By id rules lists: ", NULL);
     Tcl_AppendObjToObj(pReport, Tcl_NewIntObj(nById));
 
+    Tcl_AppendStringsToObj(pReport, "<li>By attribute rules lists: ", NULL);
+    Tcl_AppendObjToObj(pReport, Tcl_NewIntObj(nByAttr));
+
     Tcl_AppendStringsToObj(pReport, "<li>:before rules lists: ", NULL);
     Tcl_AppendObjToObj(pReport, Tcl_NewIntObj(nBefore));
 
@@ -4187,6 +5619,7 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     Tcl_AppendObjToObj(pReport, pByTag);
     Tcl_AppendObjToObj(pReport, pByClass);
     Tcl_AppendObjToObj(pReport, pById);
+    Tcl_AppendObjToObj(pReport, pByAttr);
     Tcl_AppendObjToObj(pReport, pBefore);
     Tcl_AppendObjToObj(pReport, pAfter);
 
@@ -4196,6 +5629,7 @@ HtmlCssStyleReport(clientData, interp, objc, objv)
     Tcl_DecrRefCount(pByTag);
     Tcl_DecrRefCount(pByClass);
     Tcl_DecrRefCount(pById);
+    Tcl_DecrRefCount(pByAttr);
       
     return TCL_OK;
 }
@@ -4251,7 +5685,7 @@ HtmlCssStyleConfigDump(clientData, interp, objc, objv)
 #define MAX_RULES 8096
     HtmlTree *pTree = (HtmlTree *)clientData;
     CssStyleSheet *pStyle = pTree->pStyle;
-    Tcl_HashTable *apTable[3];
+    Tcl_HashTable *apTable[4];
 
     CssRule *pRule;
     CssRule *apRule[MAX_RULES];
@@ -4268,7 +5702,8 @@ HtmlCssStyleConfigDump(clientData, interp, objc, objv)
     apTable[0] = &pStyle->aByTag;
     apTable[1] = &pStyle->aById;
     apTable[2] = &pStyle->aByClass;
-    for (jj = 0; jj < 3; jj++) {
+    apTable[3] = &pStyle->aByAttr;
+    for (jj = 0; jj < 4; jj++) {
         Tcl_HashEntry *pEntry;
         Tcl_HashSearch search;
         for (pEntry = Tcl_FirstHashEntry(apTable[jj], &search);
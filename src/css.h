@@ -66,6 +66,8 @@ typedef struct CssProperty CssProperty;
 typedef struct CssDynamic CssDynamic;
 
 typedef struct CssPropertySet CssPropertySet;
+typedef struct CssAncestorFilter CssAncestorFilter;
+typedef struct CssPrematch CssPrematch;
 
 /* Include html.h after we define our opaque types, because it includes
  * structures that contain pointers to them.
@@ -163,10 +165,51 @@ void HtmlCssStyleSheetFree(CssStyleSheet *);
 /*
  * Function to apply a stylesheet to a document node.
  */
-void HtmlCssStyleSheetApply(HtmlTree *, HtmlNode *);
+int HtmlCssStyleSheetApply(
+    HtmlTree *, HtmlNode *, CssAncestorFilter *, CssPrematch *
+);
 void HtmlCssStyleSheetGenerated(HtmlTree *, HtmlElementNode *);
 void HtmlCssStyleGenerateContent(HtmlTree *, HtmlElementNode *, int);
 
+/*
+ * Bloom filter of the type, class and id names of the ancestors of the
+ * node being styled. Maintained by HtmlStyleApply() and passed to 
+ * HtmlCssStyleSheetApply().
+ */
+CssAncestorFilter *HtmlCssAncestorFilterNew();
+void HtmlCssAncestorFilterFree(CssAncestorFilter *);
+void HtmlCssAncestorFilterPush(CssAncestorFilter *, HtmlNode *);
+void HtmlCssAncestorFilterPop(CssAncestorFilter *);
+
+/*
+ * Selector matching for every element of the document may be done using
+ * multiple threads before the whole tree is restyled (see the 
+ * -stylethreads option). The results are passed to 
+ * HtmlCssStyleSheetApply().
+ */
+CssPrematch *HtmlCssPrematch(HtmlTree *, int);
+void HtmlCssPrematchFree(CssPrematch *);
+
+/*
+ * When the value of an attribute of a node is modified, 
+ * HtmlCssAttributeDepends() returns a mask of the following values to
+ * indicate which nodes may require restyling. HtmlCssDynamicDepends()
+ * does the same for a change to the HTML_DYNAMIC_XXX flags of a node:
+ *
+ *     CSS_DEPEND_SUBJECT   - The node itself.
+ *     CSS_DEPEND_ANCESTOR  - Descendants of the node.
+ *     CSS_DEPEND_SIBLING   - Right-siblings of the node and their 
+ *                            descendants.
+ *
+ * A return value of 0 means the modification cannot change the computed
+ * values of any node.
+ */
+#define CSS_DEPEND_SUBJECT  0x01
+#define CSS_DEPEND_ANCESTOR 0x02
+#define CSS_DEPEND_SIBLING  0x04
+int HtmlCssAttributeDepends(HtmlTree *, CONST char *, CONST char *, CONST char*);
+int HtmlCssDynamicDepends(HtmlTree *, int);
+
 /*
  * Functions to interface with inline style information (in HTML, 
  * the "style" attribute).
@@ -183,6 +226,7 @@ Tcl_ObjCmdProc HtmlCssStyleReport;
 
 void HtmlCssCheckDynamic(HtmlTree *);
 void HtmlCssFreeDynamics(HtmlElementNode *);
+void HtmlCssCopyDynamics(HtmlElementNode *, HtmlElementNode *);
 int  HtmlCssTclNodeDynamics(Tcl_Interp *, HtmlNode *);
 
 /* The interface to the csssearch.c module. This module is responsible
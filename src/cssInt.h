@@ -135,6 +135,7 @@ struct CssSelector {
     u8 isDynamic;     /* True if this selector is dynamic */
     u8 eSelector;     /* CSS_SELECTOR* or CSS_PSEUDO* value */
     char *zAttr;      /* The attribute queried, if any. */
+    const char *zAttrAtom;  /* zAttr interned in HtmlTree.aAtom, or zAttr */
     char *zValue;     /* The value tested for, if any. */
     CssSelector *pNext;  /* Next simple-selector in chain */
 };
@@ -155,15 +156,49 @@ struct CssProperties {
     CssRule **apRule;
 };
 
+/*
+ * The CssRule.aAncestorHash[] array contains hash values (see 
+ * HtmlCssBloomHash()) for up to CSS_MAX_ANCESTOR_HASH of the type, class
+ * and id simple selectors that must be matched by ancestors of a node for
+ * the rule to apply to it. For example, the rule "div.a > p.b span" stores
+ * hashes for "div", "a" and "p", "b" (but not "span"). Before the selector
+ * is tested, the hashes are checked against a CssAncestorFilter containing
+ * the ancestors of the node - if any hash is missing the rule cannot match.
+ *
+ * The CssRule.iOrder variable is set by cssRuleOrderUpdate() to the
+ * position of the rule in the total priority ordering of all rules in the
+ * stylesheet (higher values for higher priority rules). This allows the
+ * rule lists to be merged in priority order using an integer comparison
+ * instead of ruleCompare().
+ *
+ * The CssRule.isPositional and CssRule.isTcl flags are used by the style
+ * sharing cache in htmlstyle.c. isPositional is set if the rule tests the
+ * position of the node among its siblings (i.e. ":first-child" or an
+ * adjacent-sibling combinator before the first descendant or child
+ * combinator). isTcl is set if the property set contains a tcl() value.
+ * Two sibling nodes for which either kind of rule is considered may not
+ * share a computed values structure. If the subject of a positional rule 
+ * includes a type selector, zPositionalTag points to the tag name. The 
+ * rule does not prevent sharing between nodes of any other type.
+ */
+#define CSS_MAX_ANCESTOR_HASH 4
+
 struct CssRule {
     CssPriority *pPriority;  /* Pointer to the priority of source stylesheet */
     int specificity;         /* Specificity of the selector */
     int iRule;               /* Rule-number within source style sheet */
+    int iOrder;              /* Position in stylesheet priority order */
     CssSelector *pSelector;  /* The selector-chain for this rule */
     int freePropertySets;          /* True to delete pPropertySet */
     int freeSelector;              /* True to delete pSelector */
     CssPropertySet *pPropertySet;  /* Property values for the rule. */
     CssRule *pNext;                /* Next rule in this list. */
+
+    int nAncestorHash;                             /* Size of aAncestorHash */
+    unsigned int aAncestorHash[CSS_MAX_ANCESTOR_HASH];  /* See above */
+    int isPositional;              /* True if rule depends on sibling order */
+    const char *zPositionalTag;    /* Subject tag of positional rule, or 0 */
+    int isTcl;                     /* True if pPropertySet contains tcl() */
 };
 
 /*
@@ -198,12 +233,18 @@ struct CssPriority {
 /*
  * A style-sheet contains zero or more rules. Depending on the nature of
  * the selector for the rule, it is either stored in a linked list starting
- * at CssStyleSheet.pUniversalRules, or in a linked list stored in the
- * hash table CssStyleSheet.rules. The CssStyleSheet.rules hash is indexed
- * by the tag type of the elements that the rule applies to.
+ * at CssStyleSheet.pUniversalRules, or in a linked list stored in one of
+ * the hash tables aByTag, aByClass, aById or aByAttr. The hash table
+ * used depends on the rightmost compound selector of the rule.
  *
  * For example, the rule "H1 {text-decoration: bold}" is stored in a linked
- * list accessible by looking up "h1" in the rules hash table.
+ * list accessible by looking up "h1" in the aByTag hash table. The rule
+ * "[href] {color: blue}" is stored in the list found by looking up "href"
+ * in the aByAttr table.
+ *
+ * CssStyleSheet.isOrderValid is cleared each time a rule or priority is
+ * added to the stylesheet. This indicates that the CssRule.iOrder values
+ * must be recalculated before the stylesheet is next applied.
  */
 struct CssStyleSheet {
     int nSyntaxErr;           /* Number of syntax errors during parsing */
@@ -217,6 +258,29 @@ struct CssStyleSheet {
     Tcl_HashTable aByTag;      /* Rule lists by tag (string keys) */
     Tcl_HashTable aByClass;    /* Rule lists by class (string keys) */
     Tcl_HashTable aById;       /* Rule lists by id (string keys) */
+    Tcl_HashTable aByAttr;     /* Rule lists by attribute name */
+
+    int isOrderValid;          /* True if CssRule.iOrder values are valid */
+    int nAncestorRule;         /* Number of rules with nAncestorHash>0 */
+
+    /* Attribute dependencies of the rules in this stylesheet. Each hash
+     * table maps from an attribute name, class name or id value to a mask
+     * of CSS_DEPEND_XXX values (see css.h). iDependAny is a mask that 
+     * applies to all attributes (set by tcl() values and the 'content'
+     * property, which may depend on any attribute of a node). See 
+     * HtmlCssAttributeDepends() for details.
+     */
+    Tcl_HashTable aDependAttr; /* Attribute names used by selectors */
+    Tcl_HashTable aDependClass;/* Class names used by selectors */
+    Tcl_HashTable aDependId;   /* Id values used by selectors */
+    int iDependAny;            /* Mask for any attribute */
+
+    /* Masks of CSS_DEPEND_XXX values for the dynamic pseudo-classes. See
+     * HtmlCssDynamicDepends().
+     */
+    int iDependHover;          /* Positions of :hover selectors */
+    int iDependFocus;          /* Positions of :focus selectors */
+    int iDependActive;         /* Positions of :active selectors */
 };
 
 /*
@@ -279,6 +343,8 @@ int HtmlCssTclNodeDynamics(Tcl_Interp *, HtmlNode *);
 
 int HtmlCssSelectorParse(HtmlTree *, int, const char *, CssStyleSheet **);
 
+unsigned int HtmlCssBloomHash(int, const char *, int);
+
 enum CssTokenType {
     CT_SPACE,    CT_LP,           CT_RP,        CT_RRP,        CT_LSP,
     CT_RSP,      CT_SEMICOLON,    CT_COMMA,     CT_COLON,      CT_PLUS,
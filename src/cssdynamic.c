@@ -41,6 +41,34 @@ HtmlCssAddDynamic(pElem, pSelector, isSet)
     pElem->pDynamic = pNew;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssCopyDynamics --
+ *
+ *     Add a dynamic condition to pTo for each dynamic condition that 
+ *     pFrom has. This is used when pTo shares the computed values of
+ *     pFrom instead of calling HtmlCssStyleSheetApply().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May add entries to pTo->pDynamic.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlCssCopyDynamics(pTo, pFrom)
+    HtmlElementNode *pTo;
+    HtmlElementNode *pFrom;
+{
+    CssDynamic *p;
+    for (p = pFrom->pDynamic; p; p = p->pNext) {
+        HtmlCssAddDynamic(pTo, p->pSelector, 0);
+    }
+}
+
 void
 HtmlCssFreeDynamics(pElem)
     HtmlElementNode *pElem;
@@ -64,6 +92,7 @@ checkDynamicCb(pTree, pNode, clientData)
     if (!HtmlNodeIsText(pNode)) {
         HtmlElementNode *pElem = (HtmlElementNode *)pNode;
         CssDynamic *p;
+        pElem->eDynamic = 0;
         for (p = pElem->pDynamic; p; p = p->pNext) {
             int res = HtmlCssSelectorTest(p->pSelector, pNode, 0) ? 1 : 0; 
             if (res != p->isSet) {
@@ -75,6 +104,70 @@ checkDynamicCb(pTree, pNode, clientData)
     return HTML_WALK_DESCEND;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * checkMarkedDynamic --
+ *
+ *     Check the dynamic conditions of the nodes in the sub-tree rooted
+ *     at pNode that have been marked by HtmlCallbackDynamicNode(). 
+ *     Sub-trees that contain no marked nodes are not visited.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Clears HtmlElementNode.eDynamic for each visited node. May call
+ *     HtmlCallbackRestyle().
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+checkMarkedDynamic(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    int eDynamic;
+
+    if (!pElem || !pElem->eDynamic) return;
+    eDynamic = pElem->eDynamic;
+
+    if (eDynamic & HTML_RESTYLE_TREE) {
+        HtmlWalkTree(pTree, pNode, checkDynamicCb, 0);
+    } else {
+        if (eDynamic & HTML_RESTYLE_NODE) {
+            checkDynamicCb(pTree, pNode, 0);
+        }
+        pElem->eDynamic = 0;
+        if (eDynamic & HTML_RESTYLE_CHILD) {
+            int i;
+            for (i = 0; i < HtmlNodeNumChildren(pNode); i++) {
+                checkMarkedDynamic(pTree, HtmlNodeChild(pNode, i));
+            }
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCssCheckDynamic --
+ *
+ *     Check the dynamic conditions of the sub-tree rooted at 
+ *     HtmlTree.cb.pDynamic and the sub-trees rooted at it's 
+ *     right-siblings, and of all nodes marked by HtmlCallbackDynamicNode().
+ *     Each node for which the result of a dynamic condition has changed
+ *     is restyled.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     See above.
+ *
+ *---------------------------------------------------------------------------
+ */
 void
 HtmlCssCheckDynamic(pTree)
     HtmlTree *pTree;
@@ -93,6 +186,9 @@ HtmlCssCheckDynamic(pTree)
         }
         pTree->cb.pDynamic = 0;
     }
+    if (pTree->pRoot) {
+        checkMarkedDynamic(pTree, pTree->pRoot);
+    }
 }
 
 int
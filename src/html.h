@@ -115,6 +115,7 @@ typedef struct HtmlAttributes HtmlAttributes;
 typedef struct HtmlTokenMap HtmlTokenMap;
 typedef struct HtmlCanvas HtmlCanvas;
 typedef struct HtmlCanvasItem HtmlCanvasItem;
+typedef struct HtmlCanvasIndex HtmlCanvasIndex;
 typedef struct HtmlFloatList HtmlFloatList;
 typedef struct HtmlPropertyCache HtmlPropertyCache;
 typedef struct HtmlNodeReplacement HtmlNodeReplacement;
@@ -133,6 +134,7 @@ typedef struct HtmlText HtmlText;
 typedef struct HtmlNode HtmlNode;
 typedef struct HtmlElementNode HtmlElementNode;
 typedef struct HtmlTextNode HtmlTextNode;
+typedef struct HtmlElementScope HtmlElementScope;
 
 typedef struct HtmlTextToken HtmlTextToken;
 typedef struct HtmlTextIter HtmlTextIter;
@@ -142,6 +144,10 @@ typedef struct HtmlDamage HtmlDamage;
 typedef struct HtmlFragmentContext HtmlFragmentContext;
 typedef struct HtmlSearchCache HtmlSearchCache;
 
+typedef struct HtmlNodeArena HtmlNodeArena;
+typedef struct HtmlNodeArenaBlock HtmlNodeArenaBlock;
+typedef struct HtmlNodeArenaClass HtmlNodeArenaClass;
+
 #include "css.h"
 #include "htmlprop.h"
 
@@ -177,8 +183,30 @@ struct HtmlTokenMap {
 #define TAG_PARENT   2
 #define TAG_OK       3
 
+/*
+ * The attributes of an element. Structures are allocated by 
+ * HtmlAttributesNew() as a single block and freed with HtmlFree().
+ *
+ * The values of the "id", "class" and "style" attributes are required for
+ * every element by the style engine, so they are cached in the zId,
+ * zClass and zStyle fields when the structure is allocated. The names in
+ * the "class" attribute are stored in azClass[], as split by 
+ * HtmlCssGetNextListItem(). Since setting an attribute replaces the whole
+ * structure (see setNodeAttribute() in htmltree.c), the cached values are
+ * never stale.
+ *
+ * Attribute names are atoms from the HtmlTree.aAtom table when possible,
+ * so HtmlMarkupArg() compares pointers before falling back to strcmp().
+ * The names used by CSS attribute selectors are interned in the same 
+ * table when the stylesheet is parsed (see CssSelector.zAttrAtom).
+ */
 struct HtmlAttributes {
     int nAttr;
+    const char *zId;                   /* Value of "id" attribute or NULL */
+    const char *zClass;                /* Value of "class" attribute or NULL */
+    const char *zStyle;                /* Value of "style" attribute or NULL */
+    int nClass;                        /* Number of entries in azClass[] */
+    const char **azClass;              /* Names from "class" attribute */
     struct HtmlAttribute {
         char *zName;
         char *zValue;
@@ -222,8 +250,11 @@ struct HtmlNodeReplacement {
  * following structure is allocated.
  */
 struct HtmlNodeCmd {
-    Tcl_Obj *pCommand;
+    Tcl_Obj *pCommand;      /* Node handle (name of node command, if any) */
     HtmlTree *pTree;
+    int iHandle;            /* N, from handle name "::tkhtml::nodeN" */
+    int iSlot;              /* Slot used by the handle (see htmltree.c) */
+    int isCommand;          /* True if a Tcl command has been created */
 };
 
 struct HtmlNodeStack {
@@ -301,10 +332,6 @@ struct HtmlNode {
 
     int iSnapshot;                 /* Last changed snapshot */
     HtmlNodeCmd *pNodeCmd;         /* Tcl command for this node */
-
-    /* Cache used for [$widget bbox] */
-    int iBboxX; int iBboxY;
-    int iBboxX2; int iBboxY2;
 };
 
 /* Value of HtmlNode.iNode for orphan and generated nodes. */
@@ -325,6 +352,7 @@ struct HtmlTextNode {
      */
     HtmlTextToken *aToken;
     char *zText;
+    Tcl_Obj *pSource;              /* If not NULL, zText points into this */
 };
 
 /*
@@ -333,6 +361,23 @@ struct HtmlTextNode {
  */
 #define HTML_INLINE_STYLE_ATTR "style"
 
+/*
+ * A summary of the open elements between an element node and the root
+ * of its tree. The tree construction code in htmltree.c uses this to
+ * figure out which elements are closed by a new tag without walking the
+ * chain of ancestors each time. Summaries are built lazily and are
+ * discarded whenever an existing node is moved within a tree (see
+ * function treeScope() in htmltree.c).
+ */
+struct HtmlElementScope {
+    int iGeneration;          /* Valid if equal to HtmlTree.iScopeGeneration */
+    HtmlNode *pParent;        /* Parent node when summary was built */
+    HtmlNode *pTest;          /* Nearest ancestor-or-self with an xClose() */
+    HtmlNode *pBarrier;       /* Nearest ancestor-or-self table element */
+    int iDepth;               /* Number of ancestors */
+    unsigned int aTag[Html_TypeCount / 32 + 1];  /* Tags open up to pBarrier */
+};
+
 /*
  * Structure to store an element (non-text) node.
  */
@@ -359,11 +404,17 @@ struct HtmlElementNode {
     /* Manipulated by the [nodeHandle dynamic] command */
     Html_u8 flags;                         /* HTML_DYNAMIC_XXX flags */
 
+    /* Set by HtmlCallbackRestyleNode() and HtmlCallbackDynamicNode() */
+    Html_u8 eRestyle;                      /* HTML_RESTYLE_XXX value or 0 */
+    Html_u8 eDynamic;                      /* Mask of HTML_RESTYLE_XXX bits */
+
     HtmlNodeReplacement *pReplacement;     /* Replaced object, if any */
     HtmlLayoutCache *pLayoutCache;         /* Cached layout, if any */
     HtmlNodeScrollbars *pScrollbar;        /* Internal scrollbars, if any */
 
     HtmlCanvasItem *pBox;
+
+    HtmlElementScope scope;                /* Used by htmltree.c */
 };
 
 /* Alias for HtmlNodeXXX() methods */
@@ -386,6 +437,7 @@ struct HtmlCanvas {
     int bottom;
     HtmlCanvasItem *pFirst;
     HtmlCanvasItem *pLast;
+    HtmlCanvasIndex *pIndex;     /* Spatial index, or NULL (see htmldraw.c) */
 };
 
 /*
@@ -414,18 +466,27 @@ struct HtmlOptions {
     int      imagecache;
     int      imagepixmapify;
     int      mode;                      /* One of the HTML_MODE_XXX values */
+    int      nodecommands;              /* Create a command per node handle */
     int      shrink;                    /* Boolean */
+    int      stylethreads;              /* Threads used to match selectors */
+    int      textwidthcache;            /* Text widths cached per font */
     double   zoom;                      /* Universal scaling factor. */
 
     int      parsemode;                 /* One of the HTML_PARSEMODE values */
+    int      parsethreads;              /* Threads used to tokenize */
 
     /* Debugging options. Not part of the official interface. */
     int      enablelayout;
     int      layoutcache;
+    int      layoutcachelimit;          /* Approx. bytes of cached layouts */
+    int      layoutcachesize;           /* Cached layouts per element */
     Tcl_Obj *logcmd;
     Tcl_Obj *timercmd;
 };
 
+#define HTML_LAYOUTCACHE_NUSE   7     /* Conditions to use a cached layout */
+#define HTML_LAYOUTCACHE_NSTORE 9     /* Conditions to cache a layout */
+
 #define HTML_MODE_QUIRKS    0
 #define HTML_MODE_ALMOST    1
 #define HTML_MODE_STANDARDS 2
@@ -495,6 +556,16 @@ void HtmlCallbackDynamic(HtmlTree *, HtmlNode *);
 void HtmlCallbackDamage(HtmlTree *, int, int, int, int);
 void HtmlCallbackLayout(HtmlTree *, HtmlNode *);
 void HtmlCallbackRestyle(HtmlTree *, HtmlNode *);
+void HtmlCallbackRestyleNode(HtmlTree *, HtmlNode *, int);
+void HtmlCallbackDynamicNode(HtmlTree *, HtmlNode *, int);
+
+/* Values for the third argument to HtmlCallbackRestyleNode() and
+ * HtmlCallbackDynamicNode(). HTML_RESTYLE_CHILD is only used in the
+ * HtmlElementNode.eDynamic mask, to mark the ancestors of marked nodes.
+ */
+#define HTML_RESTYLE_NODE  1          /* Restyle the node only */
+#define HTML_RESTYLE_TREE  2          /* Restyle the node and descendants */
+#define HTML_RESTYLE_CHILD 4          /* One or more descendants marked */
 
 void HtmlCallbackScrollX(HtmlTree *, int);
 void HtmlCallbackScrollY(HtmlTree *, int);
@@ -515,6 +586,56 @@ struct HtmlTreeState {
     int isCdataInHead;      /* True if previous token was <title> */
 };
 
+/*
+ * Each widget uses an HtmlNodeArena to allocate the fixed-size structures
+ * used for document nodes (HtmlElementNode and HtmlTextNode). Requests
+ * are rounded up to a multiple of HTML_ARENA_ALIGN bytes, and each
+ * distinct rounded size is a "size class". Memory is carved from large
+ * blocks of HTML_ARENA_BLOCK bytes. Freed slots are linked into a free-list
+ * for their size class and reused by the next allocation of the same size.
+ * When the number of outstanding allocations drops to zero (i.e. after
+ * HtmlTreeClear()), all blocks are returned to the heap.
+ *
+ * Each block counts the outstanding allocations carved from it. If a
+ * quarter or more of the blocks become unused while the document is still
+ * alive (for example after a large sub-tree is removed), the slots in the
+ * unused blocks are unlinked from the free-lists and the blocks returned
+ * to the heap too. See functions:
+ *
+ *     HtmlNodeArenaAlloc()
+ *     HtmlNodeArenaFree()
+ *     HtmlNodeArenaRelease()
+ */
+#define HTML_ARENA_ALIGN   8
+#define HTML_ARENA_NCLASS  64          /* Largest size class is 512 bytes */
+#define HTML_ARENA_BLOCK   65536
+
+struct HtmlNodeArenaBlock {
+    int nLive;                         /* Outstanding allocations in block */
+    double dAlign;                     /* Force alignment of following data */
+};
+
+struct HtmlNodeArenaClass {
+    const char *zTopic;     /* Topic passed to first allocation of this size */
+    void *pFree;            /* Linked list of free slots */
+    int nFree;              /* Number of slots in pFree list */
+    int nLive;              /* Number of outstanding allocations */
+};
+
+struct HtmlNodeArena {
+    HtmlNodeArenaBlock *pBlock;        /* Block new slots are carved from */
+    int iUsed;                         /* Bytes of pBlock already allocated */
+    HtmlNodeArenaBlock **apBlock;      /* All blocks, sorted by address */
+    int nBlock;                        /* Number of entries in apBlock[] */
+    int nBlockAlloc;                   /* Allocated size of apBlock[] */
+    int nUnused;                       /* Blocks except pBlock with nLive==0 */
+    int nLive;                         /* Outstanding allocations (all sizes) */
+    HtmlNodeArenaClass aClass[HTML_ARENA_NCLASS];
+};
+
+#define HtmlArenaNew(pTree, x) \
+    ((x *)HtmlNodeArenaAlloc(pTree, #x, sizeof(x)))
+
 struct HtmlTree {
 
     /*
@@ -554,8 +675,15 @@ struct HtmlTree {
      * entirely of 7-bit ASCII, then they are equal. The nCharParsed variable
      * is required so that the offsets passed to parse-handler callbacks
      * are in characters, not bytes. TODO! See ticket #126.
+     *
+     * Text that has been tokenized is discarded from the start of 
+     * pDocument as parsing proceeds (see HtmlTokenizerAppend()). 
+     * iDocumentOffset is the offset of the first byte of pDocument within
+     * the document as a whole. nParsed and iWriteInsert are offsets within
+     * pDocument.
      */
-    Tcl_Obj *pDocument;             /* Text of the html document */
+    Tcl_Obj *pDocument;             /* Unparsed text of the html document */
+    int iDocumentOffset;            /* Document offset of pDocument[0] */
     int nParsed;                    /* Bytes of pDocument tokenized */
     int nCharParsed;                /* TODO: Characters parsed */
 
@@ -568,6 +696,7 @@ struct HtmlTree {
     HtmlNode *pRoot;                /* The root-node of the document. */
 
     Tcl_HashTable aAtom;            /* String atoms for this widget */
+    int isParseWorker;              /* True for parallel tokenizer chunks */
 
     HtmlTreeState state;
 
@@ -608,6 +737,20 @@ struct HtmlTree {
 
     /* Used by code in HtmlStyleApply() */
     void *pStyleApply;
+    int nStyleShareHit;             /* Nodes styled using the share cache */
+    int nStyleShareMiss;            /* Nodes styled using the cascade */
+
+    /* Layout cache accounting and statistics. The aLayoutCacheUse[] and
+     * aLayoutCacheStore[] counters are described in htmllayout.c. They
+     * are reported (and reset) by the [$html _layoutcache] command.
+     */
+    int nLayoutCacheByte;           /* Approx. bytes used by cached layouts */
+    int nLayoutCacheEntry;          /* Number of cached layouts */
+    int nLayoutCacheEvict;          /* Cached layouts discarded to make room */
+    struct LayoutCache *pLayoutCacheMru;    /* Most recently used layout */
+    struct LayoutCache *pLayoutCacheLru;    /* Least recently used layout */
+    int aLayoutCacheUse[HTML_LAYOUTCACHE_NUSE + 1];
+    int aLayoutCacheStore[HTML_LAYOUTCACHE_NSTORE + 1];
 
     HtmlOptions options;            /* Configurable options */
     Tk_OptionTable optionTable;     /* Option table */
@@ -652,11 +795,15 @@ struct HtmlTree {
      */
     int isSequenceOk;    
     int iNextNode;       /* Next node index to allocate */
+    int iScopeGeneration;  /* Incremented when a node is moved */
 
-    /* True if the HtmlElementNode.iBboxX and HtmlElementNode.iBboxY values
-     * for all elements in the tree are valid.
+    /* Incremented each time a node is added, moved or deleted, or an
+     * attribute or dynamic flag of a node is modified. See HtmlCssPrematch()
+     * and indexCanvasContent() in htmldraw.c.
      */
-    int isBboxOk;
+    int iDocumentGeneration;
+
+    HtmlNodeArena arena;            /* Allocator for document nodes */
 
     HtmlCallback cb;                /* See structure definition comments */
     int iLastSnapshotId;            /* Last snapshot id allocated */
@@ -695,7 +842,12 @@ void HtmlFinishNodeHandlers(HtmlTree *);
 
 Tcl_ObjCmdProc HtmlTreeCollapseWhitespace;
 Tcl_ObjCmdProc HtmlStyleSyntaxErrs;
+Tcl_ObjCmdProc HtmlStyleStats;
+Tcl_ObjCmdProc HtmlTokenizeCmd;
+Tcl_ObjCmdProc HtmlNodeArenaStats;
+Tcl_ObjCmdProc HtmlNodeHandleCmd;
 Tcl_ObjCmdProc HtmlLayoutSize;
+Tcl_ObjCmdProc HtmlLayoutCacheStats;
 Tcl_ObjCmdProc HtmlLayoutNode;
 Tcl_ObjCmdProc HtmlLayoutImage;
 Tcl_ObjCmdProc HtmlLayoutPrimitives;
@@ -745,20 +897,28 @@ char *      HtmlNodeToString(HtmlNode *);
 HtmlNode *  HtmlNodeGetPointer(HtmlTree *, char CONST *);
 int         HtmlNodeIsOrphan(HtmlNode *);
 
-int HtmlNodeAddChild(HtmlElementNode *, int, const char *, HtmlAttributes *);
+int HtmlNodeAddChild(
+    HtmlTree *, HtmlElementNode *, int, const char *, HtmlAttributes *
+);
 int HtmlNodeAddTextChild(HtmlNode *, HtmlTextNode *);
 
 Html_u8     HtmlNodeTagType(HtmlNode *);
 
+void *HtmlNodeArenaAlloc(HtmlTree *, const char *, int);
+void HtmlNodeArenaFree(HtmlTree *, void *, int);
+void HtmlNodeArenaRelease(HtmlTree *);
+
 Tcl_Obj *HtmlNodeCommand(HtmlTree *, HtmlNode *pNode);
 int HtmlNodeDeleteCommand(HtmlTree *, HtmlNode *pNode);
 
 void HtmlDrawCleanup(HtmlTree *, HtmlCanvas *);
+void HtmlDrawIndexCanvas(HtmlTree *);
 void HtmlDrawDeleteControls(HtmlTree *, HtmlCanvas *);
 
 void HtmlDrawCanvas(HtmlCanvas*,HtmlCanvas*,int,int,HtmlNode*);
 void HtmlDrawText(HtmlCanvas*,const char*,int,int,int,int,int,HtmlNode*,int);
 void HtmlDrawTextExtend(HtmlCanvas*, int, int);
+int HtmlDrawTextSpaceFollows(HtmlCanvas*);
 int HtmlDrawTextLength(HtmlCanvas*);
 
 #define CANVAS_BOX_OPEN_LEFT    0x01      /* Open left-border */
@@ -775,6 +935,8 @@ int  HtmlDrawIsEmpty(HtmlCanvas *);
 void HtmlDrawImage(HtmlCanvas*, HtmlImage2*, int, int, int, int, HtmlNode*, int);
 void HtmlDrawOrigin(HtmlCanvas*);
 void HtmlDrawCopyCanvas(HtmlCanvas*, HtmlCanvas*);
+int HtmlDrawCanvasIsShared(HtmlCanvas*);
+int HtmlDrawCanvasSize(HtmlCanvas*);
 
 void HtmlDrawOverflow(HtmlCanvas*, HtmlNode*, int, int);
 
@@ -817,6 +979,7 @@ void HtmlAttributesToPropertyCache(HtmlNode *pNode);
 
 Tcl_HashKeyType * HtmlCaseInsenstiveHashType();
 Tcl_HashKeyType * HtmlFontKeyHashType();
+Tcl_HashKeyType * HtmlTextKeyHashType();
 Tcl_HashKeyType * HtmlComputedValuesHashType();
 
 CONST char *HtmlDefaultTcl();
@@ -855,7 +1018,7 @@ int HtmlNodeClearStyle(HtmlTree *, HtmlElementNode *);
 int HtmlNodeClearGenerated(HtmlTree *, HtmlElementNode *);
 void HtmlNodeClearRecursive(HtmlTree *, HtmlNode *);
 
-void HtmlTranslateEscapes(char *);
+void HtmlTranslateEscapes(char *, int);
 void HtmlRestackNodes(HtmlTree *pTree);
 void HtmlDelStackingInfo(HtmlTree *, HtmlElementNode *);
 
@@ -880,9 +1043,11 @@ int HtmlNodeScrollbarDoCallback(HtmlTree *, HtmlNode *);
 
 void HtmlDelScrollbars(HtmlTree *, HtmlNode *);
 
-HtmlAttributes * HtmlAttributesNew(int, char const **, int *, int);
+HtmlAttributes * HtmlAttributesNew(HtmlTree*,int,char const **,int *,int);
+void HtmlAttributesIntern(HtmlTree*, HtmlAttributes*);
 
 void HtmlParseFragment(HtmlTree *, const char *);
+int HtmlTreeBuild(HtmlTree *, Tcl_Obj *);
 void HtmlSequenceNodes(HtmlTree *);
 
 void HtmlFontReference(HtmlFont *);
@@ -925,9 +1090,9 @@ HtmlTokenMap * HtmlHashLookup(void *, const char *zType);
 /*
  * Creation, modification and deletion of HtmlTextNode objects.
  */
-HtmlTextNode * HtmlTextNew(int, const char *, int, int);
+HtmlTextNode * HtmlTextNew(HtmlTree *, Tcl_Obj *, int, const char *, int, int);
 void           HtmlTextSet(HtmlTextNode *, int, const char *, int, int);
-void           HtmlTextFree(HtmlTextNode *);
+void           HtmlTextFree(HtmlTree *, HtmlTextNode *);
 
 /* The details of this structure should be considered private to
  * htmltext.c. They are here because other code needs to know the
@@ -368,10 +368,10 @@ static int pixmapQueryCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 static int sorterCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 static int layoutNodeIndexCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 static int paintNodesSearchCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
-static int scrollToNodeCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
-static int layoutBboxCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 static int layoutNodeCb(HtmlCanvasItem *, int, int, Overflow *, ClientData);
 
+static void freeCanvasIndex(HtmlCanvas *);
+
 /*
  * This is like a big expensive assert() statement that checks the
  * internal state of the HtmlCanvas structure passed as an argument
@@ -796,6 +796,7 @@ CHECK_CANVAS(pCanvas);
     if (pPrev) {
         freeCanvasItem(pTree, pPrev);
     }
+    freeCanvasIndex(pCanvas);
     memset(pCanvas, 0, sizeof(HtmlCanvas));
 }
 
@@ -999,6 +1000,7 @@ CHECK_CANVAS(pFrom);
     assert(pTo->pLast == 0);
 
     memcpy(pTo, pFrom, sizeof(HtmlCanvas));
+    pTo->pIndex = 0;
 
     if (pTo->pFirst) {
         assert(pTo->pFirst->x.o.nRef == 1);
@@ -1014,6 +1016,73 @@ CHECK_CANVAS(pTo);
 CHECK_CANVAS(pFrom);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawCanvasIsShared --
+ *
+ *     Canvas pCanvas must have been populated by HtmlDrawCopyCanvas(), 
+ *     i.e. it is a display list stored in a layout cache. Return true if
+ *     the display list is currently also linked into another canvas.
+ *
+ * Results:
+ *     Boolean.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlDrawCanvasIsShared(pCanvas)
+    HtmlCanvas *pCanvas;
+{
+    HtmlCanvasItem *pFirst = pCanvas->pFirst;
+    assert(!pFirst || pFirst->type == CANVAS_ORIGIN);
+    return (pFirst && pFirst->x.o.nRef > 1);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawCanvasSize --
+ *
+ *     Return the approximate number of bytes of memory used by the 
+ *     primitives in the display list of pCanvas. Primitives that belong
+ *     to nested display lists created by HtmlDrawOrigin() (i.e. the 
+ *     cached layouts of descendant nodes) are not counted, as they are
+ *     accounted for separately.
+ *
+ * Results:
+ *     Number of bytes.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlDrawCanvasSize(pCanvas)
+    HtmlCanvas *pCanvas;
+{
+    HtmlCanvasItem *pItem;
+    int nItem = 0;
+
+    for (pItem = pCanvas->pFirst; pItem; pItem = pItem->pNext) {
+        if (
+            pItem != pCanvas->pFirst && 
+            pItem->type == CANVAS_ORIGIN && pItem->x.o.pSkip
+        ) {
+            pItem = pItem->x.o.pSkip;
+        } else {
+            nItem++;
+        }
+        if (pItem == pCanvas->pLast) break;
+    }
+
+    return nItem * sizeof(HtmlCanvasItem);
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1202,8 +1271,12 @@ HtmlDrawBox(pCanvas, x, y, w, h, pNode, flags, size_only, pCandidate)
         HtmlCanvasItem *pItem; 
         HtmlComputedValues *pComputed = HtmlNodeComputedValues(pNode);
         
+        /* The candidate item may only be reused if it is not currently
+         * linked into a display list. This is not the case if it is still
+         * part of a layout cached for some other containing block width.
+         */
         if (
-            pCandidate && 
+            pCandidate && pCandidate->nRef == 1 &&
             pCandidate->x.box.w == w && pCandidate->x.box.h == h &&
             pCandidate->x.box.flags == flags &&
             pCandidate->x.box.pComputed == pComputed
@@ -1351,6 +1424,22 @@ HtmlDrawTextLength(pCanvas)
     return pCanvas->pLast->x.t.nText;
 }
 
+/*
+ * Return true if the byte following the text of the last item in pCanvas
+ * is a space character. If the text refers to the document text, words
+ * may be separated by other white-space (see HtmlTextNode.zText), so
+ * the item can only be extended over the separator if this is true.
+ */
+int
+HtmlDrawTextSpaceFollows(pCanvas)
+    HtmlCanvas *pCanvas;
+{
+    CanvasText *pT;
+    assert(pCanvas && pCanvas->pLast && pCanvas->pLast->type == CANVAS_TEXT);
+    pT = &pCanvas->pLast->x.t;
+    return (pT->iIndex >= 0 && pT->zText[pT->nText] == ' ');
+}
+
 void 
 HtmlDrawImage(
         pCanvas, pImage, 
@@ -2427,12 +2516,12 @@ drawText(pQuery, pItem, drawable, x, y)
     
             nSel = iSelTo - iSelFrom;
             if (iSelFrom > 0) {
-                xs += Tk_TextWidth(font, z, iSelFrom);
+                xs += HtmlFontTextWidth(pTree, pFont, z, iSelFrom);
             }
             if (eContinue) {
                 w = pT->w + x - xs;
             } else {
-                w = Tk_TextWidth(font, zSel, nSel);
+                w = HtmlFontTextWidth(pTree, pFont, zSel, nSel);
             }
     
             h = pFont->metrics.ascent + pFont->metrics.descent;
@@ -2459,6 +2548,619 @@ drawText(pQuery, pItem, drawable, x, y)
 }
 
 
+/*
+ * The following structures are used to maintain a spatial index over
+ * the primitives in the widget canvas (HtmlTree.canvas), so that
+ * searchCanvas() calls that specify a y-coordinate range do not have to
+ * iterate through the entire display list.
+ *
+ * Each primitive is represented by a CanvasIndexEntry, storing the
+ * absolute origin it is drawn relative to and its position in the display
+ * list (iSeq). Entries with a fixed vertical extent are stored in
+ * HtmlCanvasIndex.aEntry, sorted by the top of their bounding box. The
+ * array is treated as an implicit balanced binary tree (the root of the
+ * sub-array aEntry[iLo..iHi-1] is entry (iLo+iHi)/2), and aMaxEnd[i] is
+ * the largest bottom coordinate in the subtree rooted at entry i. This
+ * makes it an interval tree - a query visits O(log n + k) entries.
+ *
+ * Primitives with a vertical extent that can change without the
+ * canvas being rebuilt are stored in HtmlCanvasIndex.aLinear and tested
+ * individually by each query. This includes:
+ *
+ *     * Primitives in the "position:fixed" section of the canvas (after
+ *       the MARKER_FIXED marker), which move with the viewport.
+ *     * CANVAS_WINDOW primitives, which are sized using the requested
+ *       size of the replaced window.
+ *
+ * Primitives whose innermost overflow region is scrollable are stored
+ * in HtmlCanvasIndex.aScroll, as searchCanvas() shifts the query range
+ * by the current scroll offset of the region. The array is sorted by 
+ * region, then by the top of the bounding box. The entries for each
+ * region (CanvasIndexOverflow.iScroll to iScroll+nScroll-1) form an
+ * interval tree of their own, in the same way as aEntry[], that is
+ * searched with the query range adjusted for that region.
+ *
+ * HtmlCanvasIndex.aOverflow stores the absolute origin of each
+ * CANVAS_OVERFLOW item, so that the associated Overflow structures can be
+ * populated for a query without walking the display list.
+ *
+ * The first time the geometry of a specific node is requested (by
+ * [widget bbox], HtmlWidgetNodeBox() or HtmlWidgetNodeTop()), a table
+ * mapping from node to a CanvasNodeEntry is built by indexCanvasNodes().
+ * It is discarded along with the rest of the index when the canvas
+ * changes.
+ *
+ * HtmlWidgetNodeTop() may need the nearest node that precedes a node in
+ * document order and generates content. For this, HtmlCanvasIndex.aContent
+ * lists the nodes that generate content sorted by node number. It is
+ * built by indexCanvasContent() the first time it is required, and
+ * rebuilt only if the document tree has since been modified (as nodes
+ * may have been renumbered by HtmlSequenceNodes()).
+ */
+typedef struct CanvasIndexEntry CanvasIndexEntry;
+typedef struct CanvasIndexOverflow CanvasIndexOverflow;
+typedef struct CanvasNodeEntry CanvasNodeEntry;
+typedef struct CanvasContentEntry CanvasContentEntry;
+
+struct CanvasIndexEntry {
+    HtmlCanvasItem *pItem;
+    int iSeq;                /* Position of pItem in the display list */
+    int x;                   /* Origin to draw pItem relative to */
+    int y;
+    int y1;                  /* Vertical extent of bounding box: [y1, y2) */
+    int y2;
+    int iOverflow;           /* Index in aOverflow[] of region, or -1 */
+    int isFixed;             /* True if in the "position:fixed" section */
+};
+
+struct CanvasIndexOverflow {
+    HtmlCanvasItem *pItem;   /* CANVAS_OVERFLOW item */
+    int x;                   /* Origin of pItem */
+    int y;
+    int isFixed;             /* True if in the "position:fixed" section */
+    int iScroll;             /* First entry for region in aScroll[] */
+    int nScroll;             /* Number of entries for region in aScroll[] */
+};
+
+/*
+ * Geometry of the content generated by a single node. Coordinates in
+ * the "position:fixed" section of the canvas (isFixed) are relative to
+ * the viewport.
+ *
+ *   iBboxX, iBboxY, iBboxX2, iBboxY2:
+ *     Bounding box of the CANVAS_BOX and CANVAS_TEXT primitives generated 
+ *     by the node. Returned by [widget bbox]. Valid if isBbox is true.
+ *
+ *   iBoxY, iLastY:
+ *     Top of the first CANVAS_BOX primitive generated by the node (valid 
+ *     if isBox is true), and of the last primitive of any type generated
+ *     by the node (valid if isContent is true). Used by
+ *     HtmlWidgetNodeTop().
+ *
+ *   left, top, right, bottom:
+ *     Bounding box of the primitives generated by the node and all of its
+ *     descendants, where the content of an overflow region is represented
+ *     by the region itself. Used by HtmlWidgetNodeBox().
+ */
+struct CanvasNodeEntry {
+    int isFixed;
+    int isBbox;
+    int iBboxX; int iBboxY;
+    int iBboxX2; int iBboxY2;
+    int isBox;
+    int isContent;
+    int iBoxY;
+    int iLastY;
+    int left; int top;
+    int right; int bottom;
+};
+
+struct CanvasContentEntry {
+    int iNode;               /* HtmlNode.iNode of node */
+    int iEntry;              /* Index of node in aNodeEntry[] */
+};
+
+struct HtmlCanvasIndex {
+    HtmlCanvasItem *pFirst;  /* Display list this index was built from */
+    HtmlCanvasItem *pLast;
+
+    int nEntry;
+    CanvasIndexEntry *aEntry;         /* Entries sorted by y1 */
+    int *aMaxEnd;                     /* Interval tree augmentation */
+
+    int nLinear;
+    CanvasIndexEntry *aLinear;        /* Entries tested by every query */
+
+    int nScroll;
+    CanvasIndexEntry *aScroll;        /* Entries in scrollable regions */
+    int *aScrollMaxEnd;               /* Interval tree augmentation */
+
+    int nOverflow;
+    CanvasIndexOverflow *aOverflow;   /* CANVAS_OVERFLOW items */
+
+    int isNodeOk;                     /* True once aNode is populated */
+    Tcl_HashTable aNode;              /* Map from HtmlNode* to aNodeEntry[] */
+    int nNodeEntry;
+    int nNodeEntryAlloc;
+    CanvasNodeEntry *aNodeEntry;
+
+    int isContentOk;                  /* True once aContent is populated */
+    int iContentGeneration;           /* HtmlTree.iDocumentGeneration */
+    int nContent;
+    CanvasContentEntry *aContent;     /* Sorted by CanvasContentEntry.iNode */
+};
+
+static void
+freeCanvasIndex(pCanvas)
+    HtmlCanvas *pCanvas;
+{
+    HtmlCanvasIndex *pIndex = pCanvas->pIndex;
+    if (pIndex) {
+        HtmlFree(pIndex->aEntry);
+        HtmlFree(pIndex->aMaxEnd);
+        HtmlFree(pIndex->aLinear);
+        HtmlFree(pIndex->aScroll);
+        HtmlFree(pIndex->aScrollMaxEnd);
+        HtmlFree(pIndex->aOverflow);
+        if (pIndex->isNodeOk) {
+            Tcl_DeleteHashTable(&pIndex->aNode);
+            HtmlFree(pIndex->aNodeEntry);
+        }
+        HtmlFree(pIndex->aContent);
+        HtmlFree(pIndex);
+        pCanvas->pIndex = 0;
+    }
+}
+
+static int
+indexEntryCompare(pVoidLeft, pVoidRight)
+    const void *pVoidLeft;
+    const void *pVoidRight;
+{
+    CanvasIndexEntry *pLeft = (CanvasIndexEntry *)pVoidLeft;
+    CanvasIndexEntry *pRight = (CanvasIndexEntry *)pVoidRight;
+    if (pLeft->y1 != pRight->y1) {
+        return (pLeft->y1 < pRight->y1) ? -1 : 1;
+    }
+    return pLeft->iSeq - pRight->iSeq;
+}
+
+static int
+indexScrollCompare(pVoidLeft, pVoidRight)
+    const void *pVoidLeft;
+    const void *pVoidRight;
+{
+    CanvasIndexEntry *pLeft = (CanvasIndexEntry *)pVoidLeft;
+    CanvasIndexEntry *pRight = (CanvasIndexEntry *)pVoidRight;
+    if (pLeft->iOverflow != pRight->iOverflow) {
+        return pLeft->iOverflow - pRight->iOverflow;
+    }
+    return indexEntryCompare(pVoidLeft, pVoidRight);
+}
+
+static int
+indexMatchCompare(pVoidLeft, pVoidRight)
+    const void *pVoidLeft;
+    const void *pVoidRight;
+{
+    CanvasIndexEntry *pLeft = *(CanvasIndexEntry **)pVoidLeft;
+    CanvasIndexEntry *pRight = *(CanvasIndexEntry **)pVoidRight;
+    return pLeft->iSeq - pRight->iSeq;
+}
+
+/*
+ * Populate aMaxEnd[] (HtmlCanvasIndex.aMaxEnd or aScrollMaxEnd) for the 
+ * implicit subtree made up of entries iLo to (iHi-1) of aEntry[]. Return 
+ * the largest y2 value in the subtree.
+ */
+static int
+indexMaxEnd(aEntry, aMaxEnd, iLo, iHi)
+    CanvasIndexEntry *aEntry;
+    int *aMaxEnd;
+    int iLo;
+    int iHi;
+{
+    int iMid;
+    int iMax;
+    if (iLo >= iHi) return INT_MIN;
+    iMid = (iLo + iHi) / 2;
+    iMax = aEntry[iMid].y2;
+    iMax = MAX(iMax, indexMaxEnd(aEntry, aMaxEnd, iLo, iMid));
+    iMax = MAX(iMax, indexMaxEnd(aEntry, aMaxEnd, iMid + 1, iHi));
+    aMaxEnd[iMid] = iMax;
+    return iMax;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlDrawIndexCanvas --
+ *
+ *     Build the spatial index used by searchCanvas() for the widget
+ *     canvas, if it is not already up to date. This is called at the end
+ *     of HtmlLayout(), and is also invoked lazily by searchCanvas().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May allocate HtmlTree.canvas.pIndex.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlDrawIndexCanvas(pTree)
+    HtmlTree *pTree;
+{
+    HtmlCanvas *pCanvas = &pTree->canvas;
+    HtmlCanvasIndex *pIndex = pCanvas->pIndex;
+    HtmlCanvasItem *pItem;
+
+    int origin_x = 0;
+    int origin_y = 0;
+    int isFixed = 0;
+    int iSeq = 0;
+
+    int nEntryAlloc = 0;
+    int nLinearAlloc = 0;
+    int nScrollAlloc = 0;
+    int nOverflowAlloc = 0;
+    int ii;
+
+    /* The overflow stack. Grown using HtmlRealloc(). */
+    int *aiStack = 0;
+    int nStack = 0;
+    int iStack = -1;
+
+    if (pIndex) {
+        if (pIndex->pFirst == pCanvas->pFirst && 
+            pIndex->pLast == pCanvas->pLast
+        ) {
+            return;
+        }
+        freeCanvasIndex(pCanvas);
+    }
+
+    pIndex = HtmlNew(HtmlCanvasIndex);
+    pIndex->pFirst = pCanvas->pFirst;
+    pIndex->pLast = pCanvas->pLast;
+
+    for (pItem = pCanvas->pFirst; pItem; pItem = pItem->pNext) {
+        iSeq++;
+        switch (pItem->type) {
+            case CANVAS_ORIGIN:
+                origin_x += pItem->x.o.x;
+                origin_y += pItem->x.o.y;
+                break;
+
+            case CANVAS_MARKER:
+                if (pItem->x.marker.flags == MARKER_FIXED) {
+                    assert(isFixed == 0);
+                    assert(origin_x == 0 && origin_y == 0);
+                    isFixed = 1;
+                }
+                break;
+
+            case CANVAS_OVERFLOW: {
+                CanvasIndexOverflow *pOverflow;
+                if (pIndex->nOverflow == nOverflowAlloc) {
+                    nOverflowAlloc = nOverflowAlloc * 2 + 8;
+                    pIndex->aOverflow = (CanvasIndexOverflow *)HtmlRealloc(0,
+                        pIndex->aOverflow,
+                        nOverflowAlloc * sizeof(CanvasIndexOverflow)
+                    );
+                }
+                pOverflow = &pIndex->aOverflow[pIndex->nOverflow];
+                pOverflow->pItem = pItem;
+                pOverflow->x = origin_x;
+                pOverflow->y = origin_y;
+                pOverflow->isFixed = isFixed;
+                pOverflow->iScroll = 0;
+                pOverflow->nScroll = 0;
+
+                iStack++;
+                if (iStack == nStack) {
+                    nStack++;
+                    aiStack = (int *)HtmlRealloc(0, aiStack, nStack*sizeof(int));
+                }
+                aiStack[iStack] = pIndex->nOverflow++;
+                break;
+            }
+
+            default: {
+                CanvasIndexEntry *pEntry;
+                int isLinear = (isFixed || pItem->type == CANVAS_WINDOW);
+                int isScroll = 0;
+                int x, y, w, h;
+
+                if (!isLinear && iStack >= 0) {
+                    int i = aiStack[iStack];
+                    HtmlNode *pNode = pIndex->aOverflow[i].pItem->x.overflow.pNode;
+                    assert(!HtmlNodeIsText(pNode));
+                    isScroll = (((HtmlElementNode *)pNode)->pScrollbar != 0);
+                }
+
+                if (isScroll) {
+                    if (pIndex->nScroll == nScrollAlloc) {
+                        nScrollAlloc = nScrollAlloc * 2 + 64;
+                        pIndex->aScroll = (CanvasIndexEntry *)HtmlRealloc(0,
+                            pIndex->aScroll,
+                            nScrollAlloc * sizeof(CanvasIndexEntry)
+                        );
+                    }
+                    pEntry = &pIndex->aScroll[pIndex->nScroll++];
+                } else if (isLinear) {
+                    if (pIndex->nLinear == nLinearAlloc) {
+                        nLinearAlloc = nLinearAlloc * 2 + 8;
+                        pIndex->aLinear = (CanvasIndexEntry *)HtmlRealloc(0,
+                            pIndex->aLinear,
+                            nLinearAlloc * sizeof(CanvasIndexEntry)
+                        );
+                    }
+                    pEntry = &pIndex->aLinear[pIndex->nLinear++];
+                } else {
+                    if (pIndex->nEntry == nEntryAlloc) {
+                        nEntryAlloc = nEntryAlloc * 2 + 64;
+                        pIndex->aEntry = (CanvasIndexEntry *)HtmlRealloc(0,
+                            pIndex->aEntry,
+                            nEntryAlloc * sizeof(CanvasIndexEntry)
+                        );
+                    }
+                    pEntry = &pIndex->aEntry[pIndex->nEntry++];
+                }
+
+                itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
+                pEntry->pItem = pItem;
+                pEntry->iSeq = iSeq;
+                pEntry->x = origin_x;
+                pEntry->y = origin_y;
+                pEntry->y1 = y;
+                pEntry->y2 = y + h;
+                pEntry->iOverflow = (iStack >= 0) ? aiStack[iStack] : -1;
+                pEntry->isFixed = isFixed;
+                break;
+            }
+        }
+
+        /* Check if we are supposed to pop the overflow stack */
+        while (iStack >= 0 && 
+            pItem == pIndex->aOverflow[aiStack[iStack]].pItem->x.overflow.pEnd
+        ) {
+            iStack--;
+        }
+    }
+    HtmlFree(aiStack);
+
+    if (pIndex->nEntry > 0) {
+        qsort(pIndex->aEntry, pIndex->nEntry, sizeof(CanvasIndexEntry), 
+            indexEntryCompare
+        );
+        pIndex->aMaxEnd = (int *)HtmlAlloc(0, pIndex->nEntry * sizeof(int));
+        indexMaxEnd(pIndex->aEntry, pIndex->aMaxEnd, 0, pIndex->nEntry);
+    }
+
+    /* Sort the entries for scrollable regions by region and then by y1,
+     * and build an interval tree for the entries of each region.
+     */
+    if (pIndex->nScroll > 0) {
+        qsort(pIndex->aScroll, pIndex->nScroll, sizeof(CanvasIndexEntry), 
+            indexScrollCompare
+        );
+        pIndex->aScrollMaxEnd = (int *)HtmlAlloc(0, 
+            pIndex->nScroll * sizeof(int)
+        );
+        for (ii = 0; ii < pIndex->nScroll; ii++) {
+            CanvasIndexOverflow *pOverflow;
+            pOverflow = &pIndex->aOverflow[pIndex->aScroll[ii].iOverflow];
+            if (pOverflow->nScroll == 0) {
+                pOverflow->iScroll = ii;
+            }
+            pOverflow->nScroll++;
+        }
+        for (ii = 0; ii < pIndex->nOverflow; ii++) {
+            CanvasIndexOverflow *pOverflow = &pIndex->aOverflow[ii];
+            indexMaxEnd(pIndex->aScroll, pIndex->aScrollMaxEnd, 
+                pOverflow->iScroll, pOverflow->iScroll + pOverflow->nScroll
+            );
+        }
+    }
+
+    pCanvas->pIndex = pIndex;
+}
+
+/*
+ * Context object used by indexQuery() to accumulate the set of index
+ * entries that intersect the query range.
+ */
+typedef struct CanvasIndexQuery CanvasIndexQuery;
+struct CanvasIndexQuery {
+    CanvasIndexEntry *aEntry;     /* Interval tree entries to search */
+    int *aMaxEnd;                 /* Interval tree augmentation */
+    int ymin;                     /* Query range: [ymin, ymax) */
+    int ymax;
+    int nMatch;
+    int nMatchAlloc;
+    CanvasIndexEntry **apMatch;
+};
+
+static void
+indexQueryAdd(pQuery, pEntry)
+    CanvasIndexQuery *pQuery;
+    CanvasIndexEntry *pEntry;
+{
+    if (pQuery->nMatch == pQuery->nMatchAlloc) {
+        pQuery->nMatchAlloc = pQuery->nMatchAlloc * 2 + 32;
+        pQuery->apMatch = (CanvasIndexEntry **)HtmlRealloc(0, pQuery->apMatch,
+            pQuery->nMatchAlloc * sizeof(CanvasIndexEntry *)
+        );
+    }
+    pQuery->apMatch[pQuery->nMatch++] = pEntry;
+}
+
+static void
+indexQuery(pQuery, iLo, iHi)
+    CanvasIndexQuery *pQuery;
+    int iLo;
+    int iHi;
+{
+    while (iLo < iHi) {
+        int iMid = (iLo + iHi) / 2;
+        CanvasIndexEntry *pEntry = &pQuery->aEntry[iMid];
+
+        /* If no entry in this subtree extends below ymin, there is 
+         * nothing to find here. 
+         */
+        if (pQuery->aMaxEnd[iMid] <= pQuery->ymin) return;
+
+        indexQuery(pQuery, iLo, iMid);
+        if (pEntry->y1 >= pQuery->ymax) return;
+        if (pEntry->y2 > pQuery->ymin) {
+            indexQueryAdd(pQuery, pEntry);
+        }
+        iLo = iMid + 1;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * searchCanvasIndex --
+ *
+ *     This function is used by searchCanvas() to handle queries that 
+ *     specify a y-coordinate range, using the spatial index described
+ *     above. The callback is invoked for the same set of primitives, in
+ *     the same order, as for a linear walk of the display list.
+ *
+ * Results:
+ *     Zero, or the first non-zero value returned by xFunc.
+ *
+ * Side effects:
+ *     May build the canvas index.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+searchCanvasIndex(pTree, ymin, ymax, xFunc, clientData, requireOverflow)
+    HtmlTree *pTree;
+    int ymin;                    /* Minimum y coordinate, or -1 */
+    int ymax;                    /* Maximum y coordinate, or -1 */
+    int (*xFunc)(HtmlCanvasItem *, int, int, Overflow *, ClientData);
+    ClientData clientData;
+    int requireOverflow;         /* Boolean. True to pass Overflow* arg */
+{
+    HtmlCanvasIndex *pIndex;
+    CanvasIndexQuery sQuery;
+    int rc = 0;
+    int ii;
+
+    HtmlDrawIndexCanvas(pTree);
+    pIndex = pTree->canvas.pIndex;
+
+    memset(&sQuery, 0, sizeof(CanvasIndexQuery));
+    sQuery.aEntry = pIndex->aEntry;
+    sQuery.aMaxEnd = pIndex->aMaxEnd;
+    sQuery.ymin = (ymin >= 0) ? ymin : INT_MIN;
+    sQuery.ymax = (ymax >= 0) ? ymax : INT_MAX;
+
+    /* Initialize the Overflow structure associated with each 
+     * CANVAS_OVERFLOW item, as searchCanvas() does during a linear walk.
+     */
+    if (requireOverflow) {
+        for (ii = 0; ii < pIndex->nOverflow; ii++) {
+            CanvasIndexOverflow *p = &pIndex->aOverflow[ii];
+            HtmlCanvasItem *pItem = p->pItem;
+            Overflow *pOverflow = (Overflow *)&pItem[1];
+            HtmlElementNode *pElem = (HtmlElementNode *)pItem->x.overflow.pNode;
+            int origin_x = p->x;
+            int origin_y = p->y;
+
+            if (p->isFixed) {
+                origin_x += pTree->iScrollX;
+                origin_y += pTree->iScrollY;
+            }
+            pOverflow->pItem = &pItem->x.overflow;
+            pOverflow->x = pItem->x.overflow.x + origin_x;
+            pOverflow->y = pItem->x.overflow.y + origin_y;
+            pOverflow->w = pItem->x.overflow.w;
+            pOverflow->h = pItem->x.overflow.h;
+            pOverflow->pixmap = 0;
+            pOverflow->pNext = 0;
+            pOverflow->xscroll = 0;
+            pOverflow->yscroll = 0;
+            if (pElem->pScrollbar) {
+                pOverflow->xscroll = pElem->pScrollbar->iHorizontal;
+                pOverflow->yscroll = pElem->pScrollbar->iVertical;
+            }
+        }
+    }
+
+    indexQuery(&sQuery, 0, pIndex->nEntry);
+
+    /* Search the interval tree for each scrollable region. The query
+     * range is shifted by the scroll offset of the region (only if the
+     * Overflow structures were initialized above, as in searchCanvas()).
+     */
+    sQuery.aEntry = pIndex->aScroll;
+    sQuery.aMaxEnd = pIndex->aScrollMaxEnd;
+    for (ii = 0; ii < pIndex->nOverflow; ii++) {
+        CanvasIndexOverflow *p = &pIndex->aOverflow[ii];
+        int yscroll = 0;
+        if (p->nScroll == 0) continue;
+        if (requireOverflow) {
+            yscroll = ((Overflow *)&p->pItem[1])->yscroll;
+        }
+        sQuery.ymin = (ymin >= 0) ? (ymin + yscroll) : INT_MIN;
+        sQuery.ymax = (ymax >= 0) ? (ymax + yscroll) : INT_MAX;
+        indexQuery(&sQuery, p->iScroll, p->iScroll + p->nScroll);
+    }
+
+    for (ii = 0; ii < pIndex->nLinear; ii++) {
+        CanvasIndexEntry *pEntry = &pIndex->aLinear[ii];
+        int x, y, w, h;
+        int ymin2 = ymin;
+        int ymax2 = ymax;
+        int origin_x = pEntry->x;
+        int origin_y = pEntry->y;
+        if (pEntry->isFixed) {
+            origin_x += pTree->iScrollX;
+            origin_y += pTree->iScrollY;
+        }
+        itemToBox(pEntry->pItem, origin_x, origin_y, &x, &y, &w, &h);
+        if (requireOverflow && pEntry->iOverflow >= 0) {
+            HtmlCanvasItem *p = pIndex->aOverflow[pEntry->iOverflow].pItem;
+            int yscroll = ((Overflow *)&p[1])->yscroll;
+            ymin2 += yscroll;
+            ymax2 += yscroll;
+        }
+        if ((ymax >= 0 && y >= ymax2) || (ymin >= 0 && (y+h) <= ymin2)) {
+            continue;
+        }
+        indexQueryAdd(&sQuery, pEntry);
+    }
+
+    qsort(sQuery.apMatch, sQuery.nMatch, sizeof(CanvasIndexEntry *), 
+        indexMatchCompare
+    );
+
+    for (ii = 0; rc == 0 && ii < sQuery.nMatch; ii++) {
+        CanvasIndexEntry *pEntry = sQuery.apMatch[ii];
+        Overflow *pOver = 0;
+        int origin_x = pEntry->x;
+        int origin_y = pEntry->y;
+        if (pEntry->isFixed) {
+            origin_x += pTree->iScrollX;
+            origin_y += pTree->iScrollY;
+        }
+        if (requireOverflow && pEntry->iOverflow >= 0) {
+            pOver = (Overflow *)&pIndex->aOverflow[pEntry->iOverflow].pItem[1];
+        }
+        rc = xFunc(pEntry->pItem, origin_x, origin_y, pOver, clientData);
+    }
+
+    HtmlFree(sQuery.apMatch);
+    return rc;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2502,6 +3204,13 @@ searchCanvas(pTree, ymin, ymax, xFunc, clientData, requireOverflow)
     /* Debugging variables to support assert() statements */
     int nOrigin = 0;
     int bSeenFixedMarker = 0;
+
+    /* If a y-coordinate range is specified, use the spatial index. */
+    if ((ymin >= 0 || ymax >= 0) && pCanvas->pFirst) {
+        return searchCanvasIndex(
+            pTree, ymin, ymax, xFunc, clientData, requireOverflow
+        );
+    }
      
     for (pItem = pCanvas->pFirst; pItem; pItem = (pSkip?pSkip:pItem->pNext)) {
 
@@ -3808,39 +4517,302 @@ HtmlLayoutNode(clientData, interp, objc, objv)
     return TCL_OK;
 }
 
-struct BboxContext {
-    HtmlNode *pPrevNode;
-};
-typedef struct BboxContext BboxContext;
+/*
+ * Return a pointer to the CanvasNodeEntry for node pNode, creating it if
+ * it does not already exist.
+ */
+static CanvasNodeEntry *
+canvasNodeEntry(pIndex, pNode)
+    HtmlCanvasIndex *pIndex;
+    HtmlNode *pNode;
+{
+    Tcl_HashEntry *pHash;
+    int isNew;
+    int iEntry;
+
+    pHash = Tcl_CreateHashEntry(&pIndex->aNode, (char *)pNode, &isNew);
+    if (isNew) {
+        CanvasNodeEntry *pEntry;
+        if (pIndex->nNodeEntry == pIndex->nNodeEntryAlloc) {
+            pIndex->nNodeEntryAlloc = pIndex->nNodeEntryAlloc * 2 + 64;
+            pIndex->aNodeEntry = (CanvasNodeEntry *)HtmlRealloc(0,
+                pIndex->aNodeEntry,
+                pIndex->nNodeEntryAlloc * sizeof(CanvasNodeEntry)
+            );
+        }
+        iEntry = pIndex->nNodeEntry++;
+        pEntry = &pIndex->aNodeEntry[iEntry];
+        memset(pEntry, 0, sizeof(CanvasNodeEntry));
+        pEntry->left = INT_MAX;
+        pEntry->top = INT_MAX;
+        pEntry->right = INT_MIN;
+        pEntry->bottom = INT_MIN;
+        Tcl_SetHashValue(pHash, (ClientData)((size_t)iEntry));
+    } else {
+        iEntry = (int)((size_t)Tcl_GetHashValue(pHash));
+    }
+    return &pIndex->aNodeEntry[iEntry];
+}
 
-static int
-bboxCb(pItem, origin_x, origin_y, pOverflow, clientData)
+/*
+ * Add the rectangle (x, y, x+w, y+h) to the HtmlWidgetNodeBox() bounding
+ * boxes of node pNode and each of its ancestors. The walk up the tree
+ * stops at the first ancestor whose box already contains the rectangle,
+ * as the boxes of all further ancestors must contain it too.
+ */
+static void
+canvasNodeBoxAdd(pIndex, pNode, x, y, w, h)
+    HtmlCanvasIndex *pIndex;
+    HtmlNode *pNode;
+    int x;
+    int y;
+    int w;
+    int h;
+{
+    HtmlNode *p;
+    for (p = pNode; p; p = HtmlNodeParent(p)) {
+        CanvasNodeEntry *pEntry = canvasNodeEntry(pIndex, p);
+        if (pEntry->left <= x && pEntry->top <= y && 
+            pEntry->right >= x + w && pEntry->bottom >= y + h
+        ) {
+            break;
+        }
+        pEntry->left = MIN(pEntry->left, x);
+        pEntry->top = MIN(pEntry->top, y);
+        pEntry->right = MAX(pEntry->right, x + w);
+        pEntry->bottom = MAX(pEntry->bottom, y + h);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * indexCanvasNodes --
+ *
+ *     Populate the HtmlCanvasIndex.aNode table for the widget canvas, if
+ *     it has not already been populated since the canvas was last
+ *     rebuilt. This requires a single walk of the display list.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May build the canvas index.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+indexCanvasNodes(pTree)
+    HtmlTree *pTree;
+{
+    HtmlCanvasIndex *pIndex;
     HtmlCanvasItem *pItem;
-    int origin_x;
-    int origin_y;
-    Overflow *pOverflow;
-    ClientData clientData;
+    HtmlCanvasItem *pSkipEnd = 0;
+    int origin_x = 0;
+    int origin_y = 0;
+    int isFixed = 0;
+
+    HtmlDrawIndexCanvas(pTree);
+    pIndex = pTree->canvas.pIndex;
+    if (pIndex->isNodeOk) return;
+
+    Tcl_InitHashTable(&pIndex->aNode, TCL_ONE_WORD_KEYS);
+    pIndex->isNodeOk = 1;
+
+    for (pItem = pTree->canvas.pFirst; pItem; pItem = pItem->pNext) {
+        switch (pItem->type) {
+            case CANVAS_ORIGIN:
+                origin_x += pItem->x.o.x;
+                origin_y += pItem->x.o.y;
+                break;
+
+            case CANVAS_MARKER:
+                if (pItem->x.marker.flags == MARKER_FIXED) {
+                    isFixed = 1;
+                }
+                break;
+
+            case CANVAS_OVERFLOW: {
+                /* The content of an overflow region contributes to the
+                 * HtmlWidgetNodeBox() boxes only via the region itself. 
+                 */
+                CanvasOverflow *pO = &pItem->x.overflow;
+                if (!pSkipEnd) {
+                    canvasNodeBoxAdd(pIndex, pO->pNode, 
+                        pO->x + origin_x, pO->y + origin_y, pO->w, pO->h
+                    );
+                    pSkipEnd = pO->pEnd;
+                }
+                break;
+            }
+
+            default: {
+                int x, y, w, h;
+                CanvasNodeEntry *pEntry;
+                HtmlNode *pNode;
+
+                pNode = itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
+                if (!pNode) break;
+
+                if (!pSkipEnd) {
+                    canvasNodeBoxAdd(pIndex, pNode, x, y, w, h);
+                }
+
+                pEntry = canvasNodeEntry(pIndex, pNode);
+                pEntry->isFixed = isFixed;
+                if (pItem->type == CANVAS_BOX || pItem->type == CANVAS_TEXT) {
+                    if (pEntry->isBbox) {
+                        pEntry->iBboxX = MIN(pEntry->iBboxX, x);
+                        pEntry->iBboxY = MIN(pEntry->iBboxY, y);
+                        pEntry->iBboxX2 = MAX(pEntry->iBboxX2, x + w);
+                        pEntry->iBboxY2 = MAX(pEntry->iBboxY2, y + h);
+                    } else {
+                        pEntry->iBboxX = x;
+                        pEntry->iBboxY = y;
+                        pEntry->iBboxX2 = x + w;
+                        pEntry->iBboxY2 = y + h;
+                        pEntry->isBbox = 1;
+                    }
+                }
+                if (pItem->type == CANVAS_BOX && !pEntry->isBox) {
+                    pEntry->iBoxY = y;
+                    pEntry->isBox = 1;
+                }
+                pEntry->iLastY = y;
+                pEntry->isContent = 1;
+                break;
+            }
+        }
+
+        if (pItem == pSkipEnd) {
+            pSkipEnd = 0;
+        }
+    }
+}
+
+/*
+ * Return the CanvasNodeEntry for node pNode, or NULL if pNode (and its
+ * descendants) generate no content.
+ */
+static CanvasNodeEntry *
+findCanvasNode(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlCanvasIndex *pIndex;
+    Tcl_HashEntry *pHash;
+
+    indexCanvasNodes(pTree);
+    pIndex = pTree->canvas.pIndex;
+    pHash = Tcl_FindHashEntry(&pIndex->aNode, (char *)pNode);
+    if (pHash) {
+        int iEntry = (int)((size_t)Tcl_GetHashValue(pHash));
+        return &pIndex->aNodeEntry[iEntry];
+    }
+    return 0;
+}
+
+static int
+contentEntryCompare(pVoidLeft, pVoidRight)
+    const void *pVoidLeft;
+    const void *pVoidRight;
+{
+    CanvasContentEntry *pLeft = (CanvasContentEntry *)pVoidLeft;
+    CanvasContentEntry *pRight = (CanvasContentEntry *)pVoidRight;
+    return pLeft->iNode - pRight->iNode;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * indexCanvasContent --
+ *
+ *     Populate the HtmlCanvasIndex.aContent array for the widget canvas,
+ *     if it has not already been populated since the canvas was last 
+ *     rebuilt or the document tree was last modified.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May build the canvas index and renumber the nodes of the document
+ *     tree (see HtmlSequenceNodes()).
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+indexCanvasContent(pTree)
+    HtmlTree *pTree;
 {
-    BboxContext *p = (BboxContext *)clientData;
-    if (pItem->x.generic.pNode && 
-        (pItem->type == CANVAS_BOX || pItem->type == CANVAS_TEXT)
+    HtmlCanvasIndex *pIndex;
+    Tcl_HashSearch search;
+    Tcl_HashEntry *pHash;
+
+    indexCanvasNodes(pTree);
+    HtmlSequenceNodes(pTree);
+    pIndex = pTree->canvas.pIndex;
+    if (
+        pIndex->isContentOk && 
+        pIndex->iContentGeneration == pTree->iDocumentGeneration
     ) {
-        HtmlNode *pNode = pItem->x.generic.pNode;
-        int x, y, w, h;
-        itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
-        if (pItem->x.generic.pNode == p->pPrevNode) {
-            pNode->iBboxX = MIN(pNode->iBboxX, x);
-            pNode->iBboxY = MIN(pNode->iBboxY, y);
-            pNode->iBboxX2 = MAX(pNode->iBboxX2, x + w);
-            pNode->iBboxY2 = MAX(pNode->iBboxY2, y + h);
+        return;
+    }
+
+    HtmlFree(pIndex->aContent);
+    pIndex->aContent = (CanvasContentEntry *)HtmlAlloc(
+        "HtmlCanvasIndex.aContent", 
+        sizeof(CanvasContentEntry) * MAX(pIndex->nNodeEntry, 1)
+    );
+    pIndex->nContent = 0;
+    for (
+        pHash = Tcl_FirstHashEntry(&pIndex->aNode, &search);
+        pHash;
+        pHash = Tcl_NextHashEntry(&search)
+    ) {
+        HtmlNode *pNode = (HtmlNode *)Tcl_GetHashKey(&pIndex->aNode, pHash);
+        int iEntry = (int)((size_t)Tcl_GetHashValue(pHash));
+        if (pIndex->aNodeEntry[iEntry].isContent) {
+            CanvasContentEntry *p = &pIndex->aContent[pIndex->nContent++];
+            p->iNode = pNode->iNode;
+            p->iEntry = iEntry;
+        }
+    }
+    qsort(pIndex->aContent, pIndex->nContent, 
+        sizeof(CanvasContentEntry), contentEntryCompare
+    );
+    pIndex->isContentOk = 1;
+    pIndex->iContentGeneration = pTree->iDocumentGeneration;
+}
+
+/*
+ * Return the CanvasNodeEntry for the node closest to pNode that precedes
+ * (or is) pNode in document order and generates content, or NULL if
+ * there is no such node.
+ */
+static CanvasNodeEntry *
+findPrecedingContent(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlCanvasIndex *pIndex;
+    int iLo = 0;
+    int iHi;
+
+    indexCanvasContent(pTree);
+    pIndex = pTree->canvas.pIndex;
+
+    /* Binary search for the last entry with iNode <= pNode->iNode. */
+    iHi = pIndex->nContent;
+    while (iLo < iHi) {
+        int iMid = (iLo + iHi) / 2;
+        if (pIndex->aContent[iMid].iNode <= pNode->iNode) {
+            iLo = iMid + 1;
         } else {
-            pNode->iBboxX = x;
-            pNode->iBboxY = y;
-            pNode->iBboxX2 = x + w;
-            pNode->iBboxY2 = y + h;
+            iHi = iMid;
         }
     }
-    return 0;
+    if (iLo == 0 || pNode->iNode == HTML_NODE_ORPHAN) return 0;
+    return &pIndex->aNodeEntry[pIndex->aContent[iLo - 1].iEntry];
 }
 
 int 
@@ -3867,17 +4839,19 @@ HtmlWidgetBboxCmd(clientData, interp, objc, objv)
             return TCL_ERROR;
         }
         if (!HtmlNodeIsOrphan(pNode)) {
-            if (!pTree->isBboxOk) {
-                BboxContext sContext;
-                sContext.pPrevNode = 0;
-                searchCanvas(pTree, -1, -1, bboxCb, (ClientData)&sContext, 1);
-                pTree->isBboxOk = 1;
+            CanvasNodeEntry *pEntry = findCanvasNode(pTree, pNode);
+            if (pEntry && pEntry->isBbox) {
+                x = pEntry->iBboxX;
+                y = pEntry->iBboxY;
+                x2 = pEntry->iBboxX2;
+                y2 = pEntry->iBboxY2;
+                if (pEntry->isFixed) {
+                    x += pTree->iScrollX;
+                    y += pTree->iScrollY;
+                    x2 += pTree->iScrollX;
+                    y2 += pTree->iScrollY;
+                }
             }
-    
-            x = pNode->iBboxX;
-            y = pNode->iBboxY;
-            x2 = pNode->iBboxX2;
-            y2 = pNode->iBboxY2;
         }
     } else {
         x = 0;
@@ -3904,6 +4878,7 @@ HtmlWidgetBboxCmd(clientData, interp, objc, objv)
  */
 typedef struct PaintNodesQuery PaintNodesQuery;
 struct PaintNodesQuery {
+    HtmlTree *pTree;
     int iNodeStart;
     int iIndexStart;
     int iNodeFin;
@@ -3966,7 +4941,8 @@ paintNodesSearchCb(pItem, origin_x, origin_y, pOverflow, clientData)
 
                     if (iNode == p->iNodeFin && p->iIndexFin >= 0) {
                         nFin = MIN(n, 1 + p->iIndexFin - pT->iIndex);
-                        right = Tk_TextWidth(pFont->tkfont, z, nFin) + left;
+                        right = left + 
+                            HtmlFontTextWidth(p->pTree, pFont, z, nFin);
                     } else {
                         right = pT->w + left;
                     }
@@ -3974,7 +4950,9 @@ paintNodesSearchCb(pItem, origin_x, origin_y, pOverflow, clientData)
                         int nStart = MAX(0, p->iIndexStart - pT->iIndex);
                         if (nStart > 0) {
                             assert(nStart <= n);
-                            left += Tk_TextWidth(pFont->tkfont, z, nStart);
+                            left += HtmlFontTextWidth(
+                                p->pTree, pFont, z, nStart
+                            );
                         }
                     }
 
@@ -4047,6 +5025,7 @@ HtmlWidgetDamageText(pTree, pNodeStart, iIndexStart, pNodeFin, iIndexFin)
         SWAPINT(iIndexStart, iIndexFin);
     }
 
+    sQuery.pTree = pTree;
     sQuery.iNodeStart = iNodeStart;
     sQuery.iNodeFin = iNodeFin;
     sQuery.iIndexStart = iIndexStart;
@@ -4093,6 +5072,7 @@ pTree, pNodeStart, iIndexStart, pNodeFin, iIndexFin, piT, piL, piB, piR
     assert(iNodeStart <= iNodeFin);
     assert(iNodeFin > iNodeStart || iIndexFin >= iIndexStart);
 
+    sQuery.pTree = pTree;
     sQuery.iNodeStart = iNodeStart;
     sQuery.iNodeFin = iNodeFin;
     sQuery.iIndexStart = iIndexStart;
@@ -4110,66 +5090,6 @@ pTree, pNodeStart, iIndexStart, pNodeFin, iIndexFin, piT, piL, piB, piR
     *piB = sQuery.bottom;
 }
 
-/*
- * The client-data for the search-callback used by HtmlWidgetNodeTop()
- */
-typedef struct ScrollToQuery ScrollToQuery;
-struct ScrollToQuery {
-    HtmlTree *pTree;
-    int iMinNode;
-    int iMaxNode;
-    int iReturn;
-};
-
-/*
- *---------------------------------------------------------------------------
- *
- * scrollToNodeCb --
- *     
- *
- * Results:
- *
- * Side effects:
- *     None.
- *
- *---------------------------------------------------------------------------
- */
-static int
-scrollToNodeCb(pItem, origin_x, origin_y, pOverflow, clientData)
-    HtmlCanvasItem *pItem;
-    int origin_x;
-    int origin_y;
-    Overflow *pOverflow;
-    ClientData clientData;
-{
-    int x, y, w, h;
-    ScrollToQuery *pQuery = (ScrollToQuery *)clientData;
-    HtmlNode *pNode;
-    int iMaxNode = pQuery->iMaxNode;
-
-    pNode = itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
-
-    /* If we have found a CANVAS_BOX for the node sought, then 
-     * unconditionally return the pixel offset of the top-border edge
-     * of the box. This is defined in CSS2.1.
-     */
-    if (pNode && pItem->type == CANVAS_BOX && pNode->iNode == iMaxNode){
-        pQuery->iReturn = y;
-        return 1;
-    }
- 
-    if (
-        pNode && 
-        pNode->iNode <= pQuery->iMaxNode && 
-        pNode->iNode >= pQuery->iMinNode
-    ) {
-        pQuery->iReturn = y;
-        pQuery->iMinNode = pNode->iNode;
-    }
-
-    return 0;
-}
-
 /*
  *---------------------------------------------------------------------------
  *
@@ -4199,55 +5119,22 @@ HtmlWidgetNodeTop(pTree, pNode)
     HtmlTree *pTree;
     HtmlNode *pNode;
 {
-    ScrollToQuery sQuery;
+    CanvasNodeEntry *pEntry;
 
-    HtmlSequenceNodes(pTree);
     HtmlCallbackForce(pTree);
 
-    sQuery.iMaxNode = pNode->iNode;
-    sQuery.iMinNode = 0;
-    sQuery.iReturn = 0;
-    sQuery.pTree = pTree;
-    searchCanvas(pTree, -1, -1, scrollToNodeCb, (ClientData)&sQuery, 1);
-    return sQuery.iReturn;
-}
-
-typedef struct LayoutBboxQuery LayoutBboxQuery;
-struct LayoutBboxQuery {
-    HtmlNode *pNode;
-    int left;
-    int right;
-    int top;
-    int bottom;
-};
-
-static int
-layoutBboxCb(pItem, origin_x, origin_y, pOverflow, clientData)
-    HtmlCanvasItem *pItem;
-    int origin_x;
-    int origin_y;
-    Overflow *pOverflow;
-    ClientData clientData;
-{
-    int x, y, w, h;
-    LayoutBboxQuery *pQuery = (LayoutBboxQuery *)clientData;
-    HtmlNode *pNode;
-
-    pNode = itemToBox(pItem, origin_x, origin_y, &x, &y, &w, &h);
-    if (pOverflow) {
-        x -= pOverflow->xscroll;
-        y -= pOverflow->yscroll;
+    /* If node pNode generated a CANVAS_BOX, then return the pixel offset
+     * of the top-border edge of the box. This is defined in CSS2.1.
+     * Otherwise, return the top of the last primitive generated by the 
+     * closest node that precedes (or is) pNode in document order.
+     */
+    pEntry = findCanvasNode(pTree, pNode);
+    if (pEntry && pEntry->isBox) {
+        return pEntry->iBoxY + (pEntry->isFixed ? pTree->iScrollY : 0);
     }
-
-/* assert(x > -2000); */
-
-    for (; pNode; pNode = HtmlNodeParent(pNode)) {
-        if (pNode == pQuery->pNode) {
-            pQuery->left = MIN(pQuery->left, x);
-            pQuery->top = MIN(pQuery->top, y);
-            pQuery->right = MAX(pQuery->right, x + w);
-            pQuery->bottom = MAX(pQuery->bottom, y + h);
-        }
+    pEntry = findPrecedingContent(pTree, pNode);
+    if (pEntry) {
+        return pEntry->iLastY + (pEntry->isFixed ? pTree->iScrollY : 0);
     }
     return 0;
 }
@@ -4313,48 +5200,29 @@ HtmlWidgetNodeBox(pTree, pNode, pX, pY, pW, pH)
     int *pH;
 {
     HtmlCanvas *pCanvas = &pTree->canvas;
-    LayoutBboxQuery sQuery;
-    HtmlCanvasItem *pItem;
-    HtmlCanvasItem *pSkip = 0;
-
-    int origin_x = 0;
-    int origin_y = 0;
+    CanvasNodeEntry *pEntry;
+    int left, right, top, bottom;
 
     HtmlCallbackForce(pTree);
 
-    sQuery.left = pCanvas->right;
-    sQuery.right = pCanvas->left;
-    sQuery.top = pCanvas->bottom;
-    sQuery.bottom = pCanvas->top;
-    sQuery.pNode = pNode;
-
-    for (pItem = pCanvas->pFirst; pItem; pItem = (pSkip?pSkip:pItem->pNext)) {
-        pSkip = 0;
-        if (pItem->type == CANVAS_OVERFLOW) {
-            CanvasOverflow *pO = &pItem->x.overflow;
-            HtmlNode *p = pO->pNode;
-            while (p && p != pNode) p = HtmlNodeParent(p);
-            if (p) {
-                CanvasOverflow *pO = &pItem->x.overflow;
-                sQuery.left = MIN(sQuery.left, pO->x + origin_x);
-                sQuery.top = MIN(sQuery.top, pO->y + origin_y);
-                sQuery.right = MAX(sQuery.right, pO->x + origin_x + pO->w);
-                sQuery.bottom = MAX(sQuery.bottom, pO->y + origin_y + pO->h);
-            }
-            pSkip = pO->pEnd;
-        } else if (pItem->type == CANVAS_ORIGIN) {
-            origin_x += pItem->x.o.x;
-            origin_y += pItem->x.o.y;
-        } else {
-            layoutBboxCb(pItem, origin_x, origin_y, 0, (ClientData)&sQuery);
-        }
+    left = pCanvas->right;
+    right = pCanvas->left;
+    top = pCanvas->bottom;
+    bottom = pCanvas->top;
+
+    pEntry = findCanvasNode(pTree, pNode);
+    if (pEntry) {
+        left = MIN(left, pEntry->left);
+        top = MIN(top, pEntry->top);
+        right = MAX(right, pEntry->right);
+        bottom = MAX(bottom, pEntry->bottom);
     }
 
-    if (sQuery.left < sQuery.right && sQuery.top < sQuery.bottom) {
-        *pX = sQuery.left;
-        *pY = sQuery.top;
-        *pW = sQuery.right - *pX;
-        *pH = sQuery.bottom - *pY;
+    if (left < right && top < bottom) {
+        *pX = left;
+        *pY = top;
+        *pW = right - left;
+        *pH = bottom - top;
     } else {
         *pX = 0;
         *pY = 0;
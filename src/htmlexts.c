@@ -2338,7 +2338,7 @@ HtmlTokenAttr(clientData, interp, argc, argv)
      * sprintf(pElem->markup.argv[j+1],"%.*s",l,value); 
      */
     strcpy(p->markup.argv[j + 1], value);
-    HtmlTranslateEscapes(p->markup.argv[j + 1]);
+    HtmlTranslateEscapes(p->markup.argv[j + 1], 1);
     return TCL_OK;
 }
 
@@ -70,12 +70,24 @@ static const char rcsid[] = "$Id: htmlfloat.c,v 1.21 2006/10/27 15:19:18 danielk
 typedef struct FloatListEntry FloatListEntry;
 
 /*
- * The core of the float-list structure is the linked list of
- * FloatListEntry structures. The linked list is always kept sorted in
- * order of the FloatListEntry.y variable, which is the y-coordinate of the
- * top of the floating margin. The bottom of the floating margin is either
- * the FloatListEntry.y variable in the next struct in the list, or
- * HtmlFloatList.yend for the last list entry.
+ * The float-list divides the vertical extent of the flow into bands.
+ * Each band is represented by a FloatListEntry structure. The
+ * FloatListEntry.y variable is the y-coordinate of the top of the band.
+ * The bottom of the band is the top of the next band (the entry with the
+ * next largest value of FloatListEntry.y), or HtmlFloatList.yend for the
+ * last band. Within a band the floating margins are constant.
+ *
+ * The entries are stored in a treap (a binary search tree kept balanced
+ * by assigning each node a pseudo-random priority) ordered by
+ * FloatListEntry.y. So that HtmlFloatListMargins() can find the
+ * floating margins over a vertical range in O(log N) time, each node
+ * also stores the largest left margin and the smallest right margin of
+ * the bands in the sub-tree rooted at the node. When a floating margin is
+ * added that spans many bands, the new margin is stored as a "pending"
+ * margin on the roots of the affected sub-trees. It is pushed down to the
+ * child nodes by floatListPush() the next time the sub-tree is descended
+ * into. The values stored in a node (including the sub-tree summary) are
+ * always up to date once all ancestors of the node have been pushed.
  *
  * All coordinates stored in the float-list are stored relative to an
  * origin point set to (0, 0) when the list is created by
@@ -93,41 +105,448 @@ struct FloatListEntry {
     int leftValid;            /* True if the left margin is valid */
     int rightValid;           /* True if the right margin is valid */
     int isTop;                /* True if this is the top of 1 or more f.b. */
-    FloatListEntry *pNext;    /* Next entry in list */
+
+    /* Tree structure */
+    unsigned int iPriority;   /* Parent priority is >= child priority */
+    FloatListEntry *apChild[2];   /* Entries with smaller and larger y */
+
+    /* Summary of the sub-tree rooted at this entry */
+    int iMaxLeft;             /* Largest valid left margin */
+    int iMinRight;            /* Smallest valid right margin */
+    int hasLeft;              /* True if iMaxLeft is valid */
+    int hasRight;             /* True if iMinRight is valid */
+
+    /* Margins not yet pushed down to the children of this entry */
+    int iPendingLeft;
+    int iPendingRight;
+    int hasPendingLeft;
+    int hasPendingRight;
 };
 struct HtmlFloatList {
     int xorigin;
     int yorigin;
     int yend;
     int endValid;
-    FloatListEntry *pEntry;
+    FloatListEntry *pEntry;   /* Root of treap */
+    unsigned int iSeed;       /* Used to generate entry priorities */
+
+    /* The following are used by HtmlFloatListClear() and
+     * HtmlFloatListClearTop(). They are the largest bottom coordinate of
+     * any left and right floating box, and the largest top coordinate of
+     * any floating box, respectively.
+     */
+    int iLeftEnd;
+    int iRightEnd;
+    int iTop;
+    int hasLeftEnd;
+    int hasRightEnd;
+    int hasTop;
 };
 
-static void 
-floatListPrint(pList)
-    HtmlFloatList *pList;
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListApply --
+ *
+ *     Apply a floating margin to entry p and all entries in the sub-tree
+ *     rooted at p. If isLeft is true, x is a left margin, otherwise it is
+ *     a right margin. The children of p are not modified - the margin is
+ *     stored as pending on p instead.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+floatListApply(p, isLeft, x)
+    FloatListEntry *p;
+    int isLeft;
+    int x;
 {
-    FloatListEntry *pEntry;
-    Tcl_Obj *pObj = Tcl_NewObj();
-    Tcl_IncrRefCount(pObj);
+    if (isLeft) {
+        p->left = (p->leftValid ? MAX(p->left, x) : x);
+        p->iMaxLeft = (p->hasLeft ? MAX(p->iMaxLeft, x) : x);
+        if (p->apChild[0] || p->apChild[1]) {
+            p->iPendingLeft = 
+                (p->hasPendingLeft ? MAX(p->iPendingLeft, x) : x);
+            p->hasPendingLeft = 1;
+        }
+        p->leftValid = 1;
+        p->hasLeft = 1;
+    } else {
+        p->right = (p->rightValid ? MIN(p->right, x) : x);
+        p->iMinRight = (p->hasRight ? MIN(p->iMinRight, x) : x);
+        if (p->apChild[0] || p->apChild[1]) {
+            p->iPendingRight = 
+                (p->hasPendingRight ? MIN(p->iPendingRight, x) : x);
+            p->hasPendingRight = 1;
+        }
+        p->rightValid = 1;
+        p->hasRight = 1;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListPush --
+ *
+ *     Push any pending margins stored on entry p down to its children.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+floatListPush(p)
+    FloatListEntry *p;
+{
+    int ii;
+    for (ii = 0; ii < 2; ii++) {
+        FloatListEntry *pChild = p->apChild[ii];
+        if (pChild) {
+            if (p->hasPendingLeft) {
+                floatListApply(pChild, 1, p->iPendingLeft);
+            }
+            if (p->hasPendingRight) {
+                floatListApply(pChild, 0, p->iPendingRight);
+            }
+        }
+    }
+    p->hasPendingLeft = 0;
+    p->hasPendingRight = 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListSummarize --
+ *
+ *     Recalculate the sub-tree summary stored in entry p from the values
+ *     stored in p and the summaries stored in its children. Entry p must
+ *     not have any pending margins.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+floatListSummarize(p)
+    FloatListEntry *p;
+{
+    int ii;
+    assert(!p->hasPendingLeft && !p->hasPendingRight);
+
+    p->hasLeft = p->leftValid;
+    p->iMaxLeft = p->left;
+    p->hasRight = p->rightValid;
+    p->iMinRight = p->right;
+    for (ii = 0; ii < 2; ii++) {
+        FloatListEntry *pChild = p->apChild[ii];
+        if (pChild && pChild->hasLeft) {
+            p->iMaxLeft = 
+                (p->hasLeft ? MAX(p->iMaxLeft, pChild->iMaxLeft) : 
+                 pChild->iMaxLeft);
+            p->hasLeft = 1;
+        }
+        if (pChild && pChild->hasRight) {
+            p->iMinRight = 
+                (p->hasRight ? MIN(p->iMinRight, pChild->iMinRight) : 
+                 pChild->iMinRight);
+            p->hasRight = 1;
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListInsert --
+ *
+ *     Insert entry pNew into the treap rooted at p. The new entry must
+ *     have no children and a y-coordinate not already in the tree.
+ *
+ * Results:
+ *     The new root of the treap.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static FloatListEntry *
+floatListInsert(p, pNew)
+    FloatListEntry *p;
+    FloatListEntry *pNew;
+{
+    int ii;
+    FloatListEntry *pChild;
+
+    if (!p) {
+        floatListSummarize(pNew);
+        return pNew;
+    }
+    assert(p->y != pNew->y);
+
+    floatListPush(p);
+    ii = (pNew->y > p->y);
+    pChild = floatListInsert(p->apChild[ii], pNew);
+    p->apChild[ii] = pChild;
+
+    if (pChild->iPriority > p->iPriority) {
+        /* Rotate pChild above p. */
+        floatListPush(pChild);
+        p->apChild[ii] = pChild->apChild[!ii];
+        pChild->apChild[!ii] = p;
+        floatListSummarize(p);
+        floatListSummarize(pChild);
+        return pChild;
+    }
+
+    floatListSummarize(p);
+    return p;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListFloor --
+ * floatListCeil --
+ *
+ *     Return the entry with the largest y-coordinate less than or equal to
+ *     y (floatListFloor()), or the entry with the smallest y-coordinate
+ *     greater than or equal to y (floatListCeil()). If there is no such
+ *     entry, return NULL.
+ *
+ *     If the isPush argument to floatListFloor() is true, pending margins
+ *     are pushed down along the path to the entry returned, so that the
+ *     margins stored in the entry may be used by the caller.
+ *
+ * Results:
+ *     Pointer to entry, or NULL.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static FloatListEntry *
+floatListFloor(p, y, isPush)
+    FloatListEntry *p;
+    int y;
+    int isPush;
+{
+    FloatListEntry *pRet = 0;
+    while (p) {
+        if (isPush) {
+            floatListPush(p);
+        }
+        if (p->y == y) {
+            return p;
+        }
+        if (p->y < y) {
+            pRet = p;
+            p = p->apChild[1];
+        } else {
+            p = p->apChild[0];
+        }
+    }
+    return pRet;
+}
+static FloatListEntry *
+floatListCeil(p, y)
+    FloatListEntry *p;
+    int y;
+{
+    FloatListEntry *pRet = 0;
+    while (p) {
+        if (p->y == y) {
+            return p;
+        }
+        if (p->y > y) {
+            pRet = p;
+            p = p->apChild[0];
+        } else {
+            p = p->apChild[1];
+        }
+    }
+    return pRet;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListRange --
+ *
+ *     Visit each entry in the sub-tree rooted at p with a y-coordinate
+ *     greater than or equal to y1 and less than y2. All keys in the
+ *     sub-tree are known to lie between iMin and iMax (inclusive).
+ *
+ *     If pLeft is not NULL, the margins of the visited entries are
+ *     combined into *pLeft and *pRight as for HtmlFloatListMargins().
+ *     Otherwise, a margin with coordinate x is applied to each visited
+ *     entry. The margin is a left margin if isLeft is true, or a right
+ *     margin otherwise.
+ *
+ *     Sub-trees that lie entirely within the range are not descended
+ *     into, so this requires O(log N) time.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     *pLeft and *pRight may be modified.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+floatListRange(p, y1, y2, iMin, iMax, pLeft, pRight, isLeft, x)
+    FloatListEntry *p;
+    int y1;
+    int y2;
+    int iMin;
+    int iMax;
+    int *pLeft;
+    int *pRight;
+    int isLeft;
+    int x;
+{
+    if (!p || iMax < y1 || iMin >= y2) {
+        return;
+    }
 
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        char zBuf[100];
-        sprintf(zBuf, "(y=%d, ", pEntry->y);
-        Tcl_AppendToObj(pObj, zBuf, -1);
-        if (pEntry->leftValid) {
-            sprintf(zBuf, "left=%d, ", pEntry->left);
+    if (y1 <= iMin && iMax < y2) {
+        if (!pLeft) {
+            floatListApply(p, isLeft, x);
         } else {
-            sprintf(zBuf, "left=-, ");
+            if (p->hasLeft) *pLeft = MAX(*pLeft, p->iMaxLeft);
+            if (p->hasRight) *pRight = MIN(*pRight, p->iMinRight);
         }
-        Tcl_AppendToObj(pObj, zBuf, -1);
-        if (pEntry->rightValid) {
-            sprintf(zBuf, "right=%d) ", pEntry->right);
+        return;
+    }
+
+    floatListPush(p);
+    if (p->y >= y1 && p->y < y2) {
+        if (!pLeft) {
+            if (isLeft) {
+                p->left = (p->leftValid ? MAX(p->left, x) : x);
+                p->leftValid = 1;
+            } else {
+                p->right = (p->rightValid ? MIN(p->right, x) : x);
+                p->rightValid = 1;
+            }
         } else {
-            sprintf(zBuf, "right=-) ");
+            if (p->leftValid) *pLeft = MAX(*pLeft, p->left);
+            if (p->rightValid) *pRight = MIN(*pRight, p->right);
         }
-        Tcl_AppendToObj(pObj, zBuf, -1);
     }
+    if (p->y > iMin) {
+        floatListRange(p->apChild[0], 
+            y1, y2, iMin, p->y - 1, pLeft, pRight, isLeft, x
+        );
+    }
+    if (p->y < iMax) {
+        floatListRange(p->apChild[1], 
+            y1, y2, p->y + 1, iMax, pLeft, pRight, isLeft, x
+        );
+    }
+    if (!pLeft) {
+        floatListSummarize(p);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * floatListBandEnd --
+ *
+ *     Find the first band in the list with a bottom coordinate greater
+ *     than y. If there is such a band, set *pEnd to its bottom coordinate
+ *     and return 1. Otherwise return 0.
+ *
+ * Results:
+ *     1 or 0.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+floatListBandEnd(pList, y, pEnd)
+    HtmlFloatList *pList;
+    int y;
+    int *pEnd;
+{
+    FloatListEntry *pFirst;
+    FloatListEntry *pNext;
+
+    if (!pList->pEntry || y >= pList->yend) {
+        return 0;
+    }
+
+    pFirst = floatListCeil(pList->pEntry, INT_MIN);
+    pNext = floatListCeil(pList->pEntry, MAX(y, pFirst->y) + 1);
+    *pEnd = (pNext ? pNext->y : pList->yend);
+    return 1;
+}
+
+static void
+floatListPushAll(p)
+    FloatListEntry *p;
+{
+    if (p) {
+        floatListPush(p);
+        floatListPushAll(p->apChild[0]);
+        floatListPushAll(p->apChild[1]);
+    }
+}
+
+static void 
+floatListPrintEntry(pObj, pEntry)
+    Tcl_Obj *pObj;
+    FloatListEntry *pEntry;
+{
+    char zBuf[100];
+    if (!pEntry) return;
+    floatListPush(pEntry);
+    floatListPrintEntry(pObj, pEntry->apChild[0]);
+    sprintf(zBuf, "(y=%d, ", pEntry->y);
+    Tcl_AppendToObj(pObj, zBuf, -1);
+    if (pEntry->leftValid) {
+        sprintf(zBuf, "left=%d, ", pEntry->left);
+    } else {
+        sprintf(zBuf, "left=-, ");
+    }
+    Tcl_AppendToObj(pObj, zBuf, -1);
+    if (pEntry->rightValid) {
+        sprintf(zBuf, "right=%d) ", pEntry->right);
+    } else {
+        sprintf(zBuf, "right=-) ");
+    }
+    Tcl_AppendToObj(pObj, zBuf, -1);
+    floatListPrintEntry(pObj, pEntry->apChild[1]);
+}
+
+static void 
+floatListPrint(pList)
+    HtmlFloatList *pList;
+{
+    Tcl_Obj *pObj = Tcl_NewObj();
+    Tcl_IncrRefCount(pObj);
+    floatListPrintEntry(pObj, pList->pEntry);
     printf("%s end=%d\n", Tcl_GetString(pObj), pList->yend);
     Tcl_DecrRefCount(pObj);
 
@@ -153,12 +572,24 @@ floatListPrint(pList)
 HtmlFloatList *HtmlFloatListNew()
 {
     HtmlFloatList *pList = HtmlNew(HtmlFloatList);
+    pList->iSeed = 1;
 #ifdef DEBUG_FLOAT_LIST
     printf("HtmlFloatListNew()  -> %p\n", pList);
 #endif
     return pList;
 }
 
+static void 
+floatListDeleteEntry(pEntry)
+    FloatListEntry *pEntry;
+{
+    if (pEntry) {
+        floatListDeleteEntry(pEntry->apChild[0]);
+        floatListDeleteEntry(pEntry->apChild[1]);
+        HtmlFree(pEntry);
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -180,13 +611,7 @@ HtmlFloatListDelete(pList)
     HtmlFloatList *pList;
 {
     if (pList) {
-        FloatListEntry *pEntry;
-        FloatListEntry *pEntry2 = 0;
-        for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-            if (pEntry2) HtmlFree(pEntry2);
-            pEntry2 = pEntry;
-        }
-        if (pEntry2) HtmlFree(pEntry2);
+        floatListDeleteEntry(pList->pEntry);
         HtmlFree(pList);
     }
 }
@@ -224,52 +649,40 @@ void insertListEntry(pList, y)
     printf("insertListEntry(%p, y=%d)\n", pList, y);
 #endif
 
-    /* See if a new entry is required at the start of the list. */
-    if (pList->pEntry && pList->pEntry->y > y) {
-        pNew = HtmlNew(FloatListEntry);
-        pNew->pNext = pList->pEntry;
+    pEntry = floatListFloor(pList->pEntry, y, 1);
+    if ((pEntry && pEntry->y == y) || (pList->endValid && pList->yend == y)) {
+        /* The list already has this entry. We need do nothing. */
         goto insert_out;
     }
 
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        if (pEntry->y == y || yend == y) {
-            /* The list already has this entry. We need do nothing. */
-            goto insert_out;
-        } 
-
-        if (yend > y) {
-            /* This entry must span the coordinate we're inserting. So we
-             * split it into two parts. The margins are the same in each
-             * part.
+    if (pList->pEntry && y < pList->yend) {
+        pNew = HtmlNew(FloatListEntry);
+        if (pEntry) {
+            /* Entry pEntry must span the coordinate we're inserting. So
+             * we split it into two parts. The margins are the same in 
+             * each part.
              */
-            int nBytes = sizeof(FloatListEntry);
-            pNew = (FloatListEntry *)HtmlAlloc("FloatListEntry", nBytes);
-            memcpy(pNew, pEntry, nBytes);
-            pEntry->pNext = pNew;
-            pNew->y = y;
-            pNew->isTop = 0;
-            goto insert_out;
-        }
+            pNew->left = pEntry->left;
+            pNew->right = pEntry->right;
+            pNew->leftValid = pEntry->leftValid;
+            pNew->rightValid = pEntry->rightValid;
+        } 
+        /* Otherwise, the new entry is at the start of the list. */
+        pNew->y = y;
+    } else {
+        assert(pList->yend < y || !pList->endValid);
+        if (pList->pEntry || pList->endValid) {
+            pNew = HtmlNew(FloatListEntry);
+            pNew->y = pList->yend;
+        } 
+        pList->yend = y;
     }
 
-    assert(pList->yend < y || pList->yend == 0);
-    pEntry = pList->pEntry;
-    while (pEntry && pEntry->pNext) {
-        pEntry = pEntry->pNext;
+    if (pNew) {
+        pList->iSeed = pList->iSeed * 1103515245 + 12345;
+        pNew->iPriority = pList->iSeed;
+        pList->pEntry = floatListInsert(pList->pEntry, pNew);
     }
-    assert(!pEntry || !pEntry->pNext);
-
-    if (pEntry || pList->endValid) {
-        pNew = HtmlNew(FloatListEntry);
-        pNew->y = pList->yend;
-        if (pEntry) {
-            pEntry->pNext = pNew;
-        } else {
-            pList->pEntry = pNew;
-        }
-    } 
-    pList->yend = y;
 
 insert_out:
     pList->endValid = 1;
@@ -325,7 +738,8 @@ HtmlFloatListAdd(pList, side, x, y1, y2)
     int y1;
     int y2;
 {
-    FloatListEntry *pEntry;
+    FloatListEntry *pTop;
+    int isLeft = (side == FLOAT_LEFT);
 
     if (y1 == y2) {
         return;
@@ -351,33 +765,25 @@ HtmlFloatListAdd(pList, side, x, y1, y2)
     insertListEntry(pList, y1);
     insertListEntry(pList, y2);
 
-    /* Now make a second pass and set the other variables on the relevant
-     * list entry or entries. We modify a list entry if it "starts" before
-     * y2 and ends after y1.
+    /* Now set the margin on the entries that "start" at or after y1 and
+     * before y2. These are exactly the entries that overlap the new
+     * floating box.
      */
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        if (pEntry->y == y1) {
-            pEntry->isTop = 1;
-        }
-        if (y2 > pEntry->y && y1 < yend) {
-            if (side==FLOAT_LEFT) {
-                if (pEntry->leftValid) {
-                    pEntry->left = MAX(pEntry->left, x);
-                } else {
-                    pEntry->leftValid = 1;
-                    pEntry->left = x;
-                }
-            } else {
-                if (pEntry->rightValid) {
-                    pEntry->right = MIN(pEntry->right, x);
-                } else {
-                    pEntry->rightValid = 1;
-                    pEntry->right = x;
-                }
-            } 
-        }
+    pTop = floatListCeil(pList->pEntry, y1);
+    assert(pTop && pTop->y == y1);
+    pTop->isTop = 1;
+    floatListRange(pList->pEntry, y1, y2, INT_MIN, INT_MAX, 0, 0, isLeft, x);
+
+    if (isLeft) {
+        pList->iLeftEnd = (pList->hasLeftEnd ? MAX(pList->iLeftEnd, y2) : y2);
+        pList->hasLeftEnd = 1;
+    } else {
+        pList->iRightEnd = 
+            (pList->hasRightEnd ? MAX(pList->iRightEnd, y2) : y2);
+        pList->hasRightEnd = 1;
     }
+    pList->iTop = (pList->hasTop ? MAX(pList->iTop, y1) : y1);
+    pList->hasTop = 1;
 
 #ifdef DEBUG_FLOAT_LIST
     floatListPrint(pList);
@@ -409,13 +815,9 @@ HtmlFloatListClearTop(pList, y)
     HtmlFloatList *pList;
     int y;
 {
-    FloatListEntry *pEntry;
     int ret = y - pList->yorigin;
-
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        if (pEntry->isTop) {
-            ret = MAX(ret, pEntry->y);
-        }
+    if (pList->hasTop) {
+        ret = MAX(ret, pList->iTop);
     }
     return ret + pList->yorigin;
 }
@@ -456,7 +858,6 @@ HtmlFloatListClear(pList, clear, y)
     int clear;         /* CLEAR_LEFT, CLEAR_RIGHT, CLEAR_NONE or CLEAR_BOTH */
     int y;
 {
-    FloatListEntry *pEntry;
     int ret = y - pList->yorigin;
 
 #ifdef DEBUG_FLOAT_LIST
@@ -469,33 +870,26 @@ HtmlFloatListClear(pList, clear, y)
     );
 #endif
 
-    if (clear == CLEAR_NONE) {
-        goto clear_out;
-    }
-    if (clear == CLEAR_BOTH) {
-        ret = MAX(ret, pList->yend);
-        goto clear_out;
-    }
-
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        switch (clear) {
-            case CLEAR_LEFT:
-                if (pEntry->leftValid) {
-                    ret = MAX(yend, ret);
-                }
-                break;
-            case CLEAR_RIGHT:
-                if (pEntry->rightValid) {
-                    ret = MAX(yend, ret);
-                }
-                break;
-            default:
-                assert(0);
-        }
+    switch (clear) {
+        case CLEAR_NONE:
+            break;
+        case CLEAR_BOTH:
+            ret = MAX(ret, pList->yend);
+            break;
+        case CLEAR_LEFT:
+            if (pList->hasLeftEnd) {
+                ret = MAX(ret, pList->iLeftEnd);
+            }
+            break;
+        case CLEAR_RIGHT:
+            if (pList->hasRightEnd) {
+                ret = MAX(ret, pList->iRightEnd);
+            }
+            break;
+        default:
+            assert(0);
     }
  
-clear_out:
     ret += pList->yorigin;
 #ifdef DEBUG_FLOAT_LIST
     printf(" -> %d\n", ret);
@@ -555,7 +949,8 @@ HtmlFloatListNormalize(pList, x, y)
  *
  *---------------------------------------------------------------------------
  */
-void floatListMarginsNormal(pList, y1, y2, pLeft, pRight)
+static void 
+floatListMarginsNormal(pList, y1, y2, pLeft, pRight)
     HtmlFloatList *pList;
     int y1;
     int y2;
@@ -564,26 +959,22 @@ void floatListMarginsNormal(pList, y1, y2, pLeft, pRight)
 {
     FloatListEntry *pEntry;
 
+    if (!pList->pEntry || y1 >= pList->yend) {
+        return;
+    }
+
     /* Locate the FloatListEntry that includes y1, if any. This is the
-     * first entry with an end-coordinate greater than y1.
+     * first entry with an end-coordinate greater than y1. The margins
+     * of this entry, and all following entries that start before y2, 
+     * are included in the result.
      */
-    for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-        int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-        assert(yend > pEntry->y);
-        if (yend > y1) {
-            if (pEntry->leftValid) {
-                *pLeft = MAX(*pLeft, pEntry->left);
-            }
-            if (pEntry->rightValid) {
-                *pRight = MIN(*pRight, pEntry->right);
-            }
-
-            if (yend < y2) {
-                floatListMarginsNormal(pList, yend, y2, pLeft, pRight);
-            }
-            break;
-        }
+    pEntry = floatListFloor(pList->pEntry, y1, 0);
+    if (!pEntry) {
+        pEntry = floatListCeil(pList->pEntry, INT_MIN);
     }
+    floatListRange(pList->pEntry, pEntry->y, MAX(y2, pEntry->y + 1), 
+        INT_MIN, INT_MAX, pLeft, pRight, 0, 0
+    );
 }
 
 /*
@@ -696,20 +1087,14 @@ HtmlFloatListPlace(pList, parentwidth, width, height, y)
     while (1) {
         int left = 0 - pList->xorigin;
         int right = parentwidth;
-        FloatListEntry *pEntry;
 
         floatListMarginsNormal(pList, ret, ret+height, &left, &right);
         if ((right - left) >= width) {
             goto place_out;
         }
-        for (pEntry = pList->pEntry; pEntry; pEntry = pEntry->pNext) {
-            int yend = pEntry->pNext ? pEntry->pNext->y : pList->yend;
-            if (yend > ret) {
-                ret = yend;
-                break;
-            }
-        }
-        if (!pEntry) {
+
+        /* Try again at the bottom of the band that contains ret. */
+        if (!floatListBandEnd(pList, ret, &ret)) {
             goto place_out;
         }
     }
@@ -756,7 +1141,12 @@ HtmlFloatListLog(pTree, zCaption, zNode, pList)
     sprintf(zBuf, "<p>Origin point is (%d, %d).</p>", x, y);
     Tcl_AppendToObj(pLog, zBuf, -1);
     Tcl_AppendToObj(pLog,"<table><tr><th>Left<th>Top (y)<th>Right<th>isTop",-1);
-    for (pCsr = pList->pEntry; pCsr; pCsr = pCsr->pNext) {
+    floatListPushAll(pList->pEntry);
+    for (
+        pCsr = floatListCeil(pList->pEntry, INT_MIN); 
+        pCsr; 
+        pCsr = floatListCeil(pList->pEntry, pCsr->y + 1)
+    ) {
         char zLeft[20];
         char zRight[20];
         strcpy(zLeft, "N/A");
@@ -794,9 +1184,9 @@ HtmlFloatListIsConstant(pList, y, iHeight)
     assert(y2 >= y1);
     if (pList->endValid && BETWEEN(y1, pList->yend, y2)) return 0;
 
-    for (p = pList->pEntry; p; p = p->pNext) {
-        if (BETWEEN(y1, p->y, y2)) return 0;
-    }
+    /* Check if any entry starts between y1 and y2. */
+    p = floatListCeil(pList->pEntry, y1);
+    if (p && BETWEEN(y1, p->y, y2)) return 0;
 
     return 1;
 }
@@ -6,6 +6,7 @@
  *
  *         * case-insensitive strings
  *         * HtmlFontKey structures
+ *         * HtmlTextKey structures
  *         * HtmlComputedValues structures
  * 
  *     The code for case-insensitive strings was copied from the Tcl core code
@@ -348,6 +349,139 @@ HtmlFontKeyHashType()
     return &hash_key_type;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * hashTextKey --
+ *
+ *     Generate a 4-byte hash of the HtmlTextKey structure pointed to by
+ *     keyPtr.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static unsigned int 
+hashTextKey(tablePtr, keyPtr)
+    Tcl_HashTable *tablePtr;    /* Hash table. */
+    VOID *keyPtr;               /* Key from which to compute hash value. */
+{
+    HtmlTextKey *pKey = (HtmlTextKey *) keyPtr;
+    CONST char *z = pKey->z;
+    CONST char *zEnd = &pKey->z[pKey->n];
+    unsigned int result = 0;
+
+    for ( ; z < zEnd; z++) {
+        result += (result<<3) + (unsigned char)*z;
+    }
+    return result;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * compareTextKey --
+ *
+ *     The compare function for the text-key hash. Compare a new key to the
+ *     key of an existing hash-entry.
+ *
+ * Results:
+ *     True if the two keys are the same, false if not.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int 
+compareTextKey(keyPtr, hPtr)
+    VOID *keyPtr;               /* New key to compare. */
+    Tcl_HashEntry *hPtr;        /* Existing key to compare. */
+{   
+    HtmlTextKey *p1 = (HtmlTextKey *) keyPtr;
+    HtmlTextKey *p2 = (HtmlTextKey *) hPtr->key.string;
+
+    return (p1->n == p2->n && 0 == memcmp(p1->z, p2->z, p1->n));
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * allocTextEntry --
+ *
+ *     Allocate enough space for a Tcl_HashEntry, an HtmlTextKey key and
+ *     a copy of the text it refers to.
+ *
+ * Results:
+ *     Pointer to allocated TclHashEntry structure.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static Tcl_HashEntry * 
+allocTextEntry(tablePtr, keyPtr)
+    Tcl_HashTable *tablePtr;    /* Hash table. */
+    VOID *keyPtr;               /* Key to store in the hash table entry. */
+{
+    HtmlTextKey *pKey = (HtmlTextKey *)keyPtr;
+    unsigned int size;
+    Tcl_HashEntry *hPtr;
+    HtmlTextKey *pStoredKey;
+
+    size = (
+        sizeof(Tcl_HashEntry) - sizeof(hPtr->key) +
+        sizeof(HtmlTextKey) + pKey->n
+    );
+    assert(size >= sizeof(Tcl_HashEntry));
+
+    hPtr = (Tcl_HashEntry *) HtmlAlloc("allocTextEntry()", size);
+    pStoredKey = (HtmlTextKey *)(hPtr->key.string);
+    pStoredKey->z = (char *)(&pStoredKey[1]);
+    pStoredKey->n = pKey->n;
+    memcpy((char *)pStoredKey->z, pKey->z, pKey->n);
+
+    return hPtr;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTextKeyHashType --
+ *
+ *     Return a pointer to the hash key type for text-key hashes. The
+ *     key-type for the hash-table is HtmlTextKey (see htmlprop.h).
+ *
+ * Results:
+ *     Pointer to hash_key_type (see above).
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+Tcl_HashKeyType * 
+HtmlTextKeyHashType() 
+{
+    /*
+     * Hash key type for text-key hash.
+     */
+    static Tcl_HashKeyType hash_key_type = {
+        TCL_HASH_KEY_TYPE_VERSION,          /* version */
+        0,                                  /* flags */
+        hashTextKey,                        /* hashKeyProc */
+        compareTextKey,                     /* compareKeysProc */
+        allocTextEntry,                     /* allocEntryProc */
+        freeCaseInsensitiveEntry            /* freeEntryProc */
+    };
+    return &hash_key_type;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
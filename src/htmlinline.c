@@ -64,6 +64,10 @@ static const char rcsid[] = "$Id: htmlinline.c,v 1.60 2008/01/12 14:23:05 daniel
  *     HtmlInlineContextPushBorder()
  *     HtmlInlineContextPopBorder()
  *
+ * MEASURE LINE BOXES (WITHOUT DRAWING THEM):
+ *
+ *     HtmlInlineContextSizeLines()
+ *
  * QUERY:
  * 
  *     HtmlInlineContextIsEmpty()
@@ -169,6 +173,13 @@ struct InlineContext {
     int iTextIndent;        /* Pixels of 'text-indent' for next line */
     int ignoreLineHeight;   /* Boolean - true to ignore lineHeight */
 
+    /* Range of line-box widths passed to HtmlInlineContextGetLineBox() over
+     * which every line break made so far would have been made at the same
+     * inline box. See HtmlInlineContextWidthRange().
+     */
+    int iMinWidth;
+    int iMaxWidth;
+
     int nInline;            /* Number of inline boxes in aInline */
     int nInlineAlloc;       /* Number of slots allocated in aInline */
     InlineBox *aInline;     /* Array of inline boxes. */
@@ -951,18 +962,22 @@ calculateLineBoxHeight(pContext, nBox, hasText, piTop, piBottom)
 }
 
 static int
-calculateLineBoxWidth(p, flags, iReqWidth, piWidth, pnBox, pHasText)
+calculateLineBoxWidth(p, flags, iReqWidth, piWidth, pnBox, pHasText, piMin, piMax)
     InlineContext *p;        /* Inline context */
     int flags;               /* As for HtmlInlineContextGetLineBox() */
     int iReqWidth;           /* Requested line box width */
     int *piWidth;            /* OUT: Width of line box */
     int *pnBox;              /* OUT: Number of inline tokens in line box */
     int *pHasText;           /* OUT: True if there is a text or newline box */
+    int *piMin;              /* OUT: Smallest iReqWidth giving same break */
+    int *piMax;              /* OUT: Largest iReqWidth giving same break */
 {
     int nBox = 0;
     int iWidth = 0;
     int ii = 0;
     int hasText = 0;
+    int iMin = 0;
+    int iMax = INT_MAX;
 
     int isForceLine = (flags & LINEBOX_FORCELINE);
     int isForceBox = (flags & LINEBOX_FORCEBOX);
@@ -999,8 +1014,12 @@ calculateLineBoxWidth(p, flags, iReqWidth, piWidth, pnBox, pHasText)
 
         if ((iWidth + iBoxW > iReqWidth) && (!isForceBox || nBox > 0)) { 
             /* pBox will not fit on the line box. Break out of this loop. */
+            iMax = iWidth + iBoxW - 1;
             break;
         }
+        if (iWidth + iBoxW <= iReqWidth) {
+            iMin = iWidth + iBoxW;
+        }
         iWidth += iBoxW;
 
         if (eType == INLINE_TEXT) {
@@ -1035,9 +1054,13 @@ calculateLineBoxWidth(p, flags, iReqWidth, piWidth, pnBox, pHasText)
          */
         int dummy1;
         int dummy2;
+        int dummy3;
+        int dummy4;
         int flags = LINEBOX_FORCEBOX | LINEBOX_FORCELINE;
         assert(isForceBox == 0);
-        calculateLineBoxWidth(p, flags, 0, &iWidth, &dummy1, &dummy2);
+        calculateLineBoxWidth(p, flags, 0, &iWidth, &dummy1, &dummy2,
+            &dummy3, &dummy4
+        );
         goto exit_calculatewidth;
     }
 
@@ -1048,6 +1071,8 @@ calculateLineBoxWidth(p, flags, iReqWidth, piWidth, pnBox, pHasText)
     *piWidth = iWidth;
     *pnBox = nBox;
     *pHasText = hasText;
+    *piMin = iMin;
+    *piMax = iMax;
 
 #if 0
     assert(nBox > 0 || iWidth > 0 || p->nInline == 0 || !isForceLine);
@@ -1149,6 +1174,8 @@ HtmlInlineContextGetLineBox(pLayout, p, flags, pWidth, pCanvas, pVSpace,pAscent)
 
     /* The amount of horizontal space available in which to stack boxes */
     const int iReqWidth = MAX(*pWidth - p->iTextIndent, 0);
+    int iMinReq;             /* Range of iReqWidth values that would have */
+    int iMaxReq;             /* broken this line-box at the same place */
 
     HtmlCanvas content;      /* Canvas for content (as opposed to borders) */
     HtmlCanvas borders;      /* Canvas for borders */
@@ -1166,10 +1193,21 @@ HtmlInlineContextGetLineBox(pLayout, p, flags, pWidth, pCanvas, pVSpace,pAscent)
      *       LINEBOX_FORCEBOX flag is not set. In this case iLineWidth
      *       is set to the width required by the first inline token.
      */
-    if (!calculateLineBoxWidth(p,flags,iReqWidth,&iLineWidth,&nBox,&hasText)) {
+    if (!calculateLineBoxWidth(
+            p, flags, iReqWidth, &iLineWidth, &nBox, &hasText, 
+            &iMinReq, &iMaxReq
+    )) {
+        p->iMinWidth = MAX(p->iMinWidth, iMinReq + p->iTextIndent);
+        if (iMaxReq < INT_MAX) {
+            p->iMaxWidth = MIN(p->iMaxWidth, iMaxReq + p->iTextIndent);
+        }
         *pWidth = iLineWidth;
         return 0;
     }
+    p->iMinWidth = MAX(p->iMinWidth, iMinReq + p->iTextIndent);
+    if (iMaxReq < INT_MAX) {
+        p->iMaxWidth = MIN(p->iMaxWidth, iMaxReq + p->iTextIndent);
+    }
     assert(nBox <= p->nInline);
 
     /* Figure out the line-box height */
@@ -1267,7 +1305,8 @@ HtmlInlineContextGetLineBox(pLayout, p, flags, pWidth, pCanvas, pVSpace,pAscent)
                 pBox[-1].eType == INLINE_TEXT &&
                 pBox->pNode == pBox[-1].pNode &&
                 nExtra <= 0.0 && 
-                pFont->space_pixels == pBox[-1].nSpace
+                pFont->space_pixels == pBox[-1].nSpace &&
+                HtmlDrawTextSpaceFollows(&content)
             ) {
                 int iWidth = pBox->canvas.right;
                 int nChar = HtmlDrawTextLength(&pBox->canvas) + 1;
@@ -1471,6 +1510,114 @@ HtmlInlineContextGetLineBox(pLayout, p, flags, pWidth, pCanvas, pVSpace,pAscent)
     return 1;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlInlineContextSizeLines --
+ *
+ *     Break all inline-boxes currently held by pContext into line-boxes
+ *     as HtmlInlineContextGetLineBox() would if it were called repeatedly
+ *     with *pWidth set to iWidth and both the LINEBOX_FORCELINE and
+ *     LINEBOX_FORCEBOX flags set. Instead of drawing each line-box, just
+ *     measure it. This is used by the intrinsic width calculation in
+ *     htmllayout.c. The inline-context is empty when this function returns.
+ *
+ * Results:
+ *     The width of the widest line-box, or 0 if there were no inline-boxes.
+ *
+ * Side effects:
+ *     Removes all inline-boxes from pContext.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlInlineContextSizeLines(p, iWidth)
+    InlineContext *p;
+    int iWidth;
+{
+    InlineBox *aInline = p->aInline;
+    InlineBorder *pBorder;
+    int iRet = 0;
+
+    while (p->nInline > 0) {
+        const int flags = LINEBOX_FORCELINE|LINEBOX_FORCEBOX;
+        int iReqWidth = MAX(iWidth - p->iTextIndent, 0);
+        int iLineWidth;
+        int nBox;
+        int hasText;
+        int iMinReq;
+        int iMaxReq;
+
+        int x = p->iTextIndent;
+        int iRight = 0;
+        int ignoreSpace = 1;
+        int i;
+
+        calculateLineBoxWidth(p, flags, iReqWidth, 
+            &iLineWidth, &nBox, &hasText, &iMinReq, &iMaxReq
+        );
+        assert(nBox > 0);
+
+        /* Figure out the right edge of the content drawn for the line-box,
+         * following the same steps as HtmlInlineContextGetLineBox(). Also
+         * keep the lists of active inline-borders up to date.
+         */
+        for (i = 0; i < nBox; i++) {
+            InlineBox *pBox = &p->aInline[i];
+            int j;
+
+            pBorder = pBox->pBorderStart;
+            for ( ; pBorder; pBorder = pBorder->pNext) {
+                if (!pBorder->pNext) {
+                    pBorder->pNext = p->pBorders;
+                    p->pBorders = pBox->pBorderStart;
+                    break;
+                }
+            }
+
+            x += pBox->nLeftPixels;
+            if (pBox->eType == INLINE_TEXT && pBox->pNode) {
+                iRight = MAX(iRight, x + pBox->nContentPixels);
+            }
+            x += pBox->nContentPixels + pBox->nRightPixels;
+            if (pBox->nRightPixels > 0) {
+                iRight = MAX(iRight, x);
+            }
+
+            for (j = 0; j < pBox->nBorderEnd; j++) {
+                pBorder = p->pBorders;
+                if (!pBorder) {
+                    pBorder = p->pBoxBorders;
+                    assert(pBorder);
+                    p->pBoxBorders = pBorder->pNext;
+                } else {
+                    p->pBorders = pBorder->pNext;
+                    HtmlFree(pBorder);
+                }
+            }
+
+            if (
+                pBox->eType != INLINE_SPACER || 
+                pBox->eWhitespace == CSS_CONST_PRE
+            ) {
+                ignoreSpace = 0;
+            }
+            if (!ignoreSpace) {
+                x += pBox->nSpace;
+            }
+            HtmlDrawCleanup(p->pTree, &pBox->canvas);
+        }
+        iRet = MAX(iRet, iRight);
+
+        p->aInline += nBox;
+        p->nInline -= nBox;
+        p->iTextIndent = 0;
+    }
+
+    p->aInline = aInline;
+    return iRet;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1625,6 +1772,8 @@ HtmlInlineContextNew(pTree, pNode, isSizeOnly, iTextIndent)
      */
     pContext->iTextIndent = iTextIndent;
     pContext->isSizeOnly = isSizeOnly;
+    pContext->iMinWidth = 0;
+    pContext->iMaxWidth = INT_MAX;
 
     START_LOG(pNode)
         const char *zTextAlign = HtmlCssConstantToString(pContext->eTextAlign);
@@ -1662,7 +1811,6 @@ HtmlInlineContextAddText(pContext, pNode)
 
     XColor *color;                 /* Color to render in */
     HtmlFont *pFont;               /* Font to render in */
-    Tk_Font tkfont;                /* Copy of pFont->tkfont */
     int eWhitespace;               /* Value of 'white-space' property */
 
     int sw;                        /* Space-Width in pFont. */
@@ -1677,7 +1825,6 @@ HtmlInlineContextAddText(pContext, pNode)
     pFont = pValues->fFont;
     eWhitespace = pValues->eWhitespace;
 
-    tkfont = pFont->tkfont;
     color = pValues->cColor->xcolor;
 
     sw = pFont->space_pixels;
@@ -1705,7 +1852,7 @@ HtmlInlineContextAddText(pContext, pNode)
 
                 p = inlineContextAddInlineCanvas(pContext, INLINE_TEXT, pNode);
 
-                tw = Tk_TextWidth(tkfont, zData, nData);
+                tw = HtmlFontTextWidth(pContext->pTree, pFont, zData, nData);
                 pBox = &pContext->aInline[pContext->nInline-1];
                 pBox->nContentPixels = tw;
                 pBox->eWhitespace = eWhitespace;
@@ -1822,6 +1969,36 @@ HtmlInlineContextAddBox(pContext, pNode, pCanvas, iWidth, iHeight, iOffset)
     HtmlInlineContextPopBorder(pContext, pBorder);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlInlineContextWidthRange --
+ *
+ *     Retrieve the range of widths that could have been passed to each
+ *     HtmlInlineContextGetLineBox() call made so far without changing
+ *     the inline box that each line-box was broken at. If all line-boxes
+ *     were offered the same width, then laying the context out again with
+ *     any width in the range [*piMin, *piMax] produces the same set of 
+ *     line-boxes (although text-align may position them differently).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlInlineContextWidthRange(pContext, piMin, piMax)
+    InlineContext *pContext;
+    int *piMin;                  /* OUT: Minimum width */
+    int *piMax;                  /* OUT: Maximum width */
+{
+    *piMin = pContext->iMinWidth;
+    *piMax = pContext->iMaxWidth;
+}
+
 HtmlNode *
 HtmlInlineContextCreator(pContext)
     InlineContext *pContext;
@@ -57,9 +57,6 @@ static const char rcsid[] = "$Id: htmllayout.c,v 1.270 2008/01/07 04:48:02 danie
 #define LOG(X) if ( \
 (X)->iNode >= 0 && pLayout->pTree->options.logcmd && 0 == pLayout->minmaxTest)
 
-/* Used for debugging the layout cache. Some output appears on stdout. */
-/* #define LAYOUT_CACHE_DEBUG */
-
 /*
  * The code to lay out a "normal-flow" is located in this file:
  *
@@ -107,15 +104,35 @@ struct NormalFlowCallback {
 };
 
 struct LayoutCache {
+    int minmaxTest;          /* Value of LayoutContext.minmaxTest */
+    int nByte;               /* Approximate memory used by this entry */
+    LayoutCache *pNext;      /* Next entry, in most recently used order */
+    HtmlLayoutCache *pOwner; /* Structure containing the pNext list */
+
+    /* Widget-wide list of cached layouts, in most recently used order,
+     * starting at HtmlTree.pLayoutCacheMru. Used to enforce the
+     * -layoutcachelimit option.
+     */
+    LayoutCache *pLruPrev;
+    LayoutCache *pLruNext;
+
     /* Cached input values for normalFlowLayout() */
     NormalFlow normalFlowIn;
     int iContaining;
     int iFloatLeft;
     int iFloatRight;
 
+    /* Range of iContaining values the cached output is valid for. If
+     * the line-boxes drawn would break in the same places for any width
+     * in this range, the layout can be reused when the containing block
+     * is resized. Otherwise both are set to iContaining.
+     */
+    int iMinContaining;
+    int iMaxContaining;
+
     /* Cached output values for normalFlowLayout() */
     NormalFlow normalFlowOut;
-    int iWidth;
+    int iWidth;                 /* Width of content, see normalFlowLayout() */
     int iHeight;
     HtmlCanvas canvas;
   
@@ -123,11 +140,21 @@ struct LayoutCache {
     int iMarginCollapse;
 };
 
+/*
+ * Each element node may have up to -layoutcachesize cached normal-flow
+ * layouts, stored in a linked list starting at HtmlLayoutCache.pCache.
+ * The list is kept in most recently used order, so that when an entry
+ * must be discarded it is the one at the tail of the list. Each entry is
+ * also part of a widget-wide list in the same order (see struct
+ * LayoutCache), from which entries are discarded when the total memory
+ * used exceeds -layoutcachelimit bytes.
+ */
 struct HtmlLayoutCache {
-    unsigned char flags;     /* Mask indicating validity of aCache[] entries */
-    LayoutCache aCache[3];
+    unsigned char flags;     /* Mask of CACHED_XXX_OK flags */
+    LayoutCache *pCache;     /* List of cached normal-flow layouts */
     int iMinWidth;
     int iMaxWidth;
+    HtmlTableRowCache *pTableRow;    /* Used by htmltable.c for table-rows */
 };
 #define CACHED_MINWIDTH_OK ((int)1<<3)
 #define CACHED_MAXWIDTH_OK ((int)1<<4)
@@ -138,10 +165,13 @@ struct HtmlLayoutCache {
  *
  *     HtmlLayoutInvalidateCache
  *     HtmlLayout
+ *     HtmlLayoutCacheStats
  *
  * Functions declared in htmllayout.h:
  *
  *     HtmlLayoutNodeContent
+ *     HtmlLayoutTableRowCache
+ *     HtmlLayoutCacheRelease
  *
  *     blockMinMaxWidth
  *     nodeGetMargins
@@ -3334,12 +3364,343 @@ normalFlowLayoutNode(pLayout, pBox, pNode, pY, pContext, pNormal)
 }
 
 
-#define LAYOUT_CACHE_N_USE_COND 6
-#ifdef LAYOUT_CACHE_DEBUG
-#define LAYOUT_CACHE_N_STORE_COND 9
-static int aDebugUseCacheCond[LAYOUT_CACHE_N_USE_COND + 1];
-static int aDebugStoreCacheCond[LAYOUT_CACHE_N_STORE_COND + 1];
-#endif
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutCacheUnlink --
+ * layoutCacheLink --
+ *
+ *     Remove pCache from, or add it to the head (most recently used end) 
+ *     of, the widget-wide list of cached layouts.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+layoutCacheUnlink(pTree, pCache)
+    HtmlTree *pTree;
+    LayoutCache *pCache;
+{
+    if (pCache->pLruPrev) {
+        pCache->pLruPrev->pLruNext = pCache->pLruNext;
+    } else {
+        assert(pTree->pLayoutCacheMru == pCache);
+        pTree->pLayoutCacheMru = pCache->pLruNext;
+    }
+    if (pCache->pLruNext) {
+        pCache->pLruNext->pLruPrev = pCache->pLruPrev;
+    } else {
+        assert(pTree->pLayoutCacheLru == pCache);
+        pTree->pLayoutCacheLru = pCache->pLruPrev;
+    }
+    pCache->pLruPrev = 0;
+    pCache->pLruNext = 0;
+}
+static void
+layoutCacheLink(pTree, pCache)
+    HtmlTree *pTree;
+    LayoutCache *pCache;
+{
+    pCache->pLruPrev = 0;
+    pCache->pLruNext = pTree->pLayoutCacheMru;
+    if (pCache->pLruNext) {
+        pCache->pLruNext->pLruPrev = pCache;
+    } else {
+        pTree->pLayoutCacheLru = pCache;
+    }
+    pTree->pLayoutCacheMru = pCache;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutCacheFree --
+ *
+ *     Free a single cached normal-flow layout. The caller must have
+ *     already removed pCache from the HtmlLayoutCache.pCache list.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Removes pCache from the widget-wide list and updates the layout 
+ *     cache accounting in pTree.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+layoutCacheFree(pTree, pCache)
+    HtmlTree *pTree;
+    LayoutCache *pCache;
+{
+    layoutCacheUnlink(pTree, pCache);
+    HtmlDrawCleanup(pTree, &pCache->canvas);
+    pTree->nLayoutCacheByte -= pCache->nByte;
+    pTree->nLayoutCacheEntry--;
+    HtmlFree(pCache);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutCacheSameInput --
+ *
+ *     Return true if cached layouts p1 and p2 were generated from the
+ *     same normalFlowLayout() inputs.
+ *
+ * Results:
+ *     Boolean.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+layoutCacheSameInput(p1, p2)
+    LayoutCache *p1;
+    LayoutCache *p2;
+{
+    return (
+        p1->minmaxTest == p2->minmaxTest &&
+        p1->iContaining == p2->iContaining &&
+        p1->iFloatLeft == p2->iFloatLeft &&
+        p1->iFloatRight == p2->iFloatRight &&
+        p1->normalFlowIn.isValid == p2->normalFlowIn.isValid &&
+        p1->normalFlowIn.iMinMargin == p2->normalFlowIn.iMinMargin &&
+        p1->normalFlowIn.iMaxMargin == p2->normalFlowIn.iMaxMargin &&
+        p1->normalFlowIn.nonegative == p2->normalFlowIn.nonegative
+    );
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutCacheInsert --
+ *
+ *     Add new cached layout pCache to the head of the list of layouts
+ *     cached for an element. Any existing entry generated from the same
+ *     inputs is discarded. Then, if the element has more than 
+ *     -layoutcachesize cached layouts, entries are discarded from the tail
+ *     (least recently used end) of the list. Finally, while the 
+ *     approximate memory used by all layouts cached by the widget exceeds
+ *     -layoutcachelimit bytes, the least recently used entry in the
+ *     widget-wide list is discarded, whichever element it belongs to. 
+ *     The new entry itself is never discarded.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May free other cached layouts.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+layoutCacheInsert(pTree, pLayoutCache, pCache)
+    HtmlTree *pTree;
+    HtmlLayoutCache *pLayoutCache;
+    LayoutCache *pCache;
+{
+    int nMax = MAX(1, pTree->options.layoutcachesize);
+    int nLimit = pTree->options.layoutcachelimit;
+    int nEntry = 1;
+    LayoutCache **pp;
+
+    pCache->pNext = pLayoutCache->pCache;
+    pCache->pOwner = pLayoutCache;
+    pLayoutCache->pCache = pCache;
+    layoutCacheLink(pTree, pCache);
+    pTree->nLayoutCacheByte += pCache->nByte;
+    pTree->nLayoutCacheEntry++;
+
+    pp = &pCache->pNext;
+    while (*pp) {
+        LayoutCache *p = *pp;
+        if (layoutCacheSameInput(p, pCache)) {
+            *pp = p->pNext;
+            layoutCacheFree(pTree, p);
+        } else if (nEntry >= nMax) {
+            *pp = p->pNext;
+            layoutCacheFree(pTree, p);
+            pTree->nLayoutCacheEvict++;
+        } else {
+            nEntry++;
+            pp = &p->pNext;
+        }
+    }
+
+    while (
+        nLimit > 0 && pTree->nLayoutCacheByte > nLimit && 
+        pTree->pLayoutCacheLru != pCache
+    ) {
+        LayoutCache *p = pTree->pLayoutCacheLru;
+        for (pp = &p->pOwner->pCache; *pp != p; pp = &(*pp)->pNext);
+        *pp = p->pNext;
+        layoutCacheFree(pTree, p);
+        pTree->nLayoutCacheEvict++;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlLayoutCacheRelease --
+ *
+ *     The display list of a cached layout may be linked into at most one
+ *     other canvas at a time (see HtmlDrawCopyCanvas()). When a layout
+ *     cached for pNode is linked into a layout cached for one of its
+ *     ancestors, it cannot be reused until the ancestor's entry is freed.
+ *
+ *     This function is called when pCanvas, the display list of a layout
+ *     cached for pNode (by normalFlowLayout() or, for table rows, by
+ *     htmltable.c), could otherwise be reused but is shared in this way.
+ *     Since the ancestors of pNode are currently being laid out from
+ *     scratch, any of their cached layouts that are not themselves in use
+ *     are discarded, starting with the parent of pNode, until pCanvas is
+ *     no longer shared or the root of the tree is reached.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May free cached layouts of ancestors of pNode.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlLayoutCacheRelease(pTree, pNode, pCanvas)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    HtmlCanvas *pCanvas;
+{
+    HtmlNode *pParent;
+    for (
+        pParent = HtmlNodeParent(pNode); 
+        pParent && HtmlDrawCanvasIsShared(pCanvas);
+        pParent = HtmlNodeParent(pParent)
+    ) {
+        HtmlElementNode *pElem = (HtmlElementNode *)pParent;
+        LayoutCache **pp = 0;
+        if (pElem->pLayoutCache) {
+            pp = &pElem->pLayoutCache->pCache;
+        }
+        while (pp && *pp) {
+            LayoutCache *p = *pp;
+            if (!HtmlDrawCanvasIsShared(&p->canvas)) {
+                *pp = p->pNext;
+                layoutCacheFree(pTree, p);
+                pTree->nLayoutCacheEvict++;
+            } else {
+                pp = &p->pNext;
+            }
+        }
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * layoutCacheCheck --
+ *
+ *     Check if cached layout pCache may be used for a call to 
+ *     normalFlowLayout() with the arguments passed to 
+ *     normalFlowLayoutFromCache(). See the conditions listed in the 
+ *     comments above that function.
+ *
+ * Results:
+ *     Zero if pCache may be used, otherwise the number of the first
+ *     condition (3 or greater) that is not met.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+layoutCacheCheck(pBox, pNormal, iLeft, iRight, pCache)
+    BoxContext *pBox;
+    NormalFlow *pNormal;
+    int iLeft;
+    int iRight;
+    LayoutCache *pCache;
+{
+#define COND(x, y) if (!(y)) return (x)
+    COND(3, 
+        pBox->iContaining == pCache->iContaining || (
+            pBox->iContaining >= pCache->iMinContaining &&
+            pBox->iContaining <= pCache->iMaxContaining
+        )
+    );
+    COND(4,
+        pNormal->isValid    == pCache->normalFlowIn.isValid &&
+        pNormal->iMinMargin == pCache->normalFlowIn.iMinMargin &&   
+        pNormal->iMaxMargin == pCache->normalFlowIn.iMaxMargin &&
+        pNormal->nonegative == pCache->normalFlowIn.nonegative
+    );
+    COND(5, 
+        iLeft == pCache->iFloatLeft && 
+        iRight - pBox->iContaining == pCache->iFloatRight - pCache->iContaining
+    );
+    COND(6, HtmlFloatListIsConstant(pNormal->pFloat, 0, pCache->iHeight));
+#undef COND
+    return 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * inlineContentIsWidthInvariant --
+ *
+ *     Return true if the descendants of pNode consist only of text and
+ *     static, non-floating, non-replaced "display:inline" elements with no
+ *     horizontal margins or padding specified as percentages. Such content
+ *     generates exactly the same inline boxes regardless of the width of
+ *     the containing block, so only the positions of line breaks depend on
+ *     the width.
+ *
+ * Results:
+ *     Boolean.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+inlineContentIsWidthInvariant(pNode)
+    HtmlNode *pNode;
+{
+    int ii;
+    for (ii = 0; ii < HtmlNodeNumChildren(pNode); ii++) {
+        HtmlNode *pChild = HtmlNodeChild(pNode, ii);
+        HtmlComputedValues *pV;
+        if (HtmlNodeIsText(pChild)) continue;
+
+        pV = HtmlNodeComputedValues(pChild);
+        if (DISPLAY(pV) == CSS_CONST_NONE) continue;
+        if (
+            DISPLAY(pV) != CSS_CONST_INLINE ||
+            pV->eFloat != CSS_CONST_NONE ||
+            pV->ePosition != CSS_CONST_STATIC ||
+            (pV->mask & (
+                PROP_MASK_MARGIN_LEFT | PROP_MASK_MARGIN_RIGHT |
+                PROP_MASK_PADDING_LEFT | PROP_MASK_PADDING_RIGHT
+            )) ||
+            nodeIsReplaced(pChild) ||
+            HtmlNodeBefore(pChild) || HtmlNodeAfter(pChild) ||
+            !inlineContentIsWidthInvariant(pChild)
+        ) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
 /*
  *---------------------------------------------------------------------------
@@ -3358,20 +3719,32 @@ static int aDebugStoreCacheCond[LAYOUT_CACHE_N_STORE_COND + 1];
  *     If the cache is not present or cannot be used, this function returns
  *     zero. In this case normalFlowLayout() should proceed.
  * 
- *     See also normalFlowLayoutToCache(), the function that creates
- *     the layout-cache used by this routine.
+ *     See also normalFlowLayout(), the function that creates the 
+ *     layout-cache used by this routine. Each of the layouts cached for 
+ *     pNode is tried in turn, most recently used first. A cached layout
+ *     may be used if:
  *
  *         1. The widget -layoutcache option is set to true.
- *         2. A valid layout cache exists for pNode.
+ *         2. The layout was cached for the same kind of layout (normal
+ *            or one of the min/max width tests).
  *         3. The width allocated for node content is the same as when the
  *            the cache was generated.
  *         4. The vertical margins that will collapse with the top margin of 
  *            the first block in this flow are the same as they were when the
  *            cache was generated.
  *         5. The current floating margins are the same as they were when 
- *            the cache was generated and there are no new floating margins
- *            in the float list that affect the area where the cached 
- *            layout is to be placed.
+ *            the cache was generated.
+ *         6. There are no new floating margins in the float list that 
+ *            affect the area where the cached layout is to be placed.
+ *         7. The cached display list is not already linked into some 
+ *            other canvas (see HtmlLayoutCacheRelease()).
+ *
+ *     The layout used, if any, is moved to the head of the list. The 
+ *     outcome is recorded in the HtmlTree.aLayoutCacheUse[] counters:
+ *     element 0 counts hits, element N counts misses for which condition
+ *     N was the first not met by the most recently used layout cached
+ *     for the same kind of layout (or by all layouts, for conditions 1 
+ *     and 2).
  *
  * Results:
  *     Non-zero if the cache associated with pNode contained a usable
@@ -3391,42 +3764,44 @@ normalFlowLayoutFromCache(pLayout, pBox, pElem, pNormal, iLeft, iRight)
     int iLeft;
     int iRight;
 {
-    int cache_mask = (1 << pLayout->minmaxTest);
-
-    HtmlFloatList   *pFloat = pNormal->pFloat;
+    HtmlTree *pTree = pLayout->pTree;
     HtmlLayoutCache *pLayoutCache = pElem->pLayoutCache;
-    LayoutCache     *pCache = &pLayoutCache->aCache[pLayout->minmaxTest];
+    LayoutCache *pCache = 0;
+    int iFail = 0;
 
     assert(pNormal->isValid == 0 || pNormal->isValid == 1);
 
-#ifdef LAYOUT_CACHE_DEBUG
-  #define COND(x, y) ( (y) || ((aDebugUseCacheCond[x]++) < 0) )
-#else
-  #define COND(x, y) (y)
-#endif
-
-    if ( 0 == (
-        COND(1, pLayout->pTree->options.layoutcache) &&
-        COND(2, pLayoutCache && (pLayoutCache->flags & cache_mask)) &&
-        COND(3, pBox->iContaining == pCache->iContaining) &&
-        COND(4,
-            pNormal->isValid    == pCache->normalFlowIn.isValid &&
-            pNormal->iMinMargin == pCache->normalFlowIn.iMinMargin &&   
-            pNormal->iMaxMargin == pCache->normalFlowIn.iMaxMargin &&
-            pNormal->nonegative == pCache->normalFlowIn.nonegative
-        ) &&
-        COND(5, iLeft == pCache->iFloatLeft && iRight == pCache->iFloatRight) &&
-        COND(6, HtmlFloatListIsConstant(pFloat, 0, pCache->iHeight))
-    )) {
-        if (pLayoutCache) {
-            HtmlDrawCleanup(pLayout->pTree, &pCache->canvas);
+    if (!pTree->options.layoutcache) {
+        iFail = 1;
+    } else if (pLayoutCache) {
+        LayoutCache **pp = &pLayoutCache->pCache;
+        for ( ; *pp; pp = &(*pp)->pNext) {
+            LayoutCache *p = *pp;
+            int rc;
+            if (p->minmaxTest != pLayout->minmaxTest) continue;
+            rc = layoutCacheCheck(pBox, pNormal, iLeft, iRight, p);
+            if (rc == 0 && HtmlDrawCanvasIsShared(&p->canvas)) {
+                HtmlLayoutCacheRelease(pTree, &pElem->node, &p->canvas);
+                if (HtmlDrawCanvasIsShared(&p->canvas)) rc = 7;
+            }
+            if (rc == 0) {
+                *pp = p->pNext;
+                p->pNext = pLayoutCache->pCache;
+                pLayoutCache->pCache = p;
+                layoutCacheUnlink(pTree, p);
+                layoutCacheLink(pTree, p);
+                pCache = p;
+                break;
+            }
+            if (!iFail) iFail = rc;
         }
-        return 0;
     }
 
-#ifdef LAYOUT_CACHE_DEBUG
-    aDebugUseCacheCond[0]++;
-#endif
+    if (!pCache) {
+        pTree->aLayoutCacheUse[iFail ? iFail : 2]++;
+        return 0;
+    }
+    pTree->aLayoutCacheUse[0]++;
 
     /* Hooray! A cached layout can be used. */
     assert(!pBox->vc.pFirst);
@@ -3439,7 +3814,7 @@ normalFlowLayoutFromCache(pLayout, pBox, pElem, pNormal, iLeft, iRight)
         }
     }
     HtmlDrawCopyCanvas(&pBox->vc, &pCache->canvas);
-    pBox->width = pCache->iWidth;
+    pBox->width = MAX(pBox->width, pCache->iWidth);
     assert(pCache->iHeight >= pBox->height);
     pBox->height = pCache->iHeight;
     pNormal->iMaxMargin = pCache->normalFlowOut.iMaxMargin;
@@ -3495,15 +3870,16 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
     int left = 0; 
     int right = pBox->iContaining;
     int overhang;
+    int iMinContaining;
+    int iMaxContaining;
+    int iWidthIn;                     /* Value of pBox->width on entry */
+    int iContentWidth;                /* Width of content of pNode */
 
     HtmlComputedValues *pV = HtmlNodeComputedValues(pNode);
     int isSizeOnly = pLayout->minmaxTest;
     int iTextIndent = PIXELVAL(pV, TEXT_INDENT, pBox->iContaining);
 
-    HtmlLayoutCache *pLayoutCache = 0;
     LayoutCache *pCache = 0;
-    int cache_mask = (1 << pLayout->minmaxTest);
-
     NormalFlowCallback sCallback;
 
     HtmlElementNode *pElem = (HtmlElementNode *)pNode;
@@ -3529,27 +3905,19 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
         return;
     }
 
-    /* If the structure for cached layout has not yet been allocated,
-     * allocate it now. The corresponding call to HtmlFree() is in
-     * the HtmlLayoutInvalidateCache() function.
-     * 
-     * Set pCache to point at the LayoutCache object used to cache
-     * this call. Boolean variable isCacheValid indicates whether or
-     * not the contents of pCache are currently valid.
+    /* Allocate a new LayoutCache entry and record the input values for
+     * this call in it. If the layout may be cached, the entry is added
+     * to the layout-cache of pNode below. Otherwise it is freed.
      */
-    if (!pElem->pLayoutCache) {
-        pElem->pLayoutCache = HtmlNew(HtmlLayoutCache);
-    }
-    pLayoutCache = pElem->pLayoutCache;
-    pCache = &pLayoutCache->aCache[pLayout->minmaxTest];
-
-    HtmlDrawCleanup(pLayout->pTree, &pCache->canvas);
-    pLayoutCache->flags &= ~(cache_mask);
+    pCache = HtmlNew(LayoutCache);
+    pCache->minmaxTest = pLayout->minmaxTest;
     pCache->normalFlowIn.iMaxMargin = pNormal->iMaxMargin;
     pCache->normalFlowIn.iMinMargin = pNormal->iMinMargin;
     pCache->normalFlowIn.isValid = pNormal->isValid;
     pCache->normalFlowIn.nonegative = pNormal->nonegative;
     pCache->iContaining = pBox->iContaining;
+    pCache->iMinContaining = pBox->iContaining;
+    pCache->iMaxContaining = pBox->iContaining;
     pCache->iFloatLeft = left;
     pCache->iFloatRight = right;
     pCache->iMarginCollapse = PIXELVAL_AUTO;
@@ -3559,6 +3927,15 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
     sCallback.pNext = 0;
     normalFlowCbAdd(pNormal, &sCallback);
 
+    /* The caller may have set pBox->width to the width of the containing
+     * block. Lay out the content with pBox->width set to zero, so that the
+     * cache records only the width of the content itself. A cached layout
+     * may be reused for a different containing block width (see 
+     * layoutCacheCheck()).
+     */
+    iWidthIn = pBox->width;
+    pBox->width = 0;
+
     /* Create the InlineContext object for this containing box */
     pContext = HtmlInlineContextNew(
             pLayout->pTree, pNode, isSizeOnly, iTextIndent
@@ -3595,6 +3972,7 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
     HtmlInlineContextPopBorder(pContext, pBorder);
 
     rc = inlineLayoutDrawLines(pLayout, pBox, pContext, 1, &y, pNormal);
+    HtmlInlineContextWidthRange(pContext, &iMinContaining, &iMaxContaining);
     HtmlInlineContextCleanup(pContext);
 
     /* If this element is a list-item with "list-style-position:outside", 
@@ -3629,12 +4007,10 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
 
     normalFlowCbDelete(pNormal, &sCallback);
 
-#undef COND
-#ifdef LAYOUT_CACHE_DEBUG
-  #define COND(x, y) ( (y) || ((aDebugStoreCacheCond[x]++) < 0) )
-#else
-  #define COND(x, y) (y)
-#endif
+    iContentWidth = pBox->width;
+    pBox->width = MAX(iWidthIn, iContentWidth);
+
+#define COND(x, y) ((y) || ((pLayout->pTree->aLayoutCacheStore[x]++) < 0))
 
     if (
         COND(1, pLayout->pTree->options.layoutcache) && 
@@ -3649,13 +4025,37 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
     ) {
         HtmlDrawOrigin(&pBox->vc);
         HtmlDrawCopyCanvas(&pCache->canvas, &pBox->vc);
-        pCache->iWidth = pBox->width;
+        pCache->iWidth = iContentWidth;
         pCache->iHeight = pBox->height;
         pCache->normalFlowOut.iMaxMargin = pNormal->iMaxMargin;
         pCache->normalFlowOut.iMinMargin = pNormal->iMinMargin;
         pCache->normalFlowOut.isValid = pNormal->isValid;
         pCache->normalFlowOut.nonegative = pNormal->nonegative;
-        pLayoutCache->flags |= cache_mask;
+
+        /* If no floating boxes intrude into this block, the line-boxes are
+         * left-aligned and the inline content does not depend on the width
+         * of the containing block, then this layout is also valid for any
+         * containing block width that breaks the lines in the same places.
+         */
+        if (
+            pCache->iFloatLeft == 0 && 
+            pCache->iFloatRight == pBox->iContaining &&
+            HtmlFloatListIsConstant(pFloat, 0, pBox->height) &&
+            !(pV->mask & PROP_MASK_TEXT_INDENT) &&
+            (isSizeOnly || (
+                pV->eTextAlign != CSS_CONST_CENTER &&
+                pV->eTextAlign != CSS_CONST__TKHTML_CENTER &&
+                pV->eTextAlign != CSS_CONST_RIGHT &&
+                pV->eTextAlign != CSS_CONST__TKHTML_RIGHT &&
+                pV->eTextAlign != CSS_CONST_JUSTIFY
+            )) &&
+            iMinContaining <= pBox->iContaining &&
+            iMaxContaining >= pBox->iContaining &&
+            inlineContentIsWidthInvariant(pNode)
+        ) {
+            pCache->iMinContaining = iMinContaining;
+            pCache->iMaxContaining = iMaxContaining;
+        }
 
         LOG(pNode) {
             HtmlTree *pTree = pLayout->pTree;
@@ -3663,22 +4063,348 @@ normalFlowLayout(pLayout, pBox, pNode, pNormal)
                 "Cached layout for node:"
                 "<ul><li>width = %d"
                 "    <li>height = %d"
+                "    <li>containing = %d..%d"
                 "</ul>",
                 Tcl_GetString(HtmlNodeCommand(pTree, pNode)),
-                pCache->iWidth, pCache->iHeight
+                pCache->iWidth, pCache->iHeight,
+                pCache->iMinContaining, pCache->iMaxContaining
 		    , NULL);
         }
 
-#ifdef LAYOUT_CACHE_DEBUG
-        aDebugStoreCacheCond[0]++;
-#endif
+        /* Add the new entry to the layout-cache for pNode. If the 
+         * HtmlLayoutCache structure has not yet been allocated, allocate
+         * it now. The corresponding call to HtmlFree() is in the
+         * HtmlLayoutInvalidateCache() function.
+         */
+        if (!pElem->pLayoutCache) {
+            pElem->pLayoutCache = HtmlNew(HtmlLayoutCache);
+        }
+        pCache->nByte = sizeof(LayoutCache);
+        pCache->nByte += HtmlDrawCanvasSize(&pCache->canvas);
+        layoutCacheInsert(pLayout->pTree, pElem->pLayoutCache, pCache);
+        pLayout->pTree->aLayoutCacheStore[0]++;
+    } else {
+        HtmlFree(pCache);
     }
+#undef COND
 
     CHECK_INTEGER_PLAUSIBILITY(pBox->vc.bottom);
     CHECK_INTEGER_PLAUSIBILITY(pBox->vc.right);
     return;
 }
 
+/*
+ * An instance of the following structure is used by the intrinsicXXX()
+ * functions below while measuring the content of a single normal-flow.
+ */
+typedef struct IntrinsicFlow IntrinsicFlow;
+struct IntrinsicFlow {
+    LayoutContext *pLayout;
+    InlineContext *pContext;   /* Inline context for the flow */
+    int iWidth;                /* Width to break line-boxes at */
+    int iResult;               /* Widest line-box or block seen so far */
+};
+
+static int intrinsicBlockWidth(LayoutContext *, HtmlNode *, int *);
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * intrinsicNode --
+ * intrinsicChildren --
+ *
+ *     Add the content generated by pNode (or by the children of pNode)
+ *     to the intrinsic width measurement *p. These mirror functions
+ *     normalFlowLayoutNode() and layoutChildren(), except that nothing
+ *     is drawn.
+ *
+ * Results:
+ *     Zero if successful, or non-zero if pNode generates content that
+ *     the intrinsic width code does not handle (i.e. a floating box). In
+ *     this case the caller must fall back to a full size-only layout.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int intrinsicChildren(IntrinsicFlow *, HtmlNode *);
+static int
+intrinsicNode(p, pNode)
+    IntrinsicFlow *p;
+    HtmlNode *pNode;
+{
+    LayoutContext *pLayout = p->pLayout;
+    HtmlComputedValues *pV;
+    int eDisplay;
+
+    if (!pNode) return 0;
+    if (HtmlNodeIsText(pNode)) {
+        HtmlInlineContextAddText(p->pContext, pNode);
+        return 0;
+    }
+
+    pV = HtmlNodeComputedValues(pNode);
+    eDisplay = DISPLAY(pV);
+
+    if (eDisplay == CSS_CONST_NONE) {
+        return 0;
+    } else if (eDisplay == CSS_CONST_INLINE) {
+        InlineBorder *pBorder;
+        int rc;
+        if (nodeIsReplaced(pNode)) return 1;
+
+        pBorder = HtmlGetInlineBorder(pLayout, p->pContext, pNode);
+        HtmlInlineContextPushBorder(p->pContext, pBorder);
+        rc = intrinsicChildren(p, pNode);
+        HtmlInlineContextPopBorder(p->pContext, pBorder);
+
+        /* See the comments regarding the BR element at the end of
+         * normalFlowLayoutNode(). 
+         */
+        if (HtmlNodeTagType(pNode) == Html_BR && pV->eClear != CSS_CONST_NONE){
+            int w = HtmlInlineContextSizeLines(p->pContext, p->iWidth);
+            p->iResult = MAX(p->iResult, w);
+        }
+        return rc;
+    } else if (
+        eDisplay == CSS_CONST_INLINE_BLOCK ||
+        eDisplay == CSS_CONST__TKHTML_INLINE_BUTTON
+    ) {
+        return 1;
+    } else if (
+        pV->ePosition == CSS_CONST_ABSOLUTE || 
+        pV->ePosition == CSS_CONST_FIXED
+    ) {
+        /* Ignored during min-max tests. See normalFlowLayoutAbsolute(). */
+        return 0;
+    } else if (pV->eFloat != CSS_CONST_NONE || nodeIsReplaced(pNode)) {
+        return 1;
+    } else if (eDisplay == CSS_CONST_BLOCK || eDisplay == CSS_CONST_LIST_ITEM) {
+        BoxProperties box;
+        MarginProperties margin;
+        int iWidth;
+        int w;
+
+        if (pV->eOverflow != CSS_CONST_VISIBLE) return 1;
+
+        /* Percentage 'min-width', 'max-width' and horizontal padding and
+         * margin values depend on the width of the containing block, 
+         * which is not known here. 
+         */
+        if (pV->mask & (
+            PROP_MASK_MIN_WIDTH | PROP_MASK_MAX_WIDTH |
+            PROP_MASK_MARGIN_LEFT | PROP_MASK_MARGIN_RIGHT |
+            PROP_MASK_PADDING_LEFT | PROP_MASK_PADDING_RIGHT
+        )) {
+            return 1;
+        }
+
+        /* Any pending line-boxes are completed before a block box. */
+        w = HtmlInlineContextSizeLines(p->pContext, p->iWidth);
+        p->iResult = MAX(p->iResult, w);
+
+        /* The block content is always measured, even if the 'width'
+         * property is not "auto", to make sure it does not contain
+         * anything (i.e. floats) that might affect the parent flow.
+         */
+        if (intrinsicBlockWidth(pLayout, pNode, &w)) return 1;
+
+        /* This block mirrors normalFlowLayoutBlock() and wrapContent(). */
+        nodeGetBoxProperties(pLayout, pNode, 0, &box);
+        nodeGetMargins(pLayout, pNode, 0, &margin);
+        iWidth = PIXELVAL(pV, WIDTH, PIXELVAL_AUTO);
+        w = getWidth(iWidth, w);
+        considerMinMaxWidth(pNode, 0, &w);
+        w += margin.margin_left + box.iLeft + box.iRight + margin.margin_right;
+        p->iResult = MAX(p->iResult, w);
+        return 0;
+    } else if (
+        eDisplay == CSS_CONST_TABLE ||
+        eDisplay == CSS_CONST_TABLE_CELL || 
+        eDisplay == CSS_CONST_TABLE_ROW
+    ) {
+        return 1;
+    }
+
+    return 0;
+}
+static int
+intrinsicChildren(p, pNode)
+    IntrinsicFlow *p;
+    HtmlNode *pNode;
+{
+    int ii;
+    if (intrinsicNode(p, HtmlNodeBefore(pNode))) return 1;
+    for (ii = 0; ii < HtmlNodeNumChildren(pNode); ii++) {
+        if (intrinsicNode(p, HtmlNodeChild(pNode, ii))) return 1;
+    }
+    return intrinsicNode(p, HtmlNodeAfter(pNode));
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * intrinsicContent --
+ *
+ *     Measure the minimum or maximum width (depending on the value of
+ *     pLayout->minmaxTest) of the content of block box pNode, without
+ *     laying it out. The content is walked once, word widths are
+ *     accumulated in a size-only inline context and line-boxes are
+ *     measured using HtmlInlineContextSizeLines(). The widths of block
+ *     boxes in the flow are computed recursively by intrinsicBlockWidth(),
+ *     which caches the results in the HtmlLayoutCache of each block.
+ *
+ *     Content that depends on the width of the containing block in ways
+ *     not handled here (floats, tables, replaced elements, percentage
+ *     'text-indent' values etc.) causes this function to fail. In this
+ *     case blockMinMaxWidth() falls back to a size-only layout.
+ *
+ * Results:
+ *     Zero if successful (and *pWidth is set), or non-zero otherwise.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+intrinsicContent(pLayout, pNode, pWidth)
+    LayoutContext *pLayout;
+    HtmlNode *pNode;
+    int *pWidth;
+{
+    HtmlComputedValues *pV = HtmlNodeComputedValues(pNode);
+    IntrinsicFlow sFlow;
+    InlineBorder *pBorder;
+    int iTextIndent;
+    int rc;
+    int w;
+
+    assert(pLayout->minmaxTest);
+    if (DISPLAY(pV) == CSS_CONST_NONE) {
+        *pWidth = 0;
+        return 0;
+    }
+    if (DISPLAY(pV) == CSS_CONST_TABLE || (pV->mask & PROP_MASK_TEXT_INDENT)) {
+        return 1;
+    }
+    if (
+        DISPLAY(pV) == CSS_CONST_LIST_ITEM &&
+        pV->eListStylePosition == CSS_CONST_INSIDE
+    ) {
+        return 1;
+    }
+
+    /* A negative 'text-indent' makes the width of the first line-box
+     * depend on the width of the containing block.
+     */
+    iTextIndent = PIXELVAL(pV, TEXT_INDENT, 0);
+    if (iTextIndent < 0) return 1;
+
+    memset(&sFlow, 0, sizeof(IntrinsicFlow));
+    sFlow.pLayout = pLayout;
+    sFlow.iWidth = (pLayout->minmaxTest == MINMAX_TEST_MAX) ? 10000 : 0;
+    sFlow.pContext = HtmlInlineContextNew(
+        pLayout->pTree, pNode, 1, iTextIndent
+    );
+
+    pBorder = HtmlGetInlineBorder(pLayout, sFlow.pContext, pNode);
+    HtmlInlineContextPushBorder(sFlow.pContext, pBorder);
+    rc = intrinsicChildren(&sFlow, pNode);
+    HtmlInlineContextPopBorder(sFlow.pContext, pBorder);
+
+    w = HtmlInlineContextSizeLines(sFlow.pContext, sFlow.iWidth);
+    HtmlInlineContextCleanup(sFlow.pContext);
+
+    *pWidth = MAX(sFlow.iResult, w);
+    return rc;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * intrinsicBlockWidth --
+ *
+ *     A wrapper around intrinsicContent() that caches the result in the
+ *     same HtmlLayoutCache fields as blockMinMaxWidth(). The cached values
+ *     are discarded along with the rest of the layout cache by
+ *     HtmlLayoutInvalidateCache().
+ *
+ * Results:
+ *     Zero if successful (and *pWidth is set), or non-zero otherwise.
+ *
+ * Side effects:
+ *     May allocate HtmlElementNode.pLayoutCache.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+intrinsicBlockWidth(pLayout, pNode, pWidth)
+    LayoutContext *pLayout;
+    HtmlNode *pNode;
+    int *pWidth;
+{
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    HtmlLayoutCache *pCache;
+    int isMin = (pLayout->minmaxTest == MINMAX_TEST_MIN);
+    int mask = (isMin ? CACHED_MINWIDTH_OK : CACHED_MAXWIDTH_OK);
+    int w;
+
+    if (!pElem->pLayoutCache) {
+        pElem->pLayoutCache = (HtmlLayoutCache *)HtmlClearAlloc(
+            "HtmlLayoutCache", sizeof(HtmlLayoutCache)
+        );
+    }
+    pCache = pElem->pLayoutCache;
+
+    if (!(pCache->flags & mask)) {
+        if (intrinsicContent(pLayout, pNode, &w)) return 1;
+        if (isMin) {
+            pCache->iMinWidth = w;
+        } else {
+            pCache->iMaxWidth = w;
+        }
+        pCache->flags |= mask;
+    }
+
+    *pWidth = (isMin ? pCache->iMinWidth : pCache->iMaxWidth);
+    return 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlLayoutTableRowCache --
+ *
+ *     Return a pointer to the slot in the layout-cache of table-row node
+ *     pNode used by htmltable.c to store a cached layout of the row. Since
+ *     the slot is part of the layout-cache, the cached row is discarded
+ *     by HtmlLayoutInvalidateCache() whenever the row or any of its
+ *     descendants is modified.
+ *
+ * Results:
+ *     Pointer to the HtmlLayoutCache.pTableRow slot.
+ *
+ * Side effects:
+ *     May allocate HtmlElementNode.pLayoutCache.
+ *
+ *---------------------------------------------------------------------------
+ */
+HtmlTableRowCache **
+HtmlLayoutTableRowCache(pNode)
+    HtmlNode *pNode;
+{
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    assert(pElem);
+    if (!pElem->pLayoutCache) {
+        pElem->pLayoutCache = (HtmlLayoutCache *)HtmlClearAlloc(
+            "HtmlLayoutCache", sizeof(HtmlLayoutCache)
+        );
+    }
+    return &pElem->pLayoutCache->pTableRow;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -3726,10 +4452,12 @@ blockMinMaxWidth(pLayout, pNode, pMin, pMax)
     if (pMin) {
         if (!(pCache->flags & CACHED_MINWIDTH_OK)) {
             pLayout->minmaxTest = MINMAX_TEST_MIN;
-            memset(&sBox, 0, sizeof(BoxContext));
-            HtmlLayoutNodeContent(pLayout, &sBox, pNode);
-            HtmlDrawCleanup(0, &sBox.vc);
-            pCache->iMinWidth = sBox.width;
+            if (intrinsicContent(pLayout, pNode, &pCache->iMinWidth)) {
+                memset(&sBox, 0, sizeof(BoxContext));
+                HtmlLayoutNodeContent(pLayout, &sBox, pNode);
+                HtmlDrawCleanup(0, &sBox.vc);
+                pCache->iMinWidth = sBox.width;
+            }
             pCache->flags |= CACHED_MINWIDTH_OK;
         }
         *pMin = pCache->iMinWidth;
@@ -3743,11 +4471,13 @@ blockMinMaxWidth(pLayout, pNode, pMin, pMax)
     if (pMax) {
         if (!(pCache->flags & CACHED_MAXWIDTH_OK)) {
             pLayout->minmaxTest = MINMAX_TEST_MAX;
-            memset(&sBox, 0, sizeof(BoxContext));
-            sBox.iContaining = 10000;
-            HtmlLayoutNodeContent(pLayout, &sBox, pNode);
-            HtmlDrawCleanup(0, &sBox.vc);
-            pCache->iMaxWidth = sBox.width;
+            if (intrinsicContent(pLayout, pNode, &pCache->iMaxWidth)) {
+                memset(&sBox, 0, sizeof(BoxContext));
+                sBox.iContaining = 10000;
+                HtmlLayoutNodeContent(pLayout, &sBox, pNode);
+                HtmlDrawCleanup(0, &sBox.vc);
+                pCache->iMaxWidth = sBox.width;
+            }
             pCache->flags |= CACHED_MAXWIDTH_OK;
         }
         *pMax = pCache->iMaxWidth;
@@ -3970,11 +4700,6 @@ HtmlLayout(pTree)
     sLayout.pTree = pTree;
     sLayout.interp = pTree->interp;
 
-#ifdef LAYOUT_CACHE_DEBUG
-    memset(aDebugUseCacheCond, 0, sizeof(int) * (LAYOUT_CACHE_N_USE_COND + 1));
-    memset(aDebugStoreCacheCond, 0, sizeof(int)*(LAYOUT_CACHE_N_STORE_COND+1));
-#endif
-
     HtmlLog(pTree, "LAYOUTENGINE", "START", NULL);
 
     /* Call HtmlLayoutNodeContent() to layout the top level box, generated 
@@ -4044,24 +4769,11 @@ HtmlLayout(pTree)
         pTree->canvas.right = MAX(pTree->canvas.right, sBox.width);
         pTree->canvas.bottom = MAX(pTree->canvas.bottom, sBox.height);
 
-        HtmlFloatListDelete(sNormal.pFloat);
-    }
+        /* Build the spatial index used to query the display list. */
+        HtmlDrawIndexCanvas(pTree);
 
-#ifdef LAYOUT_CACHE_DEBUG
-    {
-        int ii;
-        printf("LayoutCacheDebug: USE: ");
-        for (ii = 0; ii <= LAYOUT_CACHE_N_USE_COND; ii++) {
-            printf("%d ", aDebugUseCacheCond[ii]);
-        }
-        printf("\n");
-        printf("LayoutCacheDebug: STORE: ");
-        for (ii = 0; ii <= LAYOUT_CACHE_N_STORE_COND; ii++) {
-            printf("%d ", aDebugStoreCacheCond[ii]);
-        }
-        printf("\n");
+        HtmlFloatListDelete(sNormal.pFloat);
     }
-#endif
 
     HtmlComputedValuesRelease(pTree, sLayout.pImplicitTableProperties);
 
@@ -4109,11 +4821,112 @@ HtmlLayoutInvalidateCache(pTree, pNode)
     if (!HtmlNodeIsText(pNode)) {
         HtmlElementNode *pElem = (HtmlElementNode *)pNode;
         if (pElem->pLayoutCache) {
-            HtmlDrawCleanup(pTree, &pElem->pLayoutCache->aCache[0].canvas);
-            HtmlDrawCleanup(pTree, &pElem->pLayoutCache->aCache[1].canvas);
-            HtmlDrawCleanup(pTree, &pElem->pLayoutCache->aCache[2].canvas);
+            LayoutCache *pCache = pElem->pLayoutCache->pCache;
+            while (pCache) {
+                LayoutCache *pNext = pCache->pNext;
+                layoutCacheFree(pTree, pCache);
+                pCache = pNext;
+            }
+            HtmlTableRowCacheFree(pTree, pElem->pLayoutCache->pTableRow);
             HtmlFree(pElem->pLayoutCache);
             pElem->pLayoutCache = 0;
         }
     }
 }
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlLayoutCacheStats --
+ *
+ *         $html _layoutcache ?-reset?
+ *
+ *     Return a key-value list describing the layout cache:
+ *
+ *         entries   N       Number of cached layouts.
+ *         bytes     N       Approximate memory used by cached layouts.
+ *         hits      N       Times a cached layout was used.
+ *         misses    N       Times no cached layout could be used.
+ *         hitratio  R       hits / (hits + misses), or 0.0.
+ *         stores    N       Layouts added to the cache.
+ *         evictions N       Cached layouts discarded to make room.
+ *         usefail   LIST    Misses by condition (HtmlTree.aLayoutCacheUse).
+ *         storefail LIST    Layouts not cached by condition 
+ *                           (HtmlTree.aLayoutCacheStore).
+ *
+ *     The conditions counted in the "usefail" and "storefail" lists are
+ *     those listed above normalFlowLayoutFromCache() and at the end of
+ *     normalFlowLayout(), respectively. If the -reset option is passed,
+ *     all counters except "entries" and "bytes" are set to zero after
+ *     the result is constructed.
+ *
+ * Results:
+ *     Tcl result code.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlLayoutCacheStats(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+    Tcl_Obj *pRet;
+    Tcl_Obj *pUse;
+    Tcl_Obj *pStore;
+    int nHit = pTree->aLayoutCacheUse[0];
+    int nMiss = 0;
+    int ii;
+
+    if (
+        objc > 3 || 
+        (objc == 3 && strcmp(Tcl_GetString(objv[2]), "-reset"))
+    ) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-reset?");
+        return TCL_ERROR;
+    }
+
+    pUse = Tcl_NewObj();
+    for (ii = 1; ii <= HTML_LAYOUTCACHE_NUSE; ii++) {
+        int n = pTree->aLayoutCacheUse[ii];
+        Tcl_ListObjAppendElement(0, pUse, Tcl_NewIntObj(n));
+        nMiss += n;
+    }
+    pStore = Tcl_NewObj();
+    for (ii = 1; ii <= HTML_LAYOUTCACHE_NSTORE; ii++) {
+        int n = pTree->aLayoutCacheStore[ii];
+        Tcl_ListObjAppendElement(0, pStore, Tcl_NewIntObj(n));
+    }
+
+    pRet = Tcl_NewObj();
+#define ADD(zKey, pVal) \
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj(zKey, -1)); \
+    Tcl_ListObjAppendElement(0, pRet, pVal)
+
+    ADD("entries", Tcl_NewIntObj(pTree->nLayoutCacheEntry));
+    ADD("bytes", Tcl_NewIntObj(pTree->nLayoutCacheByte));
+    ADD("hits", Tcl_NewIntObj(nHit));
+    ADD("misses", Tcl_NewIntObj(nMiss));
+    ADD("hitratio", Tcl_NewDoubleObj(
+        (nHit + nMiss) ? ((double)nHit / (double)(nHit + nMiss)) : 0.0
+    ));
+    ADD("stores", Tcl_NewIntObj(pTree->aLayoutCacheStore[0]));
+    ADD("evictions", Tcl_NewIntObj(pTree->nLayoutCacheEvict));
+    ADD("usefail", pUse);
+    ADD("storefail", pStore);
+#undef ADD
+
+    if (objc == 3) {
+        pTree->nLayoutCacheEvict = 0;
+        memset(pTree->aLayoutCacheUse, 0, sizeof(pTree->aLayoutCacheUse));
+        memset(pTree->aLayoutCacheStore, 0, sizeof(pTree->aLayoutCacheStore));
+    }
+
+    Tcl_SetObjResult(interp, pRet);
+    return TCL_OK;
+}
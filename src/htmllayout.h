@@ -96,6 +96,12 @@ void HtmlInlineContextPopBorder(InlineContext *, InlineBorder *);
 
 HtmlNode *HtmlInlineContextCreator(InlineContext *);
 
+/* Range of widths over which the line breaks made so far are unchanged */
+void HtmlInlineContextWidthRange(InlineContext *, int *, int *);
+
+/* Measure the line-boxes of an inline context without drawing them */
+int HtmlInlineContextSizeLines(InlineContext *, int);
+
 /* End of htmllayoutinline.c interface
  *-------------------------------------------------------------------------*/
 
@@ -144,10 +150,16 @@ int getHeight(HtmlNode *, int, int);
  */
 int HtmlTableLayout(LayoutContext*, BoxContext*, HtmlNode*);
 
+/* Cached layout of a single table-row. See HtmlLayoutTableRowCache(). */
+typedef struct HtmlTableRowCache HtmlTableRowCache;
+void HtmlTableRowCacheFree(HtmlTree *, HtmlTableRowCache *);
+
 /* End of htmlTableLayout.c interface
  *-------------------------------------------------------------------------*/
 
 int HtmlLayoutNodeContent(LayoutContext *, BoxContext *, HtmlNode *);
+HtmlTableRowCache **HtmlLayoutTableRowCache(HtmlNode *);
+void HtmlLayoutCacheRelease(HtmlTree *, HtmlNode *, HtmlCanvas *);
 
 void HtmlLayoutDrawBox(HtmlTree*,HtmlCanvas*,int,int,int,int,HtmlNode*,int,int);
 
@@ -43,6 +43,38 @@ static char const rcsid[] =
 #define ISSPACE(x) isspace((unsigned char)(x))
 #define ISALPHA(x) isalpha((unsigned char)(x))
 
+/*
+ * The tokenizer uses the following to search for delimiters in the input
+ * text, instead of looping through it one byte at a time. They are
+ * implemented using the C library string functions, which are typically
+ * vectorized (on glibc, an SSE2 or AVX2 version is selected at runtime
+ * according to the CPU).
+ *
+ *     FIND_CHAR(z, c)
+ *         Return the offset of the first occurence of byte c in 
+ *         nul-terminated string z, or the offset of the nul-terminator 
+ *         if there is none.
+ *
+ *     FIND_SPAN(z, zSet)
+ *         Return the offset of the first byte in string z that is one of
+ *         the bytes in zSet, or the offset of the nul-terminator.
+ *
+ * TOKEN_SPACE is the set of bytes for which ISSPACE() is true in the 
+ * "C" locale.
+ */
+#define FIND_CHAR(z, c) findChar(z, c)
+#define FIND_SPAN(z, zSet) ((int)strcspn(z, zSet))
+#define TOKEN_SPACE " \t\n\v\f\r"
+
+static int
+findChar(z, c)
+    const char *z;
+    int c;
+{
+    const char *zRet = strchr(z, c);
+    return (int)(zRet ? (zRet - z) : strlen(z));
+}
+
 /*
  * The following elements have optional opening and closing tags:
  *
@@ -605,7 +637,13 @@ findEndOfScript(eTag, z, pN)
     sprintf(zEnd, "</%s", HtmlMarkupName(eTag));
     nEnd = strlen(zEnd);
 
+    /* Only positions holding a '<' character can begin the end tag, so
+     * use memchr() to skip directly from one to the next.
+     */
     for (ii = *pN; ii < (nLen - nEnd - 1); ii++) {
+        const char *zLt = memchr(&z[ii], '<', (nLen - nEnd - 1) - ii);
+        if (!zLt) break;
+        ii = (zLt - z);
         if (
             strnicmp(&z[ii], zEnd, nEnd) == 0 &&
             (z[ii+nEnd] == '>' || ISSPACE(z[ii+nEnd]))
@@ -671,6 +709,55 @@ executeScript(pTree, pCallback, pAttributes, zScript, nScript)
     return rc;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * documentIsMostlyText --
+ *
+ *     Text nodes that refer to the string representation of an object
+ *     instead of copying their text (see HtmlTextNew()) keep the whole
+ *     object alive. This is only worthwhile if most of it is text, so
+ *     count the bytes of HtmlTree.pDocument that remain to be tokenized
+ *     and are neither white-space nor between a '<' and the following 
+ *     '>'. This is approximate, as the content of <script> and <style>
+ *     elements is counted as text.
+ *
+ *     This is called once by each HtmlTokenize() call that tokenizes 
+ *     HtmlTree.pDocument, not each time the object is replaced (for 
+ *     example after a script handler calls [$html write text]).
+ *
+ * Results:
+ *     True if the bytes counted make up at least half of the bytes that
+ *     remain to be tokenized, otherwise false.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+documentIsMostlyText(pTree)
+    HtmlTree *pTree;
+{
+    int nDocument;
+    const char *z = Tcl_GetStringFromObj(pTree->pDocument, &nDocument);
+    int nText = 0;
+    int isMarkup = 0;
+    int ii;
+
+    for (ii = pTree->nParsed; ii < nDocument; ii++) {
+        char c = z[ii];
+        if (c == '<') {
+            isMarkup = 1;
+        } else if (c == '>') {
+            isMarkup = 0;
+        } else if (!isMarkup && !ISSPACE(c)) {
+            nText++;
+        }
+    }
+    return ((nText * 2) >= (nDocument - pTree->nParsed));
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -690,7 +777,9 @@ executeScript(pTree, pCallback, pAttributes, zScript, nScript)
  *
  *     If zText is NULL, then the input text is in the Tcl_Obj* at
  *     HtmlTree.pDocument, starting at byte HtmlTree.nParsed. These
- *     two variables may be modified by this function.
+ *     two variables may be modified by this function. The offsets passed
+ *     to the callbacks are relative to the start of HtmlTree.pDocument
+ *     (add HtmlTree.iDocumentOffset to obtain a document offset).
  *
  * Results:
  *
@@ -722,6 +811,14 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
      */
     int isTrimStart = 0;
 
+    /* Text nodes created from HtmlTree.pDocument may refer to its string
+     * representation instead of copying text (see HtmlTextNew()), if
+     * pSource is not NULL. It is set to HtmlTree.pDocument if isSource
+     * is true (see documentIsMostlyText()).
+     */
+    Tcl_Obj *pSource = 0;
+    int isSource = 0;
+
     if (zText) {
         /* This is an [$html fragment] command */
         n = 0;
@@ -729,6 +826,8 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
     } else {
         /* This is an [$html parse] command */
         n = pTree->nParsed;
+        isSource = documentIsMostlyText(pTree);
+        pSource = isSource ? pTree->pDocument : 0;
         z = Tcl_GetString(pTree->pDocument);
     }
 
@@ -740,7 +839,8 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
         /* A text (or whitespace) node */
         if (c != '<' && c != 0) {
             int isTrimEnd = 0;
-            for (i = 0; (c = z[n + i]) != 0 && c != '<'; i++);
+            i = FIND_CHAR(&z[n], '<');
+            c = z[n + i];
 
             /* If the next tag is a </PRE>, then skip the final newline
              * of this text node by setting isTrimEnd to true. TODO: It
@@ -766,7 +866,9 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
 
             if (c || isFinal) {
                 int ts = isTrimStart;
-                HtmlTextNode *pTextNode = HtmlTextNew(i, &z[n], isTrimEnd, ts);
+                HtmlTextNode *pTextNode = HtmlTextNew(
+                    pTree, pSource, i, &z[n], isTrimEnd, ts
+                );
                 xAddText(pTree, pTextNode, n);
                 n += i;
             } else {
@@ -780,14 +882,11 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
          * "<!--" and end with "-->".
          */
         else if (strncmp(&z[n], "<!--", 4) == 0) {
-            for (i = 4; z[n + i]; i++) {
-                if (z[n + i] == '-' && strncmp(&z[n + i], "-->", 3) == 0) {
-                    break;
-                }
-            }
-            if (z[n + i] == 0) {
+            const char *zEnd = strstr(&z[n + 4], "-->");
+            if (!zEnd) {
                 goto incomplete;
             }
+            i = (zEnd - &z[n]);
             n += i + 3;
             isTrimStart = 0;
         }
@@ -797,19 +896,16 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
             0 == strncmp(&z[n], "<![CDATA[", 9)
         ) {
             const char *zData = &z[n+9];
+            const char *zEnd = strstr(zData, "]]>");
             int nData;
-            for (i = 9; z[n + i]; i++) {
-                if (z[n + i] == ']' && strncmp(&z[n + i], "]]>", 3) == 0) {
-                    break;
-                }
-            }
-            if (z[n + i] == 0) {
+            if (!zEnd) {
                 goto incomplete;
             }
+            i = (zEnd - &z[n]);
             n += i + 3;
 
             nData = i - 9;
-            xAddText(pTree, HtmlTextNew(nData, zData, 0, 0), 0);
+            xAddText(pTree, HtmlTextNew(pTree, 0, nData, zData, 0, 0), 0);
 
             isTrimStart = 0;
         }
@@ -841,6 +937,13 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
             argv[0] = &z[n + 1];
             assert( c=='<' );
 
+            /* If the '<' is the last byte of the text, the loop below 
+             * would read past the nul-terminator. 
+             */
+            if (z[n + 1] == 0) {
+                goto incomplete;
+            }
+
             /* Check if we are dealing with a closing tag. */
             if (*argv[0] == '/' && argv[0][1]) {
                 isClosingTag = 1;
@@ -893,13 +996,8 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                  */
                 argv[argc] = &z[n+i];
 
-                j = 0;
-                while (
-                    (c = z[n + i + j]) != 0 && 
-                    !ISSPACE(c) && c != '>' && c != '=' 
-                ) {
-                    j++;
-                }
+                j = FIND_SPAN(&z[n + i], TOKEN_SPACE ">=");
+                c = z[n + i + j];
                 arglen[argc] = j;
 
                 if (c == 0) {
@@ -934,8 +1032,8 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                     int cQuote = c;
                     i++;
                     argv[argc] = &z[n + i];
-                    for (j = 0; (c = z[n + i + j]) != 0 && c != cQuote; j++) {
-                    }
+                    j = FIND_CHAR(&z[n + i], cQuote);
+                    c = z[n + i + j];
                     if (c == 0) {
                         goto incomplete;
                     }
@@ -944,10 +1042,8 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                 }
                 else {
                     argv[argc] = &z[n + i];
-                    for (j = 0;
-                         (c = z[n + i + j]) != 0 && !ISSPACE(c) && c != '>';
-                         j++) {
-                    }
+                    j = FIND_SPAN(&z[n + i], TOKEN_SPACE ">");
+                    c = z[n + i + j];
                     if (c == 0) {
                         goto incomplete;
                     }
@@ -1009,7 +1105,9 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                 HtmlAttributes *pAttr;
                 Tcl_Obj *pScript = 0;
                 const char **zArgs = (const char **)(&argv[1]);
-                pAttr = HtmlAttributesNew(argc - 1, zArgs, &arglen[1], 1);
+                pAttr = HtmlAttributesNew(pTree->isParseWorker ? 0 : pTree, 
+                    argc - 1, zArgs, &arglen[1], 1
+                );
 
 
                 /* Unless a fragment is being parsed, search for a 
@@ -1042,7 +1140,9 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                     }
                     if (zScript) {
                         HtmlTextNode *pTextNode;
-                        pTextNode = HtmlTextNew(nScript, zScript, 1, 1);
+                        pTextNode = HtmlTextNew(
+                            pTree, pSource, nScript, zScript, 1, 1
+                        );
                         xAddText(pTree, pTextNode, n);
                         xAddClosing(pTree, eType, zAtom, n);
                     } else {
@@ -1087,6 +1187,7 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
                             pTree->eWriteState = HTML_WRITE_NONE;
                             return 0;
                     }
+                    pSource = isSource ? pTree->pDocument : 0;
                     z = Tcl_GetString(pTree->pDocument);
 
                     HtmlFree(pAttr);
@@ -1109,6 +1210,425 @@ HtmlTokenize(pTree, zText, isFinal, xAddText, xAddElement, xAddClosing)
 
 /************************** End HTML Tokenizer Code ***************************/
 
+/*
+ * The parallel tokenizer (see tokenizeParallel()) is only available if
+ * Tkhtml is built with thread support. HtmlAlloc() is not thread-safe in
+ * HTML_DEBUG builds.
+ */
+#if defined(TCL_THREADS) && !defined(HTML_DEBUG)
+  #define HTML_PARSE_THREADS 1
+#endif
+
+/*
+ * The parallel tokenizer is not used for less than (PARSE_CHUNK_MIN*2)
+ * bytes of text. Each chunk it splits the text into is at least 
+ * roughly PARSE_CHUNK_MIN bytes in size.
+ */
+#define PARSE_CHUNK_MIN 16384
+
+#ifdef HTML_PARSE_THREADS
+
+typedef struct ParseChunk ParseChunk;
+typedef struct ParseToken ParseToken;
+typedef struct ParseWork ParseWork;
+
+#define PARSE_TOKEN_TEXT    1
+#define PARSE_TOKEN_ELEMENT 2
+#define PARSE_TOKEN_CLOSING 3
+
+/*
+ * A token buffered by a worker thread, to be passed to one of the
+ * xAddText(), xAddElement() or xAddClosing() callbacks by the main 
+ * thread.
+ */
+struct ParseToken {
+    int eToken;                   /* One of the PARSE_TOKEN_XXX values */
+    int eType;                    /* Tag type (elements and closing tags) */
+    const char *zType;            /* Tag name (elements and closing tags) */
+    void *p;                      /* HtmlTextNode* or HtmlAttributes* */
+    int iOffset;                  /* Offset of token within the chunk */
+};
+
+/*
+ * One chunk of the document text. The tokenizer is run on each chunk
+ * using the private HtmlTree structure, so that text nodes are allocated
+ * from a separate arena and attribute names are not interned.
+ */
+struct ParseChunk {
+    HtmlTree tree;                /* Private tree structure. MUST BE FIRST. */
+    char *zText;                  /* Nul-terminated copy of chunk text */
+    int nText;                    /* Length of zText in bytes */
+    int iOffset;                  /* Offset of zText[0] in pDocument */
+    int isOk;                     /* True if entire chunk was tokenized */
+    int nToken;                   /* Number of tokens in aToken[] */
+    int nTokenAlloc;              /* Allocated size of aToken[] */
+    ParseToken *aToken;           /* Buffered tokens */
+};
+
+struct ParseWork {
+    int nChunk;                   /* Number of chunks in aChunk[] */
+    ParseChunk *aChunk;           /* Array of chunks in document order */
+    Tcl_Mutex mutex;              /* Mutex protecting iNextChunk */
+    int iNextChunk;               /* Next chunk to be claimed by a thread */
+};
+
+static ParseToken *
+parseTokenAppend(pTree, eToken, iOffset)
+    HtmlTree *pTree;
+    int eToken;
+    int iOffset;
+{
+    ParseChunk *pChunk = (ParseChunk *)pTree;
+    ParseToken *pToken;
+    assert(pTree->isParseWorker);
+    if (pChunk->nToken == pChunk->nTokenAlloc) {
+        int nAlloc = (pChunk->nTokenAlloc * 2) + 64;
+        pChunk->aToken = (ParseToken *)HtmlRealloc("ParseChunk.aToken", 
+            pChunk->aToken, sizeof(ParseToken) * nAlloc
+        );
+        pChunk->nTokenAlloc = nAlloc;
+    }
+    pToken = &pChunk->aToken[pChunk->nToken++];
+    memset(pToken, 0, sizeof(ParseToken));
+    pToken->eToken = eToken;
+    pToken->iOffset = iOffset;
+    return pToken;
+}
+static void
+parseAddText(pTree, pTextNode, iOffset)
+    HtmlTree *pTree;
+    HtmlTextNode *pTextNode;
+    int iOffset;
+{
+    ParseToken *pToken = parseTokenAppend(pTree, PARSE_TOKEN_TEXT, iOffset);
+    pToken->p = (void *)pTextNode;
+}
+static void
+parseAddElement(pTree, eType, zType, pAttr, iOffset)
+    HtmlTree *pTree;
+    int eType;
+    const char *zType;
+    HtmlAttributes *pAttr;
+    int iOffset;
+{
+    ParseToken *pToken = parseTokenAppend(pTree,PARSE_TOKEN_ELEMENT,iOffset);
+    pToken->eType = eType;
+    pToken->zType = zType;
+    pToken->p = (void *)pAttr;
+}
+static void
+parseAddClosing(pTree, eType, zType, iOffset)
+    HtmlTree *pTree;
+    int eType;
+    const char *zType;
+    int iOffset;
+{
+    ParseToken *pToken = parseTokenAppend(pTree,PARSE_TOKEN_CLOSING,iOffset);
+    pToken->eType = eType;
+    pToken->zType = zType;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * parseWork --
+ *
+ *     Tokenize chunks of the document until there are none left to 
+ *     claim. This is run by each worker thread and by the main thread.
+ *
+ *     A chunk is tokenized correctly only if it does not end part way
+ *     through a tag, comment or PCDATA element (i.e. <script>). In this
+ *     case the tokenizer stops early and ParseChunk.isOk is left at 0.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+parseWork(p)
+    ParseWork *p;
+{
+    while (1) {
+        ParseChunk *pChunk;
+        int n;
+
+        Tcl_MutexLock(&p->mutex);
+        n = p->iNextChunk++;
+        Tcl_MutexUnlock(&p->mutex);
+        if (n >= p->nChunk) break;
+
+        pChunk = &p->aChunk[n];
+        n = HtmlTokenize(&pChunk->tree, pChunk->zText, 1, 
+            parseAddText, parseAddElement, parseAddClosing
+        );
+        pChunk->isOk = (n == pChunk->nText);
+    }
+}
+
+static Tcl_ThreadCreateType
+parseThread(clientData)
+    ClientData clientData;
+{
+    parseWork((ParseWork *)clientData);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * parseFindBoundary --
+ *
+ *     Search z[iFrom..iTo-1] for a place to split the document text. A
+ *     boundary is a '<' character that starts an opening tag and is 
+ *     preceded by text, so that the tokenizer is in the same state 
+ *     whether or not the document is split there (the text node before
+ *     a boundary is never trimmed, and clears the pending trim of a 
+ *     leading newline after a <pre> tag). Whether or not the boundary is
+ *     actually outside of a tag, comment or PCDATA element is checked 
+ *     afterwards (see parseWork()).
+ *
+ * Results:
+ *     Offset of the boundary, or -1 if there is none.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+parseFindBoundary(z, iFrom, iTo)
+    const char *z;
+    int iFrom;
+    int iTo;
+{
+    int ii;
+    for (ii = MAX(iFrom, 1); ii < iTo - 1; ii++) {
+        const char *zLt = memchr(&z[ii], '<', (iTo - 1) - ii);
+        if (!zLt) break;
+        ii = (zLt - z);
+        if (ISALPHA(z[ii+1]) && z[ii-1] != '>') {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * parseChunkFree --
+ *
+ *     Free the contents of a ParseChunk structure, including any tokens
+ *     that have not been passed to the tree.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+parseChunkFree(pChunk)
+    ParseChunk *pChunk;
+{
+    int ii;
+    for (ii = 0; ii < pChunk->nToken; ii++) {
+        ParseToken *pToken = &pChunk->aToken[ii];
+        if (pToken->eToken == PARSE_TOKEN_TEXT) {
+            HtmlTextFree(&pChunk->tree, (HtmlTextNode *)pToken->p);
+        } else if (pToken->eToken == PARSE_TOKEN_ELEMENT) {
+            HtmlFree(pToken->p);
+        }
+    }
+    HtmlNodeArenaRelease(&pChunk->tree);
+    HtmlFree(pChunk->aToken);
+    HtmlFree(pChunk->zText);
+}
+
+#endif /* HTML_PARSE_THREADS */
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tokenizeParallel --
+ *
+ *     Try to tokenize the remainder of HtmlTree.pDocument using 
+ *     -parsethreads threads. The text is split into chunks at guessed
+ *     token boundaries and each chunk is tokenized into a buffer by a
+ *     thread. The buffered tokens are then passed to the xAddText(), 
+ *     xAddElement() and xAddClosing() callbacks on the calling thread,
+ *     in document order.
+ *
+ *     This is only done for the final part of the document, if there are
+ *     no script or parse handlers (these must be invoked as the document
+ *     is tokenized) and the parser is not in "xml" mode (as unknown tag 
+ *     names are atoms). If any chunk boundary turns out to be inside of a
+ *     tag, comment or PCDATA element, the buffered tokens are discarded.
+ *
+ * Results:
+ *     -1 if the document was not tokenized. In this case the caller 
+ *     should use HtmlTokenize(). Otherwise, the same value as 
+ *     HtmlTokenize() would have returned.
+ *
+ * Side effects:
+ *     Invokes the xAddXXX() callbacks.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+tokenizeParallel(pTree, isFinal, xAddText, xAddElement, xAddClosing)
+    HtmlTree *pTree;
+    int isFinal;
+    void (*xAddText)(HtmlTree *, HtmlTextNode *, int);
+    void (*xAddElement)(HtmlTree *, int, const char *, HtmlAttributes *, int);
+    void (*xAddClosing)(HtmlTree *, int, const char *, int);
+{
+    int rc = -1;
+#ifdef HTML_PARSE_THREADS
+    int nThread = pTree->options.parsethreads;
+    ParseWork sWork;
+    Tcl_ThreadId *aId;
+    const char *z;
+    int nDocument;
+    int nStarted = 0;
+    int iPrev;
+    int ii;
+
+    if (!isFinal || nThread < 2 || 
+        pTree->options.parsemode == HTML_PARSEMODE_XML ||
+        pTree->aScriptHandler.numEntries > 0 ||
+        pTree->aParseHandler.numEntries > 0
+    ) {
+        return -1;
+    }
+    z = Tcl_GetStringFromObj(pTree->pDocument, &nDocument);
+    if ((nDocument - pTree->nParsed) < PARSE_CHUNK_MIN * 2) {
+        return -1;
+    }
+    nThread = MIN(nThread, (nDocument - pTree->nParsed) / PARSE_CHUNK_MIN);
+
+    /* The tag name lookup table is initialized on first use. Make sure 
+     * this happens before any worker threads start.
+     */
+    HtmlHashInit(0, 0);
+
+    /* Split the text into (up to) nThread chunks. */
+    memset(&sWork, 0, sizeof(ParseWork));
+    sWork.aChunk = (ParseChunk *)HtmlClearAlloc(
+        "ParseWork.aChunk", sizeof(ParseChunk) * nThread
+    );
+    iPrev = pTree->nParsed;
+    for (ii = 0; ii < nThread; ii++) {
+        ParseChunk *pChunk = &sWork.aChunk[sWork.nChunk];
+        int iEnd = nDocument;
+        if (ii < nThread - 1) {
+            int nRemain = nDocument - pTree->nParsed;
+            int iTarget = pTree->nParsed + (int)(
+                ((double)nRemain * (ii + 1)) / nThread
+            );
+            iEnd = parseFindBoundary(z, MAX(iTarget, iPrev+1), nDocument);
+            if (iEnd < 0) {
+                iEnd = nDocument;
+                ii = nThread;
+            }
+        }
+        pChunk->tree.isParseWorker = 1;
+        pChunk->tree.options.parsemode = pTree->options.parsemode;
+        pChunk->iOffset = iPrev;
+        pChunk->nText = iEnd - iPrev;
+        pChunk->zText = HtmlAlloc("ParseChunk.zText", pChunk->nText + 1);
+        memcpy(pChunk->zText, &z[iPrev], pChunk->nText);
+        pChunk->zText[pChunk->nText] = '\0';
+        sWork.nChunk++;
+        iPrev = iEnd;
+    }
+
+    /* Start a worker thread for each chunk but the first, then do a share
+     * of the work on this thread before waiting for the workers.
+     */
+    aId = (Tcl_ThreadId *)HtmlAlloc("ParseWork.aId", 
+        sizeof(Tcl_ThreadId) * sWork.nChunk
+    );
+    for (ii = 1; ii < sWork.nChunk; ii++) {
+        if (TCL_OK != Tcl_CreateThread(&aId[nStarted], parseThread, 
+                (ClientData)&sWork, TCL_THREAD_STACK_DEFAULT, 
+                TCL_THREAD_JOINABLE
+        )) {
+            break;
+        }
+        nStarted++;
+    }
+    parseWork(&sWork);
+    for (ii = 0; ii < nStarted; ii++) {
+        int rc2;
+        Tcl_JoinThread(aId[ii], &rc2);
+    }
+    HtmlFree(aId);
+    Tcl_MutexFinalize(&sWork.mutex);
+
+    for (ii = 0; ii < sWork.nChunk && sWork.aChunk[ii].isOk; ii++);
+    if (sWork.nChunk > 1 && ii == sWork.nChunk) {
+        /* Every chunk was tokenized. Pass the tokens to the callbacks.
+         * Text nodes are moved to the arena belonging to pTree, and 
+         * attribute names interned. If a callback resets the widget, 
+         * discard the remaining tokens, as HtmlTokenize() does.
+         */
+        int isReset = 0;
+        rc = nDocument;
+        for (ii = 0; ii < sWork.nChunk; ii++) {
+            ParseChunk *pChunk = &sWork.aChunk[ii];
+            int jj;
+            for (jj = 0; !isReset && jj < pChunk->nToken; jj++) {
+                ParseToken *pToken = &pChunk->aToken[jj];
+                int iOffset = pChunk->iOffset + pToken->iOffset;
+                switch (pToken->eToken) {
+                    case PARSE_TOKEN_TEXT: {
+                        HtmlTextNode *pOld = (HtmlTextNode *)pToken->p;
+                        HtmlTextNode *pNew = HtmlArenaNew(pTree,HtmlTextNode);
+                        pNew->aToken = pOld->aToken;
+                        pNew->zText = pOld->zText;
+                        pNew->pSource = pOld->pSource;
+                        pToken->eToken = 0;
+                        xAddText(pTree, pNew, iOffset);
+                        break;
+                    }
+                    case PARSE_TOKEN_ELEMENT: {
+                        HtmlAttributes *pAttr = (HtmlAttributes *)pToken->p;
+                        HtmlAttributesIntern(pTree, pAttr);
+                        pToken->eToken = 0;
+                        xAddElement(pTree, 
+                            pToken->eType, pToken->zType, pAttr, iOffset
+                        );
+                        if (pTree->eWriteState==HTML_WRITE_INHANDLERRESET) {
+                            isReset = 1;
+                        }
+                        break;
+                    }
+                    case PARSE_TOKEN_CLOSING:
+                        xAddClosing(pTree,pToken->eType,pToken->zType,iOffset);
+                        break;
+                }
+            }
+        }
+        if (!isReset) {
+            pTree->nParsed = nDocument;
+        }
+    }
+
+    for (ii = 0; ii < sWork.nChunk; ii++) {
+        parseChunkFree(&sWork.aChunk[ii]);
+    }
+    HtmlFree(sWork.aChunk);
+#endif
+    return rc;
+}
+
 static int 
 tokenizeWrapper(pTree, isFin, xAddText, xAddElement, xAddClosing)
     HtmlTree *pTree;             /* The HTML widget doing the parsing */
@@ -1125,7 +1645,10 @@ tokenizeWrapper(pTree, isFin, xAddText, xAddElement, xAddClosing)
 
     HtmlCallbackRestyle(pTree, pCurrent ? pCurrent : pTree->pRoot);
     HtmlCallbackLayout(pTree, pCurrent);
-    rc = HtmlTokenize(pTree, 0, isFin, xAddText, xAddElement, xAddClosing);
+    rc = tokenizeParallel(pTree, isFin, xAddText, xAddElement, xAddClosing);
+    if (rc < 0) {
+        rc = HtmlTokenize(pTree, 0, isFin, xAddText, xAddElement, xAddClosing);
+    }
     if (pTree->isParseFinished && pTree->eWriteState==HTML_WRITE_NONE) {
         HtmlFinishNodeHandlers(pTree);
     }
@@ -1150,12 +1673,152 @@ tokenizeWrapper(pTree, isFin, xAddText, xAddElement, xAddClosing)
     return rc;
 }
 
+/*
+ * Callbacks used by HtmlTokenizeCmd() to run the tokenizer without
+ * building a document tree. The number of tokens seen so far is stored
+ * in the interpreter result, which is an unshared integer object while
+ * the command is running.
+ */
+static void
+benchCount(pTree)
+    HtmlTree *pTree;
+{
+    Tcl_Obj *pResult = Tcl_GetObjResult(pTree->interp);
+    int nToken = 0;
+    Tcl_GetIntFromObj(0, pResult, &nToken);
+    Tcl_SetIntObj(pResult, nToken + 1);
+}
+static void
+benchAddText(pTree, pTextNode, iOffset)
+    HtmlTree *pTree;
+    HtmlTextNode *pTextNode;
+    int iOffset;
+{
+    HtmlTextFree(pTree, pTextNode);
+    benchCount(pTree);
+}
+static void
+benchAddElement(pTree, eType, zType, pAttr, iOffset)
+    HtmlTree *pTree;
+    int eType;
+    const char *zType;
+    HtmlAttributes *pAttr;
+    int iOffset;
+{
+    HtmlFree(pAttr);
+    benchCount(pTree);
+}
+static void
+benchAddClosingTag(pTree, eType, zType, iOffset)
+    HtmlTree *pTree;
+    int eType;
+    const char *zType;
+    int iOffset;
+{
+    benchCount(pTree);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTokenizeCmd --
+ *
+ *     $html _tokenize HTML-TEXT
+ *
+ *     Run the tokenizer over the supplied text as if it were a document
+ *     fragment, discarding the tokens. This is used to benchmark the 
+ *     tokenizer (see tests/tokenize_bench.tcl).
+ *
+ * Results:
+ *     Tcl result. The number of tokens is returned as the command result.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlTokenizeCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget */
+    Tcl_Interp *interp;                /* The interpreter */
+    int objc;                          /* Number of arguments */
+    Tcl_Obj *CONST objv[];             /* List of all arguments */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "HTML-TEXT");
+        return TCL_ERROR;
+    }
+
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(0));
+    HtmlTokenize(pTree, Tcl_GetString(objv[2]), 1,
+        benchAddText, benchAddElement, benchAddClosingTag
+    );
+    return TCL_OK;
+}
+
+/*
+ * Tokenized text is not discarded from the start of HtmlTree.pDocument
+ * until at least this many bytes have been tokenized.
+ */
+#define DOCUMENT_COMPACT_MIN 4096
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * documentCompact --
+ *
+ *     Discard the text of the document that has already been tokenized
+ *     from the start of HtmlTree.pDocument, so that the whole document
+ *     is not held in memory as it is parsed. This is only done once the
+ *     tokenized text is at least as large as the remainder, so each byte 
+ *     of the document is copied a bounded number of times, or if text 
+ *     nodes refer to pDocument (see HtmlTextNew()), as then it may not be
+ *     modified in place.
+ *
+ *     This function must not be called while a script handler is running,
+ *     or after [write wait], as HtmlTree.iWriteInsert refers to pDocument.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May replace HtmlTree.pDocument and modify HtmlTree.nParsed and 
+ *     HtmlTree.iDocumentOffset.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+documentCompact(pTree)
+    HtmlTree *pTree;
+{
+    int nDocument;
+    const char *zDocument;
+    int nParsed = pTree->nParsed;
+
+    assert(pTree->eWriteState == HTML_WRITE_NONE);
+    zDocument = Tcl_GetStringFromObj(pTree->pDocument, &nDocument);
+    if (Tcl_IsShared(pTree->pDocument) || (
+        nParsed >= DOCUMENT_COMPACT_MIN && nParsed >= (nDocument - nParsed)
+    )) {
+        Tcl_Obj *pTail;
+        pTail = Tcl_NewStringObj(&zDocument[nParsed], nDocument - nParsed);
+        Tcl_IncrRefCount(pTail);
+        Tcl_DecrRefCount(pTree->pDocument);
+        pTree->pDocument = pTail;
+        pTree->iDocumentOffset += nParsed;
+        pTree->nParsed = 0;
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
  * HtmlTokenizerAppend --
  *
- *     Append text to the tokenizer engine.
+ *     Append text to the tokenizer engine. Text that has already been
+ *     tokenized may be discarded first (see documentCompact()).
  *
  * Results:
  *     None.
@@ -1183,6 +1846,20 @@ HtmlTokenizerAppend(pTree, zText, nText, isFinal)
         pTree->pDocument = Tcl_NewObj();
         Tcl_IncrRefCount(pTree->pDocument);
         assert(!Tcl_IsShared(pTree->pDocument));
+    } else if (pTree->eWriteState == HTML_WRITE_NONE) {
+        documentCompact(pTree);
+    }
+
+    /* If text nodes still refer to the string representation of 
+     * pDocument, it may not be modified. Append to a copy instead. This 
+     * only happens while a script handler is running or after [write 
+     * wait], as otherwise documentCompact() has already made a copy.
+     */
+    if (Tcl_IsShared(pTree->pDocument)) {
+        Tcl_Obj *pCopy = Tcl_DuplicateObj(pTree->pDocument);
+        Tcl_IncrRefCount(pCopy);
+        Tcl_DecrRefCount(pTree->pDocument);
+        pTree->pDocument = pCopy;
     }
 
     assert(!Tcl_IsShared(pTree->pDocument));
@@ -1222,7 +1899,8 @@ char * HtmlMarkupArg(pAttr, zTag, zDefault)
     int i;
     if (pAttr) {
         for (i = 0; i < pAttr->nAttr; i++) {
-            if (strcmp(pAttr->a[i].zName, zTag) == 0) {
+            const char *zName = pAttr->a[i].zName;
+            if (zName == zTag || strcmp(zName, zTag) == 0) {
                 return pAttr->a[i].zValue;
             }
         }
@@ -2833,6 +2833,137 @@ HtmlComputedValuesFinish(p)
     return pValues;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * freeFont --
+ *
+ *     Free the HtmlFont structure pFont, along with the Tk font and the
+ *     cache of text widths associated with it.
+ *
+ * Results: 
+ *     None.
+ *
+ * Side effects:
+ *     Deletes pFont.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+freeFont(pFont)
+    HtmlFont *pFont;
+{
+    if (pFont->isWidthInit) {
+        HtmlFontWidth *pWidth;
+        HtmlFontWidth *pNext;
+        for (pWidth = pFont->pWidthHead; pWidth; pWidth = pNext) {
+            pNext = pWidth->pNext;
+            HtmlFree(pWidth);
+        }
+        Tcl_DeleteHashTable(&pFont->aWidth);
+    }
+    Tk_FreeFont(pFont->tkfont);
+    HtmlFree(pFont);
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlFontTextWidth --
+ *
+ *     Return the width in pixels of the n bytes of text at z when
+ *     rendered in font pFont. This is equivalent to Tk_TextWidth(), except
+ *     that the results are cached in the HtmlFont.aWidth table. The
+ *     -textwidthcache option determines the maximum number of entries
+ *     cached for each font.
+ *
+ * Results: 
+ *     Width of text in pixels.
+ *
+ * Side effects:
+ *     Updates the HtmlFont.aWidth cache and the HtmlTree.fontcache
+ *     hit/miss counters.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlFontTextWidth(pTree, pFont, z, n)
+    HtmlTree *pTree;
+    HtmlFont *pFont;
+    const char *z;
+    int n;
+{
+    HtmlFontCache *pCache = &pTree->fontcache;
+    int nMax = pTree->options.textwidthcache;
+    HtmlFontWidth *pWidth;
+    Tcl_HashEntry *pEntry;
+    HtmlTextKey sKey;
+    int isNew;
+
+    if (nMax <= 0) {
+        pCache->nWidthMiss++;
+        return Tk_TextWidth(pFont->tkfont, z, n);
+    }
+
+    if (!pFont->isWidthInit) {
+        Tcl_InitCustomHashTable(
+            &pFont->aWidth, TCL_CUSTOM_TYPE_KEYS, HtmlTextKeyHashType()
+        );
+        pFont->isWidthInit = 1;
+    }
+
+    sKey.z = z;
+    sKey.n = n;
+    pEntry = Tcl_CreateHashEntry(&pFont->aWidth, (char *)&sKey, &isNew);
+    if (!isNew) {
+        pWidth = (HtmlFontWidth *)Tcl_GetHashValue(pEntry);
+        pCache->nWidthHit++;
+
+        /* Move pWidth to the head of the LRU list. */
+        if (pWidth != pFont->pWidthHead) {
+            pWidth->pPrev->pNext = pWidth->pNext;
+            if (pWidth->pNext) {
+                pWidth->pNext->pPrev = pWidth->pPrev;
+            } else {
+                pFont->pWidthTail = pWidth->pPrev;
+            }
+            pWidth->pPrev = 0;
+            pWidth->pNext = pFont->pWidthHead;
+            pFont->pWidthHead->pPrev = pWidth;
+            pFont->pWidthHead = pWidth;
+        }
+        return pWidth->iWidth;
+    }
+
+    pCache->nWidthMiss++;
+    pWidth = HtmlNew(HtmlFontWidth);
+    pWidth->iWidth = Tk_TextWidth(pFont->tkfont, z, n);
+    pWidth->pEntry = pEntry;
+    Tcl_SetHashValue(pEntry, pWidth);
+
+    pWidth->pNext = pFont->pWidthHead;
+    if (pFont->pWidthHead) {
+        pFont->pWidthHead->pPrev = pWidth;
+    } else {
+        pFont->pWidthTail = pWidth;
+    }
+    pFont->pWidthHead = pWidth;
+    pFont->nWidth++;
+
+    /* Discard least recently used entries until the cache fits. */
+    while (pFont->nWidth > nMax) {
+        HtmlFontWidth *pRem = pFont->pWidthTail;
+        assert(pRem && pRem != pWidth);
+        pFont->pWidthTail = pRem->pPrev;
+        pFont->pWidthTail->pNext = 0;
+        Tcl_DeleteHashEntry(pRem->pEntry);
+        HtmlFree(pRem);
+        pFont->nWidth--;
+    }
+
+    return pWidth->iWidth;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2881,8 +3012,7 @@ HtmlFontRelease(pTree, pFont)
                 }
                 pEntry = Tcl_FindHashEntry(&p->aHash, pKey);
                 Tcl_DeleteHashEntry(pEntry);
-                Tk_FreeFont(pRem->tkfont);
-                HtmlFree(pRem);
+                freeFont(pRem);
             }
         }
     }
@@ -3127,9 +3257,8 @@ HtmlFontCacheClear(pTree, isReinit)
 
     Tcl_DeleteHashTable(&pTree->fontcache.aHash);
     for (pFont = pTree->fontcache.pLruHead; pFont; pFont = pNext) {
-        Tk_FreeFont(pFont->tkfont);
         pNext = pFont->pNext;
-        HtmlFree(pFont);
+        freeFont(pFont);
     }
     if (isReinit) {
         memset(&pTree->fontcache, 0, sizeof(HtmlFontCache));
@@ -28,6 +28,8 @@ typedef struct HtmlCounterList HtmlCounterList;
 typedef struct HtmlFont HtmlFont;
 typedef struct HtmlFontKey HtmlFontKey;
 typedef struct HtmlFontCache HtmlFontCache;
+typedef struct HtmlFontWidth HtmlFontWidth;
+typedef struct HtmlTextKey HtmlTextKey;
 
 /* 
  * This structure is used to group four padding, margin or border-width
@@ -76,6 +78,35 @@ struct HtmlFont {
     Tk_FontMetrics metrics;
 
     HtmlFont *pNext;       /* Next entry in the Html.FontCache LRU list */
+
+    /* Cache of text widths measured in this font. See HtmlFontTextWidth(). */
+    int isWidthInit;             /* True once aWidth has been initialized */
+    Tcl_HashTable aWidth;        /* Map from HtmlTextKey to HtmlFontWidth */
+    int nWidth;                  /* Number of entries in aWidth */
+    HtmlFontWidth *pWidthHead;   /* Most recently used entry */
+    HtmlFontWidth *pWidthTail;   /* Least recently used entry */
+};
+
+/*
+ * Key type for the HtmlFont.aWidth hash table, implemented in htmlhash.c.
+ * The key is the string of n bytes (not nul-terminated) at z.
+ */
+struct HtmlTextKey {
+    const char *z;
+    int n;
+};
+
+/*
+ * Each entry in the HtmlFont.aWidth hash table is an instance of the
+ * following structure. Entries are also linked into a list in most
+ * recently used order, so that the least recently used entry can be
+ * discarded when the size of the cache exceeds the -textwidthcache option.
+ */
+struct HtmlFontWidth {
+    int iWidth;                  /* Width of text in pixels */
+    Tcl_HashEntry *pEntry;       /* Entry in HtmlFont.aWidth */
+    HtmlFontWidth *pPrev;        /* Next most recently used entry */
+    HtmlFontWidth *pNext;        /* Next least recently used entry */
 };
 
 /*
@@ -88,6 +119,9 @@ struct HtmlFontCache {
     HtmlFont *pLruHead;
     HtmlFont *pLruTail;
     int nZeroRef;
+
+    int nWidthHit;               /* Text widths found in HtmlFont.aWidth */
+    int nWidthMiss;              /* Text widths measured using Tk */
 };
 
 /*
@@ -276,9 +310,10 @@ struct HtmlComputedValues {
     int iOrderedListStart;            /* '-tkhtml-ordered-list-start' */
     int iOrderedListValue;            /* '-tkhtml-ordered-list-value' */
 
+    unsigned char eTableLayout;       /* 'table-layout' */
+
     /* Properties not yet in use - TODO! */
     unsigned char eUnicodeBidi;       /* 'unicode-bidi' */
-    unsigned char eTableLayout;       /* 'table-layout' */
 
     HtmlCounterList *clCounterReset;
     HtmlCounterList *clCounterIncrement;
@@ -463,6 +498,11 @@ void HtmlComputedValuesFreePrototype(HtmlTree *);
  */
 void HtmlFontCacheClear(HtmlTree *, int);
 
+/*
+ * Measure the width of a string in a font, using the HtmlFont.aWidth cache.
+ */
+int HtmlFontTextWidth(HtmlTree *, HtmlFont *, const char *, int);
+
 /* 
  * This function formats the HtmlComputedValues structure as a Tcl list and
  * sets the result of the interpreter to that list. Used to allow inspection of
@@ -463,6 +463,148 @@ printf("Stack %d: %s %s\n", iTmp,
     HtmlFree(apTmp);
 }
 
+/*
+ * The style sharing cache.
+ *
+ * While the children of an element are being styled, up to 
+ * STYLE_SHARE_SIZE of the most recently styled children for which 
+ * HtmlCssStyleSheetApply() reported that the computed values may be
+ * shared are stored in an instance of the following structure. Before
+ * the cascade is run for a child, the cache is searched for a sibling 
+ * with the same tag, attributes (including "id", "class" and "style")
+ * and dynamic flags. If one is found, the computed values and the 
+ * dynamic conditions of the sibling are reused. Since the two nodes 
+ * also have the same parent and ancestors, the result is the same.
+ *
+ * The HtmlTree.nStyleShareHit and nStyleShareMiss counters may be
+ * queried using the [$html _stylestats] command.
+ */
+#define STYLE_SHARE_SIZE 4
+typedef struct StyleShareCache StyleShareCache;
+struct StyleShareCache {
+  HtmlElementNode *apElem[STYLE_SHARE_SIZE];
+  int iNext;                       /* Next slot of apElem[] to overwrite */
+};
+
+typedef struct StyleCounter StyleCounter;
+struct StyleCounter {
+  char *zName;
+  int iValue;
+};
+
+struct StyleApply {
+  /* Node to begin recalculating style at */
+  HtmlNode *pRestyle;
+
+  /* True if currently traversing pRestyle, or a descendent, right-sibling
+   * or descendent of a right-sibling of pRestyle.
+   */
+  int doStyle;
+
+  int doContent;
+
+  /* True if the whole tree is being restyled. */
+  int isRoot;
+
+  StyleCounter **apCounter;
+  int nCounter;
+  int nCounterAlloc;
+  int nCounterStartScope;
+
+  /* True if we have seen one or more "fixed" items */
+  int isFixed;
+
+  /* Filter containing the ancestors of the node currently being styled */
+  CssAncestorFilter *pFilter;
+
+  /* Style sharing cache for the siblings of the node being styled */
+  StyleShareCache *pShare;
+
+  /* Selector matches computed by HtmlCssPrematch(), or NULL */
+  CssPrematch *pPrematch;
+};
+typedef struct StyleApply StyleApply;
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * styleShareLookup --
+ *
+ *     Search the style sharing cache pShare for an element that element
+ *     pElem may share computed values with.
+ *
+ * Results:
+ *     Pointer to the matching element, or NULL if there is no match.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlElementNode *
+styleShareLookup(pShare, pElem)
+    StyleShareCache *pShare;
+    HtmlElementNode *pElem;
+{
+    HtmlAttributes *pA = pElem->pAttributes;
+    int nA = (pA ? pA->nAttr : 0);
+    int ii;
+
+    for (ii = 0; ii < STYLE_SHARE_SIZE; ii++) {
+        HtmlElementNode *p = pShare->apElem[ii];
+        HtmlAttributes *pB;
+        int jj;
+
+        if (!p || 
+            p->node.zTag != pElem->node.zTag || 
+            p->flags != pElem->flags
+        ) {
+            continue;
+        }
+
+        pB = p->pAttributes;
+        if ((pB ? pB->nAttr : 0) != nA) continue;
+        for (jj = 0; jj < nA; jj++) {
+            const char *zA = pA->a[jj].zValue;
+            const char *zB = pB->a[jj].zValue;
+            const char *zNameA = pA->a[jj].zName;
+            const char *zNameB = pB->a[jj].zName;
+            if (zNameA != zNameB && strcmp(zNameA, zNameB)) break;
+            if (zA != zB && (!zA || !zB || strcmp(zA, zB))) break;
+        }
+        if (jj == nA) {
+            return p;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * styleShareInsert --
+ *
+ *     Add element pElem to the style sharing cache pShare, replacing the
+ *     oldest entry if the cache is full.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+styleShareInsert(pShare, pElem)
+    StyleShareCache *pShare;
+    HtmlElementNode *pElem;
+{
+    pShare->apElem[pShare->iNext] = pElem;
+    pShare->iNext = (pShare->iNext + 1) % STYLE_SHARE_SIZE;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -477,13 +619,15 @@ printf("Stack %d: %s %s\n", iTmp,
  *---------------------------------------------------------------------------
  */
 static int 
-styleNode(pTree, pNode, clientData)
+styleNode(pTree, pNode, clientData, p)
     HtmlTree *pTree;
     HtmlNode *pNode;
     ClientData clientData;
+    StyleApply *p;
 {
     CONST char *zStyle;      /* Value of "style" attribute for node */
     int trashDynamics = (int)((size_t) clientData);
+    HtmlElementNode *pShare = 0;
 
     HtmlElementNode *pElem = (HtmlElementNode *)pNode;
     HtmlComputedValues *pV = pElem->pPropertyValues;
@@ -498,28 +642,53 @@ styleNode(pTree, pNode, clientData)
         HtmlCssFreeDynamics(pElem);
     }
 
-    /* If there is a "style" attribute on this node, parse the attribute
-     * value and put the resulting mini-stylesheet in pNode->pStyle. 
+    /* If a sibling with the same tag, attributes and dynamic flags has
+     * already been styled during this pass, use it's computed values
+     * instead of running the cascade again. In this case the "style"
+     * attribute is not parsed. It is parsed on demand if it is required
+     * later on (see nodeGetStyle() in htmltree.c).
      *
-     * We assume that if the pStyle attribute is not NULL, then this node
-     * has been styled before. The stylesheet configuration may have
-     * changed since then, so we have to recalculate pNode->pProperties,
-     * but the "style" attribute is constant so pStyle is never invalid.
+     * Otherwise, if there is a "style" attribute on this node, parse the
+     * attribute value and put the resulting mini-stylesheet in 
+     * pNode->pStyle. We assume that if the pStyle attribute is not NULL,
+     * then this node has been styled before. The stylesheet configuration
+     * may have changed since then, so we have to recalculate 
+     * pNode->pProperties, but the "style" attribute is constant so pStyle
+     * is never invalid.
      *
      * Actually, the style attribute can be modified by the user, using 
      * the [$node attribute style "new-value"] command. In this case
      * the style attribute is treated as a special case and the 
      * pElem->pStyle structure is invalidated/recalculated as required.
      */
-    if (!pElem->pStyle) {
-        zStyle = HtmlNodeAttr(pNode, "style");
-        if (zStyle) {
-            HtmlCssInlineParse(pTree, -1, zStyle, &pElem->pStyle);
-        }
+    if (p->pShare && !pElem->pOverride) {
+        pShare = styleShareLookup(p->pShare, pElem);
     }
+    if (pShare) {
+        pElem->pPropertyValues = pShare->pPropertyValues;
+        HtmlComputedValuesReference(pElem->pPropertyValues);
+        HtmlCssCopyDynamics(pElem, pShare);
+        pTree->nStyleShareHit++;
+    } else {
+        int isShareable;
+        if (!pElem->pStyle && pElem->pAttributes) {
+            zStyle = pElem->pAttributes->zStyle;
+            if (zStyle) {
+                HtmlCssInlineParse(pTree, -1, zStyle, &pElem->pStyle);
+            }
+        }
 
-    /* Recalculate the properties for this node */
-    HtmlCssStyleSheetApply(pTree, pNode);
+        /* Recalculate the properties for this node */
+        isShareable = HtmlCssStyleSheetApply(
+            pTree, pNode, p->pFilter, p->pPrematch
+        );
+        if (p->pShare) {
+            pTree->nStyleShareMiss++;
+            if (isShareable) {
+                styleShareInsert(p->pShare, pElem);
+            }
+        }
+    }
     HtmlComputedValuesRelease(pTree, pElem->pPreviousValues);
     pElem->pPreviousValues = pV;
 
@@ -536,35 +705,6 @@ styleNode(pTree, pNode, clientData)
     return HtmlComputedValuesCompare(pElem->pPropertyValues, pV);
 }
 
-typedef struct StyleCounter StyleCounter;
-struct StyleCounter {
-  char *zName;
-  int iValue;
-};
-
-struct StyleApply {
-  /* Node to begin recalculating style at */
-  HtmlNode *pRestyle;
-
-  /* True if currently traversing pRestyle, or a descendent, right-sibling
-   * or descendent of a right-sibling of pRestyle.
-   */
-  int doStyle;
-
-  int doContent;
-
-  /* True if the whole tree is being restyled. */
-  int isRoot;
-
-  StyleCounter **apCounter;
-  int nCounter;
-  int nCounterAlloc;
-  int nCounterStartScope;
-
-  /* True if we have seen one or more "fixed" items */
-  int isFixed;
-};
-typedef struct StyleApply StyleApply;
 
 static void 
 styleApply(pTree, pNode, p)
@@ -574,8 +714,12 @@ styleApply(pTree, pNode, p)
 {
     int i;
     int doStyle;
+    int isStyle;                     /* True to restyle this node */
+    int eRestyle;                    /* Saved HtmlElementNode.eRestyle */
     int nCounterStartScope;
     int redrawmode = 0;
+    StyleShareCache sShare;          /* Style sharing cache for children */
+    StyleShareCache *pShare;         /* Saved value of p->pShare */
     HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
 
     /* Text nodes do not have an associated style. */
@@ -585,8 +729,16 @@ styleApply(pTree, pNode, p)
         p->doStyle = 1;
     }
 
-    if (p->doStyle) {
-        redrawmode = styleNode(pTree, pNode, (ClientData) ((size_t) p->isRoot));
+    /* Nodes marked by HtmlCallbackRestyleNode() are restyled even if they
+     * are not part of the region that begins at p->pRestyle.
+     */
+    eRestyle = pElem->eRestyle;
+    pElem->eRestyle = 0;
+    isStyle = (p->doStyle || eRestyle);
+
+    if (isStyle) {
+        ClientData isRoot = (ClientData) ((size_t) p->isRoot);
+        redrawmode = styleNode(pTree, pNode, isRoot, p);
 
         /* If there has been a style-callback configured (-stylecmd option to
          * the [nodeHandle replace] command) for this node, invoke it now.
@@ -597,6 +749,18 @@ styleApply(pTree, pNode, p)
             if (rc != TCL_OK) {
                 Tcl_BackgroundError(pTree->interp);
             }
+
+            /* The script may have modified the document in ways that
+             * HtmlCssStyleSheetApply() cannot detect. Do not use any
+             * more precomputed selector matches during this pass, and do
+             * not share computed values with siblings styled before the
+             * script was run.
+             */
+            HtmlCssPrematchFree(p->pPrematch);
+            p->pPrematch = 0;
+            if (p->pShare) {
+                memset(p->pShare, 0, sizeof(StyleShareCache));
+            }
         }
     }
 
@@ -604,7 +768,7 @@ styleApply(pTree, pNode, p)
     nCounterStartScope = p->nCounterStartScope;
     p->nCounterStartScope = p->nCounter;
 
-    if (p->doStyle || p->doContent) {
+    if (isStyle || p->doContent) {
         /* Destroy current generated content */
         if (pElem->pBefore || pElem->pAfter) {
             HtmlNodeClearGenerated(pTree, pElem);
@@ -622,13 +786,30 @@ styleApply(pTree, pNode, p)
         HtmlStyleHandleCounters(pTree, HtmlNodeComputedValues(pElem->pBefore));
     }
 
+    /* The descendants of this node must be restyled if this node is part
+     * of the p->pRestyle region, if it was marked with HTML_RESTYLE_TREE,
+     * or if it's computed values have changed (and so the values 
+     * inherited by descendants may have changed). Computed values are
+     * interned, so comparing pointers is sufficient.
+     */
     doStyle = p->doStyle;
+    if (eRestyle == HTML_RESTYLE_TREE || (
+        isStyle && pElem->pPropertyValues != pElem->pPreviousValues
+    )) {
+        p->doStyle = 1;
+    }
+    HtmlCssAncestorFilterPush(p->pFilter, pNode);
+    pShare = p->pShare;
+    memset(&sShare, 0, sizeof(StyleShareCache));
+    p->pShare = &sShare;
     for (i = 0; i < HtmlNodeNumChildren(pNode); i++) {
         styleApply(pTree, HtmlNodeChild(pNode, i), p);
     }
+    p->pShare = pShare;
+    HtmlCssAncestorFilterPop(p->pFilter);
     p->doStyle = doStyle;
 
-    if (p->doStyle || p->doContent) {
+    if (isStyle || p->doContent) {
         /* Generate :after content */
         HtmlCssStyleGenerateContent(pTree, pElem, 0);
         if (pElem->pAfter) {
@@ -835,6 +1016,14 @@ HtmlStyleApply(pTree, pNode)
     memset(&sApply, 0, sizeof(StyleApply));
     sApply.pRestyle = pNode;
     sApply.isRoot = isRoot;
+    sApply.pFilter = HtmlCssAncestorFilterNew();
+
+    /* If the whole tree is to be restyled and the -stylethreads option
+     * is set, match selectors against all nodes in parallel first.
+     */
+    if (isRoot && pTree->options.stylethreads > 1) {
+        sApply.pPrematch = HtmlCssPrematch(pTree, pTree->options.stylethreads);
+    }
 
     assert(pTree->pStyleApply == 0);
     pTree->pStyleApply = (void *)&sApply;
@@ -842,6 +1031,52 @@ HtmlStyleApply(pTree, pNode)
     pTree->pStyleApply = 0;
     pTree->isFixed = sApply.isFixed;
     HtmlFree(sApply.apCounter);
+    HtmlCssAncestorFilterFree(sApply.pFilter);
+    HtmlCssPrematchFree(sApply.pPrematch);
+    return TCL_OK;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlStyleStats --
+ *
+ *     $html _stylestats
+ *
+ *     Return a key-value list of statistics for the style sharing cache.
+ *     The keys are "sharehit" (number of nodes styled by reusing the 
+ *     computed values of a sibling) and "sharemiss" (number of nodes for
+ *     which the cascade was run). Both counters accumulate over the 
+ *     lifetime of the widget. The root node is not counted.
+ *
+ * Results:
+ *     Tcl result (i.e. TCL_OK, TCL_ERROR).
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlStyleStats(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget */
+    Tcl_Interp *interp;                /* The interpreter */
+    int objc;                          /* Number of arguments */
+    Tcl_Obj *CONST objv[];             /* List of all arguments */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+    Tcl_Obj *pRet = Tcl_NewObj();
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "");
+        return TCL_ERROR;
+    }
+
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("sharehit", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewIntObj(pTree->nStyleShareHit));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewStringObj("sharemiss", -1));
+    Tcl_ListObjAppendElement(0, pRet, Tcl_NewIntObj(pTree->nStyleShareMiss));
+    Tcl_SetObjResult(interp, pRet);
     return TCL_OK;
 }
 
@@ -62,6 +62,22 @@ struct CellReqWidth {
 #define CELL_WIDTH_PIXELS  1
 #define CELL_WIDTH_PERCENT 2
 
+/*
+ * A cached layout of a single table row, stored in the layout-cache of
+ * the row node (see HtmlLayoutTableRowCache()). The canvas contains the
+ * row background and border and the content of each cell, with the top
+ * of the row at y-coordinate 0. It may be reused if the table is laid out
+ * again with the same column widths and 'border-spacing', provided the
+ * row and its descendants have not been modified since.
+ */
+struct HtmlTableRowCache {
+    int nCol;                /* Number of entries in aWidth[] */
+    int *aWidth;             /* Column widths the row was laid out for */
+    int border_spacing;      /* 'border-spacing' the row was laid out for */
+    int iHeight;             /* Height of row, including border-spacing */
+    HtmlCanvas canvas;       /* Row content */
+};
+
 /*
  * Structure used whilst laying out tables. See HtmlTableLayout().
  */
@@ -101,6 +117,19 @@ struct TableData {
     int *aY;                 /* Top y-coord for each row+1, wrt table box */
     TableCell *aCell;
 
+    int isRowSpan;           /* True if any cell has a rowspan other than 1 */
+
+    /*
+     * Used by tableDrawCells() and tableDrawRow() to reuse or create
+     * cached row layouts (see struct HtmlTableRowCache).
+     */
+    int isRowCache;          /* True if row layouts may be cached */
+    int iCacheRow;           /* Row the following four apply to, or -1 */
+    HtmlNode *pCacheNode;    /* Row node to cache iCacheRow in, or NULL */
+    HtmlTableRowCache *pRowCache;  /* Reusable layout of row iCacheRow */
+    NodeList *pAbsolute;     /* LayoutContext.pAbsolute at start of row */
+    NodeList *pFixed;        /* LayoutContext.pFixed at start of row */
+
     int row;                 /* Current row */
     int y;                   /* y-coord to draw at */
     int x;                   /* x-coord to draw at */
@@ -128,6 +157,13 @@ static CellCallback tableColWidthMultiSpan;
 /* Figure out the actual column widths (TableData.aWidth[]). */
 static void tableCalculateCellWidths(TableData *, int, int);
 
+/* Column widths for 'table-layout:fixed' tables. These are used instead
+ * of the three functions above. Only the first row of the table is
+ * examined.
+ */
+static CellCallback tableColWidthFixed;
+static void tableCalculateFixedWidths(TableData *, int);
+
 /* A row and cell callback (used together in a single iteration) to draw
  * the table content. All the actual drawing is done here. Everything
  * else is just about figuring out column widths.
@@ -669,6 +705,72 @@ tableColWidthMultiSpan(pNode, col, colspan, row, rowspan, pContext)
     return TCL_OK;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableColWidthFixed --
+ *
+ *     A tableIterate() callback used instead of tableColWidthSingleSpan()
+ *     and tableColWidthMultiSpan() when the table is laid out using the
+ *     fixed table layout algorithm (CSS 2.1 section 17.5.2.1). Only cells
+ *     in the first row of the table are considered, and their content is
+ *     never examined.
+ *
+ *     If the 'width' property of a first row cell is not 'auto', the
+ *     columns spanned by the cell are assigned an equal share of the
+ *     cell's width (including horizontal border and padding). A percentage
+ *     width is resolved against TableData.availablewidth.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Populates TableData.aReqWidth[] with CELL_WIDTH_AUTO or
+ *     CELL_WIDTH_PIXELS entries.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int 
+tableColWidthFixed(pNode, col, colspan, row, rowspan, pContext)
+    HtmlNode *pNode;
+    int col;
+    int colspan;
+    int row;
+    int rowspan;
+    void *pContext;
+{
+    TableData *pData = (TableData *)pContext;
+    CellReqWidth *aReq = pData->aReqWidth;
+    HtmlComputedValues *pV;
+    int iWidth;
+
+    if (row != 0) {
+        return TCL_OK;
+    }
+    if (colspan <= 0) {
+        colspan = 1;
+    }
+
+    fixNodeProperties(pData, pNode);
+    pV = HtmlNodeComputedValues(pNode);
+    iWidth = PIXELVAL(pV, WIDTH, pData->availablewidth);
+    if (iWidth >= 0) {
+        BoxProperties box;
+        int ii;
+        nodeGetBoxProperties(pData->pLayout, pNode, 0, &box);
+        iWidth += box.iLeft + box.iRight;
+        iWidth -= (colspan - 1) * pData->border_spacing;
+        for (ii = col; ii < (col + colspan); ii++) {
+            int w = MAX(0, iWidth) / (colspan - (ii - col));
+            aReq[ii].eType = CELL_WIDTH_PIXELS;
+            aReq[ii].x.iVal = w;
+            iWidth -= w;
+        }
+    }
+
+    return TCL_OK;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -700,6 +802,9 @@ tableCountCells(pNode, col, colspan, row, rowspan, pContext)
     if (colspan==0) {
         colspan = 1;
     }
+    if (rowspan!=1) {
+        pData->isRowSpan = 1;
+    }
 
     if (pData->nCol<(col+colspan)) {
         pData->nCol = col+colspan;
@@ -718,6 +823,189 @@ tableCountRows(pNode, row, pContext)
     return TCL_OK;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTableRowCacheFree --
+ *
+ *     Free a cached row layout created by tableRowToCache(). This is
+ *     called by HtmlLayoutInvalidateCache() when the layout-cache of the
+ *     row node is discarded.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlTableRowCacheFree(pTree, pRowCache)
+    HtmlTree *pTree;
+    HtmlTableRowCache *pRowCache;
+{
+    if (pRowCache) {
+        HtmlDrawCleanup(pTree, &pRowCache->canvas);
+        HtmlFree(pRowCache);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableRowCacheStart --
+ *
+ *     This is called by tableDrawCells() for the first cell of each row
+ *     drawn. Argument pRow is the parent of the cell, or NULL if the cell
+ *     is a transient node.
+ *
+ *     If the row has a cached layout that was created with the same
+ *     column widths as are now in use, and the cached display list is
+ *     not still linked into a layout cached for an ancestor (see 
+ *     HtmlLayoutCacheRelease()), set TableData.pRowCache so that
+ *     the cells of the row are not laid out again. Otherwise, discard
+ *     any cached layout. Cached layouts share canvas items with the
+ *     layout-caches of the cells, so a stale row layout must be discarded
+ *     before the cells are laid out.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Sets the TableData.iCacheRow, pCacheNode, pRowCache, pAbsolute and
+ *     pFixed variables.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableRowCacheStart(pData, pRow, row)
+    TableData *pData;
+    HtmlNode *pRow;
+    int row;
+{
+    LayoutContext *pLayout = pData->pLayout;
+
+    pData->iCacheRow = row;
+    pData->pCacheNode = 0;
+    pData->pRowCache = 0;
+    pData->pAbsolute = pLayout->pAbsolute;
+    pData->pFixed = pLayout->pFixed;
+
+    if (
+        pRow && pRow->iNode >= 0 && 
+        DISPLAY(HtmlNodeComputedValues(pRow)) == CSS_CONST_TABLE_ROW
+    ) {
+        HtmlTableRowCache **ppCache = HtmlLayoutTableRowCache(pRow);
+        HtmlTableRowCache *p = *ppCache;
+        int nCol = pData->nCol;
+
+        if (pData->isRowCache) {
+            pData->pCacheNode = pRow;
+            if (p && 
+                p->nCol == nCol && 
+                p->border_spacing == pData->border_spacing &&
+                0 == memcmp(p->aWidth, pData->aWidth, nCol * sizeof(int))
+            ) {
+                HtmlTree *pTree = pLayout->pTree;
+                if (HtmlDrawCanvasIsShared(&p->canvas)) {
+                    HtmlLayoutCacheRelease(pTree, pRow, &p->canvas);
+                }
+                if (!HtmlDrawCanvasIsShared(&p->canvas)) {
+                    pData->pRowCache = p;
+                    return;
+                }
+            }
+        }
+
+        HtmlTableRowCacheFree(pLayout->pTree, p);
+        *ppCache = 0;
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableRowFromCache --
+ *
+ *     Draw row number row of the table using the cached layout
+ *     TableData.pRowCache. The cached layout is drawn at the current
+ *     y-coordinate of the row, and the y-coordinates of subsequent rows
+ *     are adjusted by the height of the cached row.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableRowFromCache(pData, pNode, row)
+    TableData *pData;
+    HtmlNode *pNode;
+    int row;
+{
+    HtmlTableRowCache *p = pData->pRowCache;
+    HtmlCanvas sRow;
+    int y = pData->aY[row];
+    int i;
+
+    assert(p && pNode == pData->pCacheNode);
+
+    memset(&sRow, 0, sizeof(HtmlCanvas));
+    HtmlDrawCopyCanvas(&sRow, &p->canvas);
+    DRAW_CANVAS(&pData->pBox->vc, &sRow, 0, y, pNode);
+
+    for (i = row + 1; i <= pData->nRow; i++) {
+        pData->aY[i] = MAX(pData->aY[i], y + p->iHeight);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableRowToCache --
+ *
+ *     Store the layout of row number row, drawn to canvas pCanvas by
+ *     tableDrawRow(), in the layout-cache of row node pNode. The
+ *     y-coordinates in pCanvas are relative to the top of the row.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Adds origin items to pCanvas.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableRowToCache(pData, pNode, row, pCanvas)
+    TableData *pData;
+    HtmlNode *pNode;
+    int row;
+    HtmlCanvas *pCanvas;
+{
+    HtmlTableRowCache **ppCache = HtmlLayoutTableRowCache(pNode);
+    HtmlTableRowCache *p;
+    int nCol = pData->nCol;
+
+    assert(*ppCache == 0);
+    p = (HtmlTableRowCache *)HtmlClearAlloc("HtmlTableRowCache",
+        sizeof(HtmlTableRowCache) + nCol * sizeof(int)
+    );
+    p->nCol = nCol;
+    p->aWidth = (int *)&p[1];
+    memcpy(p->aWidth, pData->aWidth, nCol * sizeof(int));
+    p->border_spacing = pData->border_spacing;
+    p->iHeight = pData->aY[row + 1] - pData->aY[row];
+
+    HtmlDrawOrigin(pCanvas);
+    HtmlDrawCopyCanvas(&p->canvas, pCanvas);
+    *ppCache = p;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -748,11 +1036,38 @@ tableDrawRow(pNode, row, pContext)
     int i;                                 /* Column iterator */
     const int mmt = pLayout->minmaxTest;
 
+    HtmlCanvas sRow;                       /* Canvas for cached row layout */
+    HtmlCanvas *pCanvas = &pData->pBox->vc;
+    int y0 = 0;                            /* Offset of pCanvas y-coords */
+    int isStore = 0;                       /* True to cache the row layout */
+
     HtmlElementNode *pElem = (HtmlElementNode *)pNode;
     assert(!pElem || !HtmlNodeIsText(pNode));
 
     assert(row < pData->nRow);
 
+    /* If the cells of this row were not laid out because a cached layout
+     * of the row can be used, draw the cached layout and return. Otherwise,
+     * if the row layout may be cached, draw the row into the temporary
+     * canvas sRow, relative to the top of the row.
+     */
+    if (pData->iCacheRow == row) {
+        if (pData->pRowCache) {
+            tableRowFromCache(pData, pNode, row);
+            return TCL_OK;
+        }
+        isStore = (
+            pData->pCacheNode == pNode &&
+            pData->pAbsolute == pLayout->pAbsolute &&
+            pData->pFixed == pLayout->pFixed
+        );
+        if (isStore) {
+            memset(&sRow, 0, sizeof(HtmlCanvas));
+            pCanvas = &sRow;
+            y0 = pData->aY[row];
+        }
+    }
+
     /* Add the background and border for the table-row, if a node exists. A
      * node may not exist if the row is entirely populated by overflow from
      * above. For example in the following document, there is no node for the
@@ -786,7 +1101,7 @@ tableDrawRow(pNode, row, pContext)
         }
         w1 += ((pData->nCol - 1) * pData->border_spacing);
         HtmlLayoutDrawBox(pData->pLayout->pTree, 
-            &pData->pBox->vc, x1, y1, w1, h1, pNode, 0, mmt
+            pCanvas, x1, y1 - y0, w1, h1, pNode, 0, mmt
         );
     }
     CHECK_INTEGER_PLAUSIBILITY(pData->pBox->vc.bottom);
@@ -805,8 +1120,6 @@ tableDrawRow(pNode, row, pContext)
             int y;
             int k;
 
-            HtmlCanvas *pCanvas = &pData->pBox->vc;
-
             x1 = x;
             y1 = pData->aY[pCell->startrow];
             w1 = 0;
@@ -817,7 +1130,7 @@ tableDrawRow(pNode, row, pContext)
             h1 = pData->aY[pCell->finrow] - pData->border_spacing - y1;
             if (pCell->pNode->iNode >= 0) {
                 HtmlLayoutDrawBox(pData->pLayout->pTree, 
-                    pCanvas, x1, y1, w1, h1, pCell->pNode, 0, mmt
+                    pCanvas, x1, y1 - y0, w1, h1, pCell->pNode, 0, mmt
                 );
             }
             nodeGetBoxProperties(pLayout, pCell->pNode, 0, &box);
@@ -844,13 +1157,20 @@ tableDrawRow(pNode, row, pContext)
                     break;
             }
             CHECK_INTEGER_PLAUSIBILITY(pCanvas->bottom);
-            DRAW_CANVAS(pCanvas, &pCell->box.vc, x+box.iLeft, y, pCell->pNode);
+            DRAW_CANVAS(
+                pCanvas, &pCell->box.vc, x+box.iLeft, y-y0, pCell->pNode
+            );
             CHECK_INTEGER_PLAUSIBILITY(pCanvas->bottom);
             memset(pCell, 0, sizeof(TableCell));
         }
         x += pData->aWidth[i];
     }
 
+    if (isStore) {
+        tableRowToCache(pData, pNode, row, &sRow);
+        DRAW_CANVAS(&pData->pBox->vc, &sRow, 0, y0, pNode);
+    }
+
     CHECK_INTEGER_PLAUSIBILITY(pData->pBox->vc.bottom);
     CHECK_INTEGER_PLAUSIBILITY(pData->pBox->vc.right);
 
@@ -927,6 +1247,20 @@ tableDrawCells(pNode, col, colspan, row, rowspan, pContext)
         pData->aY[row] = y;
     }
 
+    /* If this is the first cell of a new row, check for a cached layout
+     * of the row. If one can be used, the cell is not laid out here.
+     * The cached row is drawn by tableDrawRow().
+     */
+    if (row != pData->iCacheRow) {
+        tableRowCacheStart(pData, HtmlNodeParent(pNode), row);
+    }
+    if (pData->pRowCache) {
+        return TCL_OK;
+    }
+    if (!HtmlNodeParent(pNode)) {
+        pData->pCacheNode = 0;
+    }
+
     for (i=0; i<col; i++) {
         x += pData->aWidth[i];
     }
@@ -1709,6 +2043,61 @@ tableCalculateMaxWidth(pData)
     return ret;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * tableCalculateFixedWidths --
+ *
+ *     Figure out the actual column widths for a table laid out using
+ *     the fixed table layout algorithm, based on the requested widths
+ *     collected by tableColWidthFixed(). Columns with a requested width
+ *     get exactly that width. The remaining space, if any, is divided
+ *     equally between the columns without one, or between all columns
+ *     if every column has a requested width.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Populates TableData.aWidth[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+tableCalculateFixedWidths(pData, availablewidth)
+    TableData *pData;
+    int availablewidth;    /* Total width available for cells */
+{
+    CellReqWidth *aReqWidth = pData->aReqWidth;
+    int *aWidth = pData->aWidth;
+    int nCol = pData->nCol;
+    int iRemaining = availablewidth;
+    int nAuto = 0;
+    int ii;
+
+    for (ii = 0; ii < nCol; ii++) {
+        if (aReqWidth[ii].eType == CELL_WIDTH_PIXELS) {
+            aWidth[ii] = aReqWidth[ii].x.iVal;
+            iRemaining -= aWidth[ii];
+        } else {
+            aWidth[ii] = 0;
+            nAuto++;
+        }
+    }
+
+    if (iRemaining > 0) {
+        int n = (nAuto > 0) ? nAuto : nCol;
+        for (ii = 0; ii < nCol; ii++) {
+            if (nAuto == 0 || aReqWidth[ii].eType != CELL_WIDTH_PIXELS) {
+                int w = iRemaining / n;
+                aWidth[ii] += w;
+                iRemaining -= w;
+                n--;
+            }
+        }
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -1727,7 +2116,10 @@ tableCalculateMaxWidth(pData)
  *     but <col> and <colspan> are fairly important.
  *
  *     The table layout algorithm used is described in section 17.5.2.2 of 
- *     the CSS 2.1 spec.
+ *     the CSS 2.1 spec. If the table has 'table-layout:fixed' and a 'width'
+ *     other than 'auto', the fixed layout algorithm from section 17.5.2.1
+ *     is used instead. Since <col> elements are not supported, the column
+ *     widths are taken from the cells of the first row.
  *
  *     When this function is called, pBox->iContaining contains the width
  *     available to the table content - not including any margin, border or
@@ -1757,6 +2149,7 @@ HtmlTableLayout(pLayout, pBox, pNode)
     int nCol = 0;             /* Number of columns in this table */
     int i;
     int availwidth;           /* Total width available for cells */
+    int isFixed;              /* True to use the fixed layout algorithm */
 
     int *aMinWidth = 0;       /* Minimum width for each column */
     int *aMaxWidth = 0;       /* Minimum width for each column */
@@ -1782,6 +2175,15 @@ HtmlTableLayout(pLayout, pBox, pNode)
      */
     data.border_spacing = pV->iBorderSpacing;
 
+    /* The fixed table layout algorithm is only used if the table has a
+     * 'width' other than 'auto' (CSS 2.1 section 17.5.2.1). In this case
+     * the column widths depend only on the table width and the first row
+     * of the table, so cell content is laid out once, while drawing.
+     */
+    isFixed = (pV->eTableLayout == CSS_CONST_FIXED && (
+        (pV->mask & PROP_MASK_WIDTH) || pV->iWidth != PIXELVAL_AUTO
+    ));
+
     /* First step is to figure out how many columns this table has.
      * There are two ways to do this - by looking at COL or COLGROUP
      * children of the table, or by counting the cells in each rows.
@@ -1821,6 +2223,8 @@ HtmlTableLayout(pLayout, pBox, pNode)
     data.aReqWidth = aReqWidth;
     data.aSingleReqWidth = aSingleReqWidth;
 
+    availwidth = (pBox->iContaining - (nCol+1) * data.border_spacing);
+
     /* Calculate the minimum, maximum, and requested percentage widths of
      * each column.  The first pass only considers cells that span a single
      * column.  In this case the min/max width of each column is the maximum of
@@ -1832,34 +2236,57 @@ HtmlTableLayout(pLayout, pBox, pNode)
      * the width of each column that the cell spans is increased by 
      * the same amount (plus or minus a pixel to account for integer
      * rounding).
+     *
+     * For a fixed layout table, the column widths are determined by the
+     * first row only. When calculating the min or max width of the table
+     * percentage widths are ignored and columns without a requested
+     * width are zero pixels wide.
      */
-    tableIterate(pTree, pNode, tableColWidthSingleSpan, 0, &data);
-    memcpy(aReqWidth, aSingleReqWidth, nCol*sizeof(CellReqWidth));
-    tableIterate(pTree, pNode, tableColWidthMultiSpan, 0, &data);
+    if (isFixed) {
+        int iAvail = (pLayout->minmaxTest ? 0 : availwidth);
+        data.availablewidth = (iAvail ? iAvail : PIXELVAL_AUTO);
+        tableIterate(pTree, pNode, tableColWidthFixed, 0, &data);
+        tableCalculateFixedWidths(&data, iAvail);
+    } else {
+        tableIterate(pTree, pNode, tableColWidthSingleSpan, 0, &data);
+        memcpy(aReqWidth, aSingleReqWidth, nCol*sizeof(CellReqWidth));
+        tableIterate(pTree, pNode, tableColWidthMultiSpan, 0, &data);
+    }
 
     pBox->width = 0;
-    availwidth = (pBox->iContaining - (nCol+1) * data.border_spacing);
     switch (pLayout->minmaxTest) {
         case 0:
-            tableCalculateCellWidths(&data, availwidth, 0);
+            if (!isFixed) {
+                tableCalculateCellWidths(&data, availwidth, 0);
+            }
             for (i = 0; i < nCol; i++) {
                 pBox->width += aWidth[i];
             }
             data.aY = aY;
             data.aCell = aCell;
             data.pBox = pBox;
+            data.iCacheRow = -1;
+            data.isRowCache = (
+                pTree->options.layoutcache && !data.isRowSpan
+            );
             tableIterate(pTree, pNode, tableDrawCells, tableDrawRow, &data);
             pBox->height = data.aY[data.nRow];
             break;
 
         case MINMAX_TEST_MIN:
             for (i = 0; i < nCol; i++) {
-                pBox->width += aMinWidth[i];
+                pBox->width += (isFixed ? aWidth[i] : aMinWidth[i]);
             }
             break;
 
         case MINMAX_TEST_MAX: {
             int minwidth = 0;
+            if (isFixed) {
+                for (i = 0; i < nCol; i++) {
+                    pBox->width += aWidth[i];
+                }
+                break;
+            }
             pBox->width = tableCalculateMaxWidth(&data);
             pBox->width = MIN(pBox->width, availwidth);
             for (i = 0; i < nCol; i++) {
@@ -279,8 +279,32 @@ HtmlHashInit(htmlPtr, start)
 }
 
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributesNew --
+ *
+ *     Allocate a new HtmlAttributes structure containing the (argc/2)
+ *     attribute name/value pairs in argv[] (string lengths in arglen[]).
+ *     If doEscape is true, entity references are translated and the 
+ *     attribute names folded to lower-case.
+ *
+ *     If pTree is not NULL, attribute names are interned in the 
+ *     HtmlTree.aAtom table. The values of the "id", "class" and "style"
+ *     attributes are cached and the class list is split into individual
+ *     names (see the comments above struct HtmlAttributes in html.h).
+ *
+ * Results:
+ *     Pointer to new structure, or NULL if argc is less than 2.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
 HtmlAttributes *
-HtmlAttributesNew(argc, argv, arglen, doEscape)
+HtmlAttributesNew(pTree, argc, argv, arglen, doEscape)
+    HtmlTree *pTree;
     int argc;
     char const **argv;
     int *arglen;
@@ -292,18 +316,44 @@ HtmlAttributesNew(argc, argv, arglen, doEscape)
         int nByte;
         int j;
         char *zBuf;
+        int iClass = -1;          /* Index of "class" attribute, if any */
+        int nClassMax = 0;        /* Max. number of entries in azClass[] */
+        int nClassByte = 0;       /* Bytes reserved for azClass[] strings */
 
         int nAttr = argc / 2;
 
+        /* Find the "class" attribute. Translating entities can only make
+         * the value shorter, so the space required for the split class 
+         * list is bounded by the length of the untranslated value.
+         */
+        for (j = 0; iClass < 0 && j < nAttr; j++) {
+            if (arglen[j*2] == 5 && (doEscape ? 
+                    0 == strnicmp(argv[j*2], "class", 5) :
+                    0 == strncmp(argv[j*2], "class", 5)
+            )) {
+                iClass = j;
+                nClassMax = (arglen[j*2+1] / 2) + 1;
+            }
+        }
+
         nByte = sizeof(HtmlAttributes);
         for (j = 0; j < argc; j++) {
             nByte += arglen[j] + 1;
         }
         nByte += sizeof(struct HtmlAttribute) * (argc - 1);
+        if (iClass >= 0) {
+            nClassByte = arglen[iClass*2+1] + nClassMax;
+            nByte += nClassMax * sizeof(char *) + nClassByte;
+        }
 
         pMarkup = (HtmlAttributes *)HtmlAlloc("HtmlAttributes", nByte);
         pMarkup->nAttr = nAttr;
-        zBuf = (char *)(&pMarkup->a[nAttr]);
+        pMarkup->zId = 0;
+        pMarkup->zClass = 0;
+        pMarkup->zStyle = 0;
+        pMarkup->nClass = 0;
+        pMarkup->azClass = (const char **)(&pMarkup->a[nAttr]);
+        zBuf = (char *)(&pMarkup->azClass[nClassMax]);
 
         for (j=0; j < nAttr; j++) {
             int idx = (j * 2);
@@ -312,7 +362,7 @@ HtmlAttributesNew(argc, argv, arglen, doEscape)
             memcpy(zBuf, argv[idx], arglen[idx]);
             zBuf[arglen[idx]] = '\0';
             if (doEscape) {
-                HtmlTranslateEscapes(zBuf);
+                HtmlTranslateEscapes(zBuf, 1);
                 ToLower(zBuf);
             }
             zBuf += (arglen[idx] + 1);
@@ -320,14 +370,84 @@ HtmlAttributesNew(argc, argv, arglen, doEscape)
             pMarkup->a[j].zValue = zBuf;
             memcpy(zBuf, argv[idx+1], arglen[idx+1]);
             zBuf[arglen[idx+1]] = '\0';
-            if (doEscape) HtmlTranslateEscapes(zBuf);
+            if (doEscape) HtmlTranslateEscapes(zBuf, 1);
             zBuf += (arglen[idx+1] + 1);
+
+            if (!pMarkup->zId && 0 == strcmp(pMarkup->a[j].zName, "id")) {
+                pMarkup->zId = pMarkup->a[j].zValue;
+            }
+            if (!pMarkup->zStyle && 0==strcmp(pMarkup->a[j].zName, "style")) {
+                pMarkup->zStyle = pMarkup->a[j].zValue;
+            }
+        }
+
+        /* Split the value of the class attribute into a list of names. */
+        if (iClass >= 0) {
+            const char *zClass = pMarkup->a[iClass].zValue;
+            char *zEnd = &zBuf[nClassByte];
+            int nClass;
+            pMarkup->zClass = zClass;
+            while (
+                pMarkup->nClass < nClassMax &&
+                (zClass = HtmlCssGetNextListItem(zClass,strlen(zClass),&nClass))
+            ) {
+                if (&zBuf[nClass + 1] > zEnd) break;
+                memcpy(zBuf, zClass, nClass);
+                zBuf[nClass] = '\0';
+                pMarkup->azClass[pMarkup->nClass++] = zBuf;
+                zBuf += (nClass + 1);
+                zClass += nClass;
+            }
+        }
+
+        if (pTree) {
+            HtmlAttributesIntern(pTree, pMarkup);
         }
     }
 
     return pMarkup;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlAttributesIntern --
+ *
+ *     Replace each attribute name in pMarkup with the equivalent atom 
+ *     from the HtmlTree.aAtom table, where there is an exact match. This
+ *     is called by HtmlAttributesNew() if it is passed a tree, and by the
+ *     parallel tokenizer in htmlparse.c, which builds attributes on 
+ *     threads that may not use the atoms table.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May add entries to HtmlTree.aAtom.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlAttributesIntern(pTree, pMarkup)
+    HtmlTree *pTree;
+    HtmlAttributes *pMarkup;
+{
+    int j;
+    for (j = 0; pMarkup && j < pMarkup->nAttr; j++) {
+        const char *zName = pMarkup->a[j].zName;
+        Tcl_HashEntry *pEntry;
+        const char *zAtom;
+        int isNew;
+        pEntry = Tcl_CreateHashEntry(&pTree->aAtom, zName, &isNew);
+        zAtom = Tcl_GetHashKey(&pTree->aAtom, pEntry);
+        /* The atoms table is case-insensitive. Only use the atom
+         * if it is an exact match for the attribute name. */
+        if (0 == strcmp(zAtom, zName)) {
+            pMarkup->a[j].zName = (char *)zAtom;
+        }
+    }
+}
+
 /*
 ** Convert a markup name into a type integer
 */
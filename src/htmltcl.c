@@ -418,7 +418,6 @@ static void runLayoutEngine(ClientData clientData);
 INSTRUMENTED(runDynamicStyleEngine, HTML_INSTRUMENT_DYNAMIC_STYLE_ENGINE)
 {
     HtmlTree *pTree = (HtmlTree *)clientData;
-    assert(pTree->cb.pDynamic);
     HtmlCssCheckDynamic(pTree);
 }
 
@@ -427,9 +426,12 @@ INSTRUMENTED(runStyleEngine, HTML_INSTRUMENT_STYLE_ENGINE)
     HtmlTree *pTree = (HtmlTree *)clientData;
     HtmlNode *pRestyle = pTree->cb.pRestyle;
 
+    /* If pRestyle is NULL, then only nodes marked by 
+     * HtmlCallbackRestyleNode() need to be restyled.
+     */
     pTree->cb.pRestyle = 0;
     assert(pTree->cb.pSnapshot);
-    assert(pRestyle);
+    if (!pTree->pRoot) return;
 
     HtmlStyleApply(pTree, pRestyle);
     HtmlRestackNodes(pTree);
@@ -444,13 +446,24 @@ INSTRUMENTED(runLayoutEngine, HTML_INSTRUMENT_LAYOUT_ENGINE)
 {
     HtmlTree *pTree = (HtmlTree *)clientData;
     HtmlDamage *pD;
+    clock_t layoutClock;
+    int nHit;
+    int nMiss;
 
     assert(pTree->cb.pSnapshot);
 
     if (!pTree->options.enablelayout) return;
 
     pD = pTree->cb.pDamage;
+    nHit = pTree->fontcache.nWidthHit;
+    nMiss = pTree->fontcache.nWidthMiss;
+    layoutClock = clock();
     HtmlLayout(pTree);
+    layoutClock = clock() - layoutClock;
+    HtmlLog(pTree, "TIMING", "Layout: clicks=%d textwidth-hit=%d miss=%d",
+        layoutClock, pTree->fontcache.nWidthHit - nHit,
+        pTree->fontcache.nWidthMiss - nMiss
+    );
     if (0 && pTree->cb.isForce) {
         pTree->cb.flags |= HTML_SCROLL;
     }
@@ -807,6 +820,58 @@ HtmlCallbackRestyle(pTree, pNode)
     HtmlCssSearchInvalidateCache(pTree);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCallbackRestyleNode --
+ *
+ *     Next widget idle-callback, recalculate style information for node
+ *     pNode (if eRestyle is HTML_RESTYLE_NODE), or for pNode and all of
+ *     it's descendants (if eRestyle is HTML_RESTYLE_TREE). Unlike 
+ *     HtmlCallbackRestyle(), the right-siblings of pNode are not 
+ *     restyled. The descendants of a node restyled with HTML_RESTYLE_NODE
+ *     are restyled only if it's computed values change.
+ *
+ *     The node is marked by setting HtmlElementNode.eRestyle. Any number
+ *     of nodes may be marked between style engine runs. If pNode has 
+ *     never been styled, this function is equivalent to 
+ *     HtmlCallbackRestyle().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify HtmlTree.cb and/or register for an idle callback with
+ *     the Tcl event loop.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlCallbackRestyleNode(pTree, pNode, eRestyle)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    int eRestyle;
+{
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    assert(eRestyle == HTML_RESTYLE_NODE || eRestyle == HTML_RESTYLE_TREE);
+
+    if (!pElem) return;
+    if (!pElem->pPropertyValues) {
+        HtmlCallbackRestyle(pTree, pNode);
+        return;
+    }
+
+    snapshotLayout(pTree);
+    pElem->eRestyle = MAX(pElem->eRestyle, eRestyle);
+    if (!pTree->cb.flags) {
+        Tcl_DoWhenIdle(callbackHandler, (ClientData)pTree);
+    }
+    pTree->cb.flags |= HTML_RESTYLE;
+
+    HtmlTextInvalidate(pTree);
+    HtmlCssSearchInvalidateCache(pTree);
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -841,6 +906,54 @@ HtmlCallbackDynamic(pTree, pNode)
     }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlCallbackDynamicNode --
+ *
+ *     Next widget idle-callback, check if any of the dynamic CSS 
+ *     conditions attached to node pNode (if eCheck is HTML_RESTYLE_NODE),
+ *     or to pNode and it's descendants (if eCheck is HTML_RESTYLE_TREE),
+ *     have changed. If so, restyle the affected nodes.
+ *
+ *     The node is marked by setting bits in HtmlElementNode.eDynamic.
+ *     The HTML_RESTYLE_CHILD bit is set on each ancestor of pNode, so
+ *     that HtmlCssCheckDynamic() can find the marked nodes without 
+ *     visiting unmarked sub-trees.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     May modify HtmlTree.cb and/or register for an idle callback with
+ *     the Tcl event loop.
+ *
+ *---------------------------------------------------------------------------
+ */
+void 
+HtmlCallbackDynamicNode(pTree, pNode, eCheck)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    int eCheck;
+{
+    HtmlElementNode *pElem = HtmlNodeAsElement(pNode);
+    HtmlNode *p;
+    assert(eCheck == HTML_RESTYLE_NODE || eCheck == HTML_RESTYLE_TREE);
+
+    if (!pElem) return;
+    pElem->eDynamic |= eCheck;
+    for (p = HtmlNodeParent(pNode); p; p = HtmlNodeParent(p)) {
+        HtmlElementNode *pParent = (HtmlElementNode *)p;
+        if (pParent->eDynamic & HTML_RESTYLE_CHILD) break;
+        pParent->eDynamic |= HTML_RESTYLE_CHILD;
+    }
+
+    if (!pTree->cb.flags) {
+        Tcl_DoWhenIdle(callbackHandler, (ClientData)pTree);
+    }
+    pTree->cb.flags |= HTML_DYNAMIC;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -875,8 +988,6 @@ HtmlCallbackLayout(pTree, pNode)
         for (p = pNode; p; p = HtmlNodeParent(p)) {
             HtmlLayoutInvalidateCache(pTree, p);
         }
-
-        pTree->isBboxOk = 0;
     }
 }
 
@@ -1075,6 +1186,7 @@ deleteWidget(clientData)
     HtmlDamage *pDamage;
     HtmlTree *pTree = (HtmlTree *)clientData;
     HtmlTreeClear(pTree);
+    HtmlNodeArenaRelease(pTree);
 
     /* Delete the contents of the three "handler" hash tables */
     cleanupHandlerTable(&pTree->aNodeHandler);
@@ -1264,7 +1376,6 @@ worldChangedCb(pTree, pNode, clientData)
         HtmlNodeClearStyle(pTree, pElem);
         HtmlDrawCanvasItemRelease(pTree, pElem->pBox);
         pElem->pBox = 0;
-        pTree->isBboxOk = 0;
     }
     return HTML_WALK_DESCEND;
 }
@@ -1343,6 +1454,9 @@ configureCmd(clientData, interp, objc, objv)
     #define DOUBLE(v, s1, s2, s3, f) \
         {TK_OPTION_DOUBLE, "-" #v, s1, s2, s3, -1, \
          Tk_Offset(HtmlOptions, v), 0, 0, f}
+    #define INT(v, s1, s2, s3, f) \
+        {TK_OPTION_INT, "-" #v, s1, s2, s3, -1, \
+         Tk_Offset(HtmlOptions, v), 0, 0, f}
     
     /* Option table definition for the html widget. */
     static Tk_OptionSpec htmlOptionSpec[] = {
@@ -1365,13 +1479,19 @@ BOOLEAN (imagecache, "imageCache", "ImageCache", "1", S_MASK),
 BOOLEAN (imagepixmapify, "imagePixmapify", "ImagePixmapify", "0", 0),
 STRING  (imagecmd, "imageCmd", "ImageCmd", ""),
 STRINGT (mode, "mode", "Mode", "standards", azModes),
+BOOLEAN (nodecommands, "nodeCommands", "NodeCommands", "1", 0),
 STRINGT (parsemode, "parsemode", "Parsemode", "html", azParseModes),
+INT     (parsethreads, "parseThreads", "ParseThreads", "0", 0),
 BOOLEAN (shrink, "shrink", "Shrink", "0", S_MASK),
+INT     (stylethreads, "styleThreads", "StyleThreads", "0", 0),
+INT     (textwidthcache, "textWidthCache", "TextWidthCache", "1000", 0),
 DOUBLE  (zoom, "zoom", "Zoom", "1.0", F_MASK),
 
 /* Debugging options */
 BOOLEAN (enablelayout, "enableLayout", "EnableLayout", "1", S_MASK),
 BOOLEAN (layoutcache, "layoutCache", "LayoutCache", "1", L_MASK),
+INT     (layoutcachelimit, "layoutCacheLimit", "LayoutCacheLimit", "0", 0),
+INT     (layoutcachesize, "layoutCacheSize", "LayoutCacheSize", "4", 0),
 STRING  (logcmd, "logCmd", "LogCmd", ""),
 STRING  (timercmd, "timerCmd", "TimerCmd", ""),
 
@@ -1380,6 +1500,7 @@ STRING  (timercmd, "timerCmd", "TimerCmd", ""),
     #undef PIXELS
     #undef STRING
     #undef BOOLEAN
+    #undef INT
 
     HtmlTree *pTree = (HtmlTree *)clientData;
     char *pOptions = (char *)&pTree->options;
@@ -1778,6 +1899,39 @@ preloadCmd(clientData, interp, objc, objv)
     return TCL_OK;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * buildCmd --
+ *
+ *         $widget build NODE-SPEC-LIST
+ *
+ *     Build orphan nodes from a list of node specifications and return
+ *     a list of node handles. See HtmlTreeBuild() for details.
+ * 
+ * Results:
+ *     List of node-handles.
+ *
+ * Side effects:
+ *     Creates new orphan nodes.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int 
+buildCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget */
+    Tcl_Interp *interp;                /* The interpreter */
+    int objc;                          /* Number of arguments */
+    Tcl_Obj *const *objv;              /* List of all arguments */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "NODE-SPEC-LIST");
+        return TCL_ERROR;
+    }
+    return HtmlTreeBuild(pTree, objv[2]);
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -2483,6 +2637,42 @@ stylereportCmd(clientData, interp, objc, objv)
 {
     return HtmlCssStyleReport(clientData, interp, objc, objv);
 }
+static int 
+stylestatsCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlStyleStats(clientData, interp, objc, objv);
+}
+static int 
+arenastatsCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlNodeArenaStats(clientData, interp, objc, objv);
+}
+static int 
+layoutcacheCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlLayoutCacheStats(clientData, interp, objc, objv);
+}
+static int 
+tokenizeCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlTokenizeCmd(clientData, interp, objc, objv);
+}
 
 /*
  *---------------------------------------------------------------------------
@@ -2564,6 +2754,7 @@ int widgetCmd(clientData, interp, objc, objv)
      */
     SubCmd aSub[] = {
         {"bbox",         bboxCmd},
+        {"build",        buildCmd},
         {"cget",         cgetCmd},
         {"configure",    configureCmd},
         {"fragment",     fragmentCmd},
@@ -2584,13 +2775,17 @@ int widgetCmd(clientData, interp, objc, objv)
         /* The following are for debugging only. May change at any time.
 	 * They are not included in the documentation. Just don't touch Ok? :)
          */
+        {"_arenastats",  arenastatsCmd},
         {"_delay",       delayCmd},
         {"_force",       forceCmd},
         {"_images",      imagesCmd},
+        {"_layoutcache", layoutcacheCmd},
         {"_primitives",  primitivesCmd},
         {"_relayout",    relayoutCmd},
         {"_styleconfig", styleconfigCmd},
         {"_stylereport", stylereportCmd},
+        {"_stylestats",  stylestatsCmd},
+        {"_tokenize",    tokenizeCmd},
 #ifndef NDEBUG
         {"_hashstats",  hashstatsCmd},
 #endif
@@ -2705,6 +2900,7 @@ newWidget(clientData, interp, objc, objv)
     /* Load the default style-sheet, ready for the first document. */
     doLoadDefaultStyle(pTree);
     pTree->isSequenceOk = 1;
+    pTree->iScopeGeneration = 1;
 
 #ifdef TKHTML_ENABLE_PROFILE
     if (1) {
@@ -2824,6 +3020,15 @@ htmlUriCmd(clientData, interp, objc, objv)
 {
     return HtmlCreateUri(clientData, interp, objc, objv);
 }
+static int 
+htmlNodeCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* Unused */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    return HtmlNodeHandleCmd(clientData, interp, objc, objv);
+}
 
 /*
  *---------------------------------------------------------------------------
@@ -2952,6 +3157,8 @@ DLL_EXPORT int Tkhtml_Init(interp)
 
     Tcl_CreateObjCommand(interp, "::tkhtml::uri", htmlUriCmd, 0, 0);
 
+    Tcl_CreateObjCommand(interp, "::tkhtml::node", htmlNodeCmd, 0, 0);
+
     Tcl_CreateObjCommand(interp, "::tkhtml::byteoffset", htmlByteOffsetCmd,0,0);
     Tcl_CreateObjCommand(interp, "::tkhtml::charoffset", htmlCharOffsetCmd,0,0);
 
@@ -42,6 +42,7 @@ static const char rcsid[] = "$Id: htmltree.c,v 1.161 2008/02/14 08:39:14 danielk
 #include "swproc.h"
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
 
 
 struct HtmlFragmentContext {
@@ -75,11 +76,119 @@ struct HtmlFragmentContext {
 
 static void treeCloseFosterTree(HtmlTree *);
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * treeScope --
+ *
+ *     Return a pointer to the HtmlElementScope summary for element pNode,
+ *     first rebuilding it (and the summaries of any ancestors that also
+ *     need it) if it is out of date.
+ *
+ *     A summary is out of date if it was built before the most recent
+ *     move of an existing node (see nodeInsertChild() and nodeOrphanize()),
+ *     or if the parent of pNode has changed since. While a document is
+ *     being parsed new elements are added as children of the most
+ *     recently added element, so usually only the summary for pNode
+ *     itself needs to be built and this function is O(1).
+ *
+ * Results:
+ *     Pointer to the summary for pNode.
+ *
+ * Side effects:
+ *     May modify the HtmlElementNode.scope structures of pNode and its
+ *     ancestors.
+ *
+ *---------------------------------------------------------------------------
+ */
+#define SCOPE_ISVALID(pTree, pElem) (                             \
+    (pElem)->scope.iGeneration == (pTree)->iScopeGeneration &&    \
+    (pElem)->scope.pParent == HtmlNodeParent(&(pElem)->node)      \
+)
+static HtmlElementScope *
+treeScope(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    HtmlElementNode *aStatic[32];
+    HtmlElementNode **apStack = aStatic;
+    int nAlloc = 32;
+    int nStack = 0;
+    HtmlElementNode *p;
+
+    assert(HtmlNodeAsElement(pNode));
+
+    /* Find the elements with out of date summaries. */
+    for (p = HtmlNodeAsElement(pNode); p; p = HtmlElemParent(p)) {
+        if (SCOPE_ISVALID(pTree, p)) break;
+        if (nStack == nAlloc) {
+            int nByte = nAlloc * 2 * sizeof(HtmlElementNode *);
+            HtmlElementNode **apNew;
+            apNew = (HtmlElementNode **)HtmlAlloc("temp", nByte);
+            memcpy(apNew, apStack, nStack * sizeof(HtmlElementNode *));
+            if (apStack != aStatic) {
+                HtmlFree(apStack);
+            }
+            apStack = apNew;
+            nAlloc = nAlloc * 2;
+        }
+        apStack[nStack++] = p;
+    }
+
+    /* Rebuild them, outermost first. */
+    while (nStack > 0) {
+        HtmlElementScope *pScope;
+        HtmlElementNode *pParent;
+        HtmlTokenMap *pMap;
+        int eTag;
+
+        p = apStack[--nStack];
+        pParent = HtmlElemParent(p);
+        pScope = &p->scope;
+        eTag = p->node.eTag;
+        pMap = HtmlMarkup(eTag);
+
+        if (pParent && !TAG_TO_TABLELEVEL(eTag)) {
+            memcpy(pScope->aTag, pParent->scope.aTag, sizeof(pScope->aTag));
+            pScope->pBarrier = pParent->scope.pBarrier;
+        } else {
+            memset(pScope->aTag, 0, sizeof(pScope->aTag));
+            pScope->pBarrier = (TAG_TO_TABLELEVEL(eTag) ? &p->node : 0);
+        }
+        if (eTag > 0 && eTag <= Html_TypeCount) {
+            pScope->aTag[eTag / 32] |= (1U << (eTag % 32));
+        }
+
+        if (pMap && pMap->xClose) {
+            pScope->pTest = &p->node;
+        } else {
+            pScope->pTest = (pParent ? pParent->scope.pTest : 0);
+        }
+        pScope->iDepth = (pParent ? pParent->scope.iDepth + 1 : 0);
+        pScope->pParent = (HtmlNode *)pParent;
+        pScope->iGeneration = pTree->iScopeGeneration;
+    }
+
+    if (apStack != aStatic) {
+        HtmlFree(apStack);
+    }
+    return &HtmlNodeAsElement(pNode)->scope;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
  * explicitCloseCount --
  *
+ *     Figure out how many elements are closed by the explicit closing
+ *     tag identified by eTag and zTag if the element currently being
+ *     constructed is pCurrent.
+ *
+ *     The HtmlElementScope summary records which tags are open between
+ *     pCurrent and the nearest enclosing table element. In the usual
+ *     case of a closing tag that does not match any open element (i.e.
+ *     stray "</font>" tags in tag-soup), this allows the function to
+ *     return without walking the chain of ancestors.
  *
  * Results:
  *     Sets the value of *pNClose.
@@ -90,13 +199,27 @@ static void treeCloseFosterTree(HtmlTree *);
  *---------------------------------------------------------------------------
  */
 static void 
-explicitCloseCount(pCurrent, eTag, zTag, pNClose)
+explicitCloseCount(pTree, pCurrent, eTag, zTag, pNClose)
+    HtmlTree *pTree;
     HtmlNode *pCurrent;     /* Node currently being constructed */
     int eTag;               /* Id of closing tag (i.e. "</p>" -> Html_P) */
     const char *zTag;       /* Atom of closing tag */
     int *pNClose;           /* OUT: Number of elements to close */
 {
     *pNClose = 0;
+    if (pCurrent && eTag > 0 && eTag <= Html_TypeCount) {
+        HtmlElementScope *pScope = treeScope(pTree, pCurrent);
+        HtmlNode *pBarrier = pScope->pBarrier;
+        if (
+            0 == (pScope->aTag[eTag / 32] & (1U << (eTag % 32))) && (
+                pBarrier == 0 ||
+                TAG_TO_TABLELEVEL(eTag) <= TAG_TO_TABLELEVEL(pBarrier->eTag)
+            )
+        ) {
+            return;
+        }
+    }
+
     if (eTag != Html_HTML && eTag != Html_BODY && eTag != Html_HEAD) {
         HtmlNode *p;
         int nLevel = 0;
@@ -118,6 +241,25 @@ explicitCloseCount(pCurrent, eTag, zTag, pNClose)
     }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * implicitCloseCount --
+ *
+ *     Figure out how many elements are implicitly closed by an opening
+ *     tag of type eTag if the element currently being constructed is
+ *     pCurrent. Only the ancestors of pCurrent that have a content-test
+ *     (HtmlTokenMap.xClose) function are visited, using the
+ *     HtmlElementScope.pTest pointers to skip the others.
+ *
+ * Results:
+ *     Sets the value of *pNClose.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
 static void 
 implicitCloseCount(pTree, pCurrent, eTag, pNClose)
     HtmlTree *pTree;
@@ -128,26 +270,26 @@ implicitCloseCount(pTree, pCurrent, eTag, pNClose)
     int nClose = 0;
 
     if (pCurrent) {
-        int nLevel = 0;
-        HtmlNode *p;
+        HtmlElementScope *pScope = treeScope(pTree, pCurrent);
+        HtmlNode *p = pScope->pTest;
         int eCloseRes = TAG_PARENT;
-        assert(HtmlNodeAsElement(pCurrent));
     
-        for (p = pCurrent; p && eCloseRes != TAG_OK; p = HtmlNodeParent(p)) {
+        while (p && eCloseRes != TAG_OK) {
             HtmlTokenMap *pMap = HtmlMarkup(HtmlNodeTagType(p));
-            nLevel++;
-    
-            if (pMap && pMap->xClose) {
-                eCloseRes = pMap->xClose(pTree, p, eTag);
-                assert(
-                    eCloseRes == TAG_CLOSE || 
-                    eCloseRes == TAG_OK || 
-                    eCloseRes == TAG_PARENT
-                );
-                if (eCloseRes == TAG_CLOSE) {
-                    nClose = nLevel;
-                }
+            HtmlElementNode *pParent = HtmlElemParent(HtmlNodeAsElement(p));
+
+            assert(pMap && pMap->xClose);
+            eCloseRes = pMap->xClose(pTree, p, eTag);
+            assert(
+                eCloseRes == TAG_CLOSE || 
+                eCloseRes == TAG_OK || 
+                eCloseRes == TAG_PARENT
+            );
+            if (eCloseRes == TAG_CLOSE) {
+                HtmlElementScope *pTestScope = &HtmlNodeAsElement(p)->scope;
+                nClose = pScope->iDepth - pTestScope->iDepth + 1;
             }
+            p = (pParent ? pParent->scope.pTest : 0);
         }
     }
 
@@ -242,21 +384,518 @@ HtmlNodeClearStyle(pTree, pElem)
     return 0;
 }
 
+/*
+ * Node handles.
+ *
+ * Each node that has been passed to a script has an HtmlNodeCmd structure
+ * and a handle name of the form "::tkhtml::nodeN". If the -nodecommands
+ * option of the widget is true when the handle is created, a Tcl command
+ * of the same name is created as well. Either way, the handle may be
+ * used with the [::tkhtml::node] dispatch command:
+ *
+ *     ::tkhtml::node HANDLE SUBCOMMAND ?ARGS...?
+ *
+ * All node handles that belong to a thread are stored in the hash table
+ * NodeHandleData.aHandle, keyed by N. Each handle also occupies a slot
+ * of the NodeHandleData.aSlot[] array (HtmlNodeCmd.iSlot). When a handle
+ * is deleted, the generation number of its slot is incremented and the
+ * slot is added to a free-list for reuse by a later handle.
+ *
+ * A Tcl_Obj passed to [::tkhtml::node] is converted to the nodeHandleType
+ * object type. This type caches the slot number and the slot's generation
+ * number at the time. The cached slot is used only if it's generation has
+ * not changed since, i.e. if the handle has not been deleted. Otherwise
+ * the handle is looked up in aHandle again.
+ */
+typedef struct NodeHandleSlot NodeHandleSlot;
+struct NodeHandleSlot {
+    HtmlNode *pNode;             /* Node, or NULL if the slot is free */
+    int iGeneration;             /* Incremented when the handle is deleted */
+    int iNextFree;               /* Next free slot plus 1, if pNode==0 */
+};
+
+typedef struct NodeHandleData NodeHandleData;
+struct NodeHandleData {
+    int isInit;                  /* True once aHandle is initialized */
+    int iNextHandle;             /* Value of N for next handle created */
+    Tcl_HashTable aHandle;       /* Map from N to (HtmlNode *) */
+    NodeHandleSlot *aSlot;       /* Array of nSlot slots */
+    int nSlot;                   /* Allocated size of aSlot[] */
+    int nSlotUsed;               /* Slots aSlot[0..nSlotUsed-1] used so far */
+    int iFreeSlot;               /* First free slot plus 1, or 0 */
+};
+static Tcl_ThreadDataKey nodeHandleKey;
+
+static Tcl_ObjType nodeHandleType = {
+    "tkhtml-node",               /* name */
+    0,                           /* freeIntRepProc */
+    0,                           /* dupIntRepProc */
+    0,                           /* updateStringProc */
+    0                            /* setFromAnyProc */
+};
+
+static void
+nodeHandleThreadExit(clientData)
+    ClientData clientData;
+{
+    NodeHandleData *p = (NodeHandleData *)clientData;
+    if (p->isInit) {
+        Tcl_DeleteHashTable(&p->aHandle);
+        HtmlFree(p->aSlot);
+        p->aSlot = 0;
+        p->nSlot = 0;
+        p->nSlotUsed = 0;
+        p->iFreeSlot = 0;
+        p->isInit = 0;
+    }
+}
+
+static NodeHandleData *
+getNodeHandleData()
+{
+    NodeHandleData *p = (NodeHandleData *)Tcl_GetThreadData(
+        &nodeHandleKey, sizeof(NodeHandleData)
+    );
+    if (!p->isInit) {
+        Tcl_InitHashTable(&p->aHandle, TCL_ONE_WORD_KEYS);
+        Tcl_CreateThreadExitHandler(nodeHandleThreadExit, (ClientData)p);
+        p->isInit = 1;
+    }
+    return p;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeDeleteCommand --
+ *
+ *     Delete the node handle for node pNode, if one has been created.
+ *
+ * Results:
+ *     Always 0.
+ *
+ * Side effects:
+ *     May delete a Tcl command.
+ *
+ *---------------------------------------------------------------------------
+ */
 int 
 HtmlNodeDeleteCommand(pTree, pNode)
     HtmlTree *pTree;
     HtmlNode *pNode;
 {
-    if (pNode->pNodeCmd) {
-        Tcl_Obj *pCommand = pNode->pNodeCmd->pCommand;
-        Tcl_DeleteCommand(pTree->interp, Tcl_GetString(pCommand));
+    HtmlNodeCmd *pNodeCmd = pNode->pNodeCmd;
+    if (pNodeCmd) {
+        NodeHandleData *p = getNodeHandleData();
+        Tcl_Obj *pCommand = pNodeCmd->pCommand;
+        Tcl_HashEntry *pEntry;
+
+        pEntry = Tcl_FindHashEntry(
+            &p->aHandle, (char *)((size_t)pNodeCmd->iHandle)
+        );
+        if (pEntry) {
+            Tcl_DeleteHashEntry(pEntry);
+        }
+
+        /* If the thread is exiting, nodeHandleThreadExit() may already
+         * have freed the aSlot[] array. 
+         */
+        if (pNodeCmd->iSlot < p->nSlotUsed) {
+            NodeHandleSlot *pSlot = &p->aSlot[pNodeCmd->iSlot];
+            pSlot->pNode = 0;
+            pSlot->iGeneration++;
+            pSlot->iNextFree = p->iFreeSlot;
+            p->iFreeSlot = pNodeCmd->iSlot + 1;
+        }
+
+        if (pNodeCmd->isCommand) {
+            Tcl_DeleteCommand(pTree->interp, Tcl_GetString(pCommand));
+        }
         Tcl_DecrRefCount(pCommand);
-        HtmlFree(pNode->pNodeCmd);
+        HtmlFree(pNodeCmd);
         pNode->pNodeCmd = 0;
     }
     return 0;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * arenaFindBlock --
+ *
+ *     Return the index in pArena->apBlock[] of the block that contains
+ *     the arena slot p.
+ *
+ * Results:
+ *     Index of block.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+arenaFindBlock(pArena, p)
+    HtmlNodeArena *pArena;
+    void *p;
+{
+    int iLo = 0;
+    int iHi = pArena->nBlock - 1;
+
+    /* Find the last block that starts at or before p. */
+    while (iLo < iHi) {
+        int iMid = (iLo + iHi + 1) / 2;
+        if ((char *)pArena->apBlock[iMid] <= (char *)p) {
+            iLo = iMid;
+        } else {
+            iHi = iMid - 1;
+        }
+    }
+    assert((char *)p > (char *)pArena->apBlock[iLo]);
+    assert((char *)p < (char *)&pArena->apBlock[iLo][1] + HTML_ARENA_BLOCK);
+    return iLo;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * arenaNewBlock --
+ *
+ *     Allocate a new block for the node arena and make it the block that
+ *     new slots are carved from.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     The new block is inserted into pArena->apBlock[].
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+arenaNewBlock(pArena)
+    HtmlNodeArena *pArena;
+{
+    HtmlNodeArenaBlock *pBlock;
+    int ii;
+
+    if (pArena->pBlock && pArena->pBlock->nLive == 0) {
+        pArena->nUnused++;
+    }
+
+    pBlock = (HtmlNodeArenaBlock *)HtmlAlloc(
+        "HtmlNodeArenaBlock", sizeof(HtmlNodeArenaBlock) + HTML_ARENA_BLOCK
+    );
+    pBlock->nLive = 0;
+
+    if (pArena->nBlock == pArena->nBlockAlloc) {
+        int nNew = pArena->nBlockAlloc ? pArena->nBlockAlloc * 2 : 8;
+        pArena->apBlock = (HtmlNodeArenaBlock **)HtmlRealloc(
+            "HtmlNodeArena.apBlock", (char *)pArena->apBlock,
+            nNew * sizeof(HtmlNodeArenaBlock *)
+        );
+        pArena->nBlockAlloc = nNew;
+    }
+    for (ii = pArena->nBlock; ii > 0; ii--) {
+        if ((char *)pArena->apBlock[ii - 1] < (char *)pBlock) break;
+        pArena->apBlock[ii] = pArena->apBlock[ii - 1];
+    }
+    pArena->apBlock[ii] = pBlock;
+    pArena->nBlock++;
+
+    pArena->pBlock = pBlock;
+    pArena->iUsed = 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * arenaSweep --
+ *
+ *     Return the unused blocks of the node arena (all blocks except the
+ *     current one for which HtmlNodeArenaBlock.nLive is zero) to the heap.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Slots within the freed blocks are removed from the free-lists.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+arenaSweep(pArena)
+    HtmlNodeArena *pArena;
+{
+    int ii;
+    int jj;
+
+    for (ii = 0; ii < HTML_ARENA_NCLASS; ii++) {
+        HtmlNodeArenaClass *pClass = &pArena->aClass[ii];
+        void **ppSlot = &pClass->pFree;
+        while (*ppSlot) {
+            void *pSlot = *ppSlot;
+            HtmlNodeArenaBlock *pBlock;
+            pBlock = pArena->apBlock[arenaFindBlock(pArena, pSlot)];
+            if (pBlock->nLive == 0 && pBlock != pArena->pBlock) {
+                *ppSlot = *(void **)pSlot;
+                pClass->nFree--;
+            } else {
+                ppSlot = (void **)pSlot;
+            }
+        }
+    }
+
+    jj = 0;
+    for (ii = 0; ii < pArena->nBlock; ii++) {
+        HtmlNodeArenaBlock *pBlock = pArena->apBlock[ii];
+        if (pBlock->nLive == 0 && pBlock != pArena->pBlock) {
+            HtmlFree(pBlock);
+        } else {
+            pArena->apBlock[jj++] = pBlock;
+        }
+    }
+    pArena->nBlock = jj;
+    pArena->nUnused = 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeArenaAlloc --
+ *
+ *     Allocate nByte bytes of zeroed memory from the node arena of widget
+ *     pTree (see the comments above struct HtmlNodeArena in html.h). The
+ *     allocation should be freed using HtmlNodeArenaFree() with the same
+ *     value for nByte. Requests too large for any size class are passed
+ *     through to HtmlAlloc().
+ *
+ * Results:
+ *     Pointer to allocated memory.
+ *
+ * Side effects:
+ *     May allocate a new arena block.
+ *
+ *---------------------------------------------------------------------------
+ */
+void *
+HtmlNodeArenaAlloc(pTree, zTopic, nByte)
+    HtmlTree *pTree;
+    const char *zTopic;
+    int nByte;
+{
+    HtmlNodeArena *pArena = &pTree->arena;
+    HtmlNodeArenaClass *pClass;
+    HtmlNodeArenaBlock *pBlock;
+    int iClass = (nByte + HTML_ARENA_ALIGN - 1) / HTML_ARENA_ALIGN - 1;
+    int nSlot = (iClass + 1) * HTML_ARENA_ALIGN;
+    char *pRet;
+
+    assert(nByte > 0);
+    if (iClass >= HTML_ARENA_NCLASS) {
+        return (void *)HtmlClearAlloc(zTopic, nByte);
+    }
+    pClass = &pArena->aClass[iClass];
+
+    if (pClass->pFree) {
+        /* Reuse a slot from the free-list for this size class. */
+        pRet = (char *)pClass->pFree;
+        pClass->pFree = *(void **)pRet;
+        pClass->nFree--;
+        pBlock = pArena->apBlock[arenaFindBlock(pArena, pRet)];
+        if (pBlock->nLive == 0 && pBlock != pArena->pBlock) {
+            pArena->nUnused--;
+        }
+    } else {
+        /* Carve a new slot from the current block. Allocate a new block
+         * if there is not enough space left in the current one. 
+         */
+        if (!pArena->pBlock || (pArena->iUsed + nSlot) > HTML_ARENA_BLOCK) {
+            arenaNewBlock(pArena);
+        }
+        pBlock = pArena->pBlock;
+        pRet = ((char *)&pBlock[1]) + pArena->iUsed;
+        pArena->iUsed += nSlot;
+    }
+    pBlock->nLive++;
+
+    if (!pClass->zTopic) {
+        pClass->zTopic = zTopic;
+    }
+    pClass->nLive++;
+    pArena->nLive++;
+
+    memset(pRet, 0, nByte);
+    return (void *)pRet;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeArenaFree --
+ *
+ *     Free an allocation returned by HtmlNodeArenaAlloc(). Argument nByte
+ *     must be the same as was passed to HtmlNodeArenaAlloc().
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     The slot is added to the free-list for its size class. If this was
+ *     the last outstanding allocation, all arena blocks are freed.
+ *     Otherwise, if a quarter or more of the blocks are now unused, the
+ *     unused blocks are freed.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlNodeArenaFree(pTree, p, nByte)
+    HtmlTree *pTree;
+    void *p;
+    int nByte;
+{
+    HtmlNodeArena *pArena = &pTree->arena;
+    HtmlNodeArenaClass *pClass;
+    HtmlNodeArenaBlock *pBlock;
+    int iClass = (nByte + HTML_ARENA_ALIGN - 1) / HTML_ARENA_ALIGN - 1;
+
+    if (!p) return;
+    if (iClass >= HTML_ARENA_NCLASS) {
+        HtmlFree(p);
+        return;
+    }
+    pClass = &pArena->aClass[iClass];
+    assert(pClass->nLive > 0 && pArena->nLive > 0);
+
+    *(void **)p = pClass->pFree;
+    pClass->pFree = p;
+    pClass->nFree++;
+    pClass->nLive--;
+    pArena->nLive--;
+
+    pBlock = pArena->apBlock[arenaFindBlock(pArena, p)];
+    assert(pBlock->nLive > 0);
+    pBlock->nLive--;
+    if (pBlock->nLive == 0 && pBlock != pArena->pBlock) {
+        pArena->nUnused++;
+    }
+
+    if (pArena->nLive == 0) {
+        HtmlNodeArenaRelease(pTree);
+    } else if (pArena->nUnused > 0 && pArena->nUnused * 4 >= pArena->nBlock) {
+        arenaSweep(pArena);
+    }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeArenaRelease --
+ *
+ *     Return all blocks belonging to the node arena of widget pTree to the
+ *     heap. This is called automatically when the last outstanding arena
+ *     allocation is freed, and when the widget is destroyed.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Any pointers returned by HtmlNodeArenaAlloc() become invalid.
+ *
+ *---------------------------------------------------------------------------
+ */
+void
+HtmlNodeArenaRelease(pTree)
+    HtmlTree *pTree;
+{
+    HtmlNodeArena *pArena = &pTree->arena;
+    int ii;
+    for (ii = 0; ii < pArena->nBlock; ii++) {
+        HtmlFree(pArena->apBlock[ii]);
+    }
+    if (pArena->apBlock) {
+        HtmlFree(pArena->apBlock);
+    }
+    memset(pArena, 0, sizeof(HtmlNodeArena));
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeArenaStats --
+ *
+ *         $html _arenastats
+ *
+ *     Return a list describing the current state of the node arena, in
+ *     the same format as [::tkhtml::heapdebug]. Each element is a list of
+ *     three elements: {TOPIC N-ALLOCATIONS N-BYTES}. There is one element 
+ *     for each size class in use (using the name of the first structure
+ *     allocated with that size), followed by:
+ *
+ *         {free-list N-SLOTS N-BYTES}
+ *         {HtmlNodeArenaBlock N-BLOCKS N-BYTES}
+ *
+ * Results:
+ *     TCL_OK.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlNodeArenaStats(clientData, interp, objc, objv)
+    ClientData clientData;             /* The HTML widget data structure */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    HtmlTree *pTree = (HtmlTree *)clientData;
+    HtmlNodeArena *pArena = &pTree->arena;
+    Tcl_Obj *pRet = Tcl_NewObj();
+    Tcl_Obj *pObj;
+    int nFree = 0;
+    int nFreeByte = 0;
+    int ii;
+
+    for (ii = 0; ii < HTML_ARENA_NCLASS; ii++) {
+        HtmlNodeArenaClass *pClass = &pArena->aClass[ii];
+        int nSlot = (ii + 1) * HTML_ARENA_ALIGN;
+        if (pClass->zTopic && (pClass->nLive || pClass->nFree)) {
+            pObj = Tcl_NewObj();
+            Tcl_ListObjAppendElement(0, pObj, 
+                Tcl_NewStringObj(pClass->zTopic, -1)
+            );
+            Tcl_ListObjAppendElement(0, pObj, Tcl_NewIntObj(pClass->nLive));
+            Tcl_ListObjAppendElement(0, pObj, 
+                Tcl_NewIntObj(pClass->nLive * nSlot)
+            );
+            Tcl_ListObjAppendElement(0, pRet, pObj);
+        }
+        nFree += pClass->nFree;
+        nFreeByte += pClass->nFree * nSlot;
+    }
+
+    pObj = Tcl_NewObj();
+    Tcl_ListObjAppendElement(0, pObj, Tcl_NewStringObj("free-list", -1));
+    Tcl_ListObjAppendElement(0, pObj, Tcl_NewIntObj(nFree));
+    Tcl_ListObjAppendElement(0, pObj, Tcl_NewIntObj(nFreeByte));
+    Tcl_ListObjAppendElement(0, pRet, pObj);
+
+    pObj = Tcl_NewObj();
+    Tcl_ListObjAppendElement(0, pObj, 
+        Tcl_NewStringObj("HtmlNodeArenaBlock", -1)
+    );
+    Tcl_ListObjAppendElement(0, pObj, Tcl_NewIntObj(pArena->nBlock));
+    Tcl_ListObjAppendElement(0, pObj, 
+        Tcl_NewIntObj(pArena->nBlock * HTML_ARENA_BLOCK)
+    );
+    Tcl_ListObjAppendElement(0, pRet, pObj);
+
+    Tcl_SetObjResult(interp, pRet);
+    return TCL_OK;
+}
+
 
 /*
  *---------------------------------------------------------------------------
@@ -289,6 +928,7 @@ freeNode(pTree, pNode)
          * general, primitives must be deleted before their owner nodes.
          */
         HtmlLayoutInvalidateCache(pTree, pNode);
+        pTree->iDocumentGeneration++;
 
         if (!HtmlNodeIsText(pNode)) {
             /* Do HtmlElementNode specific destruction */
@@ -318,7 +958,6 @@ freeNode(pTree, pNode)
             HtmlTextNode *pTextNode = HtmlNodeAsText(pNode);
             assert(pTextNode);
             HtmlTagCleanupNode(pTextNode);
-            HtmlFree(pTextNode->aToken);
         }
 
         /* Delete the computed values caches. */
@@ -326,7 +965,11 @@ freeNode(pTree, pNode)
 
         HtmlNodeDeleteCommand(pTree, pNode);
 
-        HtmlFree(pNode);
+        if (HtmlNodeIsText(pNode)) {
+            HtmlTextFree(pTree, HtmlNodeAsText(pNode));
+        } else {
+            HtmlNodeArenaFree(pTree, pNode, sizeof(HtmlElementNode));
+        }
     }
 }
 
@@ -439,7 +1082,8 @@ nodeRemoveChild(pElem, pChild)
  *---------------------------------------------------------------------------
  */
 void
-HtmlElementNormalize(pElem)
+HtmlElementNormalize(pTree, pElem)
+    HtmlTree *pTree;
     HtmlElementNode *pElem;
 {
     int ii;
@@ -453,12 +1097,63 @@ HtmlElementNormalize(pElem)
 
             /* TODO: Fold text from pRemove into pElem->apChildren[ii] */
 
-            HtmlTextFree(HtmlNodeAsText(pRemove));
+            HtmlTextFree(pTree, HtmlNodeAsText(pRemove));
             ii--;
         }
     }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeHandlerEval --
+ *
+ *     Invoke the node handler script for node pNode, if one exists. Any
+ *     error is reported as a background error.
+ *
+ *     This is called by nodeHandlerCallbacks() and by buildNode(). The
+ *     nodes created by [$html build] are not part of the document being
+ *     parsed, so buildNode() calls this function directly, leaving the
+ *     parser state (HtmlTree.eWriteState and the foster tree) alone.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     Whatever the node handler script does.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+nodeHandlerEval(pTree, pNode)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+{
+    Tcl_HashEntry *pEntry;
+    Tcl_Interp *interp = pTree->interp;
+    int eTag = HtmlNodeTagType(pNode);
+
+    pEntry = Tcl_FindHashEntry(&pTree->aNodeHandler, (char *)((size_t) eTag));
+    if (pEntry) {
+        Tcl_Obj *pEval;
+        Tcl_Obj *pScript;
+        Tcl_Obj *pNodeCmd;
+        int rc;
+
+        pScript = (Tcl_Obj *)Tcl_GetHashValue(pEntry);
+        pEval = Tcl_DuplicateObj(pScript);
+        Tcl_IncrRefCount(pEval);
+
+        pNodeCmd = HtmlNodeCommand(pTree, pNode);
+        Tcl_ListObjAppendElement(0, pEval, pNodeCmd);
+        rc = Tcl_EvalObjEx(interp, pEval, TCL_EVAL_DIRECT|TCL_EVAL_GLOBAL);
+        if (rc != TCL_OK) {
+            Tcl_BackgroundError(interp);
+        }
+        Tcl_DecrRefCount(pEval);
+    }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -484,8 +1179,6 @@ nodeHandlerCallbacks(pTree, pNode)
     HtmlTree *pTree;
     HtmlNode *pNode;
 {
-    Tcl_HashEntry *pEntry;
-    Tcl_Interp *interp = pTree->interp;
     int eTag = HtmlNodeTagType(pNode);
     int isFragment = (pTree->pFragment?1:0);
 
@@ -502,7 +1195,7 @@ nodeHandlerCallbacks(pTree, pNode)
     );
     
     if (!HtmlNodeIsText(pNode)) {
-        /* HtmlElementNormalize(HtmlNodeAsElement(pNode)); */
+        /* HtmlElementNormalize(pTree, HtmlNodeAsElement(pNode)); */
     }
 
     if (!isFragment && TAG_TO_TABLELEVEL(eTag) > 0) {
@@ -510,28 +1203,12 @@ nodeHandlerCallbacks(pTree, pNode)
     }
 
     /* Execute the node-handler script for node pNode, if one exists. */
-    pEntry = Tcl_FindHashEntry(&pTree->aNodeHandler, (char *)((size_t) eTag));
-    if (pEntry) {
-        Tcl_Obj *pEval;
-        Tcl_Obj *pScript;
-        Tcl_Obj *pNodeCmd;
-        int rc;
-
-        pScript = (Tcl_Obj *)Tcl_GetHashValue(pEntry);
-        pEval = Tcl_DuplicateObj(pScript);
-        Tcl_IncrRefCount(pEval);
-
+    if (Tcl_FindHashEntry(&pTree->aNodeHandler, (char *)((size_t) eTag))) {
         if (!isFragment) {
             pTree->eWriteState = HTML_PARSE_NODEHANDLER;
         }
 
-        pNodeCmd = HtmlNodeCommand(pTree, pNode);
-        Tcl_ListObjAppendElement(0, pEval, pNodeCmd);
-        rc = Tcl_EvalObjEx(interp, pEval, TCL_EVAL_DIRECT|TCL_EVAL_GLOBAL);
-        if (rc != TCL_OK) {
-            Tcl_BackgroundError(interp);
-        }
-        Tcl_DecrRefCount(pEval);
+        nodeHandlerEval(pTree, pNode);
 
         assert(
             isFragment || 
@@ -613,6 +1290,8 @@ nodeOrphanize(pTree, pNode)
     );
     pNode->iNode = HTML_NODE_ORPHAN;
     pNode->pParent = 0;
+    pTree->iScopeGeneration++;
+    pTree->iDocumentGeneration++;
 
     Tcl_CreateHashEntry(&pTree->aOrphan, (const char *)pNode, &eNew);
     assert(eNew);
@@ -662,6 +1341,14 @@ nodeInsertChild(pTree, pElem, pBefore, pAfter, pChild)
         return;
     }
 
+    /* If an existing sub-tree is being moved, the HtmlElementScope 
+     * summaries stored for the elements within it are now out of date.
+     */
+    if (HtmlNodeParent(pChild) || HtmlNodeNumChildren(pChild) > 0) {
+        pTree->iScopeGeneration++;
+    }
+    pTree->iDocumentGeneration++;
+
     /* Unlink pChild from it's parent node. */
     if (HtmlNodeParent(pChild)) {
         HtmlNode *pParent = HtmlNodeParent(pChild);
@@ -715,7 +1402,7 @@ nodeInsertChild(pTree, pElem, pBefore, pAfter, pChild)
  *     token for the new node. The value returned is the index of the new
  *     child. So the call:
  *
- *          HtmlNodeChild(pNode, HtmlNodeAddChild(pNode, pToken))
+ *          HtmlNodeChild(pNode, HtmlNodeAddChild(pTree, pNode, pToken))
  *
  *     returns the new child node.
  *
@@ -728,7 +1415,8 @@ nodeInsertChild(pTree, pElem, pBefore, pAfter, pChild)
  *---------------------------------------------------------------------------
  */
 int 
-HtmlNodeAddChild(pElem, eTag, zTag, pAttributes)
+HtmlNodeAddChild(pTree, pElem, eTag, zTag, pAttributes)
+    HtmlTree *pTree;
     HtmlElementNode *pElem;
     int eTag;
     const char *zTag;               /* Atom for tag name */
@@ -751,7 +1439,8 @@ HtmlNodeAddChild(pElem, eTag, zTag, pAttributes)
     }
     assert(zTag);
 
-    pNew = HtmlNew(HtmlElementNode);
+    pTree->iDocumentGeneration++;
+    pNew = HtmlArenaNew(pTree, HtmlElementNode);
     pNew->pAttributes = pAttributes;
     pNew->node.pParent = (HtmlNode *)pElem;
     pNew->node.eTag = eTag;
@@ -810,7 +1499,8 @@ HtmlNodeAddTextChild(pNode, pTextNode)
  *---------------------------------------------------------------------------
  */
 static void
-setNodeAttribute(pNode, zAttrName, zAttrVal)
+setNodeAttribute(pTree, pNode, zAttrName, zAttrVal)
+    HtmlTree *pTree;
     HtmlNode *pNode;
     const char *zAttrName;
     const char *zAttrVal;
@@ -850,8 +1540,9 @@ setNodeAttribute(pNode, zAttrName, zAttrVal)
         aLen[i] = strlen(azPtr[i]);
     }
 
-    pElem->pAttributes = HtmlAttributesNew(nArgs, azPtr, aLen, 0);
+    pElem->pAttributes = HtmlAttributesNew(pTree, nArgs, azPtr, aLen, 0);
     HtmlFree(pAttr);
+    pTree->iDocumentGeneration++;
 
     /* If this was a call to set the "style" attribute, discard the
      * compiled version at version HtmlElementNode.pStyle.
@@ -863,17 +1554,73 @@ setNodeAttribute(pNode, zAttrName, zAttrVal)
 }
 
 static void
-mergeAttributes(pNode, pAttr)
+mergeAttributes(pTree, pNode, pAttr)
+    HtmlTree *pTree;
     HtmlNode *pNode;
     HtmlAttributes *pAttr;
 {
     int ii;
     for (ii = 0; pAttr && ii < pAttr->nAttr; ii++) {
-        setNodeAttribute(pNode, pAttr->a[ii].zName, pAttr->a[ii].zValue);
+        setNodeAttribute(
+            pTree, pNode, pAttr->a[ii].zName, pAttr->a[ii].zValue
+        );
     }
     HtmlFree(pAttr);
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * restyleDepends --
+ *
+ *     This is called after an attribute of node pNode has been modified
+ *     using the [nodeHandle attribute] command, or a dynamic flag has
+ *     been modified using [nodeHandle dynamic]. Argument eDepend is the
+ *     mask returned by HtmlCssAttributeDepends() or HtmlCssDynamicDepends()
+ *     for the modification. Only those nodes that may be affected by the 
+ *     change are marked for restyling (if isDynamic is false) or for 
+ *     checking their dynamic conditions (if isDynamic is true).
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     See above.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+restyleDepends(pTree, pNode, eDepend, isDynamic)
+    HtmlTree *pTree;
+    HtmlNode *pNode;
+    int eDepend;
+    int isDynamic;
+{
+    void (*xMark)(HtmlTree *, HtmlNode *, int) = 
+        (isDynamic ? HtmlCallbackDynamicNode : HtmlCallbackRestyleNode);
+
+    if (eDepend & CSS_DEPEND_ANCESTOR) {
+        xMark(pTree, pNode, HTML_RESTYLE_TREE);
+    } else if (eDepend & CSS_DEPEND_SUBJECT) {
+        xMark(pTree, pNode, HTML_RESTYLE_NODE);
+    }
+
+    if ((eDepend & CSS_DEPEND_SIBLING) && HtmlNodeParent(pNode)) {
+        HtmlNode *pParent = HtmlNodeParent(pNode);
+        int ii;
+        for (ii = HtmlNodeNumChildren(pParent) - 1; ii >= 0; ii--) {
+            HtmlNode *pSibling = HtmlNodeChild(pParent, ii);
+            if (pSibling == pNode) break;
+            xMark(pTree, pSibling, HTML_RESTYLE_TREE);
+        }
+    }
+
+    /* The results of [$html search] may depend on attribute values */
+    if (!isDynamic) {
+        HtmlCssSearchInvalidateCache(pTree);
+    }
+}
+
 static int
 doAttributeHandler(pTree, pNode, zAttr, zValue) 
     HtmlTree *pTree;
@@ -930,7 +1677,7 @@ doParseHandler(pTree, eType, pNode, iOffset)
             Tcl_ListObjAppendElement(0, pScript, Tcl_NewStringObj("", -1));
         }
         Tcl_ListObjAppendElement(
-            0, pScript, Tcl_NewIntObj(iOffset + pTree->nParsed)
+            0, pScript, Tcl_NewIntObj(iOffset + pTree->iDocumentOffset)
         );
 
         rc = Tcl_EvalObjEx(pTree->interp, pScript, TCL_EVAL_GLOBAL);
@@ -981,14 +1728,18 @@ HtmlInitTree(pTree)
          */
         HtmlElementNode *pRoot;
 
-        pRoot = HtmlNew(HtmlElementNode);
+        pRoot = HtmlArenaNew(pTree, HtmlElementNode);
         pRoot->node.eTag = Html_HTML;
         pRoot->node.zTag = HtmlTypeToName(pTree, Html_HTML);
         pTree->pRoot = (HtmlNode *)pRoot;
 
 
-        HtmlNodeAddChild(pRoot, Html_HEAD, HtmlTypeToName(pTree, Html_HEAD), 0);
-        HtmlNodeAddChild(pRoot, Html_BODY, HtmlTypeToName(pTree, Html_BODY), 0);
+        HtmlNodeAddChild(
+            pTree, pRoot, Html_HEAD, HtmlTypeToName(pTree, Html_HEAD), 0
+        );
+        HtmlNodeAddChild(
+            pTree, pRoot, Html_BODY, HtmlTypeToName(pTree, Html_BODY), 0
+        );
         HtmlCallbackRestyle(pTree, (HtmlNode *)pRoot);
     }
 
@@ -1103,10 +1854,12 @@ treeAddFosterElement(pTree, eTag, zTag, pAttr)
     }
 
     if (pFoster) {
-        int n = HtmlNodeAddChild((HtmlElementNode *)pFoster, eTag, zTag, pAttr);
+        int n = HtmlNodeAddChild(
+            pTree, (HtmlElementNode *)pFoster, eTag, zTag, pAttr
+        );
         pNew = HtmlNodeChild(pFoster, n);
     } else {
-        pNew = (HtmlNode *)HtmlNew(HtmlElementNode);
+        pNew = (HtmlNode *)HtmlArenaNew(pTree, HtmlElementNode);
         ((HtmlElementNode *)pNew)->pAttributes = pAttr;
         pNew->eTag = eTag;
         if (!zTag) {
@@ -1144,7 +1897,7 @@ treeAddFosterClosingTag(pTree, eTag, zTag)
     pFosterParent = findFosterParent(pTree, 0);
     assert(pFosterParent);
 
-    explicitCloseCount(pTree->state.pFoster, eTag, zTag, &nClose);
+    explicitCloseCount(pTree, pTree->state.pFoster, eTag, zTag, &nClose);
     pFoster = pTree->state.pFoster;
     for (ii = 0; ii < nClose && pFoster != pFosterParent; ii++) {
         nodeHandlerCallbacks(pTree, pFoster);
@@ -1205,7 +1958,9 @@ treeAddTableComponent(pTree, eTag, pAttr)
         eParentTag == Html_TABLE && 
         (eTag == Html_TR || eTag == Html_TD || eTag == Html_TH)
     ) {
-        int n2 = HtmlNodeAddChild((HtmlElementNode *)pParent, Html_TBODY, 0, 0);
+        int n2 = HtmlNodeAddChild(
+            pTree, (HtmlElementNode *)pParent, Html_TBODY, 0, 0
+        );
         pParent = HtmlNodeChild(pParent, n2);
         pParent->iNode = pTree->iNextNode++;
         eParentTag = Html_TBODY;
@@ -1213,14 +1968,16 @@ treeAddTableComponent(pTree, eTag, pAttr)
 
     /* See if we need to add an implicit <TR> node */
     if (eParentTag != Html_TR && (eTag == Html_TD || eTag == Html_TH)) {
-        int n2 = HtmlNodeAddChild((HtmlElementNode *)pParent, Html_TR, 0, 0);
+        int n2 = HtmlNodeAddChild(
+            pTree, (HtmlElementNode *)pParent, Html_TR, 0, 0
+        );
         pParent = HtmlNodeChild(pParent, n2);
         pParent->iNode = pTree->iNextNode++;
         eParentTag = Html_TR;
     }
     
     /* Add the new node to pParent */
-    n = HtmlNodeAddChild((HtmlElementNode *)pParent, eTag, 0, pAttr);
+    n = HtmlNodeAddChild(pTree, (HtmlElementNode *)pParent, eTag, 0, pAttr);
     pNew = HtmlNodeChild(pParent, n);
     pNew->iNode = pTree->iNextNode++;
     pTree->state.pCurrent = pNew;
@@ -1294,17 +2051,17 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
     switch (eType) {
         case Html_HTML:
             pParsed = pTree->pRoot;
-            mergeAttributes(pParsed, pAttr);
+            mergeAttributes(pTree, pParsed, pAttr);
             HtmlCallbackRestyle(pTree, pParsed);
             break;
         case Html_HEAD:
             pParsed = pHeadNode;
-            mergeAttributes(pParsed, pAttr);
+            mergeAttributes(pTree, pParsed, pAttr);
             HtmlCallbackRestyle(pTree, pParsed);
             break;
         case Html_BODY:
             pParsed = pBodyNode;
-            mergeAttributes(pParsed, pAttr);
+            mergeAttributes(pTree, pParsed, pAttr);
             HtmlCallbackRestyle(pTree, pParsed);
             break;
 
@@ -1317,7 +2074,7 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
          * section.
          */
         case Html_TITLE: {
-            int n = HtmlNodeAddChild(pHeadElem, eType, 0, pAttr);
+            int n = HtmlNodeAddChild(pTree, pHeadElem, eType, 0, pAttr);
             HtmlNode *p = HtmlNodeChild(pHeadNode, n);
             pTree->state.isCdataInHead = 1;
             p->iNode = pTree->iNextNode++;
@@ -1330,7 +2087,7 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
         case Html_META:
         case Html_LINK:
         case Html_BASE: {
-            int n = HtmlNodeAddChild(pHeadElem, eType, 0, pAttr);
+            int n = HtmlNodeAddChild(pTree, pHeadElem, eType, 0, pAttr);
             HtmlNode *p = HtmlNodeChild(pHeadNode, n);
             p->iNode = pTree->iNextNode++;
             nodeHandlerCallbacks(pTree, p);
@@ -1380,7 +2137,7 @@ HtmlTreeAddElement(pTree, eType, zType, pAttr, iOffset)
 
                 pC = HtmlNodeAsElement(pCurrent);
                 assert(!HtmlNodeIsText(pTree->state.pCurrent));
-                N = HtmlNodeAddChild(pC, eType, zType, pAttr);
+                N = HtmlNodeAddChild(pTree, pC, eType, zType, pAttr);
                 pCurrent = HtmlNodeChild(pCurrent, N);
                 pCurrent->iNode = pTree->iNextNode++;
                 pParsed = pCurrent;
@@ -1493,7 +2250,7 @@ HtmlTreeAddClosingTag(pTree, eTag, zTag, iOffset)
         treeAddFosterClosingTag(pTree, eTag, zTag);
     } else {
         HtmlNode *pBody = HtmlNodeChild(pTree->pRoot, 1);
-        explicitCloseCount(pTree->state.pCurrent, eTag, zTag, &nClose);
+        explicitCloseCount(pTree, pTree->state.pCurrent, eTag, zTag, &nClose);
         for (ii = 0; ii < nClose && pTree->state.pCurrent != pBody; ii++) {
             nodeHandlerCallbacks(pTree, pTree->state.pCurrent);
             pTree->state.pCurrent = HtmlNodeParent(pTree->state.pCurrent);
@@ -2137,8 +2894,8 @@ nodeGetStyle(pTree, p)
     HtmlNode *p;
 {
     HtmlElementNode *pElem = HtmlNodeAsElement(p);
-    const char *zStyle;
-    if (!pElem->pStyle && (zStyle = HtmlNodeAttr(p, "style"))) { 
+    if (!pElem->pStyle && pElem->pAttributes && pElem->pAttributes->zStyle) {
+        const char *zStyle = pElem->pAttributes->zStyle;
         HtmlCssInlineParse(pTree, -1, zStyle, &pElem->pStyle);
     }
     return pElem->pStyle;
@@ -2296,6 +3053,16 @@ nodeTextCommand(interp, pNode, objc, objv)
 
     if (eChoice == NODE_TEXT_GET) {
         Tcl_SetStringObj(pRet, pTextNode->zText, nByte);
+        if (pTextNode->pSource) {
+            /* zText refers to the document text, so the words may be 
+             * separated by white-space other than a space character.
+             */
+            char *z = Tcl_GetString(pRet);
+            int ii;
+            for (ii = 0; ii < nByte; ii++) {
+                if (isspace((unsigned char)z[ii])) z[ii] = ' ';
+            }
+        }
     }
 
     if( pRet ){
@@ -2434,6 +3201,7 @@ nodeCommand(clientData, interp, objc, objv)
                  *     eval $handler [list $attribute-name] [list $new-value]
                  */
                 int rc;
+                int eDepend;
                 char *zCopy; 
 
                 assert(!zDefault);
@@ -2447,8 +3215,11 @@ nodeCommand(clientData, interp, objc, objv)
                 if (rc != TCL_OK) {
                     return rc;
                 }
-                setNodeAttribute(pNode, zAttrName, zAttrVal);
-                HtmlCallbackRestyle(pTree, pNode);
+                eDepend = HtmlCssAttributeDepends(pTree, 
+                    zAttrName, HtmlNodeAttr(pNode, zAttrName), zAttrVal
+                );
+                setNodeAttribute(pTree, pNode, zAttrName, zAttrVal);
+                restyleDepends(pTree, pNode, eDepend, 0);
             }
 
             if (zAttrName) {
@@ -2733,6 +3504,7 @@ node_attr_usage:
             Tcl_Obj *pRet;
             int i;
             Html_u8 mask = 0;
+            Html_u8 eOldFlags;
 
             HtmlElementNode *pElem = (HtmlElementNode *)pNode;
             if (HtmlNodeIsText(pNode)) {
@@ -2770,20 +3542,25 @@ node_attr_usage:
                 return TCL_ERROR;
             }
 
+            eOldFlags = pElem->flags;
             if (*zArg1 == 's') {
                 pElem->flags |= mask;
             } else {
                 pElem->flags &= ~(mask?mask:0xFF);
             }
 
-            if (zArg2) {
+            if (eOldFlags != pElem->flags) {
+                pTree->iDocumentGeneration++;
+            }
+            if (zArg2 && eOldFlags != pElem->flags) {
                 if (
                     mask == HTML_DYNAMIC_LINK || 
                     mask == HTML_DYNAMIC_VISITED
                 ) {
                     HtmlCallbackRestyle(pTree, pNode);
                 } else {
-                    HtmlCallbackDynamic(pTree, pNode);
+                    int eDepend = HtmlCssDynamicDepends(pTree, mask);
+                    restyleDepends(pTree, pNode, eDepend, 1);
                 }
             }
 
@@ -2893,8 +3670,10 @@ node_attr_usage:
  *
  * HtmlNodeCommand --
  *
- *     Return a Tcl object containing the name of the Tcl command used to
- *     access pNode. If the command does not already exist it is created.
+ *     Return a Tcl object containing the node handle used to access
+ *     pNode. If the handle does not already exist it is created, along 
+ *     with a Tcl command of the same name if the -nodecommands option
+ *     is true (see the comments above HtmlNodeDeleteCommand()).
  *
  *     The Tcl_Obj * returned is always a pointer to pNode->pCommand.
  *
@@ -2911,7 +3690,6 @@ HtmlNodeCommand(pTree, pNode)
     HtmlTree *pTree;
     HtmlNode *pNode;
 {
-    static int nodeNumber = 0;
     HtmlNodeCmd *pNodeCmd = pNode->pNodeCmd;
 
     if (pNode->iNode == HTML_NODE_GENERATED) {
@@ -2919,16 +3697,57 @@ HtmlNodeCommand(pTree, pNode)
     }
 
     if (!pNodeCmd) {
+        NodeHandleData *p = getNodeHandleData();
+        Tcl_HashEntry *pEntry;
         char zBuf[100];
         Tcl_Obj *pCmd;
-        sprintf(zBuf, "::tkhtml::node%d", nodeNumber++);
+        int isNew;
+        int iSlot;
+        int iHandle = p->iNextHandle++;
+        sprintf(zBuf, "::tkhtml::node%d", iHandle);
+
+        /* Find a free slot in the aSlot[] array, growing it if required */
+        if (p->iFreeSlot) {
+            iSlot = p->iFreeSlot - 1;
+            p->iFreeSlot = p->aSlot[iSlot].iNextFree;
+        } else {
+            if (p->nSlotUsed == p->nSlot) {
+                int nNew = (p->nSlot ? p->nSlot * 2 : 64);
+                p->aSlot = (NodeHandleSlot *)HtmlRealloc(
+                    "NodeHandleSlot", p->aSlot, nNew * sizeof(NodeHandleSlot)
+                );
+                memset(&p->aSlot[p->nSlot], 0, 
+                    (nNew - p->nSlot) * sizeof(NodeHandleSlot)
+                );
+                p->nSlot = nNew;
+            }
+            iSlot = p->nSlotUsed++;
+        }
+        p->aSlot[iSlot].pNode = pNode;
 
         pCmd = Tcl_NewStringObj(zBuf, -1);
         Tcl_IncrRefCount(pCmd);
-        Tcl_CreateObjCommand(pTree->interp, zBuf, nodeCommand, pNode, 0);
+        pCmd->typePtr = &nodeHandleType;
+        pCmd->internalRep.twoPtrValue.ptr1 = (void *)((size_t)iSlot);
+        pCmd->internalRep.twoPtrValue.ptr2 = (void *)(
+            (size_t)p->aSlot[iSlot].iGeneration
+        );
+
+        pEntry = Tcl_CreateHashEntry(
+            &p->aHandle, (char *)((size_t)iHandle), &isNew
+        );
+        assert(isNew);
+        Tcl_SetHashValue(pEntry, (ClientData)pNode);
+
         pNodeCmd = HtmlNew(HtmlNodeCmd);
         pNodeCmd->pCommand = pCmd;
         pNodeCmd->pTree = pTree;
+        pNodeCmd->iHandle = iHandle;
+        pNodeCmd->iSlot = iSlot;
+        if (pTree->options.nodecommands) {
+            Tcl_CreateObjCommand(pTree->interp, zBuf, nodeCommand, pNode, 0);
+            pNodeCmd->isCommand = 1;
+        }
         pNode->pNodeCmd = pNodeCmd;
     }
 
@@ -3044,6 +3863,7 @@ int HtmlTreeClear(pTree)
         Tcl_DecrRefCount(pTree->pDocument);
     }
     pTree->nParsed = 0;
+    pTree->iDocumentOffset = 0;
     pTree->pDocument = 0;
 
     /* Free the stylesheets */
@@ -3063,18 +3883,60 @@ int HtmlTreeClear(pTree)
     return TCL_OK;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * nodeHandleLookup --
+ *
+ *     Find the node with handle name zHandle. The name may be a node
+ *     handle of the form "::tkhtml::nodeN" or any other name that resolves
+ *     to a node command.
+ *
+ * Results:
+ *     Pointer to node, or NULL if zHandle is not a valid node handle.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlNode *
+nodeHandleLookup(interp, zHandle)
+    Tcl_Interp *interp;
+    char CONST *zHandle;
+{
+    NodeHandleData *p = getNodeHandleData();
+    Tcl_CmdInfo info;
+    int iHandle;
+    char c;
+
+    if (1 == sscanf(zHandle, "::tkhtml::node%d%c", &iHandle, &c)) {
+        Tcl_HashEntry *pEntry;
+        pEntry = Tcl_FindHashEntry(&p->aHandle, (char *)((size_t)iHandle));
+        if (pEntry) {
+            return (HtmlNode *)Tcl_GetHashValue(pEntry);
+        }
+    }
+
+    if (Tcl_GetCommandInfo(interp, zHandle, &info) && 
+        info.objProc == nodeCommand
+    ) {
+        return (HtmlNode *)info.objClientData;
+    }
+    return 0;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
  * HtmlNodeGetPointer --
  *
- *     String argument zCmd is the name of a node command created for
- *     some node of tree pTree. Find the corresponding HtmlNode pointer
- *     and return it. If zCmd is not the name of a node command, leave
- *     an error in pTree->interp and return NULL.
+ *     String argument zCmd is the handle of some node of tree pTree. Find
+ *     the corresponding HtmlNode pointer and return it. If zCmd is not a
+ *     node handle, leave an error in pTree->interp and return NULL.
  *
  * Results:
- *     Pointer to node object associated with Tcl command zCmd, or NULL.
+ *     Pointer to node object associated with handle zCmd, or NULL.
  *
  * Side effects:
  *     None.
@@ -3087,15 +3949,82 @@ HtmlNodeGetPointer(pTree, zCmd)
     char CONST *zCmd;
 {
     Tcl_Interp *interp = pTree->interp;
-    Tcl_CmdInfo info;
-    int rc;
-
-    rc = Tcl_GetCommandInfo(interp, zCmd, &info);
-    if (rc == 0 || info.objProc != nodeCommand){ 
+    HtmlNode *pNode = nodeHandleLookup(interp, zCmd);
+    if (!pNode) {
         Tcl_AppendResult(interp, "no such node: ", zCmd, NULL);
-        return 0;
     }
-    return (HtmlNode *)info.objClientData;
+    return pNode;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlNodeHandleCmd --
+ *
+ *         ::tkhtml::node NODE-HANDLE SUBCOMMAND ?ARGS...?
+ *
+ *     Invoke a subcommand of the node identified by NODE-HANDLE. This
+ *     works the same way as [NODE-HANDLE SUBCOMMAND ?ARGS...?], but works
+ *     whether or not a node command was created for the node (see the
+ *     -nodecommands option).
+ *
+ * Results:
+ *     Tcl result (i.e. TCL_OK, TCL_ERROR).
+ *
+ * Side effects:
+ *     Whatever the subcommand does. The NODE-HANDLE object is converted
+ *     to the nodeHandleType object type.
+ *
+ *---------------------------------------------------------------------------
+ */
+int 
+HtmlNodeHandleCmd(clientData, interp, objc, objv)
+    ClientData clientData;             /* Unused */
+    Tcl_Interp *interp;                /* Current interpreter. */
+    int objc;                          /* Number of arguments. */
+    Tcl_Obj *CONST objv[];             /* Argument strings. */
+{
+    NodeHandleData *p = getNodeHandleData();
+    Tcl_Obj *pHandle;
+    HtmlNode *pNode = 0;
+    int iSlot;
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "NODE-HANDLE ?SUBCOMMAND ...?");
+        return TCL_ERROR;
+    }
+    pHandle = objv[1];
+
+    if (pHandle->typePtr == &nodeHandleType) {
+        int iGen = (int)((size_t)pHandle->internalRep.twoPtrValue.ptr2);
+        iSlot = (int)((size_t)pHandle->internalRep.twoPtrValue.ptr1);
+        if (iSlot < p->nSlotUsed && p->aSlot[iSlot].iGeneration == iGen) {
+            pNode = p->aSlot[iSlot].pNode;
+        }
+    }
+    if (!pNode) {
+        const char *zHandle = Tcl_GetString(pHandle);
+        pNode = nodeHandleLookup(interp, zHandle);
+        if (!pNode) {
+            Tcl_AppendResult(interp, "no such node: ", zHandle, NULL);
+            return TCL_ERROR;
+        }
+
+        /* Cache the slot number in the handle object. */
+        if (pHandle->typePtr && pHandle->typePtr->freeIntRepProc) {
+            pHandle->typePtr->freeIntRepProc(pHandle);
+        }
+        assert(pNode->pNodeCmd);
+        iSlot = pNode->pNodeCmd->iSlot;
+        pHandle->typePtr = &nodeHandleType;
+        pHandle->internalRep.twoPtrValue.ptr1 = (void *)((size_t)iSlot);
+        pHandle->internalRep.twoPtrValue.ptr2 = (void *)(
+            (size_t)p->aSlot[iSlot].iGeneration
+        );
+    }
+    assert(pNode->pNodeCmd);
+
+    return nodeCommand((ClientData)pNode, interp, objc - 1, &objv[1]);
 }
 
 /************************************************************************
@@ -3181,7 +4110,7 @@ fragmentAddElement(pTree, eType, zType, pAttributes, iOffset)
         fragmentOrphan(pTree);
     }
 
-    pElem = HtmlNew(HtmlElementNode);
+    pElem = HtmlArenaNew(pTree, HtmlElementNode);
     pElem->pAttributes = pAttributes;
     pElem->node.eTag = eType;
     if (!zType) {
@@ -3217,7 +4146,7 @@ fragmentAddClosingTag(pTree, eType, zType, iOffset)
     int nClose;
     int ii;
     HtmlFragmentContext *p = pTree->pFragment;
-    explicitCloseCount(p->pCurrent, eType, zType, &nClose);
+    explicitCloseCount(pTree, (HtmlNode *)p->pCurrent, eType, zType, &nClose);
     for (ii = 0; ii < nClose; ii++) {
         assert(p->pCurrent);
         nodeHandlerCallbacks(pTree, p->pCurrent);
@@ -3256,6 +4185,297 @@ HtmlParseFragment(pTree, zHtml)
     Tcl_SetObjResult(pTree->interp, sContext.pNodeList);
 }
 
+/*
+ * The following functions implement the [$html build] command. See
+ * HtmlTreeBuild() for a description of the node specifications accepted.
+ */
+static int
+buildLookupTag(pTree, zTag, peType, pzAtom)
+    HtmlTree *pTree;
+    const char *zTag;
+    int *peType;
+    const char **pzAtom;
+{
+    HtmlTokenMap *pMap;
+    HtmlHashInit(0, 0);
+    pMap = HtmlHashLookup(0, zTag);
+    if (pMap) {
+        switch (pMap->type) {
+            case Html_HTML:
+            case Html_HEAD:
+            case Html_BODY:
+                break;
+            default:
+                *peType = pMap->type;
+                *pzAtom = pMap->zName;
+                return TCL_OK;
+        }
+    } else if (pTree->options.parsemode == HTML_PARSEMODE_XML && zTag[0]) {
+        Tcl_HashEntry *pEntry;
+        int isNew;
+        pEntry = Tcl_CreateHashEntry(&pTree->aAtom, zTag, &isNew);
+        *peType = 0;
+        *pzAtom = Tcl_GetHashKey(&pTree->aAtom, pEntry);
+        return TCL_OK;
+    }
+    Tcl_ResetResult(pTree->interp);
+    Tcl_AppendResult(pTree->interp, "cannot build element: ", zTag, NULL);
+    return TCL_ERROR;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * buildCheck --
+ *
+ *     Check that pSpec is a valid node specification for [$html build].
+ *
+ * Results:
+ *     TCL_OK if pSpec is valid, or TCL_ERROR (with an error message in
+ *     the interpreter) otherwise.
+ *
+ * Side effects:
+ *     None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+buildCheck(pTree, pSpec)
+    HtmlTree *pTree;
+    Tcl_Obj *pSpec;
+{
+    Tcl_Interp *interp = pTree->interp;
+    Tcl_Obj **apSpec;
+    Tcl_Obj **apChild;
+    int nSpec;
+    int nChild = 0;
+    int nAttr = 0;
+    int eType;
+    const char *zAtom;
+    const char *zTag;
+    int ii;
+
+    if (Tcl_ListObjGetElements(interp, pSpec, &nSpec, &apSpec)) {
+        return TCL_ERROR;
+    }
+    if (nSpec < 1 || nSpec > 3) goto bad_spec;
+
+    zTag = Tcl_GetString(apSpec[0]);
+    if (0 == strcmp(zTag, "#text")) {
+        if (nSpec != 2) goto bad_spec;
+        return TCL_OK;
+    }
+    if (buildLookupTag(pTree, zTag, &eType, &zAtom)) {
+        return TCL_ERROR;
+    }
+
+    if (nSpec > 1) {
+        Tcl_Obj **apAttr;
+        if (Tcl_ListObjGetElements(interp, apSpec[1], &nAttr, &apAttr)) {
+            return TCL_ERROR;
+        }
+        if (nAttr % 2) goto bad_spec;
+    }
+    if (nSpec > 2) {
+        if (Tcl_ListObjGetElements(interp, apSpec[2], &nChild, &apChild)) {
+            return TCL_ERROR;
+        }
+        if (nChild > 0 && eType && (HtmlMarkup(eType)->flags&HTMLTAG_EMPTY)) {
+            goto bad_spec;
+        }
+        for (ii = 0; ii < nChild; ii++) {
+            if (buildCheck(pTree, apChild[ii])) {
+                return TCL_ERROR;
+            }
+        }
+    }
+    return TCL_OK;
+
+bad_spec:
+    Tcl_ResetResult(interp);
+    Tcl_AppendResult(interp, "bad node specification: ", 
+        Tcl_GetString(pSpec), NULL
+    );
+    return TCL_ERROR;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * buildNode --
+ *
+ *     Create the sub-tree described by node specification pSpec, which
+ *     has already been checked by buildCheck(). If pParent is not NULL,
+ *     the new node is added as the right-most child of pParent. 
+ *     Otherwise the new node becomes an orphan.
+ *
+ * Results:
+ *     Pointer to the new node.
+ *
+ * Side effects:
+ *     Node handler callbacks are invoked for each new element, in the
+ *     same order as if the sub-tree had been parsed.
+ *
+ *---------------------------------------------------------------------------
+ */
+static HtmlNode *
+buildNode(pTree, pParent, pSpec)
+    HtmlTree *pTree;
+    HtmlElementNode *pParent;
+    Tcl_Obj *pSpec;
+{
+    Tcl_Obj **apSpec;
+    int nSpec;
+    const char *zTag;
+    HtmlNode *pNew;
+
+    Tcl_ListObjGetElements(0, pSpec, &nSpec, &apSpec);
+    zTag = Tcl_GetString(apSpec[0]);
+
+    if (0 == strcmp(zTag, "#text")) {
+        int nText;
+        const char *zText = Tcl_GetStringFromObj(apSpec[1], &nText);
+        HtmlTextNode *pTextNode = HtmlTextNew(pTree, 0, nText, zText, 0, 0);
+        if (pParent) {
+            int idx = HtmlNodeAddTextChild((HtmlNode *)pParent, pTextNode);
+            pNew = HtmlNodeChild((HtmlNode *)pParent, idx);
+        } else {
+            pNew = (HtmlNode *)pTextNode;
+            pNew->eTag = Html_Text;
+            nodeOrphanize(pTree, pNew);
+        }
+    } else {
+        HtmlAttributes *pAttr = 0;
+        HtmlElementNode *pElem;
+        const char *zAtom;
+        int eType;
+        int ii;
+
+        buildLookupTag(pTree, zTag, &eType, &zAtom);
+
+        if (nSpec > 1) {
+            Tcl_Obj **apAttr;
+            int nAttr;
+            Tcl_ListObjGetElements(0, apSpec[1], &nAttr, &apAttr);
+            if (nAttr > 0) {
+                const char **azArg;
+                int *aLen;
+                azArg = (const char **)HtmlAlloc("temp", 
+                    nAttr * (sizeof(char *) + sizeof(int))
+                );
+                aLen = (int *)&azArg[nAttr];
+                for (ii = 0; ii < nAttr; ii++) {
+                    azArg[ii] = Tcl_GetStringFromObj(apAttr[ii], &aLen[ii]);
+                }
+                pAttr = HtmlAttributesNew(pTree, nAttr, azArg, aLen, 0);
+                HtmlFree(azArg);
+            }
+        }
+
+        if (pParent) {
+            int idx = HtmlNodeAddChild(pTree, pParent, eType, zAtom, pAttr);
+            pNew = HtmlNodeChild((HtmlNode *)pParent, idx);
+        } else {
+            pNew = (HtmlNode *)HtmlArenaNew(pTree, HtmlElementNode);
+            ((HtmlElementNode *)pNew)->pAttributes = pAttr;
+            pNew->eTag = eType;
+            pNew->zTag = zAtom;
+            nodeOrphanize(pTree, pNew);
+        }
+        pElem = (HtmlElementNode *)pNew;
+
+        if (nSpec > 2) {
+            /* The node handler callbacks invoked for the children may
+             * modify or shimmer the Tcl objects passed to [$html build].
+             * Iterate through a private copy of the list of child 
+             * specifications so that apChild[] remains valid.
+             */
+            Tcl_Obj *pChildren = Tcl_DuplicateObj(apSpec[2]);
+            Tcl_Obj **apChild;
+            int nChild;
+            Tcl_IncrRefCount(pChildren);
+            Tcl_ListObjGetElements(0, pChildren, &nChild, &apChild);
+            for (ii = 0; ii < nChild; ii++) {
+                buildNode(pTree, pElem, apChild[ii]);
+            }
+            Tcl_DecrRefCount(pChildren);
+        }
+        nodeHandlerEval(pTree, pNew);
+    }
+
+    return pNew;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * HtmlTreeBuild --
+ *
+ *         $html build NODE-SPEC-LIST
+ *
+ *     Build orphan sub-trees from the list of node specifications 
+ *     pSpecList. Each node specification is a list in one of the 
+ *     following forms:
+ *
+ *         {#text TEXT}
+ *         {TAG ?ATTRIBUTE-LIST? ?CHILD-SPEC-LIST?}
+ *
+ *     where ATTRIBUTE-LIST is a key-value list of attribute names and
+ *     values and CHILD-SPEC-LIST is a list of node specifications for
+ *     the child nodes of the element. The nodes are created directly, 
+ *     without serializing and parsing markup. Nothing is restyled or laid
+ *     out until the sub-trees are inserted into the document, for 
+ *     example with a single [$node insert] command.
+ *
+ * Results:
+ *     TCL_OK or TCL_ERROR. If successful, the interpreter result is set
+ *     to a list of node handles for the roots of the new sub-trees. If
+ *     any specification is invalid, no nodes are created.
+ *
+ * Side effects:
+ *     See above.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+HtmlTreeBuild(pTree, pSpecList)
+    HtmlTree *pTree;
+    Tcl_Obj *pSpecList;
+{
+    Tcl_Interp *interp = pTree->interp;
+    Tcl_Obj **apSpec;
+    Tcl_Obj *pRet;
+    int nSpec;
+    int ii;
+
+    if (Tcl_ListObjGetElements(interp, pSpecList, &nSpec, &apSpec)) {
+        return TCL_ERROR;
+    }
+    for (ii = 0; ii < nSpec; ii++) {
+        if (buildCheck(pTree, apSpec[ii])) {
+            return TCL_ERROR;
+        }
+    }
+
+    /* Node handler callbacks may modify pSpecList. Iterate through a
+     * private copy (see also buildNode()).
+     */
+    pSpecList = Tcl_DuplicateObj(pSpecList);
+    Tcl_IncrRefCount(pSpecList);
+    Tcl_ListObjGetElements(0, pSpecList, &nSpec, &apSpec);
+
+    pRet = Tcl_NewObj();
+    Tcl_IncrRefCount(pRet);
+    for (ii = 0; ii < nSpec; ii++) {
+        HtmlNode *pNew = buildNode(pTree, 0, apSpec[ii]);
+        Tcl_ListObjAppendElement(0, pRet, HtmlNodeCommand(pTree, pNew));
+    }
+    Tcl_DecrRefCount(pSpecList);
+    Tcl_SetObjResult(interp, pRet);
+    Tcl_DecrRefCount(pRet);
+    return TCL_OK;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -0,0 +1,162 @@
+#
+# Generate the C lookup table used by HtmlTranslateEscapes() to translate
+# named character references (i.e. "&nbsp;") from the file entities.txt.
+# Usage:
+#
+#     tclsh mkentities.tcl > htmlentities.c
+#
+# The table is a perfect hash table built using the "hash and displace"
+# method. Each name is first hashed with seed 0 to one of $nBucket
+# buckets. Then, for each bucket in order of decreasing size, a seed is
+# found such that hashing each name in the bucket with that seed maps
+# it to a distinct, unused slot of the $nSlot entry table. The seed for
+# each bucket is stored in the aHtmlEntitySeed[] array. Procedure [Hash]
+# must be kept in sync with function entityHash() in htmltext.c.
+#
+
+# 32-bit FNV-1a hash of string $zName, with the initial value modified by
+# $iSeed.
+#
+proc Hash {zName iSeed} {
+  set h [expr {(2166136261 ^ $iSeed) & 0xFFFFFFFF}]
+  foreach c [split $zName ""] {
+    scan $c %c i
+    set h [expr {(($h ^ $i) * 16777619) & 0xFFFFFFFF}]
+  }
+  return $h
+}
+
+# Return a C string literal containing the UTF-8 encoding of the list of
+# Unicode code-points $lChar.
+#
+proc Utf8Literal {lChar} {
+  set ret ""
+  foreach iChar $lChar {
+    if {$iChar < 0x80} {
+      set lByte [list $iChar]
+    } elseif {$iChar < 0x800} {
+      set lByte [list \
+        [expr {0xC0 | ($iChar >> 6)}] \
+        [expr {0x80 | ($iChar & 0x3F)}] \
+      ]
+    } elseif {$iChar < 0x10000} {
+      set lByte [list \
+        [expr {0xE0 | ($iChar >> 12)}] \
+        [expr {0x80 | (($iChar >> 6) & 0x3F)}] \
+        [expr {0x80 | ($iChar & 0x3F)}] \
+      ]
+    } else {
+      set lByte [list \
+        [expr {0xF0 | ($iChar >> 18)}] \
+        [expr {0x80 | (($iChar >> 12) & 0x3F)}] \
+        [expr {0x80 | (($iChar >> 6) & 0x3F)}] \
+        [expr {0x80 | ($iChar & 0x3F)}] \
+      ]
+    }
+    foreach iByte $lByte {
+      append ret [format "\\x%.2X" $iByte]
+    }
+  }
+  return "\"$ret\""
+}
+
+# Read the entity names and values from entities.txt. Names marked with
+# the word "legacy" may be used without a trailing ";".
+#
+set fd [open [file join [file dirname [info script]] entities.txt]]
+set lName [list]
+set nMaxName 0
+set nMaxLegacy 0
+while {[gets $fd line] >= 0} {
+  set line [string trim $line]
+  if {$line eq "" || [string index $line 0] eq "#"} continue
+  set zName [lindex $line 0]
+  set lChar [list]
+  set aLegacy($zName) 0
+  foreach zChar [lrange $line 1 end] {
+    if {$zChar eq "legacy"} {
+      set aLegacy($zName) 1
+      if {[string length $zName] > $nMaxLegacy} {
+        set nMaxLegacy [string length $zName]
+      }
+      continue
+    }
+    lappend lChar [scan [string range $zChar 2 end] %x]
+  }
+  set aValue($zName) [Utf8Literal $lChar]
+  lappend lName $zName
+  if {[string length $zName] > $nMaxName} {
+    set nMaxName [string length $zName]
+  }
+}
+close $fd
+
+set nEntity [llength $lName]
+set nBucket [expr {($nEntity + 3) / 4}]
+set nSlot [expr {$nEntity + ($nEntity / 4)}]
+
+# Assign each name to a bucket. Then find a seed for each bucket.
+#
+foreach zName $lName {
+  lappend aBucket([expr {[Hash $zName 0] % $nBucket}]) $zName
+}
+set lBucket [list]
+foreach iBucket [array names aBucket] {
+  lappend lBucket [list [llength $aBucket($iBucket)] $iBucket]
+}
+for {set ii 0} {$ii < $nBucket} {incr ii} {
+  set aSeed($ii) 0
+}
+foreach e [lsort -integer -decreasing -index 0 $lBucket] {
+  set iBucket [lindex $e 1]
+  for {set iSeed 1} {$iSeed < 65536} {incr iSeed} {
+    set lSlot [list]
+    foreach zName $aBucket($iBucket) {
+      set iSlot [expr {[Hash $zName $iSeed] % $nSlot}]
+      if {[info exists aSlot($iSlot)] || [lsearch $lSlot $iSlot] >= 0} break
+      lappend lSlot $iSlot
+    }
+    if {[llength $lSlot] == [llength $aBucket($iBucket)]} break
+  }
+  if {$iSeed == 65536} {
+    error "Failed to find a seed for bucket $iBucket"
+  }
+  set aSeed($iBucket) $iSeed
+  foreach zName $aBucket($iBucket) iSlot $lSlot {
+    set aSlot($iSlot) $zName
+  }
+}
+
+# Write the C code.
+#
+puts "/*"
+puts " * Automatically generated from entities.txt by mkentities.tcl."
+puts " * Do not edit."
+puts " */"
+puts "#define HTML_ENTITY_NBUCKET $nBucket"
+puts "#define HTML_ENTITY_NSLOT   $nSlot"
+puts "#define HTML_ENTITY_MAXNAME $nMaxName"
+puts "#define HTML_ENTITY_MAXLEGACY $nMaxLegacy"
+puts ""
+puts "static const unsigned short aHtmlEntitySeed\[HTML_ENTITY_NBUCKET\] = {"
+set line "   "
+for {set ii 0} {$ii < $nBucket} {incr ii} {
+  if {[string length $line] > 70} {
+    puts $line
+    set line "   "
+  }
+  append line " $aSeed($ii),"
+}
+puts $line
+puts "};"
+puts ""
+puts "static const struct HtmlEntity aHtmlEntity\[HTML_ENTITY_NSLOT\] = {"
+for {set ii 0} {$ii < $nSlot} {incr ii} {
+  if {[info exists aSlot($ii)]} {
+    set zName $aSlot($ii)
+    puts "    {\"$zName\", $aValue($zName), $aLegacy($zName)},"
+  } else {
+    puts "    {0, 0, 0},"
+  }
+}
+puts "};"
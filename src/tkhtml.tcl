@@ -63,13 +63,14 @@ namespace eval tkhtml {
     # the width in characters.
     proc inputsize_to_css {} {
         upvar N node
-        set size [$node attr size]
+        set size [::tkhtml::node $node attr size]
         catch {
           if {$size < 0} {error "Bad value for size attribute"}
         }
 
         # Figure out if we are talking characters or pixels:
-        switch -- [string tolower [$node attr -default text type]] {
+        set type [::tkhtml::node $node attr -default text type]
+        switch -- [string tolower $type] {
           text     { 
             incr size [expr {int(($size/10)+1)}]
             set units ex 
@@ -90,7 +91,7 @@ namespace eval tkhtml {
 
     proc if_disabled {if else} {
       upvar N node
-      set disabled [$node attr -default 0 disabled]
+      set disabled [::tkhtml::node $node attr -default 0 disabled]
       if {$disabled} {return $if}
       return $else
     }
@@ -100,20 +101,20 @@ namespace eval tkhtml {
     # attributes are compulsory for <textarea> elements.
     proc textarea_width {} {
         upvar N node
-        set cols [$node attr -default "" cols]
+        set cols [::tkhtml::node $node attr -default "" cols]
         if {[regexp {[[:digit:]]+}] $cols} { return "${cols}ex" }
         return $cols
     }
     proc textarea_height {} {
         upvar N node
-        set rows [$node attr -default "" rows]
+        set rows [::tkhtml::node $node attr -default "" rows]
         if {[regexp {[[:digit:]]+} $rows]} { return "[expr ${rows} * 1.2]em" }
         return $rows
     }
 
     proc size_to_fontsize {} {
         upvar N node
-        set size [$node attr size]
+        set size [::tkhtml::node $node attr size]
 
         if {![regexp {([+-]?)([0123456789]+)} $size dummy sign quantity]} {
           error "not an integer"
@@ -146,17 +147,19 @@ namespace eval tkhtml {
 
     proc vscrollbar {base node} {
       set sb [scrollbar ${base}.vsb_[string map {: _} $node]]
-      $sb configure -borderwidth 1 -highlightthickness 0 -command "$node yview"
+      $sb configure -borderwidth 1 -highlightthickness 0 \
+          -command [list ::tkhtml::node $node yview]
       return $sb
     }
     proc hscrollbar {base node} {
       set sb [scrollbar ${base}.hsb_[string map {: _} $node] -orient horiz]
-      $sb configure -borderwidth 1 -highlightthickness 0 -command "$node xview"
+      $sb configure -borderwidth 1 -highlightthickness 0 \
+          -command [list ::tkhtml::node $node xview]
       return $sb
     }
 
     proc ol_liststyletype {} {
-      switch -exact -- [uplevel {$N attr type}] {
+      switch -exact -- [uplevel {::tkhtml::node $N attr type}] {
         i {return lower-roman}
         I {return upper-roman}
         a {return lower-alpha}
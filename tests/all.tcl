@@ -9,6 +9,7 @@ sourcefile tree.test
 sourcefile style.test
 sourcefile dynamic.test
 sourcefile options.test
+sourcefile layout.test
 
 finish_test
 
@@ -0,0 +1,72 @@
+#
+# Code shared by the *_bench.tcl benchmark scripts in this directory.
+# Each script sources this file, then calls [bench_init] to create the
+# widget .h, [bench_time] to time a script and [bench_report_rate] or
+# [bench_report_scaling] to print each result, and finally [bench_finish].
+#
+# All benchmark scripts accept an optional ITERATIONS argument: the
+# number of times each timed script is run. The reported time is the
+# average.
+#
+
+set auto_path [concat [file dirname [info script]] $auto_path]
+package require Tkhtml
+
+# bench_init NITER ?WIDGET-OPTIONS...?
+#
+#     Set the global variable nIter to the number of iterations passed on
+#     the command line, or NITER if there is none. Then create the html
+#     widget .h using the supplied options. If any options are supplied
+#     the widget is also packed, so that layout and drawing take place.
+#
+proc bench_init {nIter args} {
+  set ::nIter $nIter
+  if {[llength $::argv] > 0} {
+    set ::nIter [lindex $::argv 0]
+  }
+  eval [list html .h] $args
+  if {[llength $args] > 0} {
+    pack .h
+    update
+  }
+}
+
+# bench_time SCRIPT
+#
+#     Run SCRIPT $nIter times in the caller's context. Return the average
+#     number of microseconds taken.
+#
+proc bench_time {script} {
+  lindex [uplevel 1 [list time $script $::nIter]] 0
+}
+
+# bench_report_rate NAME NBYTE USEC ?EXTRA?
+#
+#     Print the throughput achieved processing NBYTE bytes in USEC
+#     microseconds in MB/s. EXTRA, if present, is printed after the number
+#     of bytes.
+#
+proc bench_report_rate {name nByte usec {extra ""}} {
+  set mbs [expr {$usec > 0 ? (double($nByte) / $usec) : 0.0}]
+  puts [format "%-30s %8d bytes %14s %8.2f MB/s" $name $nByte $extra $mbs]
+}
+
+# bench_report_scaling N UNIT USEC
+#
+#     Print the time taken to process N items of type UNIT, and the time
+#     taken per item.
+#
+proc bench_report_scaling {N unit usec} {
+  puts [format "%6d %ss %10.0f us %8.3f us/%s" \
+      $N $unit $usec [expr {double($usec) / $N}] $unit
+  ]
+}
+
+# bench_finish
+#
+#     Destroy the widget created by [bench_init] and exit.
+#
+proc bench_finish {} {
+  destroy .h
+  exit
+}
@@ -0,0 +1,40 @@
+#
+# Entity translation benchmark. Usage:
+#
+#     wish entity_bench.tcl ?ITERATIONS?
+#
+# The tokenizer is run over three generated documents using the
+# [$html _tokenize] debugging command: one with no character references,
+# one where most words in text and attribute values are named character
+# references, and one using numeric character references. The throughput
+# for each is printed in MB/s.
+#
+
+source [file join [file dirname [info script]] bench_common.tcl]
+
+proc makeDocument {lWord} {
+  set doc ""
+  for {set ii 0} {$ii < 2000} {incr ii} {
+    set w1 [lindex $lWord [expr {$ii % [llength $lWord]}]]
+    set w2 [lindex $lWord [expr {($ii * 7) % [llength $lWord]}]]
+    append doc "<p title=\"$w1 $w2\">$w1 text $w2 and $w1$w2 more</p>\n"
+  }
+  return $doc
+}
+
+set aDoc(plain) [makeDocument {alpha beta gamma delta epsilon}]
+set aDoc(named) [makeDocument {
+  &amp; &lt; &gt; &nbsp; &copy; &eacute; &rarr; &hellip; &Agrave; &mdash;
+  &NotGreaterEqual; &CounterClockwiseContourIntegral; &unknown; &amp
+}]
+set aDoc(numeric) [makeDocument {&#38; &#x3C; &#8594; &#x2026; &#169;}]
+
+bench_init 20
+
+foreach name {plain named numeric} {
+  set doc $aDoc($name)
+  set usec [bench_time {.h _tokenize $doc}]
+  bench_report_rate $name [string bytelength $doc] $usec
+}
+
+bench_finish
@@ -0,0 +1,40 @@
+#
+# Float layout benchmark. Usage:
+#
+#     wish float_bench.tcl ?ITERATIONS?
+#
+# Each document is an "image gallery" consisting of N left-floated boxes
+# of varying heights, each followed by a little inline text. The time
+# taken to lay out each document is printed for increasing values of N.
+# If floating margin queries do not depend on the number of floats in
+# the flow, the time per float should stay roughly constant as N
+# increases.
+#
+
+source [file join [file dirname [info script]] bench_common.tcl]
+
+proc makeDocument {N} {
+  set doc ""
+  for {set ii 0} {$ii < $N} {incr ii} {
+    set h [expr {40 + ($ii % 7) * 5}]
+    append doc "<div style=\"float:left;width:90px;height:${h}px\"></div>"
+    append doc "<span>caption $ii</span>\n"
+  }
+  return $doc
+}
+
+bench_init 5 -width 800 -height 600
+
+foreach N {250 500 1000 2000 4000} {
+  set doc [makeDocument $N]
+  .h reset
+  .h parse -final $doc
+  update
+  set usec [bench_time {
+    .h _relayout -layout [.h node]
+    update
+  }]
+  bench_report_scaling $N float $usec
+}
+
+bench_finish
@@ -0,0 +1,34 @@
+#
+# Tree construction benchmark for pathologically nested documents. Usage:
+#
+#     wish nesting_bench.tcl ?ITERATIONS?
+#
+# Each document consists of N unclosed <font> and <div> elements, each
+# followed by stray closing tags that do not match any open element, and
+# finally a run of closing tags that do. The time taken to [parse] each
+# document is printed for increasing values of N. If the cost of closing
+# tags does not depend on the depth of the tree, the time per element
+# should stay roughly constant as N increases.
+#
+
+source [file join [file dirname [info script]] bench_common.tcl]
+
+proc makeDocument {N} {
+  set doc ""
+  append doc [string repeat {<font size=2><div>text</b></i></span>} $N]
+  append doc [string repeat {</div></font>} [expr {$N / 2}]]
+  return $doc
+}
+
+bench_init 5
+
+foreach N {1000 2000 4000 8000 16000} {
+  set doc [makeDocument $N]
+  set usec [bench_time {
+    .h reset
+    .h parse -final $doc
+  }]
+  bench_report_scaling $N element $usec
+}
+
+bench_finish
@@ -0,0 +1,39 @@
+#
+# Tokenizer throughput benchmark. Usage:
+#
+#     wish tokenize_bench.tcl ?ITERATIONS?
+#
+# The tokenizer is run over each of the tests/page*/index.html documents
+# using the [$html _tokenize] debugging command (the tokens are discarded,
+# no document tree is built). The throughput for each page and for all
+# pages together is printed in MB/s.
+#
+
+source [file join [file dirname [info script]] bench_common.tcl]
+
+proc readFile {fname} {
+  set fd [open $fname]
+  set ret [read $fd]
+  close $fd
+  return $ret
+}
+
+bench_init 20
+
+set dir [file dirname [info script]]
+set nTotalByte 0
+set nTotalUsec 0
+foreach page [lsort [glob -nocomplain [file join $dir page* index.html]]] {
+  set doc [readFile $page]
+  set nByte [string bytelength $doc]
+  set nToken [.h _tokenize $doc]
+  set usec [bench_time {.h _tokenize $doc}]
+  bench_report_rate \
+      [file join [file tail [file dirname $page]] [file tail $page]] \
+      $nByte $usec "$nToken tokens"
+  incr nTotalByte $nByte
+  set nTotalUsec [expr {$nTotalUsec + $usec}]
+}
+bench_report_rate total $nTotalByte $nTotalUsec
+
+bench_finish